@@ -14,8 +14,25 @@
 // along with this program; if not, write to the Free Software
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
+#include <stdlib.h>
+#include <string.h>
 #include "Allocator.h"
 
+// set for the audio thread only
+static __thread bool s_RealtimeThread=false;
+
+void Allocator::SetRealtimeThread()
+{
+	s_RealtimeThread=true;
+}
+
+bool Allocator::IsRealtimeThread()
+{
+	return s_RealtimeThread;
+}
+
+///////////////////////////////////////////////////////////
+
 char *MallocAllocator::New(unsigned int size)
 {
 	return new char[size];
@@ -47,11 +64,12 @@ char *RealtimeAllocator::New(unsigned int size)
 	m_Position+=size;
 	
 
+	// handing out the start again would alias live buffers
 	if (m_Position>m_Size)
 	{
-		cerr<<"out of realtime buffer mem, here we go!!! :("<<endl;
-		m_Position=0;
-		ret = m_Buffer;
+		cerr<<"out of realtime buffer mem"<<endl;
+		m_Position-=size;
+		return NULL;
 	}
 	
 	return ret;
@@ -62,3 +80,226 @@ void RealtimeAllocator::Delete(char *mem)
 	//cerr<<"delete"<<endl;
 	// we don't need no stinking delete!
 }
+
+///////////////////////////////////////////////////////////
+
+// blocks carry their size class in front, keeping the data 16 byte aligned
+static const unsigned int POOL_HEADER_SIZE = 16;
+static const unsigned int POOL_LARGE = POOL_NUM_CLASSES;
+
+PoolAllocator::PoolAllocator() :
+m_Failures(0),
+m_LargeInUse(0),
+m_DeferredWrite(0),
+m_DeferredRead(0),
+m_DeferredLock(0),
+m_DeferredFull(0)
+{
+	memset(m_Classes,0,sizeof(m_Classes));
+}
+
+PoolAllocator::~PoolAllocator()
+{
+	FreeDeferred();
+	for (unsigned int c=0; c<POOL_NUM_CLASSES; c++)
+	{
+		while (m_Classes[c].Free!=NULL)
+		{
+			Block *b=m_Classes[c].Free;
+			m_Classes[c].Free=b->Next;
+			free((char*)b-POOL_HEADER_SIZE);
+		}
+	}
+}
+
+// 64, 80, 96, 112, 128, 160...
+unsigned int PoolAllocator::ClassSize(unsigned int c)
+{
+	return (4+c%4)<<(c/4+POOL_MIN_SIZE-2);
+}
+
+unsigned int PoolAllocator::ClassFor(unsigned int size)
+{
+	unsigned int c=0;
+	while (c<POOL_NUM_CLASSES && ClassSize(c)<size) c++;
+	return c;
+}
+
+// the critical sections are a couple of pointer swaps, so spinning 
+// is cheaper than a mutex the audio thread could sleep on
+void PoolAllocator::Lock(SizeClass &c)
+{
+	while (__sync_lock_test_and_set(&c.Lock,1)) {}
+}
+
+void PoolAllocator::Unlock(SizeClass &c)
+{
+	__sync_lock_release(&c.Lock);
+}
+
+char *PoolAllocator::NewBlock(unsigned int c)
+{
+	unsigned int size = c==POOL_LARGE?0:ClassSize(c);
+	char *mem=(char*)malloc(POOL_HEADER_SIZE+size);
+	if (mem==NULL) return NULL;
+	*(unsigned int*)mem=c;
+	return mem+POOL_HEADER_SIZE;
+}
+
+void PoolAllocator::Reserve(unsigned int size, unsigned int count)
+{
+	unsigned int c=ClassFor(size);
+	if (c==POOL_LARGE) return;
+	
+	SizeClass &sc=m_Classes[c];
+	Lock(sc);
+	unsigned int have=sc.NumFree;
+	Unlock(sc);
+	
+	for (; have<count; have++)
+	{
+		Block *b=(Block*)NewBlock(c);
+		if (b==NULL) break;
+		Lock(sc);
+		b->Next=sc.Free;
+		sc.Free=b;
+		sc.NumFree++;
+		Unlock(sc);
+	}
+}
+
+char *PoolAllocator::New(unsigned int size)
+{
+	unsigned int c=ClassFor(size);
+	
+	if (c==POOL_LARGE)
+	{
+		if (IsRealtimeThread()) 
+		{
+			__sync_fetch_and_add(&m_Failures,1);
+			return NULL;
+		}
+		
+		char *mem=(char*)malloc(POOL_HEADER_SIZE+size);
+		if (mem==NULL) return NULL;
+		*(unsigned int*)mem=POOL_LARGE;
+		__sync_fetch_and_add(&m_LargeInUse,1);
+		return mem+POOL_HEADER_SIZE;
+	}
+	
+	SizeClass &sc=m_Classes[c];
+	Lock(sc);
+	Block *b=sc.Free;
+	if (b!=NULL)
+	{
+		sc.Free=b->Next;
+		sc.NumFree--;
+	}
+	if (b!=NULL || !IsRealtimeThread())
+	{
+		sc.InUse++;
+		if (sc.InUse>sc.HighWater) sc.HighWater=sc.InUse;
+	}
+	Unlock(sc);
+	
+	if (b!=NULL) return (char*)b;
+	
+	if (IsRealtimeThread()) 
+	{
+		__sync_fetch_and_add(&m_Failures,1);
+		return NULL;
+	}
+	
+	char *mem=NewBlock(c);
+	if (mem==NULL)
+	{
+		Lock(sc);
+		sc.InUse--;
+		Unlock(sc);
+	}
+	return mem;
+}
+
+void PoolAllocator::Delete(char *mem)
+{
+	if (mem==NULL) return;
+	
+	unsigned int c=*(unsigned int*)(mem-POOL_HEADER_SIZE);
+	if (c==POOL_LARGE)
+	{
+		__sync_fetch_and_sub(&m_LargeInUse,1);
+		if (IsRealtimeThread())
+		{
+			unsigned int next=(m_DeferredWrite+1)%POOL_DEFERRED_SIZE;
+			if (next!=m_DeferredRead)
+			{
+				m_Deferred[m_DeferredWrite]=mem-POOL_HEADER_SIZE;
+				__sync_synchronize();
+				m_DeferredWrite=next;
+				return;
+			}
+			// nothing has emptied the queue for a while, freeing 
+			// here beats leaking
+			m_DeferredFull++;
+		}
+		free(mem-POOL_HEADER_SIZE);
+		return;
+	}
+	
+	SizeClass &sc=m_Classes[c];
+	Block *b=(Block*)mem;
+	Lock(sc);
+	b->Next=sc.Free;
+	sc.Free=b;
+	sc.NumFree++;
+	sc.InUse--;
+	Unlock(sc);
+}
+
+void PoolAllocator::FreeDeferred()
+{
+	// only one reader at a time, the realtime thread never waits on this
+	if (__sync_lock_test_and_set(&m_DeferredLock,1)) return;
+	while (m_DeferredRead!=m_DeferredWrite)
+	{
+		__sync_synchronize();
+		free(m_Deferred[m_DeferredRead]);
+		__sync_synchronize();
+		m_DeferredRead=(m_DeferredRead+1)%POOL_DEFERRED_SIZE;
+	}
+	__sync_lock_release(&m_DeferredLock);
+}
+
+unsigned int PoolAllocator::GetBytesInUse()
+{
+	unsigned int bytes=0;
+	for (unsigned int c=0; c<POOL_NUM_CLASSES; c++)
+	{
+		bytes+=m_Classes[c].InUse*ClassSize(c);
+	}
+	return bytes;
+}
+
+unsigned int PoolAllocator::GetBytesFree()
+{
+	unsigned int bytes=0;
+	for (unsigned int c=0; c<POOL_NUM_CLASSES; c++)
+	{
+		bytes+=m_Classes[c].NumFree*ClassSize(c);
+	}
+	return bytes;
+}
+
+void PoolAllocator::Dump()
+{
+	cerr<<"pool allocator: "<<GetBytesInUse()<<" bytes in use, "<<GetBytesFree()
+		<<" free, "<<m_LargeInUse<<" large blocks, "<<m_Failures<<" failures, "
+		<<m_DeferredFull<<" large frees on the realtime thread"<<endl;
+	for (unsigned int c=0; c<POOL_NUM_CLASSES; c++)
+	{
+		const SizeClass &sc=m_Classes[c];
+		if (sc.HighWater==0 && sc.NumFree==0) continue;
+		cerr<<"  "<<ClassSize(c)<<" bytes: "<<sc.InUse<<" in use, "
+			<<sc.NumFree<<" free, high water "<<sc.HighWater<<endl;
+	}
+}
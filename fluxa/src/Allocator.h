@@ -26,8 +26,20 @@ class Allocator
 public:
 	virtual ~Allocator() {}
 	virtual void Reset() {}
+	// make sure there are count blocks of this size ready to go
+	virtual void Reserve(unsigned int size, unsigned int count) {}
 	virtual char *New(unsigned int size)=0;
 	virtual void Delete(char *mem)=0;
+	// frees what the realtime thread has handed back, call from 
+	// any other thread
+	virtual void FreeDeferred() {}
+	virtual void Dump() {}
+	virtual unsigned int GetFailures() { return 0; }
+	
+	// call from the audio thread, allocators that can refuse to malloc 
+	// there will fail rather than block
+	static void SetRealtimeThread();
+	static bool IsRealtimeThread();
 };
 
 ///////////////////////////////////////////////////
@@ -63,4 +75,68 @@ protected:
 	unsigned int m_Size;
 };
 
+/////////////////////////////////////////////////////
+
+static const unsigned int POOL_MIN_SIZE = 6;  // 64 bytes
+static const unsigned int POOL_MAX_SIZE = 21; // 2 megs
+// four classes per power of two, so we waste at most 25%
+static const unsigned int POOL_NUM_CLASSES = (POOL_MAX_SIZE-POOL_MIN_SIZE)*4+1;
+// large blocks deleted on the realtime thread waiting to be freed
+static const unsigned int POOL_DEFERRED_SIZE = 256;
+
+// keeps freed blocks in size classes for reuse. off the 
+// realtime thread empty classes are refilled with malloc, on it New 
+// returns NULL and counts the failure instead. anything bigger than the
+// largest class is malloced and freed directly, and fails on the
+// realtime thread. large blocks deleted on the realtime thread are 
+// queued for FreeDeferred, as free can take a lock
+class PoolAllocator : public Allocator
+{
+public:
+	PoolAllocator();
+	virtual ~PoolAllocator();
+
+	virtual void Reserve(unsigned int size, unsigned int count);
+	virtual char *New(unsigned int size);
+	virtual void Delete(char *mem);
+	virtual void FreeDeferred();
+	virtual void Dump();
+	
+	virtual unsigned int GetFailures() { return m_Failures; }
+	unsigned int GetBytesInUse();
+	unsigned int GetBytesFree();
+	
+protected:
+	struct Block
+	{
+		Block *Next;
+	};
+	
+	struct SizeClass
+	{
+		volatile int Lock;
+		Block *Free;
+		unsigned int NumFree;
+		unsigned int InUse;
+		unsigned int HighWater;
+	};
+	
+	static unsigned int ClassSize(unsigned int c);
+	static unsigned int ClassFor(unsigned int size);
+	char *NewBlock(unsigned int c);
+	void Lock(SizeClass &c);
+	void Unlock(SizeClass &c);
+	
+	SizeClass m_Classes[POOL_NUM_CLASSES];
+	volatile unsigned int m_Failures;
+	volatile unsigned int m_LargeInUse;
+	
+	// written only by the realtime thread, read only by FreeDeferred
+	char *m_Deferred[POOL_DEFERRED_SIZE];
+	volatile unsigned int m_DeferredWrite;
+	volatile unsigned int m_DeferredRead;
+	volatile int m_DeferredLock;
+	unsigned int m_DeferredFull;
+};
+
 #endif
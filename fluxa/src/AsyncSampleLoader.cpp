@@ -15,18 +15,24 @@
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
 #include <unistd.h>
-#include <sndfile.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include "AsyncSampleLoader.h"
 #include "SearchPaths.h"
 
 using namespace spiralcore;
 
 AsyncSampleLoader *AsyncSampleLoader::m_Singleton=NULL;
-deque<AsyncSampleLoader::LoadItem> AsyncSampleLoader::m_LoadQueue;
-pthread_mutex_t* AsyncSampleLoader::m_Mutex;
-map<string,Sample*> AsyncSampleLoader::m_Cache;
 
-short *LoadWav(FILE *file, unsigned int &size, unsigned short &channels);
+// frames decoded at a time when mixing down
+static const unsigned int DECODE_CHUNK_FRAMES = 4096;
+static const char CACHE_MAGIC[4] = {'F','X','C','1'};
+static const unsigned int CACHE_HEADER_SIZE = 8;
 
 AsyncSampleLoader* AsyncSampleLoader::Get()
 {
@@ -37,23 +43,66 @@ AsyncSampleLoader* AsyncSampleLoader::Get()
 void AsyncSampleLoader::Shutdown()
 {
 	if (m_Singleton) delete m_Singleton;
+	m_Singleton=NULL;
 }
 
-AsyncSampleLoader::AsyncSampleLoader()
+AsyncSampleLoader::AsyncSampleLoader() :
+m_SampleRate(44100),
+m_NumThreads(0),
+m_Quit(false),
+m_Busy(0),
+m_Deferred(false),
+m_NumDeferred(0)
 {
-	m_Mutex = new pthread_mutex_t;
-	pthread_mutex_init(m_Mutex,NULL);
+	pthread_mutex_init(&m_Mutex,NULL);
+	pthread_cond_init(&m_Work,NULL);
+	pthread_cond_init(&m_Done,NULL);
+	
+	char *home=getenv("HOME");
+	if (home!=NULL) m_CacheDir=string(home)+"/.fluxa/cache";
+	
+	// loading is mostly waiting on the disk, so a few threads
+	// is plenty, even on one core
+	long cores=sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned int threads=cores<2?2:(unsigned int)cores;
+	if (threads>SAMPLELOADER_MAX_THREADS) threads=SAMPLELOADER_MAX_THREADS;
+	
+	for (unsigned int n=0; n<threads; n++)
+	{
+		if (pthread_create(&m_Threads[m_NumThreads],NULL,WorkerThread,this)==0) 
+		{
+			m_NumThreads++;
+		}
+	}
+	
+	if (m_NumThreads==0) cerr<<"AsyncSampleLoader: could not start any loader threads"<<endl;
 }
 
 AsyncSampleLoader::~AsyncSampleLoader()
 {
+	pthread_mutex_lock(&m_Mutex);
+	m_Quit=true;
+	pthread_cond_broadcast(&m_Work);
+	pthread_mutex_unlock(&m_Mutex);
+	
+	for (unsigned int n=0; n<m_NumThreads; n++)
+	{
+		pthread_join(m_Threads[n],NULL);
+	}
+	
 	for (map<string,Sample*>::iterator i=m_Cache.begin(); i!=m_Cache.end(); i++)
 	{
-		cerr<<"deleting cache "<<i->first<<endl;
 		delete i->second;
 	}
 	
-	Shutdown();
+	for (vector<pair<void*,size_t> >::iterator i=m_Mappings.begin(); i!=m_Mappings.end(); i++)
+	{
+		munmap(i->first,i->second);
+	}
+	
+	pthread_cond_destroy(&m_Done);
+	pthread_cond_destroy(&m_Work);
+	pthread_mutex_destroy(&m_Mutex);
 }
 
 Sample *AsyncSampleLoader::AddToQueue(const string &Filename)
@@ -70,196 +119,306 @@ Sample *AsyncSampleLoader::AddToQueue(const string &Filename)
 	
 	// add to the cache
 	m_Cache[Filename]=NewItem.SamplePtr;
+	m_Pending.push_back(NewItem);
+	return NewItem.SamplePtr;
+}
 
-	// spinlock
-	for (int n=0; n<5; n++) // why?
+void AsyncSampleLoader::LoadQueue()
+{
+	if (m_Pending.empty()) return;
+	
+	// the workers only hold the lock for long enough to take an item,
+	// if we can't get it now RetryLoadQueue tries again next block
+	if (pthread_mutex_trylock(&m_Mutex)==0)
 	{
-		if (pthread_mutex_trylock(m_Mutex))
-		{
-			m_LoadQueue.push_back(NewItem);
-			pthread_mutex_unlock(m_Mutex);
-			return NewItem.SamplePtr;
-		}
+		m_LoadQueue.insert(m_LoadQueue.end(),m_Pending.begin(),m_Pending.end());
+		m_Pending.clear();
+		pthread_cond_broadcast(&m_Work);
+		pthread_mutex_unlock(&m_Mutex);
+		m_Deferred=false;
+	}
+	else
+	{
+		// this is the audio thread, so it's counted rather than logged
+		if (!m_Deferred) m_NumDeferred++;
+		m_Deferred=true;
 	}
-	cerr<<"Could not get a lock on the loaderqueue, not loading ["<<Filename<<"]"<<endl;
-	return NewItem.SamplePtr;
 }
 
-void AsyncSampleLoader::LoadQueue()
+void AsyncSampleLoader::LoadQueueNow()
 {
-	if (pthread_mutex_trylock(m_Mutex))
+	pthread_mutex_lock(&m_Mutex);
+	m_LoadQueue.insert(m_LoadQueue.end(),m_Pending.begin(),m_Pending.end());
+	m_Pending.clear();
+	
+	if (m_NumThreads==0)
 	{
-		if (m_LoadQueue.size()>0)
+		// no workers, so do it here
+		while (!m_LoadQueue.empty())
 		{
-			pthread_create(&m_LoaderThread,NULL,(void*(*)(void*))LoadLoop,NULL);
+			LoadItem item=m_LoadQueue.front();
+			m_LoadQueue.pop_front();
+			pthread_mutex_unlock(&m_Mutex);
+			Load(item);
+			pthread_mutex_lock(&m_Mutex);
 		}
-		pthread_mutex_unlock(m_Mutex);
 	}
 	else
 	{
-		//cerr<<"Could not get a lock on the loaderqueue from LoadQueue()"<<endl;
+		pthread_cond_broadcast(&m_Work);
+		while (!m_LoadQueue.empty() || m_Busy>0)
+		{
+			pthread_cond_wait(&m_Done,&m_Mutex);
+		}
 	}
+	pthread_mutex_unlock(&m_Mutex);
 }
 
-void AsyncSampleLoader::LoadLoop()
+void *AsyncSampleLoader::WorkerThread(void *context)
+{
+	((AsyncSampleLoader*)context)->WorkerLoop();
+	return NULL;
+}
+
+void AsyncSampleLoader::WorkerLoop()
 {		
-	pthread_mutex_lock(m_Mutex);
-	while (m_LoadQueue.size())
+	pthread_mutex_lock(&m_Mutex);
+	while (!m_Quit)
 	{
-		LoadItem Item = *m_LoadQueue.begin();
-		m_LoadQueue.pop_front();
-		pthread_mutex_unlock(m_Mutex);
-			
-		SF_INFO info;
-		info.format=0;
-		string filename=SearchPaths::Get()->GetFullPath(Item.Name);
-
-		cerr<<"async loading: "<<filename<<endl;
-		
-		FILE* file = fopen (filename.c_str(), "rb") ;
-		if (!file)
+		if (m_LoadQueue.empty())
 		{
-			cerr<<"Error opening ["<<Item.Name<<"]"<<endl;
+			pthread_cond_wait(&m_Work,&m_Mutex);
+			continue;
 		}
-		else
-		{
-			unsigned short channels=0;
-			unsigned int size=0;
-			short *data = LoadWav(file,size,channels);
-			size/=2; // bytes -> samples
-			
-			if (data)
-			{
-				unsigned int samples=size/channels;
-				Item.SamplePtr->Allocate(samples);
-				
-				// mix down to mono if need be
-				if (channels>1)
-				{
-					int from=0;
-					for (unsigned int n=0; n<samples; n++)
-					{
-						for (int c=0; c<channels; c++)
-						{
-							//cerr<<n<<endl; // 60414
-							Item.SamplePtr->Set(n,((*Item.SamplePtr)[n]+(data[from++]/32767.0f))/(float)channels);
-						}
-					}
-				}
-				else
-				{
-					for (unsigned int n=0; n<size; n++)
-					{
-						Item.SamplePtr->Set(n,data[n]/32767.0f);
-					}
-				}
-				delete[] data;
-			}
-			fclose(file);
-		}
-		sleep(1);
+		
+		LoadItem item=m_LoadQueue.front();
+		m_LoadQueue.pop_front();
+		m_Busy++;
+		pthread_mutex_unlock(&m_Mutex);
+		
+		Load(item);
+		
+		pthread_mutex_lock(&m_Mutex);
+		m_Busy--;
+		if (m_LoadQueue.empty() && m_Busy==0) pthread_cond_broadcast(&m_Done);
 	}		
-	pthread_mutex_unlock(m_Mutex);
+	pthread_mutex_unlock(&m_Mutex);
 }
 
-/*
-void AsyncSampleLoader::LoadLoop()
-{		
-	pthread_mutex_lock(m_Mutex);
-	while (m_LoadQueue.size())
+void AsyncSampleLoader::Load(const LoadItem &item)
+{
+	string filename=SearchPaths::Get()->GetFullPath(item.Name);
+	string cachepath=CachePath(filename);
+	
+	Sample loaded;
+	if (cachepath!="" && ReadCache(cachepath,loaded))
 	{
-		LoadItem Item = *m_LoadQueue.begin();
-		m_LoadQueue.pop_front();
-			
-		SF_INFO info;
-		info.format=0;
-		string filename=SearchPaths::Get()->GetFullPath(Item.Name);
+		item.SamplePtr->Take(loaded);
+		return;
+	}
 
-		cerr<<"async loading: "<<filename<<endl;
-		
-		SNDFILE* file = sf_open (filename.c_str(), SFM_READ, &info) ;
-		if (!file)
+	SF_INFO info;
+	info.format=0;
+	SNDFILE* file = sf_open(filename.c_str(), SFM_READ, &info);
+	if (!file)
+	{
+		cerr<<"Error opening ["<<item.Name<<"] : "<<sf_strerror(file)<<endl;
+		return;
+	}
+	
+	Sample decoded;
+	bool ok=Decode(file,info,decoded);
+	sf_close(file);
+	if (!ok) 
+	{
+		cerr<<"Error decoding ["<<item.Name<<"]"<<endl;
+		return;
+	}
+	
+	if ((unsigned int)info.samplerate!=m_SampleRate)
+	{
+		Resample(decoded,info.samplerate,loaded);
+	}
+	else
+	{
+		loaded.Take(decoded);
+	}
+	
+	if (cachepath!="" && loaded.GetLength()>=SAMPLELOADER_CACHE_MIN_FRAMES)
+	{
+		WriteCache(cachepath,loaded);
+	}
+	
+	item.SamplePtr->Take(loaded);
+}
+
+bool AsyncSampleLoader::Decode(SNDFILE *file, const SF_INFO &info, Sample &out)
+{
+	if (info.frames<=0 || info.channels<=0 || info.frames>=UINT_MAX) return false;
+	
+	unsigned int frames=info.frames;
+	if (!out.Allocate(frames)) return false;
+	AudioType *dest=out.GetNonConstBuffer();
+	
+	unsigned int pos=0;
+	if (info.channels==1)
+	{
+		// mono goes straight into the buffer
+		sf_count_t got=sf_readf_float(file,dest,frames);
+		if (got>0) pos=got;
+	}
+	else
+	{
+		// mix down a chunk at a time
+		float *chunk=new float[DECODE_CHUNK_FRAMES*info.channels];
+		float scale=1.0f/info.channels;
+		while (pos<frames)
 		{
-			cerr<<"Error opening ["<<Item.Name<<"] : "<<sf_strerror (file)<<endl;
-		}
-		Item.SamplePtr->Allocate(info.frames);
+			sf_count_t got=sf_readf_float(file,chunk,DECODE_CHUNK_FRAMES);
+			if (got<=0) break;
 			
-		// mix down to mono if need be
-		if (info.channels>1)
-		{
-			float *Buffer = new float[info.frames*info.channels];
-		
-			sf_readf_float(file,Buffer,info.frames*info.channels);
-			int from=0;
-			for (unsigned int n=0; n<info.frames; n++)
+			const float *from=chunk;
+			for (sf_count_t n=0; n<got && pos<frames; n++)
 			{
-				for (int c=0; c<info.channels; c++)
-				{
-					Item.SamplePtr->Set(n,((*Item.SamplePtr)[n]+Buffer[from++])/2.0f);
-				}
+				float sum=0;
+				for (int c=0; c<info.channels; c++) sum+=*from++;
+				dest[pos++]=sum*scale;
 			}
 		}
-		else
-		{
-			sf_readf_float(file, Item.SamplePtr->GetNonConstBuffer(), info.frames);	
-		}
-		sf_close(file);
-		
-		sleep(1);
-	}		
-	pthread_mutex_unlock(m_Mutex);
-}
-*/
-// having problems with libsndfile crashing in this thread. (nm/eb.wav)
-// need to look into it more, but need this working for a gig
-// so writing a quick dirty wav loader here 
-short *LoadWav(FILE *file, unsigned int &size, unsigned short &channels)
-{
-	char id[5];
-	id[4]='\0';
-	fread(id,1,4,file);
-	if (strcmp(id,"RIFF")!=0) 
+		delete[] chunk;
+	}
+	
+	if (pos==0) return false;
+	
+	// some formats only estimate the length, so keep what we got - 
+	// zeroing the rest first in case the crop can't allocate
+	if (pos<frames)
 	{
-		cerr<<"WAV format error (RIFF): "<<id<<endl;
-		return NULL;
+		for (unsigned int n=pos; n<frames; n++) dest[n]=0;
+		out.CropTo(pos);
 	}
-	fread(&size,1,4,file);
-	fread(id,1,4,file);
-	if (strcmp(id,"WAVE")!=0)
+	return true;
+}
+
+// cubic hermite, which is cheap and a lot better than linear
+void AsyncSampleLoader::Resample(const Sample &in, unsigned int fromrate, Sample &out)
+{
+	double step=fromrate/(double)m_SampleRate;
+	unsigned int inlength=in.GetLength();
+	unsigned int outlength=(unsigned int)(inlength/step);
+	if (outlength==0 || !out.Allocate(outlength)) return;
+	
+	const AudioType *src=in.GetBuffer();
+	AudioType *dest=out.GetNonConstBuffer();
+	unsigned int last=inlength-1;
+	
+	for (unsigned int n=0; n<outlength; n++)
 	{
-		cerr<<"WAV format error (WAVE): "<<id<<endl;
-		return NULL;
+		double pos=n*step;
+		unsigned int i=(unsigned int)pos;
+		float t=pos-i;
+		
+		float y0=src[i>0?i-1:0];
+		float y1=src[i];
+		float y2=src[i+1<last?i+1:last];
+		float y3=src[i+2<last?i+2:last];
+		
+		float c1=0.5f*(y2-y0);
+		float c2=y0-2.5f*y1+2.0f*y2-0.5f*y3;
+		float c3=0.5f*(y3-y0)+1.5f*(y1-y2);
+		dest[n]=((c3*t+c2)*t+c1)*t+y1;
 	}
-	fread(id,1,4,file);
-	if (strcmp(id,"fmt ")!=0)
+}
+
+// the cache file name depends on everything that changes the decoded data
+string AsyncSampleLoader::CachePath(const string &filename)
+{
+	if (m_CacheDir=="") return "";
+	
+	struct stat st;
+	if (stat(filename.c_str(),&st)!=0) return "";
+	
+	char key[1024];
+	snprintf(key,sizeof(key),"%s:%ld:%ld:%u",filename.c_str(),
+		(long)st.st_mtime,(long)st.st_size,m_SampleRate);
+	
+	// fnv-1a
+	unsigned long long hash=14695981039346656037ULL;
+	for (const char *c=key; *c; c++)
 	{
-		cerr<<"WAV format error (fmt ): "<<id<<endl;
-		return NULL;
+		hash^=(unsigned char)*c;
+		hash*=1099511628211ULL;
 	}
-	fread(&size,1,4,file);
-	unsigned int datastart=size+ftell(file);
-	short compression;
-	fread(&compression,1,2,file);
-	if (compression!=1)
+	
+	char name[64];
+	snprintf(name,sizeof(name),"/%016llx.raw",hash);
+	return m_CacheDir+name;
+}
+
+bool AsyncSampleLoader::ReadCache(const string &path, Sample &out)
+{
+	int fd=open(path.c_str(),O_RDONLY);
+	if (fd<0) return false;
+	
+	struct stat st;
+	char header[CACHE_HEADER_SIZE];
+	unsigned int frames=0;
+	if (fstat(fd,&st)!=0 || read(fd,header,CACHE_HEADER_SIZE)!=(ssize_t)CACHE_HEADER_SIZE ||
+		memcmp(header,CACHE_MAGIC,4)!=0)
 	{
-		cerr<<"WAV data is compressed"<<endl;
-		return NULL;
+		close(fd);
+		return false;
 	}
-	fread(&channels,1,2,file);
-	if (!(channels==1 || channels==2))
+	memcpy(&frames,header+4,4);
+	
+	size_t size=CACHE_HEADER_SIZE+frames*sizeof(AudioType);
+	if (frames==0 || (size_t)st.st_size!=size)
 	{
-		cerr<<"WAV data is not mono or stereo"<<endl;
-		return NULL;
+		close(fd);
+		return false;
 	}
-	fseek(file,datastart,SEEK_SET);		
-	fread(id,1,4,file);
-	if (strcmp(id,"data")!=0)
+	
+	// private and writable, so anyone changing the sample just gets 
+	// their own copy of the page rather than a crash
+	void *mem=mmap(NULL,size,PROT_READ|PROT_WRITE,MAP_PRIVATE,fd,0);
+	close(fd);
+	if (mem==MAP_FAILED) return false;
+	
+	// start paging it in now, rather than when it's first played
+	madvise(mem,size,MADV_WILLNEED);
+	
+	pthread_mutex_lock(&m_Mutex);
+	m_Mappings.push_back(pair<void*,size_t>(mem,size));
+	pthread_mutex_unlock(&m_Mutex);
+	
+	out.Borrow((AudioType*)((char*)mem+CACHE_HEADER_SIZE),frames);
+	return true;
+}
+
+void AsyncSampleLoader::WriteCache(const string &path, const Sample &sample)
+{
+	// make the directory and it's parent if needed
+	string parent=m_CacheDir.substr(0,m_CacheDir.find_last_of('/'));
+	if (parent!="") mkdir(parent.c_str(),0755);
+	mkdir(m_CacheDir.c_str(),0755);
+	
+	// write to a temp file first, so other loaders never see half a file
+	char tmp[32];
+	snprintf(tmp,sizeof(tmp),".%d.%lx",getpid(),(unsigned long)pthread_self());
+	string tmppath=path+tmp;
+	
+	FILE *file=fopen(tmppath.c_str(),"wb");
+	if (!file) return;
+	
+	unsigned int frames=sample.GetLength();
+	bool ok=fwrite(CACHE_MAGIC,1,4,file)==4 && 
+		fwrite(&frames,1,4,file)==4 &&
+		fwrite(sample.GetBuffer(),sizeof(AudioType),frames,file)==frames;
+	ok=fclose(file)==0 && ok;
+	
+	if (!ok || rename(tmppath.c_str(),path.c_str())!=0)
 	{
-		cerr<<"WAV format error (data): "<<id<<endl;
-		return NULL;
+		cerr<<"AsyncSampleLoader: could not write cache file "<<path<<endl;
+		unlink(tmppath.c_str());
 	}
-	fread(&size,1,4,file);
-	char *data=new char[size];
-	fread(data,1,size,file);
-	return (short*)data;
-};
+}
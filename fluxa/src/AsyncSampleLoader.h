@@ -18,6 +18,8 @@
 #include <pthread.h>
 #include <deque>
 #include <map>
+#include <vector>
+#include <sndfile.h>
 #include "Types.h"
 #include "Sample.h"
 
@@ -29,44 +31,80 @@ using namespace std;
 namespace spiralcore
 {
 
-// a sample loader that does it's loading in another thread. should be suitable
-// for realtime use. caches samples (forever) and seems to work, but needs a 
-// little fixing up to be safer
+static const unsigned int SAMPLELOADER_MAX_THREADS = 4;
+// samples at least this long are kept decoded on disk and mmapped 
+// next time, rather than decoded again
+static const unsigned int SAMPLELOADER_CACHE_MIN_FRAMES = 65536;
+
+// a sample loader that does it's loading in a pool of worker threads, 
+// decoding with libsndfile and resampling to the engine samplerate.
+// should be suitable for realtime use. caches samples (forever), and 
+// keeps large ones decoded in a cache directory so they can be mmapped
 class AsyncSampleLoader
 {
 public:
 	static AsyncSampleLoader* Get();
 	static void Shutdown();
 	
-	// this sample will be filled later. *should* be ok to play it, as
-	// it will be allocated on one chunk, and the size updated after
-	// might get some noise though - and you probably shouldnt - need to
-	// have some info on whether it's loaded or not :)
+	void SetSampleRate(unsigned int s) { m_SampleRate=s; }
+	// empty to turn off the disk cache
+	void SetCacheDir(const string &dir) { m_CacheDir=dir; }
+	
+	// this sample will be filled later, it has zero length until it's
+	// loaded, and the length is only set once the data is all there.
 	// ownership of the sample remains in control of this class - do not
 	// delete!
 	Sample *AddToQueue(const string &Filename);
-	// batches em up to save time
+	// batches em up to save time, hands them to the workers
 	void LoadQueue();
+	// hands over any that LoadQueue had to leave behind,
+	// called every block from the audio thread
+	void RetryLoadQueue() { if (m_Deferred) LoadQueue(); }
+	// how many times a hand over had to wait for the next block
+	unsigned int GetNumDeferred() { return m_NumDeferred; }
+	// blocks until everything queued is loaded, for non realtime use
+	void LoadQueueNow();
 	
 private:
 	AsyncSampleLoader();
 	~AsyncSampleLoader();
 	
-	static void LoadLoop();
-
-	pthread_t  m_LoaderThread;
-	static pthread_mutex_t* m_Mutex;
-	
 	struct LoadItem
 	{
 		string Name;
 		Sample *SamplePtr;
 	};
 	
-	static map<string,Sample*> m_Cache;
+	static void *WorkerThread(void *context);
+	void WorkerLoop();
+	void Load(const LoadItem &item);
+	bool Decode(SNDFILE *file, const SF_INFO &info, Sample &out);
+	void Resample(const Sample &in, unsigned int fromrate, Sample &out);
+	string CachePath(const string &filename);
+	bool ReadCache(const string &path, Sample &out);
+	void WriteCache(const string &path, const Sample &sample);
+	
+	unsigned int m_SampleRate;
+	string m_CacheDir;
+	
+	pthread_t m_Threads[SAMPLELOADER_MAX_THREADS];
+	unsigned int m_NumThreads;
+	pthread_mutex_t m_Mutex;
+	pthread_cond_t m_Work;
+	pthread_cond_t m_Done;
+	bool m_Quit;
+	unsigned int m_Busy;
+	
+	map<string,Sample*> m_Cache;
+	// only touched by the thread adding samples, so we never
+	// have to wait for the workers to add to the queue
+	deque<LoadItem> m_Pending;
+	bool m_Deferred;
+	unsigned int m_NumDeferred;
+	deque<LoadItem> m_LoadQueue;
+	// the mmapped cache files, unmapped on shutdown
+	vector<pair<void*,size_t> > m_Mappings;
 	
-	// two loaderstacks, so we can get a lock on at least one of them at any time
-	static deque<LoadItem> m_LoadQueue;
 	static AsyncSampleLoader *m_Singleton;
 };
 
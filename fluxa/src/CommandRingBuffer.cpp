@@ -22,8 +22,10 @@ using namespace std;
 
 CommandRingBuffer::Command::Command(const char *name, const char *types, const char *data, unsigned int datasize)
 {
-	strcpy(Name,name);
-	strcpy(Types,types);
+	strncpy(Name,name,sizeof(Name)-1);
+	Name[sizeof(Name)-1]='\0';
+	strncpy(Types,types,COMMAND_MAX_ARGS-1);
+	Types[COMMAND_MAX_ARGS-1]='\0';
 	memcpy(Data,data,datasize);
 	
 	m_NumArgs=strlen(Types);
@@ -16,7 +16,12 @@
 
 #include "RingBuffer.h"
 
+#ifndef COMMAND_RINGBUFFER
+#define COMMAND_RINGBUFFER
+
 static const unsigned int COMMAND_DATA_SIZE = 4096;
+// enough for a /define of a reasonably sized synth
+static const unsigned int COMMAND_MAX_ARGS = 256;
 
 class CommandRingBuffer : public RingBuffer
 {
@@ -39,11 +44,11 @@ public:
 		char *GetBlob(unsigned int index);
 		unsigned int Size() { return m_NumArgs; }
 		char Name[256];
-		char Types[64];
+		char Types[COMMAND_MAX_ARGS];
 		
 	private:
 		char Data[COMMAND_DATA_SIZE];
-		int m_Offsets[64]; 
+		int m_Offsets[COMMAND_MAX_ARGS]; 
 		unsigned int m_NumArgs; 
 		
 	};	
@@ -54,3 +59,5 @@ public:
 private:
 	Command m_Current;
 };
+
+#endif
@@ -20,6 +20,8 @@
 #ifndef NE_EVENT
 #define NE_EVENT
 
+static const unsigned int EVENT_MAX_PARAMS = 16;
+
 namespace spiralcore
 {
 
@@ -35,7 +37,9 @@ public:
 	Position(0),
 	Channel(0),
 	NoteNum(0),
-	Message(0)
+	Message(0),
+	DefID(-1),
+	NumParams(0)
 	{}
 	
 	int ID;            // the currently playing sample, or voice
@@ -48,6 +52,9 @@ public:
 	int NoteNum;
 	char Message;      // used for charscore message passing
 	Time TimeStamp;    // when to do this event
+	int DefID;         // synth definition to instance, or -1
+	unsigned int NumParams;
+	float32 Params[EVENT_MAX_PARAMS]; // synth definition parameters
 };
 
 }
@@ -18,7 +18,8 @@
 
 using namespace spiralcore;
 
-EventQueue::EventQueue()
+EventQueue::EventQueue() :
+m_Size(0)
 {
 }
 
@@ -34,6 +35,7 @@ bool EventQueue::Add(const Event &e)
 		{
 			m_Queue[i].m_Event=e;
 			m_Queue[i].m_IsEmpty=false;
+			m_Size++;
 			return true;
 		}
 	}
@@ -50,6 +52,7 @@ bool EventQueue::Get(Time from, Time till, Event &e)
 		{
 			e=m_Queue[i].m_Event;      // return this one
 			m_Queue[i].m_IsEmpty=true; // delete from the queue
+			m_Size--;
 			return true;
 		}
 	}
@@ -38,6 +38,8 @@ public:
 	// time slice until it returns false
 	bool Get(Time from, Time till, Event &e);
 	
+	unsigned int GetSize() { return m_Size; }
+	
 private:
 
 	struct QueueItem
@@ -48,6 +50,7 @@ private:
 	};
 
 	QueueItem m_Queue[EVENT_QUEUE_SIZE]; 
+	unsigned int m_Size;
 };
 
 }
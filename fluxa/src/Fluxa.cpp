@@ -18,25 +18,45 @@
 #include "SearchPaths.h"
 #include "Fluxa.h"
 #include "SampleStore.h"
+#include "AsyncSampleLoader.h"
 #include "Modules.h"
 
 using namespace spiralcore;
 
+// blocks kept aside for buffers that grow when the block size changes
+static const unsigned int FLUXA_SPARE_BLOCKS = 64;
+// the biggest buffer size jack allows
+static const unsigned int FLUXA_MAX_BLOCK_SIZE = 8192;
+// how often to walk the node pools for the stats
+static const unsigned int FLUXA_NODE_STATS_BLOCKS = 64;
+
 Fluxa::Fluxa(OSCServer *server, JackClient* jack, const string &leftport, const string &rightport) :
 m_SampleRate(jack->GetSamplerate()),
-m_Graph(70,jack->GetSamplerate()),
+m_BlockSize(jack->GetBufferSize()),
+m_Realtime(true),
+m_Jack(jack),
+m_Commands(server->GetCommandRingBuffer()),
+m_Graph(70,jack->GetSamplerate(),jack->GetBufferSize()),
 m_Sampler(jack->GetSamplerate()),
+m_JackLeft(NULL),
+m_JackRight(NULL),
 m_Running(false),
-m_Server(server),
 m_GlobalVolume(1.0f),
 m_Pan(0.0f),
 m_Debug(false),
+m_AllocFailures(0),
+m_ReportedAllocFailures(0),
+m_ReportedMissed(0),
+m_ReportedDeferred(0),
+m_StatsBlocks(0),
+m_GraphDropped(0),
 m_LeftEq(jack->GetSamplerate()),
 m_RightEq(jack->GetSamplerate()),
 m_Comp(jack->GetSamplerate())
 {		
-	WaveTable::WriteWaves();
+	Init();
  	jack->SetCallback(Run,(void*)this);
+	server->SetIdleCallback(Idle,(void*)this);
 
 	//PortAudioClient* Audio=PortAudioClient::Get();
 	//Audio->SetCallback(Run,(void*)this);
@@ -46,49 +66,141 @@ m_Comp(jack->GetSamplerate())
 	//Options.BufferSize=512;
 	//Audio->Attach("Fluxa",Options);	
 	
-	m_LeftBuffer.Allocate(1024);
-	m_RightBuffer.Allocate(1024);
-	m_LeftBuffer.Zero();
-	m_RightBuffer.Zero();
-	
 	if (jack->IsAttached())
 	{	
 		//Audio->SetOutputs(m_LeftBuffer.GetNonConstBuffer(),m_RightBuffer.GetNonConstBuffer());
 		
 		m_LeftJack = jack->AddOutputPort();
- 		jack->SetOutputBuf(m_LeftJack, m_LeftBuffer.GetNonConstBuffer());
+		m_JackLeft = m_LeftBuffer.GetNonConstBuffer();
+ 		jack->SetOutputBuf(m_LeftJack, m_JackLeft);
  	    jack->ConnectOutput(m_LeftJack,leftport);
   	    m_RightJack = jack->AddOutputPort();
- 		jack->SetOutputBuf(m_RightJack, m_RightBuffer.GetNonConstBuffer());
+		m_JackRight = m_RightBuffer.GetNonConstBuffer();
+ 		jack->SetOutputBuf(m_RightJack, m_JackRight);
   	    jack->ConnectOutput(m_RightJack,rightport); 	
  		m_Running=true;
 	}
 	//Sample::SetAllocator(new RealtimeAllocator(1024*1024*40));
 	
+	cerr<<"fluxa server ready... "<<endl;
+}
+
+Fluxa::Fluxa(CommandRingBuffer *commands, unsigned int samplerate, unsigned int blocksize) :
+m_SampleRate(samplerate),
+m_BlockSize(blocksize),
+m_Realtime(false),
+m_Jack(NULL),
+m_Commands(commands),
+m_Graph(70,samplerate,blocksize),
+m_Sampler(samplerate),
+m_LeftJack(0),
+m_RightJack(0),
+m_JackLeft(NULL),
+m_JackRight(NULL),
+m_Running(true),
+m_GlobalVolume(1.0f),
+m_Pan(0.0f),
+m_Debug(false),
+m_AllocFailures(0),
+m_ReportedAllocFailures(0),
+m_ReportedMissed(0),
+m_ReportedDeferred(0),
+m_StatsBlocks(0),
+m_GraphDropped(0),
+m_LeftEq(samplerate),
+m_RightEq(samplerate),
+m_Comp(samplerate)
+{		
+	Init();
+}
+
+void Fluxa::Init()
+{
+	WaveTable::WriteWaves();
+	
+	// big enough for any block size, so they never have to grow
+	unsigned int size=m_BlockSize>FLUXA_MAX_BLOCK_SIZE?m_BlockSize:FLUXA_MAX_BLOCK_SIZE;
+	m_LeftBuffer.Allocate(size);
+	m_RightBuffer.Allocate(size);
+	m_LeftBuffer.Zero();
+	m_RightBuffer.Zero();
+	
+	// spare blocks for the nodes that have to grow in the audio thread,
+	// for each size up to the largest jack can switch to
+	for (size=m_BlockSize; size>0 && size<=FLUXA_MAX_BLOCK_SIZE; size*=2)
+	{
+		Sample::GetAllocator()->Reserve(size*sizeof(AudioType),FLUXA_SPARE_BLOCKS);
+		Sample::GetAllocator()->Reserve(size*2*sizeof(AudioType),FLUXA_SPARE_BLOCKS);
+	}
+	
+	// start the loader threads here rather than in the audio thread,
+	// and have it resample to our rate
+	AsyncSampleLoader::Get()->SetSampleRate(m_SampleRate);
+	
 	Time Now;
 	Now.SetToNow();
 	m_CurrentTime.Seconds=Now.Seconds;
 	m_CurrentTime.Fraction=Now.Fraction;
-	
-	cerr<<"fluxa server ready... "<<endl;
 }
 
 void Fluxa::Run(void *RunContext, unsigned int BufSize)
 { 
-	((Fluxa*)RunContext)->ProcessCommands();
-	((Fluxa*)RunContext)->Process(BufSize);
+	Fluxa *fluxa=(Fluxa*)RunContext;
+	if (fluxa->m_Realtime) Allocator::SetRealtimeThread();
+	fluxa->m_Stats.StartBlock();
+	fluxa->ProcessCommands();
+	if (fluxa->m_Realtime) SampleStore::Get()->RetryLoadQueue();
+	fluxa->Process(BufSize);
+	fluxa->UpdateStats(BufSize);
+	fluxa->m_Stats.EndBlock(BufSize,fluxa->m_SampleRate);
+	if (!fluxa->m_Realtime) fluxa->Report();
+}
+
+// the osc server's thread, where we can allocate
+void Fluxa::Idle(void *Context)
+{
+	Fluxa *fluxa=(Fluxa*)Context;
+	fluxa->m_Graph.BuildNodes();
+	Sample::GetAllocator()->FreeDeferred();
+	fluxa->Report();
+}
+
+// logs the problems the audio thread has counted since last time
+void Fluxa::Report()
+{
+	Stats::Block stats;
+	m_Stats.Read(stats);
+	if (stats.AllocFailures>m_ReportedAllocFailures)
+	{
+		cerr<<"out of sample memory in the audio thread ("<<stats.AllocFailures<<" failed allocations)"<<endl;
+	}
+	if (stats.MissedSamples>m_ReportedMissed)
+	{
+		cerr<<stats.MissedSamples-m_ReportedMissed<<" sample plays missed, they were not loaded yet, "
+			<<"not found or at zero speed"<<endl;
+	}
+	if (stats.DeferredLoads>m_ReportedDeferred)
+	{
+		cerr<<"the sample loader was busy, "<<stats.DeferredLoads-m_ReportedDeferred
+			<<" loads waited for the next block"<<endl;
+	}
+	m_ReportedAllocFailures=stats.AllocFailures;
+	m_ReportedMissed=stats.MissedSamples;
+	m_ReportedDeferred=stats.DeferredLoads;
 }
 
 void Fluxa::ProcessCommands()
 {
 	CommandRingBuffer::Command cmd;
-	while (m_Server->Get(cmd))
+	while (m_Commands->Get(cmd))
 	{
 		string name = cmd.Name;
 		//cerr<<name<<endl;		
 		
 		if (name=="/setclock")	
 		{ 
+			// when rendering offline the clock is driven by the command times
+			if (!m_Realtime) continue;
 			// baddddd :P
 			Time Now;
 			Now.SetToNow();
@@ -142,43 +254,81 @@ void Fluxa::ProcessCommands()
 			e.TimeStamp.Fraction=(unsigned int)cmd.GetInt(1);
 			e.ID=cmd.GetInt(2);
             e.Pan=cmd.GetFloat(3);
+			Schedule(e);
+		}
+		else if (name=="/define")	
+		{
+			// id root numnodes, then the nodes as type [value param+1] 
+			// (terminals only), followed by node arg to connections
+			bool ok=cmd.Size()>=3;
+			unsigned int id=ok?cmd.GetInt(0):0;
+			unsigned int numnodes=ok?cmd.GetInt(2):0;
+			ok=ok && m_Graph.Define(id,cmd.GetInt(1));
 			
-			if (e.TimeStamp.Seconds==0 && e.TimeStamp.Fraction==0)
+			unsigned int pos=3;
+			for (unsigned int n=0; ok && n<numnodes; n++)
 			{
-				e.TimeStamp=m_CurrentTime;
-				e.TimeStamp+=0.1;
-			}
-			if (e.TimeStamp>=m_CurrentTime) 
-			{
-				m_EventQueue.Add(e);
-
-				if (e.TimeStamp.GetDifference(m_CurrentTime)>30)
+				if (pos>=cmd.Size()) { ok=false; break; }
+				int t=cmd.GetInt(pos);
+				if (t<0 || t>=Graph::NUMTYPES) { ok=false; break; }
+				Graph::Type type=(Graph::Type)t;
+				if (type==Graph::TERMINAL) 
 				{
-					Trace(RED,YELLOW,"Reset clock? Event far in future %f seconds",e.TimeStamp.GetDifference(m_CurrentTime));
-				} 			
+					if (pos+2>=cmd.Size()) { ok=false; break; }
+					ok=m_Graph.DefineNode(id,type,cmd.GetFloat(pos+1),cmd.GetInt(pos+2)-1);
+					pos+=3;
+				}
+				else
+				{
+					ok=m_Graph.DefineNode(id,type,0,-1);
+					pos+=1;
+				}
 			}
-			else 
+			
+			for (; ok && pos+2<cmd.Size(); pos+=3)
 			{
-				Trace(RED,YELLOW,"Event arrived too late [%f secs], playing now anyway!",m_CurrentTime.GetDifference(e.TimeStamp));
-				e.TimeStamp=m_CurrentTime;
-				e.TimeStamp+=0.1;
-				m_EventQueue.Add(e);
+				ok=m_Graph.DefineLink(id,cmd.GetInt(pos),cmd.GetInt(pos+1),cmd.GetInt(pos+2));
 			}
 			
-			if (m_Debug)
+			if (!ok) 
+			{
+				cerr<<"/define - malformed arguments..."<<endl;
+				m_Graph.Define(id,0);
+			}
+		}
+		else if (name=="/playdef")	
+		{
+			Event e;
+			e.TimeStamp.Seconds=(unsigned int)cmd.GetInt(0);
+			e.TimeStamp.Fraction=(unsigned int)cmd.GetInt(1);
+			e.DefID=cmd.GetInt(2);
+            e.Pan=cmd.GetFloat(3);
+			for (unsigned int n=4; n<cmd.Size() && e.NumParams<EVENT_MAX_PARAMS; n++)
 			{
-				Trace(RED,YELLOW,"/play received ID=%d secs=%d frac=%d",e.ID,(unsigned int)e.TimeStamp.Seconds,
-																			 (unsigned int)e.TimeStamp.Fraction);
+				e.Params[e.NumParams++]=cmd.GetFloat(n);
 			}
+			Schedule(e);
 		}
 		else if (name=="/maxsynths")	
 		{ 		
 			m_Graph.SetMaxPlaying(cmd.GetInt(0));
 		}
+		else if (name=="/poolsize")	
+		{ 		
+			int t=cmd.GetInt(0);
+			int count=cmd.GetInt(1);
+			if (t>=0 && t<Graph::NUMTYPES) 
+			{
+				m_Graph.SetPoolSize((Graph::Type)t,count<1?1:count);
+			}
+		}
+		else if (name=="/resetstats")	
+		{ 		
+			m_Stats.Reset();
+		}
 		else if (name=="/reset")	
 		{ 		
-			m_Graph.Clear();
-			m_Graph.Init();
+			m_Graph.Reset();
 		}
 		else if (name=="/globalvolume")	
 		{ 		
@@ -214,7 +364,10 @@ void Fluxa::ProcessCommands()
 		}
 		else if (name=="/loadqueue")
 		{
-			SampleStore::Get()->LoadQueue();
+			// no hurry offline, and the samples need to be there 
+			// for the render to be the same every time
+			if (m_Realtime) SampleStore::Get()->LoadQueue();
+			else SampleStore::Get()->LoadQueueNow();
 		}
 		else if (name=="/unload")
 		{
@@ -231,6 +384,63 @@ void Fluxa::ProcessCommands()
 	}	
 }
 
+void Fluxa::Schedule(Event &e)
+{
+	if (e.TimeStamp.Seconds==0 && e.TimeStamp.Fraction==0)
+	{
+		e.TimeStamp=m_CurrentTime;
+		e.TimeStamp+=0.1;
+	}
+	if (e.TimeStamp>=m_CurrentTime) 
+	{
+		if (!m_EventQueue.Add(e)) m_Stats.GetWorking().DroppedEvents++;
+
+		if (e.TimeStamp.GetDifference(m_CurrentTime)>30)
+		{
+			Trace(RED,YELLOW,"Reset clock? Event far in future %f seconds",e.TimeStamp.GetDifference(m_CurrentTime));
+		} 			
+	}
+	else 
+	{
+		Trace(RED,YELLOW,"Event arrived too late [%f secs], playing now anyway!",m_CurrentTime.GetDifference(e.TimeStamp));
+		m_Stats.GetWorking().LateEvents++;
+		e.TimeStamp=m_CurrentTime;
+		e.TimeStamp+=0.1;
+		if (!m_EventQueue.Add(e)) m_Stats.GetWorking().DroppedEvents++;
+	}
+	
+	if (m_Debug)
+	{
+		Trace(RED,YELLOW,"/play received ID=%d DefID=%d secs=%d frac=%d",e.ID,e.DefID,
+			(unsigned int)e.TimeStamp.Seconds,(unsigned int)e.TimeStamp.Fraction);
+	}
+}
+
+void Fluxa::UpdateStats(unsigned int BufSize)
+{
+	Stats::Block &stats=m_Stats.GetWorking();
+	stats.Voices=m_Graph.GetNumPlaying();
+	stats.MaxVoices=m_Graph.GetMaxPlaying();
+	stats.SamplerChannels=m_Sampler.GetNumChannels();
+	stats.QueuedEvents=m_EventQueue.GetSize();
+	stats.CommandBytes=m_Commands->ReadSpace();
+	stats.CommandBufferSize=m_Commands->GetSize();
+	stats.AllocFailures=m_AllocFailures;
+	stats.MissedSamples=Sampler::GetNumMissed();
+	stats.DeferredLoads=SampleStore::Get()->GetNumDeferred();
+	if (m_Jack!=NULL) stats.Xruns=m_Jack->GetXruns();
+	
+	unsigned int dropped=m_Graph.GetNumDropped();
+	stats.DroppedEvents+=dropped-m_GraphDropped;
+	m_GraphDropped=dropped;
+	
+	if (m_StatsBlocks++%FLUXA_NODE_STATS_BLOCKS==0)
+	{
+		stats.NumNodeTypes=Graph::NUMTYPES;
+		m_Graph.CountNodes(stats.NodesInUse,stats.NodesTotal);
+	}
+}
+
 void Fluxa::Process(unsigned int BufSize)
 {	
 	if (BufSize==0)
@@ -239,18 +449,33 @@ void Fluxa::Process(unsigned int BufSize)
 		return;
 	}
 
-	if (BufSize>(unsigned int)m_LeftBuffer.GetLength())
+	// only past the biggest block size we allocated for
+	bool ok=true;
+	if (BufSize>(unsigned int)m_LeftBuffer.GetLength()) ok=m_LeftBuffer.Allocate(BufSize);
+	if (BufSize>(unsigned int)m_RightBuffer.GetLength()) ok=m_RightBuffer.Allocate(BufSize) && ok;
+	
+	// allocating may have moved the buffers, and without them jack is left to 
+	// output silence, as it would read past the end of the ones we have
+	if (m_Jack!=NULL && (!ok || m_LeftBuffer.GetNonConstBuffer()!=m_JackLeft ||
+		m_RightBuffer.GetNonConstBuffer()!=m_JackRight))
 	{
-		m_LeftBuffer.Allocate(BufSize);
-		m_RightBuffer.Allocate(BufSize);
-		//PortAudioClient::Get()->SetOutputs(m_LeftBuffer.GetNonConstBuffer(),m_RightBuffer.GetNonConstBuffer());
- 		JackClient::Get()->SetOutputBuf(m_LeftJack, m_LeftBuffer.GetNonConstBuffer());
- 		JackClient::Get()->SetOutputBuf(m_RightJack, m_RightBuffer.GetNonConstBuffer());
+		m_JackLeft=ok?m_LeftBuffer.GetNonConstBuffer():NULL;
+		m_JackRight=ok?m_RightBuffer.GetNonConstBuffer():NULL;
+		//PortAudioClient::Get()->SetOutputs(m_JackLeft,m_JackRight);
+ 		m_Jack->SetOutputBuf(m_LeftJack, m_JackLeft);
+ 		m_Jack->SetOutputBuf(m_RightJack, m_JackRight);
 	}
+	if (!ok) return;
 	
 	m_LeftBuffer.Zero();
 	m_RightBuffer.Zero();
 	
+	// no other thread to make the nodes for bigger pools
+	if (!m_Realtime) m_Graph.BuildNodes();
+	
+	// logged by Report, outside of the audio thread
+	m_AllocFailures=Sample::GetAllocator()->GetFailures();
+	
 	Time LastTime = m_CurrentTime;
 	m_CurrentTime.IncBySample(BufSize,m_SampleRate);
 	
@@ -261,7 +486,8 @@ void Fluxa::Process(unsigned int BufSize)
 		// hack to get round bug with GetDifference throwing big numbers
 		if (t<=0) 
 		{
-			m_Graph.Play(t,e.ID,e.Pan);
+			if (e.DefID>=0) m_Graph.PlayDef(t,e.DefID,e.Params,e.NumParams,e.Pan);
+			else m_Graph.Play(t,e.ID,e.Pan);
 		}
 		else
 		{
@@ -22,6 +22,7 @@
 #include "Sampler.h"
 #include "Graph.h"
 #include "JackClient.h"
+#include "Stats.h"
 
 #ifndef FLEEP
 #define FLEEP
@@ -31,15 +32,35 @@ static const int EVENT_BUFFER_SIZE=256;
 class Fluxa
 {
 public:
+	// realtime, run from the jack callback with commands from the osc server
 	Fluxa(OSCServer *server, JackClient* jack, const string &leftport, const string &rightport);
+	// non realtime, the owner feeds the commands and calls Run itself
+	Fluxa(CommandRingBuffer *commands, unsigned int samplerate, unsigned int blocksize);
 	~Fluxa() {}
 	
-private:
 	static void Run(void *RunContext, unsigned int BufSize);
+	static void Idle(void *Context);
+	
+	void SetTime(const Time &t) { m_CurrentTime=t; }
+	const Time &GetTime() { return m_CurrentTime; }
+	const Sample &GetLeft() { return m_LeftBuffer; }
+	const Sample &GetRight() { return m_RightBuffer; }
+	Graph &GetGraph() { return m_Graph; }
+	Stats &GetStats() { return m_Stats; }
+	
+private:
+	void Init();
 	void Process(unsigned int BufSize);
 	void ProcessCommands();
+	void Schedule(Event &e);
+	void UpdateStats(unsigned int BufSize);
+	void Report();
 	
 	unsigned int m_SampleRate;
+	unsigned int m_BlockSize;
+	bool m_Realtime;
+	JackClient *m_Jack;
+	CommandRingBuffer *m_Commands;
 		
 	Graph m_Graph;
 	Sampler m_Sampler;
@@ -47,13 +68,23 @@ private:
 	Sample m_RightBuffer;
 	int    m_LeftJack;
 	int    m_RightJack;
+	// the buffers jack is reading from
+	float *m_JackLeft;
+	float *m_JackRight;
 	bool 	m_Running;
 	Time	m_CurrentTime;
-	OSCServer *m_Server;
 	EventQueue m_EventQueue;
 	float m_GlobalVolume;
 	float m_Pan;
 	bool m_Debug;
+	unsigned int m_AllocFailures;
+	// what Report has already logged
+	unsigned int m_ReportedAllocFailures;
+	unsigned int m_ReportedMissed;
+	unsigned int m_ReportedDeferred;
+	Stats m_Stats;
+	unsigned int m_StatsBlocks;
+	unsigned int m_GraphDropped;
 	
 	Eq m_LeftEq;
     Eq m_RightEq;
@@ -20,11 +20,19 @@
 #include "ModuleNodes.h"
 #include "Modules.h"
 
-Graph::Graph(unsigned int NumNodes, unsigned int SampleRate) :
+Graph::Graph(unsigned int NumNodes, unsigned int SampleRate, unsigned int BlockSize) :
 m_MaxPlaying(10),
-m_NumNodes(NumNodes),
-m_SampleRate(SampleRate)
+m_NumPlaying(0),
+m_NumDropped(0),
+m_NextSerial(0),
+m_Voices(MAX_VOICES),
+m_PoolSizes(NUMTYPES,NumNodes),
+m_NewNodes(4096),
+m_SampleRate(SampleRate),
+m_BlockSize(BlockSize),
+m_SynthDefs(MAX_SYNTHDEFS)
 {
+	m_PoolSizes[TERMINAL]=2000;
 	Init();
 }
 
@@ -33,104 +41,346 @@ Graph::~Graph()
 	Clear();
 }
 
+// same as the names used by pool-size in fluxa.ss
+static const char *TypeNames[Graph::NUMTYPES] = {
+	"terminal","sine","saw","tri","squ","white","pink","adsr","add","sub","mul","div","pow",
+	"mooglp","moogbp","mooghp","formant","sample","crush","distort","klip","echo","ks" };
+
+const char *Graph::GetTypeName(Type t)
+{
+	if ((int)t<0 || t>=NUMTYPES) return "unknown";
+	return TypeNames[t];
+}
+
+void Graph::CountNodes(unsigned int *inuse, unsigned int *total)
+{
+	for (unsigned int t=0; t<NUMTYPES; t++)
+	{
+		NodeDescVec *descvec=m_NodeDescVec[t];
+		inuse[t]=0;
+		total[t]=descvec->m_Size;
+		for (unsigned int n=0; n<descvec->m_Size; n++)
+		{
+			if (descvec->m_Vec[n]->m_Node->GetOwner()>=0) inuse[t]++;
+		}
+	}
+}
+
+GraphNode *Graph::NewNode(Type t)
+{
+	switch(t)
+	{
+		case TERMINAL : return new TerminalNode(0);
+		case SINOSC : return new OscNode((int)WaveTable::SINE,m_SampleRate);
+		case SAWOSC : return new OscNode((int)WaveTable::SAW,m_SampleRate);
+		case TRIOSC : return new OscNode((int)WaveTable::TRIANGLE,m_SampleRate);
+		case SQUOSC : return new OscNode((int)WaveTable::SQUARE,m_SampleRate);
+		case WHITEOSC : return new OscNode((int)WaveTable::NOISE,m_SampleRate);
+		case PINKOSC : return new OscNode((int)WaveTable::PINKNOISE,m_SampleRate);
+		case ADSR : return new ADSRNode(m_SampleRate);
+		case ADD : return new MathNode(MathNode::ADD);
+		case SUB : return new MathNode(MathNode::SUB);
+		case MUL : return new MathNode(MathNode::MUL);
+		case DIV : return new MathNode(MathNode::DIV);
+		case POW : return new MathNode(MathNode::POW);
+		case MOOGLP : return new FilterNode(FilterNode::MOOGLP,m_SampleRate);
+		case MOOGBP : return new FilterNode(FilterNode::MOOGBP,m_SampleRate);
+		case MOOGHP : return new FilterNode(FilterNode::MOOGHP,m_SampleRate);
+		case FORMANT : return new FilterNode(FilterNode::FORMANT,m_SampleRate);
+		case SAMPLER : return new SampleNode(m_SampleRate);
+		case CRUSH : return new EffectNode(EffectNode::CRUSH,m_SampleRate);
+		case DISTORT : return new EffectNode(EffectNode::DISTORT,m_SampleRate);
+		case CLIP : return new EffectNode(EffectNode::CLIP,m_SampleRate);
+		case DELAY : return new EffectNode(EffectNode::DELAY,m_SampleRate);
+		case KS : return new KSNode(m_SampleRate);
+		default: assert(0); break;
+	}
+	return NULL;
+}
+
 void Graph::Init()
 {
 	for (unsigned int type=0; type<NUMTYPES; type++)
 	{
-		NodeDescVec *descvec = new NodeDescVec;
-		
-		unsigned int count=m_NumNodes;
-		
-		if (type==TERMINAL) count=2000;
-		
-		for(unsigned int n=0; n<count; n++)
+		m_NodeDescVec.push_back(new NodeDescVec);
+		m_NodeDescVec[type]->m_Vec.reserve(MAX_POOL_SIZE);
+		m_Wanted[type]=m_PoolSizes[type];
+		m_Built[type]=0;
+	}
+	
+	// the ringbuffer may not hold them all at once
+	while (!BuildNodes()) TakeNodes();
+	TakeNodes();
+}
+
+void Graph::Clear()
+{
+	for (unsigned int v=0; v<m_Voices.size(); v++)
+	{
+		m_Voices[v]=Voice();
+	}
+	m_NumPlaying=0;
+	m_NodeMap.clear();
+	
+	TakeNodes();
+	for (vector<NodeDescVec*>::iterator i=m_NodeDescVec.begin(); 
+		i!=m_NodeDescVec.end(); ++i)
+	{
+		for (vector<NodeDesc*>::iterator ni=(*i)->m_Vec.begin();
+			ni!=(*i)->m_Vec.end(); ++ni)
 		{
-			NodeDesc *nodedesc = new NodeDesc;
+			delete (*ni)->m_Node;
+			delete *ni;
+		}
+		delete *i;
+	}
+	
+	m_NodeDescVec.clear();	
+}
+
+void Graph::Reset()
+{
+	for (unsigned int v=0; v<m_Voices.size(); v++)
+	{
+		StopVoice(v);
+	}
+	m_NumPlaying=0;
+	m_NodeMap.clear();
+	
+	for (vector<NodeDescVec*>::iterator i=m_NodeDescVec.begin(); 
+		i!=m_NodeDescVec.end(); ++i)
+	{
+		for (vector<NodeDesc*>::iterator ni=(*i)->m_Vec.begin();
+			ni!=(*i)->m_Vec.end(); ++ni)
+		{
+			(*ni)->m_ID=0;
+			(*ni)->m_Node->SetOwner(-1);
+			(*ni)->m_Node->Clear();
+		}
+	}
+}
+
+void Graph::SetMaxPlaying(unsigned int s)
+{
+	if (s<1) s=1;
+	if (s>MAX_VOICES) s=MAX_VOICES;
+	m_MaxPlaying=s;
+}
+
+void Graph::SetPoolSize(Type t, unsigned int count)
+{
+	if ((int)t<0 || t>=NUMTYPES) return;
+	if (count<1) count=1;
+	if (count>MAX_POOL_SIZE) count=MAX_POOL_SIZE;
+	m_PoolSizes[t]=count;
+	m_Wanted[t]=count;
+	ResizePool(t);
+}
+
+// only hands out the nodes we already have, the rest arrive later
+void Graph::ResizePool(Type t)
+{
+	NodeDescVec *descvec=m_NodeDescVec[t];
+	descvec->m_Size=m_PoolSizes[t];
+	if (descvec->m_Size>descvec->m_Vec.size()) descvec->m_Size=descvec->m_Vec.size();
+	if (descvec->m_Current>=descvec->m_Size) descvec->m_Current=0;
+}
+
+bool Graph::BuildNodes()
+{
+	for (unsigned int type=0; type<NUMTYPES; type++)
+	{
+		Type t=(Type)type;
+		while (m_Built[t]<m_Wanted[t])
+		{
+			NewNodeMsg msg;
+			// keep a gap, as a completely full ringbuffer reads as empty
+			if (m_NewNodes.WriteSpace()<=sizeof(msg)) return false;
 			
-			switch(type)
+			GraphNode *node = NewNode(t);
+			if (!node->Reserve(m_BlockSize))
 			{
-				case TERMINAL : nodedesc->m_Node = new TerminalNode(0); break;
-				case SINOSC : nodedesc->m_Node = new OscNode((int)WaveTable::SINE,m_SampleRate); break;
-				case SAWOSC : nodedesc->m_Node = new OscNode((int)WaveTable::SAW,m_SampleRate); break;
-				case TRIOSC : nodedesc->m_Node = new OscNode((int)WaveTable::TRIANGLE,m_SampleRate); break;
-				case SQUOSC : nodedesc->m_Node = new OscNode((int)WaveTable::SQUARE,m_SampleRate); break;
-				case WHITEOSC : nodedesc->m_Node = new OscNode((int)WaveTable::NOISE,m_SampleRate); break;
-				case PINKOSC : nodedesc->m_Node = new OscNode((int)WaveTable::PINKNOISE,m_SampleRate); break;
-				case ADSR : nodedesc->m_Node = new ADSRNode(m_SampleRate); break;
-				case ADD : nodedesc->m_Node = new MathNode(MathNode::ADD); break;
-				case SUB : nodedesc->m_Node = new MathNode(MathNode::SUB); break;
-				case MUL : nodedesc->m_Node = new MathNode(MathNode::MUL); break;
-				case DIV : nodedesc->m_Node = new MathNode(MathNode::DIV); break;
-				case POW : nodedesc->m_Node = new MathNode(MathNode::POW); break;
-				case MOOGLP : nodedesc->m_Node = new FilterNode(FilterNode::MOOGLP,m_SampleRate); break;
-				case MOOGBP : nodedesc->m_Node = new FilterNode(FilterNode::MOOGBP,m_SampleRate); break;
-				case MOOGHP : nodedesc->m_Node = new FilterNode(FilterNode::MOOGHP,m_SampleRate); break;
-				case FORMANT : nodedesc->m_Node = new FilterNode(FilterNode::FORMANT,m_SampleRate); break;
-				case SAMPLER : nodedesc->m_Node = new SampleNode(m_SampleRate); break;
-				case CRUSH : nodedesc->m_Node = new EffectNode(EffectNode::CRUSH,m_SampleRate); break;
-				case DISTORT : nodedesc->m_Node = new EffectNode(EffectNode::DISTORT,m_SampleRate); break;
-				case CLIP : nodedesc->m_Node = new EffectNode(EffectNode::CLIP,m_SampleRate); break;
-				case DELAY : nodedesc->m_Node = new EffectNode(EffectNode::DELAY,m_SampleRate); break;				
-				case KS : nodedesc->m_Node = new KSNode(m_SampleRate); break;				
-				default: assert(0); break;
+				cerr<<"out of sample memory, pool for type "<<GetTypeName(t)<<" limited to "
+					<<m_Built[t]<<" nodes"<<endl;
+				delete node;
+				// don't try again until a bigger pool is asked for
+				m_Built[t]=m_Wanted[t];
+				break;
 			}
 			
-			descvec->m_Vec.push_back(nodedesc);
+			msg.m_Type=t;
+			msg.m_Desc=new NodeDesc;
+			msg.m_Desc->m_Node=node;
+			m_NewNodes.Write((char*)&msg,sizeof(msg));
+			m_Built[t]++;
 		}
-		
-		m_NodeDescMap[(Type)type] = descvec;
 	}
+	return true;
 }
 
-void Graph::Clear()
+// picks up the nodes from BuildNodes, there is room in the 
+// tables for them so this doesn't allocate
+void Graph::TakeNodes()
 {
-	m_RootNodes.clear();
-	m_NodeMap.clear();
+	NewNodeMsg msg;
+	while (m_NewNodes.ReadSpace()>=sizeof(msg) && m_NewNodes.Read((char*)&msg,sizeof(msg)))
+	{
+		NodeDescVec *descvec=m_NodeDescVec[msg.m_Type];
+		if (descvec->m_Vec.size()<MAX_POOL_SIZE)
+		{
+			descvec->m_Vec.push_back(msg.m_Desc);
+			ResizePool(msg.m_Type);
+		}
+	}
+}
+
+// takes the next free node from the pool for this type, stealing
+// a voice if they are all in use, returns NULL if nothing can be freed
+GraphNode *Graph::Recycle(Type t, unsigned int id)
+{
+	if ((int)t<0 || t>=NUMTYPES) return NULL;
+	NodeDescVec *descvec=m_NodeDescVec[t];
 	
-	for (map<Type,NodeDescVec*>::iterator i=m_NodeDescMap.begin(); 
-		i!=m_NodeDescMap.end(); ++i)
+	for (unsigned int attempt=0; attempt<2; attempt++)
 	{
-		for (vector<NodeDesc*>::iterator ni=i->second->m_Vec.begin();
-			ni!=i->second->m_Vec.end(); ++ni)
+		for (unsigned int n=0; n<descvec->m_Size; n++)
 		{
-			delete (*ni)->m_Node;
+			NodeDesc *desc=descvec->m_Vec[descvec->NewIndex()];
+			if (desc->m_Node->GetOwner()<0)
+			{
+				if (desc->m_ID!=0)
+				{
+					map<unsigned int,GraphNode*>::iterator i=m_NodeMap.find(desc->m_ID);
+					if (i!=m_NodeMap.end() && i->second==desc->m_Node) m_NodeMap.erase(i);
+				}
+		
+				desc->m_ID=id;
+				desc->m_Node->Clear();
+				return desc->m_Node;
+			}
 		}
-		i->second->m_Vec.clear();
+		
+		int victim=FindVictim(t);
+		if (victim<0) break;
+		StopVoice(victim);
 	}
 	
-	m_NodeDescMap.clear();	
+	return NULL;
 }
 
-void Graph::Create(unsigned int id, Type t, float v)
+int Graph::NewVoice()
+{
+	while (m_NumPlaying>=m_MaxPlaying)
+	{
+		int victim=FindVictim(NUMTYPES);
+		if (victim<0) break;
+		StopVoice(victim);
+	}
+
+	for (unsigned int v=0; v<m_Voices.size(); v++)
+	{
+		if (!m_Voices[v].m_Active) return v;
+	}
+	return -1;
+}
+
+void Graph::StartVoice(unsigned int v, GraphNode *root, float pan)
 {
-	unsigned int index=m_NodeDescMap[t]->NewIndex();
-	unsigned int oldid=m_NodeDescMap[t]->m_Vec[index]->m_ID;
+	Voice &voice=m_Voices[v];
+	voice.m_Active=true;
+	voice.m_Root=root;
+	voice.m_Pan=pan;
+	voice.m_Level=0;
+	voice.m_SilentSamples=0;
+	voice.m_Serial=m_NextSerial++;
+	voice.m_Held=true;
+	voice.m_Released=false;
+	m_NumPlaying++;
+}
 
-//cerr<<"create id:"<<id<<" index:"<<index<<" type:"<<t<<" value:"<<v<<endl;
+void Graph::StopVoice(unsigned int v)
+{
+	Voice &voice=m_Voices[v];
+	for (unsigned int n=0; n<voice.m_NumNodes; n++)
+	{
+		if (voice.m_Nodes[n]->GetOwner()==(int)v) voice.m_Nodes[n]->SetOwner(-1);
+	}
+	if (voice.m_Active) m_NumPlaying--;
+	voice=Voice();
+}
+
+void Graph::Own(unsigned int v, GraphNode *node)
+{
+	Voice &voice=m_Voices[v];
+	node->SetOwner(v);
+	// nodes we can't keep track of are just left to be recycled
+	if (voice.m_NumNodes<VOICE_MAX_NODES) voice.m_Nodes[voice.m_NumNodes++]=node;
+}
+
+void Graph::Claim(unsigned int v, GraphNode *node)
+{
+	if (node==NULL || node->GetOwner()==(int)v) return;
+	Own(v,node);
+	for (unsigned int n=0; n<node->GetNumChildren(); n++)
+	{
+		Claim(v,node->GetChild(n));
+	}
+}
+
+// quiet or released voices go first, then the oldest
+bool Graph::IsBetterVictim(unsigned int a, unsigned int b)
+{
+	const Voice &va=m_Voices[a];
+	const Voice &vb=m_Voices[b];
+	if (va.m_Held!=vb.m_Held) return !va.m_Held;
+	if (va.m_Released!=vb.m_Released) return va.m_Released;
+	if (va.m_Level!=vb.m_Level) return va.m_Level<vb.m_Level;
+	return va.m_Serial<vb.m_Serial;
+}
+
+// finds the voice to steal, only looking at voices using 
+// nodes from the pool of the type given, or all for NUMTYPES
+int Graph::FindVictim(Type t)
+{
+	if ((int)t<0 || t>NUMTYPES) return -1;
 	
-	map<unsigned int,GraphNode*>::iterator i=m_NodeMap.find(oldid);
-	if (i!=m_NodeMap.end()) m_NodeMap.erase(i);
+	bool candidate[MAX_VOICES];
+	for (unsigned int v=0; v<MAX_VOICES; v++) candidate[v]=(t==NUMTYPES);
 	
-	list<pair<unsigned int,float> >::iterator remove;
-	bool found=false;
-	for (list<pair<unsigned int,float> >::iterator ri=m_RootNodes.begin();
-		ri!=m_RootNodes.end(); ++ri)
+	if (t<NUMTYPES)
 	{
-		if (ri->first==oldid) 
+		for (vector<NodeDesc*>::iterator i=m_NodeDescVec[t]->m_Vec.begin();
+			i!=m_NodeDescVec[t]->m_Vec.end(); ++i)
 		{
-			remove=ri;
-			found=true;
+			int owner=(*i)->m_Node->GetOwner();
+			if (owner>=0) candidate[owner]=true;
 		}
 	}
-	if (found) m_RootNodes.erase(remove);
 	
-	m_NodeDescMap[t]->m_Vec[index]->m_ID=id;
-	m_NodeDescMap[t]->m_Vec[index]->m_Node->Clear();
-	m_NodeMap[id]=m_NodeDescMap[t]->m_Vec[index]->m_Node;
+	int victim=-1;
+	for (unsigned int v=0; v<m_Voices.size(); v++)
+	{
+		if (m_Voices[v].m_Active && candidate[v] && 
+			(victim<0 || IsBetterVictim(v,victim)))
+		{
+			victim=v;
+		}
+	}
+	return victim;
+}
+
+void Graph::Create(unsigned int id, Type t, float v)
+{
+//cerr<<"create id:"<<id<<" type:"<<t<<" value:"<<v<<endl;
+	if ((int)t<0 || t>=NUMTYPES) return;
+
+	GraphNode *node=Recycle(t,id);
+	if (node==NULL) return;
+	m_NodeMap[id]=node;
 		
 	if (t==TERMINAL)
 	{
-		TerminalNode *terminal = dynamic_cast<TerminalNode*>(m_NodeMap[id]);
+		TerminalNode *terminal = dynamic_cast<TerminalNode*>(node);
 		assert(terminal!=NULL);
 		terminal->SetValue(v);
 	}
@@ -139,44 +389,174 @@ void Graph::Create(unsigned int id, Type t, float v)
 void Graph::Connect(unsigned int id, unsigned int arg, unsigned int to)
 {
 //cerr<<"connect id "<<id<<" arg "<<arg<<" to "<<to<<endl;
-	if (m_NodeMap[id]!=NULL && m_NodeMap[to]!=NULL)
+	map<unsigned int,GraphNode*>::iterator node=m_NodeMap.find(id);
+	map<unsigned int,GraphNode*>::iterator child=m_NodeMap.find(to);
+	if (node!=m_NodeMap.end() && child!=m_NodeMap.end())
 	{
-		m_NodeMap[id]->SetChild(arg,m_NodeMap[to]);
+		node->second->SetChild(arg,child->second);
 	}
 }
 
 void Graph::Play(float time, unsigned int id, float pan)
 {
 //cerr<<"play id "<<id<<endl;
-	if (m_NodeMap[id]!=NULL)
+	map<unsigned int,GraphNode*>::iterator i=m_NodeMap.find(id);
+	if (i!=m_NodeMap.end())
 	{
-		m_NodeMap[id]->Trigger(time);
-		m_RootNodes.push_back(pair<unsigned int, float>(id,pan));
-		
-		while (m_RootNodes.size()>m_MaxPlaying)
+		int v=NewVoice();
+		if (v<0) 
 		{
-			m_RootNodes.erase(m_RootNodes.begin());
+			m_NumDropped++;
+			return;
 		}
+		Claim(v,i->second);
+		i->second->Trigger(time);
+		StartVoice(v,i->second,pan);
 	}
 }
 
-void Graph::Process(unsigned int bufsize, Sample &left, Sample &right)
+bool Graph::Define(unsigned int id, unsigned int root)
+{
+	if (id>=MAX_SYNTHDEFS || root>=SYNTHDEF_MAX_NODES) return false;
+	SynthDef &def=m_SynthDefs[id];
+	def.m_Root=root;
+	def.m_NumNodes=0;
+	def.m_NumLinks=0;
+	return true;
+}
+
+bool Graph::DefineNode(unsigned int id, Type t, float v, int param)
+{
+	if (id>=MAX_SYNTHDEFS || (int)t<0 || t>=NUMTYPES) return false;
+	SynthDef &def=m_SynthDefs[id];
+	if (def.m_NumNodes>=SYNTHDEF_MAX_NODES) return false;
+	
+	SynthDef::NodeSpec &spec=def.m_Nodes[def.m_NumNodes++];
+	spec.m_Type=t;
+	spec.m_Value=v;
+	spec.m_Param=param;
+	return true;
+}
+
+bool Graph::DefineLink(unsigned int id, unsigned int node, unsigned int arg, unsigned int to)
 {
-	for(list<pair<unsigned int, float> >::iterator i=m_RootNodes.begin();
-		i!=m_RootNodes.end(); ++i)
-	{        
-		if (m_NodeMap[i->first]!=NULL)
+	if (id>=MAX_SYNTHDEFS) return false;
+	SynthDef &def=m_SynthDefs[id];
+	if (def.m_NumLinks>=SYNTHDEF_MAX_LINKS || 
+		node>=def.m_NumNodes || to>=def.m_NumNodes) return false;
+	
+	SynthDef::LinkSpec &spec=def.m_Links[def.m_NumLinks++];
+	spec.m_Node=node;
+	spec.m_Arg=arg;
+	spec.m_To=to;
+	return true;
+}
+
+void Graph::PlayDef(float time, unsigned int id, const float *params, unsigned int numparams, float pan)
+{
+	if (id>=MAX_SYNTHDEFS) return;
+	const SynthDef &def=m_SynthDefs[id];
+	if (def.m_Root>=def.m_NumNodes) return;
+	
+	int v=NewVoice();
+	if (v<0) 
+	{
+		m_NumDropped++;
+		return;
+	}
+	
+	// instance the nodes straight out of the pools, no ids needed, owning 
+	// them as we go so they can't be handed out twice
+	GraphNode *nodes[SYNTHDEF_MAX_NODES];
+	for (unsigned int n=0; n<def.m_NumNodes; n++)
+	{
+		const SynthDef::NodeSpec &spec=def.m_Nodes[n];
+		nodes[n]=Recycle(spec.m_Type,0);
+		if (nodes[n]==NULL)
+		{
+			StopVoice(v);
+			m_NumDropped++;
+			return;
+		}
+		Own(v,nodes[n]);
+		
+		if (spec.m_Type==TERMINAL)
 		{
-			m_NodeMap[i->first]->Process(bufsize);
+			float value=spec.m_Value;
+			if (spec.m_Param>=0 && (unsigned int)spec.m_Param<numparams) 
+			{
+				value=params[spec.m_Param];
+			}
+			static_cast<TerminalNode*>(nodes[n])->SetValue(value);
+		}
+	}
+	
+	for (unsigned int n=0; n<def.m_NumLinks; n++)
+	{
+		const SynthDef::LinkSpec &spec=def.m_Links[n];
+		nodes[spec.m_Node]->SetChild(spec.m_Arg,nodes[spec.m_To]);
+	}
+	
+	nodes[def.m_Root]->Trigger(time);
+	StartVoice(v,nodes[def.m_Root],pan);
+}
 
-            // do stereo panning
-            float pan = i->second;
-            float leftpan=1,rightpan=1;
-            if (pan<0) leftpan=1-pan;
-            else rightpan=1+pan;
+void Graph::UpdateVoice(unsigned int v, unsigned int bufsize)
+{
+	Voice &voice=m_Voices[v];
 	
-			left.MulMix(m_NodeMap[i->first]->GetOutput(),0.1*leftpan);
-            right.MulMix(m_NodeMap[i->first]->GetOutput(),0.1*rightpan);
+	unsigned int envelopes=0, released=0;
+	for (unsigned int n=0; n<voice.m_NumNodes; n++)
+	{
+		if (voice.m_Nodes[n]->GetOwner()==(int)v && voice.m_Nodes[n]->HasEnvelope())
+		{
+			envelopes++;
+			if (voice.m_Nodes[n]->IsReleased()) released++;
 		}
 	}
+	voice.m_Held=released<envelopes;
+	voice.m_Released=envelopes>0 && released==envelopes;
+	
+	const Sample &out=voice.m_Root->GetOutput();
+	unsigned int len=bufsize<out.GetLength()?bufsize:out.GetLength();
+	float level=0;
+	for (unsigned int n=0; n<len; n++)
+	{
+		float s=fabsf(out[n]);
+		if (s>level) level=s;
+	}
+	voice.m_Level=level;
+	
+	// voices without envelopes can be silent for a while and come back, 
+	// so only the ones which have finished are stopped
+	if (voice.m_Released && level<VOICE_SILENCE_THRESHOLD) voice.m_SilentSamples+=bufsize;
+	else voice.m_SilentSamples=0;
+	
+	if (voice.m_SilentSamples>VOICE_SILENCE_HOLD*m_SampleRate) 
+	{
+		StopVoice(v);
+	}
+}
+
+void Graph::Process(unsigned int bufsize, Sample &left, Sample &right)
+{
+	TakeNodes();
+	
+	for (unsigned int v=0; v<m_Voices.size(); v++)
+	{
+		Voice &voice=m_Voices[v];
+		if (!voice.m_Active) continue;
+		
+		voice.m_Root->Process(bufsize);
+
+		// do stereo panning
+		float leftpan=1,rightpan=1;
+		if (voice.m_Pan<0) leftpan=1-voice.m_Pan;
+		else rightpan=1+voice.m_Pan;
+
+		left.MulMix(voice.m_Root->GetOutput(),0.1*leftpan);
+		right.MulMix(voice.m_Root->GetOutput(),0.1*rightpan);
+		
+		UpdateVoice(v,bufsize);
+	}
 }
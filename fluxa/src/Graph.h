@@ -16,19 +16,29 @@
 
 #include <vector>
 #include <map>
-#include <set>
-#include <list>
 #include <math.h>
 #include "GraphNode.h"
 #include "ModuleNodes.h"
+#include "RingBuffer.h"
 
 #ifndef GRAPH
 #define GRAPH
 
+static const unsigned int MAX_SYNTHDEFS=256;
+static const unsigned int SYNTHDEF_MAX_NODES=64;
+static const unsigned int SYNTHDEF_MAX_LINKS=64;
+static const unsigned int MAX_VOICES=256;
+static const unsigned int VOICE_MAX_NODES=64;
+// the most nodes a pool can grow to, so its table never reallocates
+static const unsigned int MAX_POOL_SIZE=8192;
+// voices quieter than this for longer than the hold time are stopped
+static const float VOICE_SILENCE_THRESHOLD=0.0001f;
+static const float VOICE_SILENCE_HOLD=0.2f;
+
 class Graph
 {
 public:
-	Graph(unsigned int NumNodes, unsigned int SampleRate);
+	Graph(unsigned int NumNodes, unsigned int SampleRate, unsigned int BlockSize);
 	~Graph();
 	
 	enum Type{TERMINAL,SINOSC,SAWOSC,TRIOSC,SQUOSC,WHITEOSC,PINKOSC,ADSR,ADD,SUB,MUL,DIV,POW,
@@ -37,13 +47,96 @@ public:
 	
 	void Init();
 	void Clear();
+	// stops everything and forgets the node ids, keeping the pools
+	void Reset();
 	void Create(unsigned int id, Type t, float v);
 	void Connect(unsigned int id, unsigned int arg, unsigned int to);
 	void Play(float time, unsigned int id, float pan);
 	void Process(unsigned int bufsize, Sample &left, Sample &right);
-	void SetMaxPlaying(int s) { m_MaxPlaying=s; }
+	void SetMaxPlaying(unsigned int s);
+	// growing a pool only asks for the nodes, which are made by BuildNodes
+	void SetPoolSize(Type t, unsigned int count);
+	// makes the nodes asked for by SetPoolSize, call regularly from outside 
+	// the audio thread, they are picked up by the next Process. returns
+	// false if there wasn't room to send them all
+	bool BuildNodes();
+	unsigned int GetNumPlaying() { return m_NumPlaying; }
+	unsigned int GetMaxPlaying() { return m_MaxPlaying; }
+	// voices we couldn't find room for
+	unsigned int GetNumDropped() { return m_NumDropped; }
+	// walks the pools, so not something to do every block
+	void CountNodes(unsigned int *inuse, unsigned int *total);
+	static const char *GetTypeName(Type t);
+	
+	// synth definitions - a topology is sent once with /define, after
+	// which each note only needs the definition id and its parameters
+	bool Define(unsigned int id, unsigned int root);
+	bool DefineNode(unsigned int id, Type t, float v, int param);
+	bool DefineLink(unsigned int id, unsigned int node, unsigned int arg, unsigned int to);
+	void PlayDef(float time, unsigned int id, const float *params, unsigned int numparams, float pan);
 	
 private:
+	GraphNode *NewNode(Type t);
+	GraphNode *Recycle(Type t, unsigned int id);
+	void ResizePool(Type t);
+	void TakeNodes();
+	
+	int NewVoice();
+	void StartVoice(unsigned int v, GraphNode *root, float pan);
+	void StopVoice(unsigned int v);
+	void Own(unsigned int v, GraphNode *node);
+	void Claim(unsigned int v, GraphNode *node);
+	void UpdateVoice(unsigned int v, unsigned int bufsize);
+	int FindVictim(Type t);
+	bool IsBetterVictim(unsigned int a, unsigned int b);
+
+	// a playing synth graph, and the nodes it is using so they
+	// don't get handed out again while it's still audible
+	class Voice
+	{
+	public:
+		Voice(): m_Active(false), m_Root(NULL), m_Pan(0), m_Level(0), m_SilentSamples(0), 
+			m_Serial(0), m_Held(false), m_Released(false), m_NumNodes(0) {}
+		
+		bool m_Active;
+		GraphNode *m_Root;
+		float m_Pan;
+		float m_Level;     // peak output of the last block
+		unsigned int m_SilentSamples;
+		unsigned int m_Serial;
+		bool m_Held;       // an envelope is still attacking or decaying
+		bool m_Released;   // all envelopes are releasing or finished
+		unsigned int m_NumNodes;
+		GraphNode *m_Nodes[VOICE_MAX_NODES];
+	};
+
+	// all fixed size, so defining and instancing never allocates
+	class SynthDef
+	{
+	public:
+		SynthDef(): m_Root(0), m_NumNodes(0), m_NumLinks(0) {}
+		
+		struct NodeSpec
+		{
+			Type m_Type;
+			float m_Value;
+			int m_Param; // index into the play parameters, or -1 for a constant
+		};
+		
+		struct LinkSpec
+		{
+			unsigned int m_Node;
+			unsigned int m_Arg;
+			unsigned int m_To;
+		};
+	
+		unsigned int m_Root;
+		unsigned int m_NumNodes;
+		unsigned int m_NumLinks;
+		NodeSpec m_Nodes[SYNTHDEF_MAX_NODES];
+		LinkSpec m_Links[SYNTHDEF_MAX_LINKS];
+	};
+
 	class NodeDesc
 	{
 	public:
@@ -52,13 +145,15 @@ private:
 		unsigned int m_ID;
 	};
 	
+	// shrinking only stops nodes past m_Size being handed out, they
+	// are not deleted as they may still be referenced by other nodes
 	class NodeDescVec
 	{
 	public:
 		unsigned int NewIndex()
 		{
 			m_Current++;
-			if (m_Current>=m_Vec.size()) 
+			if (m_Current>=m_Size) 
 			{
 				//cerr<<"going round..."<<endl;
 				m_Current=0;
@@ -66,17 +161,36 @@ private:
 			return m_Current;
 		}
 		
-		NodeDescVec(): m_Current(0) {}
+		NodeDescVec(): m_Current(0), m_Size(0) {}
 		unsigned int m_Current;
+		unsigned int m_Size;
 		vector<NodeDesc*> m_Vec;
 	};
 	
 	unsigned int m_MaxPlaying;
-	list<pair<unsigned int, float> > m_RootNodes;
+	unsigned int m_NumPlaying;
+	unsigned int m_NumDropped;
+	unsigned int m_NextSerial;
+	vector<Voice> m_Voices;
 	map<unsigned int,GraphNode*> m_NodeMap;
-	map<Type,NodeDescVec*> m_NodeDescMap;
-	unsigned int m_NumNodes;
+	vector<NodeDescVec*> m_NodeDescVec;
+	vector<unsigned int> m_PoolSizes;
+	
+	// new nodes on their way from BuildNodes to the audio thread
+	struct NewNodeMsg
+	{
+		Type m_Type;
+		NodeDesc *m_Desc;
+	};
+	RingBuffer m_NewNodes;
+	// pool sizes asked for by the audio thread, and the nodes made 
+	// so far, which only BuildNodes touches
+	volatile unsigned int m_Wanted[NUMTYPES];
+	unsigned int m_Built[NUMTYPES];
+	
 	unsigned int m_SampleRate;
+	unsigned int m_BlockSize;
+	vector<SynthDef> m_SynthDefs;
 };
 
 #endif
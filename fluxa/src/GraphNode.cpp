@@ -22,7 +22,8 @@ using namespace std;
 
 ///////////////////////////////////////////
 	
-GraphNode::GraphNode(unsigned int numinputs) 
+GraphNode::GraphNode(unsigned int numinputs) :
+m_Owner(-1)
 { 
 	for(unsigned int n=0; n<numinputs; n++)
 	{
@@ -61,6 +62,25 @@ void GraphNode::ProcessChildren(unsigned int bufsize)
 	}
 }
 
+bool GraphNode::Prepare(unsigned int bufsize)
+{
+	ProcessChildren(bufsize);
+	
+	bool ready=Reserve(bufsize);
+	for(vector<GraphNode*>::iterator i=m_ChildNodes.begin(); 
+		i!=m_ChildNodes.end(); ++i)
+	{
+		// terminals are only read with GetValue
+		if (*i!=NULL && !(*i)->IsTerminal() && (*i)->GetOutput().GetLength()<bufsize)
+		{
+			ready=false;
+		}
+	}
+	
+	if (!ready) m_Output.Zero();
+	return ready;
+}
+
 void GraphNode::Clear()
 {
 	for(unsigned int n=0; n<m_ChildNodes.size(); n++)
@@ -69,6 +89,15 @@ void GraphNode::Clear()
 	}
 }
 
+bool GraphNode::Reserve(unsigned int bufsize)
+{
+	if (bufsize>m_Output.GetLength())
+	{
+		return m_Output.Allocate(bufsize);
+	}
+	return true;
+}
+
 void GraphNode::SetChild(unsigned int num, GraphNode *s)
 {
 	if(num<m_ChildNodes.size())
@@ -37,22 +37,38 @@ public:
 	virtual void Process(unsigned int bufsize)=0;
 	virtual float GetValue() { return 0; }
 	virtual bool IsTerminal() { return false; }
+	// envelope state, so the graph can tell which voices are still audible
+	virtual bool HasEnvelope() { return false; }
+	virtual bool IsReleased() { return true; }
 	virtual Sample &GetOutput() { return m_Output; }
 	virtual void Clear();
+	// allocate buffers for this blocksize up front, so processing
+	// doesn't have to - returns false if the memory wasn't there
+	virtual bool Reserve(unsigned int bufsize);
 	
 	void TriggerChildren(float time);
 	void ProcessChildren(unsigned int bufsize);
+	// processes the children and checks the block fits in our buffers and 
+	// theirs, growing ours if needed. if the memory isn't there (in the audio 
+	// thread) our output is silenced and false returned, skip the block then
+	bool Prepare(unsigned int bufsize);
 	void SetChild(unsigned int num, GraphNode *s);
 	bool ChildExists(unsigned int num);
 	GraphNode* GetChild(unsigned int num);
+	unsigned int GetNumChildren() { return m_ChildNodes.size(); }
 	Sample &GetInput(unsigned int num);
 	float GetCVValue();
 	
+	// the voice this node is playing in, or -1 if it's free
+	int GetOwner() { return m_Owner; }
+	void SetOwner(int s) { m_Owner=s; }
+	
 protected:
 	Sample m_Output;
 	
 private:
 	vector<GraphNode*> m_ChildNodes;
+	int m_Owner;
 };
 
 #endif
@@ -27,6 +27,7 @@ JackClient*       JackClient::m_Singleton  = NULL;
 bool              JackClient::m_Attached   = false;
 long unsigned int JackClient::m_BufferSize = 0;
 long unsigned int JackClient::m_SampleRate = 0;
+volatile unsigned int JackClient::m_Xruns  = 0;
 void            (*JackClient::RunCallback)(void*, unsigned int BufSize)=NULL;
 void             *JackClient::RunContext   = NULL;
 jack_client_t    *JackClient::m_Client     = NULL;
@@ -63,6 +64,8 @@ bool JackClient::Attach(const string &ClientName)
         jack_set_process_callback(m_Client, JackClient::Process, 0);
         jack_set_sample_rate_callback (m_Client, JackClient::OnSRateChange, 0);
         jack_on_shutdown (m_Client, JackClient::OnJackShutdown, this);
+        jack_set_xrun_callback (m_Client, JackClient::OnXrun, 0);
+        m_BufferSize=jack_get_buffer_size(m_Client);
 
         m_InputPortMap.clear();
         m_OutputPortMap.clear();
@@ -179,6 +182,14 @@ int JackClient::OnSRateChange(jack_nframes_t n, void *o)
 
 /////////////////////////////////////////////////////////////////////////////////////////////
 
+int JackClient::OnXrun(void *o)
+{
+        m_Xruns++;
+        return 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+
 void JackClient::OnJackShutdown(void *o)
 {
         cerr<<"Shutdown"<<endl;
@@ -54,6 +54,9 @@ public:
     int    AddInputPort();
     int    AddOutputPort();
 	unsigned int GetSamplerate() { return m_SampleRate; }
+	// the block size we expect to be called with
+	unsigned int GetBufferSize() { return m_BufferSize?m_BufferSize:1024; }
+	unsigned int GetXruns() { return m_Xruns; }
 	
 protected:
 	JackClient();
@@ -62,6 +65,7 @@ protected:
 	static int  Process(jack_nframes_t nframes, void *o);
 	static int  OnSRateChange(jack_nframes_t n, void *o);
 	static void OnJackShutdown(void *o);
+	static int  OnXrun(void *o);
 
 private:
 
@@ -85,6 +89,7 @@ private:
 	static long unsigned int  m_BufferSize;
 	static long unsigned int  m_SampleRate;	
 	static bool               m_Attached;
+	static volatile unsigned int m_Xruns;
 	int m_NextInputID;
 	int m_NextOutputID;
 	
@@ -15,6 +15,12 @@
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
 #include "ModuleNodes.h"
+
+// assigning would reallocate if the lengths are different
+static void CopyBlock(const Sample &from, Sample &to, unsigned int bufsize)
+{
+	for (unsigned int n=0; n<bufsize; n++) to[n]=from[n];
+}
 	
 TerminalNode::TerminalNode(float Value):
 GraphNode(0),
@@ -44,11 +50,7 @@ void OscNode::Trigger(float time)
 
 void OscNode::Process(unsigned int bufsize)
 {
-	if (bufsize>(unsigned int)m_Output.GetLength())
-	{
-		m_Output.Allocate(bufsize);
-	}
-	ProcessChildren(bufsize);
+	if (!Prepare(bufsize)) return;
 	
 	if (ChildExists(0) && !GetChild(0)->IsTerminal())
 	{
@@ -80,12 +82,7 @@ void ADSRNode::Trigger(float time)
 
 void ADSRNode::Process(unsigned int bufsize)
 {
-	if (bufsize>(unsigned int)m_Output.GetLength())
-	{
-		m_Output.Allocate(bufsize);
-	}
-	
-	ProcessChildren(bufsize);
+	if (!Prepare(bufsize)) return;
 	m_Envelope.Process(bufsize, m_Output);
 }
 
@@ -102,12 +99,7 @@ void MathNode::Trigger(float time)
 
 void MathNode::Process(unsigned int bufsize)
 {
-	if (bufsize>(unsigned int)m_Output.GetLength())
-	{
-		m_Output.Allocate(bufsize);
-	}
-	
-	ProcessChildren(bufsize);
+	if (!Prepare(bufsize)) return;
 	
 	if (ChildExists(0) && ChildExists(1))
 	{
@@ -263,12 +255,7 @@ void FilterNode::Trigger(float time)
 
 void FilterNode::Process(unsigned int bufsize)
 {
-	if (bufsize>(unsigned int)m_Output.GetLength())
-	{
-		m_Output.Allocate(bufsize);
-	}
-	
-	ProcessChildren(bufsize);
+	if (!Prepare(bufsize)) return;
 	
 	if (ChildExists(0) && !GetChild(0)->IsTerminal() && ChildExists(1) && ChildExists(2))
 	{		
@@ -309,15 +296,18 @@ void SampleNode::Trigger(float time)
 	}
 }
 
-void SampleNode::Process(unsigned int bufsize)
+bool SampleNode::Reserve(unsigned int bufsize)
 {
-	if (bufsize>(unsigned int)m_Output.GetLength())
+	if (bufsize>(unsigned int)m_Temp.GetLength() && !m_Temp.Allocate(bufsize))
 	{
-		m_Output.Allocate(bufsize);
-		m_Temp.Allocate(bufsize);
+		return false;
 	}
-	
-	ProcessChildren(bufsize);
+	return GraphNode::Reserve(bufsize);
+}
+
+void SampleNode::Process(unsigned int bufsize)
+{
+	if (!Prepare(bufsize)) return;
 	m_Output.Zero();
 	m_Sampler.Process(bufsize, m_Output, m_Temp);
 }
@@ -336,18 +326,13 @@ void EffectNode::Trigger(float time)
 
 void EffectNode::Process(unsigned int bufsize)
 {
-	if (bufsize>(unsigned int)m_Output.GetLength())
-	{
-		m_Output.Allocate(bufsize);
-	}
-	
-	ProcessChildren(bufsize);
+	if (!Prepare(bufsize)) return;
 
     if (ChildExists(0) && !GetChild(0)->IsTerminal() && ChildExists(1))
     {
         if (m_Type==CLIP)
         {
-            m_Output=GetInput(0);
+            CopyBlock(GetInput(0),m_Output,bufsize);
             if (GetChild(0)->IsTerminal())
             {
                 HardClip(m_Output, GetChild(1)->GetCVValue());
@@ -361,8 +346,8 @@ void EffectNode::Process(unsigned int bufsize)
         {		
             switch (m_Type)
             {
-			    case CRUSH : m_Output=GetInput(0); Crush(m_Output, GetChild(1)->GetCVValue(), GetChild(2)->GetCVValue()); break;
-			    case DISTORT : m_Output=GetInput(0); Distort(m_Output, GetChild(1)->GetCVValue()); break;
+			    case CRUSH : CopyBlock(GetInput(0),m_Output,bufsize); Crush(m_Output, GetChild(1)->GetCVValue(), GetChild(2)->GetCVValue()); break;
+			    case DISTORT : CopyBlock(GetInput(0),m_Output,bufsize); Distort(m_Output, GetChild(1)->GetCVValue()); break;
                 case DELAY : 
 			    {  
                     m_Delay.SetDelay(GetChild(1)->GetCVValue());
@@ -400,11 +385,7 @@ void KSNode::Trigger(float time)
 
 void KSNode::Process(unsigned int bufsize)
 {
-	if (bufsize>(unsigned int)m_Output.GetLength())
-	{
-		m_Output.Allocate(bufsize);
-	}
-	ProcessChildren(bufsize);
+	if (!Prepare(bufsize)) return;
 
 	if (ChildExists(1) && ChildExists(2))
 	{		
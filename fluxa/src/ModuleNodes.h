@@ -31,6 +31,8 @@ public:
 	virtual float GetValue() { return m_Value; }
 	virtual void SetValue(float s) { m_Value=s; }
 	virtual bool IsTerminal() { return true; }
+	// only the value is used
+	virtual bool Reserve(unsigned int bufsize) { return true; }
 	//virtual void Clear() { GraphNode::Clear(); m_Value=0; }
 	
 private:
@@ -55,6 +57,7 @@ public:
     KSNode(unsigned int SampleRate);
 	virtual void Trigger(float time);
 	virtual void Process(unsigned int bufsize);
+	virtual bool Reserve(unsigned int bufsize) { return m_KS.IsAllocated() && GraphNode::Reserve(bufsize); }
 	
 private:
 	KS m_KS;
@@ -67,6 +70,8 @@ public:
 	ADSRNode(unsigned int SampleRate);
 	virtual void Trigger(float time);
 	virtual void Process(unsigned int bufsize);
+	virtual bool HasEnvelope() { return true; }
+	virtual bool IsReleased() { return m_Envelope.IsReleased(); }
 	
 private:
 	Envelope m_Envelope;
@@ -109,6 +114,7 @@ public:
 	SampleNode(unsigned int samplerate);
 	virtual void Trigger(float time);
 	virtual void Process(unsigned int bufsize);
+	virtual bool Reserve(unsigned int bufsize);
 	
 private:
 	PlayMode m_PlayMode;
@@ -124,6 +130,7 @@ public:
 	EffectNode(Type type, unsigned int samplerate);
 	virtual void Trigger(float time);
 	virtual void Process(unsigned int bufsize);
+	virtual bool Reserve(unsigned int bufsize) { return m_Delay.IsAllocated() && GraphNode::Reserve(bufsize); }
 	
 private:
 	Type m_Type;
@@ -627,7 +627,7 @@ void MoogFilter::Process(unsigned int BufSize, Sample &In, Sample *CutoffCV, Sam
 ///////////////////////////////////////////////////////////////////////////
 
 //-------------------------------------------------------------VOWEL COEFFICIENTS
-const float coeff[5][11]= {
+const double coeff[5][11]= {
 { 8.11044e-06,
 8.943665402, -36.83889529, 92.01697887, -154.337906, 181.6233289,
 -151.8651235,   89.09614114, -35.10298511, 8.388101016, -0.923313471  ///A
@@ -666,7 +666,8 @@ void FormantFilter::Reset()
 
 void FormantFilter::Process(unsigned int BufSize, Sample &In, Sample *CutoffCV, Sample &Out)
 {		
-	float res,o[5],out=0, in=0;
+	double res;
+	float o[5],out=0, in=0;
 		
 	for (unsigned int n=0; n<BufSize; n++)
 	{		
@@ -681,7 +682,7 @@ void FormantFilter::Process(unsigned int BufSize, Sample &In, Sample *CutoffCV,
 
 		for (int v=0; v<5; v++)
 		{
-			res= (float) (coeff[v][0]*in +
+			res= (coeff[v][0]*in +
 					  coeff[v][1]*memory[v][0] +  
 					  coeff[v][2]*memory[v][1] +
 					  coeff[v][3]*memory[v][2] +
@@ -703,7 +704,7 @@ void FormantFilter::Process(unsigned int BufSize, Sample &In, Sample *CutoffCV,
 			memory[v][3]=memory[v][2];
 			memory[v][2]=memory[v][1];
 			memory[v][1]=memory[v][0];
-			memory[v][0]=(float) res;
+			memory[v][0]=res;
 
 			o[v]=res;
 		}
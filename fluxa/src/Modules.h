@@ -136,6 +136,9 @@ public:
 	void SetSustain(float s) { m_Sustain=s; }
 	void SetRelease(float s) { m_Release=s; }
 	void SetVolume(float s)  { m_Volume=s; }
+	
+	// past the decay, or not playing at all
+	bool IsReleased() const { return m_t==-1000.0f || m_t>=m_Attack+m_Decay; }
 
 protected:
 	bool   m_Trigger;
@@ -242,8 +245,9 @@ public:
 
 private:
 	float m_Vowel;
-		
-	float memory[5][10];
+	
+	// the filters are tenth order, so they need the precision
+	double memory[5][10];
 };
 
 // a wrapper for the other filters
@@ -281,6 +285,7 @@ public:
 
 	void SetDelay(float s) { m_Delay=s; }
 	void SetFeedback(float s) { m_Feedback=s; }
+	bool IsAllocated() { return m_Buffer.GetLength()>0; }
 	
 protected:
 	float m_Delay, m_Feedback;
@@ -363,6 +368,7 @@ public:
 
     void SetCutoff(float s) { m_Filter.SetCutoff(s); }    
     void SetResonance(float s) { m_Filter.SetResonance(s); }
+	bool IsAllocated() { return m_Buffer.GetLength()>0; }
 	
 protected:
 	float m_Delay, m_Feedback;
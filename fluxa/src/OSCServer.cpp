@@ -19,8 +19,11 @@
 #include <cstdlib>
 #include <unistd.h>
 #include <iostream>
+#include <vector>
 
 #include "OSCServer.h"
+#include "Graph.h"
+#include "Time.h"
 
 using namespace std;
 
@@ -31,6 +34,12 @@ extern "C" {
 #endif
 
 OSCServer::OSCServer(const string &Port) :
+m_RecordFile(NULL),
+m_Stats(NULL),
+m_StatsLog(0),
+m_IdleCallback(NULL),
+m_IdleContext(NULL),
+m_DroppedCommands(0),
 m_Port(Port),
 m_Exit(false),
 m_CommandRingBuffer(262144)
@@ -43,12 +52,132 @@ m_CommandRingBuffer(262144)
 OSCServer::~OSCServer()
 {
         m_Exit=true;
+        if (m_RecordFile!=NULL) fclose(m_RecordFile);
+}
+
+bool OSCServer::Record(const string &filename)
+{
+        m_RecordFile = fopen(filename.c_str(),"w");
+        if (m_RecordFile==NULL)
+        {
+                cerr<<"could not open "<<filename<<" for recording"<<endl;
+                return false;
+        }
+        fprintf(m_RecordFile,"# fluxa session, render with: fluxa -render %s out.wav\n",filename.c_str());
+        return true;
+}
+
+// one line per message: arrival time, path, types and arguments
+void OSCServer::RecordMessage(const char *path, const char *types, lo_arg **argv, int argc)
+{
+        spiralcore::Time now;
+        now.SetToNow();
+        fprintf(m_RecordFile,"%.6f %s %s",now.Seconds+now.GetFraction(),path,types[0]?types:"-");
+        for (int i=0; i<argc; i++)
+        {
+                switch (types[i])
+                {
+                        case LO_INT32: fprintf(m_RecordFile," %d",argv[i]->i); break;
+                        case LO_FLOAT: fprintf(m_RecordFile," %.9g",argv[i]->f); break;
+                        case LO_STRING:
+                        {
+                                fputs(" \"",m_RecordFile);
+                                for (const char *c=&argv[i]->s; *c!='\0'; c++)
+                                {
+                                        if (*c=='"' || *c=='\\') fputc('\\',m_RecordFile);
+                                        fputc(*c,m_RecordFile);
+                                }
+                                fputc('"',m_RecordFile);
+                        }
+                        break;
+                        default: break;
+                }
+        }
+        fputc('\n',m_RecordFile);
+        fflush(m_RecordFile);
 }
 
 void OSCServer::Run()
 {
         lo_server_thread_start(m_Server);
-    while (!m_Exit) usleep(1000);
+        float sincelog=0;
+    while (!m_Exit) 
+        {
+                usleep(1000);
+                sincelog+=0.001;
+                if (m_IdleCallback!=NULL) m_IdleCallback(m_IdleContext);
+                if (m_Stats!=NULL && m_StatsLog>0 && sincelog>=m_StatsLog)
+                {
+                        spiralcore::Stats::Block stats;
+                        m_Stats->Read(stats);
+                        spiralcore::Stats::Print(stats,cerr);
+                        cerr<<"dropped commands "<<m_DroppedCommands<<endl;
+                        sincelog=0;
+                }
+        }
+}
+
+// replies with name value pairs, preceded by the number of pairs, to the
+// port asked for (or the one the request came from) on the sender's host
+void OSCServer::SendStats(lo_message request, const char *port)
+{
+        lo_address source = lo_message_get_source(request);
+        if (source==NULL) return;
+        
+        lo_address dest = lo_address_new(lo_address_get_hostname(source),
+                                         port!=NULL?port:lo_address_get_port(source));
+        if (dest==NULL) return;
+        
+        spiralcore::Stats::Block stats;
+        m_Stats->Read(stats);
+        
+        vector<pair<string,float> > values;
+        values.push_back(pair<string,float>("load",stats.Load));
+        values.push_back(pair<string,float>("average-load",stats.AverageLoad));
+        values.push_back(pair<string,float>("peak-load",stats.PeakLoad));
+        values.push_back(pair<string,float>("block-size",stats.BlockSize));
+        values.push_back(pair<string,float>("sample-rate",stats.SampleRate));
+        values.push_back(pair<string,float>("callbacks",stats.Callbacks));
+        values.push_back(pair<string,float>("overruns",stats.Overruns));
+        values.push_back(pair<string,float>("xruns",stats.Xruns));
+        values.push_back(pair<string,float>("voices",stats.Voices));
+        values.push_back(pair<string,float>("max-voices",stats.MaxVoices));
+        values.push_back(pair<string,float>("sampler-channels",stats.SamplerChannels));
+        values.push_back(pair<string,float>("queued-events",stats.QueuedEvents));
+        values.push_back(pair<string,float>("command-bytes",stats.CommandBytes));
+        values.push_back(pair<string,float>("command-buffer-size",stats.CommandBufferSize));
+        values.push_back(pair<string,float>("late-events",stats.LateEvents));
+        values.push_back(pair<string,float>("dropped-events",stats.DroppedEvents));
+        values.push_back(pair<string,float>("dropped-commands",m_DroppedCommands));
+        values.push_back(pair<string,float>("alloc-failures",stats.AllocFailures));
+        values.push_back(pair<string,float>("missed-samples",stats.MissedSamples));
+        values.push_back(pair<string,float>("deferred-loads",stats.DeferredLoads));
+        
+        char name[64];
+        for (unsigned int n=0; n<spiralcore::STATS_HISTOGRAM_SIZE; n++)
+        {
+                snprintf(name,sizeof(name),"load-%d%%",n*10);
+                values.push_back(pair<string,float>(name,stats.Histogram[n]));
+        }
+        
+        for (unsigned int n=0; n<stats.NumNodeTypes; n++)
+        {
+                snprintf(name,sizeof(name),"nodes-%s",Graph::GetTypeName((Graph::Type)n));
+                values.push_back(pair<string,float>(name,stats.NodesInUse[n]));
+                snprintf(name,sizeof(name),"pool-%s",Graph::GetTypeName((Graph::Type)n));
+                values.push_back(pair<string,float>(name,stats.NodesTotal[n]));
+        }
+        
+        lo_message reply = lo_message_new();
+        lo_message_add_int32(reply,values.size());
+        for (vector<pair<string,float> >::iterator i=values.begin(); i!=values.end(); ++i)
+        {
+                lo_message_add_string(reply,i->first.c_str());
+                lo_message_add_float(reply,i->second);
+        }
+        lo_send_message(dest,"/stats",reply);
+        lo_message_free(reply);
+        lo_address_free(dest);
 }
 
 void OSCServer::ErrorHandler(int num, const char *msg, const char *path)
@@ -62,6 +191,27 @@ int OSCServer::DefaultHandler(const char *path, const char *types, lo_arg **argv
 {
         OSCServer *server = (OSCServer*)user_data;
 
+        // these are answered here rather than going to the audio thread
+        if (!strcmp(path,"/stats") && server->m_Stats!=NULL)
+        {
+                const char *port=NULL;
+                if (argc>0 && types[0]==LO_STRING) port=&argv[0]->s;
+                server->SendStats(data,port);
+                return 1;
+        }
+        if (!strcmp(path,"/statslog"))
+        {
+                if (argc>0 && types[0]==LO_FLOAT) server->m_StatsLog=argv[0]->f;
+                if (argc>0 && types[0]==LO_INT32) server->m_StatsLog=argv[0]->i;
+                return 1;
+        }
+
+        if (argc>=(int)COMMAND_MAX_ARGS)
+        {
+                cerr<<"osc message has too many arguments for ringbuffer command"<<endl;
+                return 1;
+        }
+
         unsigned int size = 0;
         for (int i=0; i<argc; i++)
         {
@@ -128,12 +278,15 @@ int OSCServer::DefaultHandler(const char *path, const char *types, lo_arg **argv
                 }
         }
 
+        if (server->m_RecordFile!=NULL) server->RecordMessage(path,types,argv,argc);
+
         if (1)//pos==size) hmm
         {
                 CommandRingBuffer::Command command(path,types,newdata,pos);
                 if (!server->m_CommandRingBuffer.Send(command))
                 {
                         //cerr<<"OSCServer - ringbuffer full!"<<endl;
+                        server->m_DroppedCommands++;
                 }
         }
         else
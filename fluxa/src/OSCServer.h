@@ -15,11 +15,16 @@
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
 #include <string>
+#include <cstdio>
 #include <lo/lo.h>
 #include "CommandRingBuffer.h"
+#include "Stats.h"
 
 using namespace std;
 
+#ifndef OSC_SERVER
+#define OSC_SERVER
+
 class OSCServer
 {
 public:
@@ -28,13 +33,31 @@ public:
 	
 	void Run();
 	bool Get(CommandRingBuffer::Command& command) { return m_CommandRingBuffer.Get(command);}
+	CommandRingBuffer *GetCommandRingBuffer() { return &m_CommandRingBuffer; }
+	// log everything received, for rendering with fluxa -render later
+	bool Record(const string &filename);
+	// answers /stats requests, and logs them every period seconds if it's set
+	void SetStats(spiralcore::Stats *s) { m_Stats=s; }
+	void SetStatsLog(float period) { m_StatsLog=period; }
+	// called regularly from the thread running the server, for non realtime work
+	void SetIdleCallback(void(*Idle)(void*), void *Context) { m_IdleCallback=Idle; m_IdleContext=Context; }
 	
 private:
 	static int DefaultHandler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
 	static void ErrorHandler(int num, const char *m, const char *path);
+	void RecordMessage(const char *path, const char *types, lo_arg **argv, int argc);
+	void SendStats(lo_message request, const char *port);
 
 	lo_server_thread m_Server;
+	FILE *m_RecordFile;
+	spiralcore::Stats *m_Stats;
+	float m_StatsLog;
+	void(*m_IdleCallback)(void*);
+	void *m_IdleContext;
+	unsigned int m_DroppedCommands;
 	string m_Port;
 	bool m_Exit;
 	CommandRingBuffer m_CommandRingBuffer; 
 };
+
+#endif
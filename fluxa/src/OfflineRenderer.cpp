@@ -0,0 +1,470 @@
+// Copyright (C) 2010 David Griffiths <dave@pawfal.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include <sys/time.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fstream>
+#include <sndfile.h>
+#include "OfflineRenderer.h"
+
+using namespace spiralcore;
+
+// big enough for a few hundred commands per block
+static const unsigned int OFFLINE_RING_BUFFER_SIZE = 2097152;
+
+static double WallTime()
+{
+	timeval tv;
+	gettimeofday(&tv,0);
+	return tv.tv_sec+tv.tv_usec/1000000.0;
+}
+
+// reads a bare or double quoted token from the line
+static bool NextToken(const string &line, unsigned int &pos, string &token)
+{
+	token.clear();
+	while (pos<line.size() && isspace(line[pos])) pos++;
+	if (pos>=line.size()) return false;
+	
+	if (line[pos]=='"')
+	{
+		pos++;
+		while (pos<line.size() && line[pos]!='"')
+		{
+			if (line[pos]=='\\' && pos+1<line.size()) pos++;
+			token+=line[pos++];
+		}
+		if (pos>=line.size()) return false;
+		pos++;
+		return true;
+	}
+	
+	while (pos<line.size() && !isspace(line[pos])) token+=line[pos++];
+	return true;
+}
+
+OfflineRenderer::OfflineRenderer(unsigned int samplerate, unsigned int bufsize) :
+m_SampleRate(samplerate),
+m_BufSize(bufsize),
+m_Commands(OFFLINE_RING_BUFFER_SIZE)
+{
+}
+
+OfflineRenderer::~OfflineRenderer()
+{
+}
+
+bool OfflineRenderer::LoadCommands(const string &filename)
+{
+	ifstream file(filename.c_str());
+	if (!file)
+	{
+		cerr<<"could not open command file "<<filename<<endl;
+		return false;
+	}
+	
+	string line;
+	unsigned int linenum=0;
+	while (getline(file,line))
+	{
+		linenum++;
+		if (!ParseCommand(line)) 
+		{
+			cerr<<filename<<":"<<linenum<<" could not parse command, ignoring"<<endl;
+		}
+	}
+	
+	if (m_Queue.empty())
+	{
+		cerr<<"no commands in "<<filename<<endl;
+		return false;
+	}
+	return true;
+}
+
+bool OfflineRenderer::ParseCommand(const string &line)
+{
+	unsigned int pos=0;
+	string token;
+	
+	// blank lines and comments
+	if (!NextToken(line,pos,token) || token[0]=='#') return true;
+	
+	TimedCommand cmd;
+	cmd.Time=strtod(token.c_str(),NULL);
+	if (!NextToken(line,pos,cmd.Name) || cmd.Name[0]!='/') return false;
+	if (!NextToken(line,pos,cmd.Types)) return false;
+	if (cmd.Types=="-") cmd.Types="";
+	
+	if (cmd.Name.size()>=sizeof(((CommandRingBuffer::Command*)0)->Name) || 
+		cmd.Types.size()>=COMMAND_MAX_ARGS) return false;
+	
+	for (unsigned int i=0; i<cmd.Types.size(); i++)
+	{
+		if (!NextToken(line,pos,token)) return false;
+		switch (cmd.Types[i])
+		{
+			case 'i': 
+			{
+				int v=strtol(token.c_str(),NULL,10);
+				cmd.Data.append((char*)&v,4);
+			}
+			break;
+			case 'f':
+			{
+				float v=strtod(token.c_str(),NULL);
+				cmd.Data.append((char*)&v,4);
+			}
+			break;
+			case 's':
+			{
+				cmd.Data.append(token);
+				cmd.Data+='\0';
+			}
+			break;
+			default: return false;
+		}
+	}
+	
+	if (cmd.Data.size()>COMMAND_DATA_SIZE) return false;
+	
+	// keep them in time order, but stable for ones at the same time
+	vector<TimedCommand>::iterator i=m_Queue.end();
+	while (i!=m_Queue.begin() && (i-1)->Time>cmd.Time) --i;
+	m_Queue.insert(i,cmd);
+	return true;
+}
+
+double OfflineRenderer::Render(const string &filename, double tail)
+{
+	if (m_Queue.empty()) return 0;
+	
+	SF_INFO info;
+	memset(&info,0,sizeof(info));
+	info.samplerate=m_SampleRate;
+	info.channels=2;
+	
+	string ext=filename.substr(filename.find_last_of('.')+1);
+	if (ext=="flac" || ext=="FLAC") info.format=SF_FORMAT_FLAC|SF_FORMAT_PCM_24;
+	else info.format=SF_FORMAT_WAV|SF_FORMAT_FLOAT;
+	
+	SNDFILE *file=sf_open(filename.c_str(),SFM_WRITE,&info);
+	if (file==NULL)
+	{
+		cerr<<"could not open "<<filename<<" for writing: "<<sf_strerror(file)<<endl;
+		return 0;
+	}
+	
+	Fluxa fluxa(&m_Commands,m_SampleRate,m_BufSize);
+	
+	// start the clock at the first command, so recorded timestamps line up
+	double start=m_Queue[0].Time;
+	Time now;
+	now.Seconds=(unsigned int)floor(start);
+	now.SetFraction(start-floor(start));
+	fluxa.SetTime(now);
+	
+	double end=m_Queue.back().Time+tail;
+	double blocktime=m_BufSize/(double)m_SampleRate;
+	float *interleaved=new float[m_BufSize*2];
+	unsigned int next=0;
+	double rendered=0;
+	double wallstart=WallTime();
+	
+	for (double t=start; t<end; t+=blocktime)
+	{
+		// everything due before the end of this block is handled at its start, 
+		// same as the jack callback - if the ringbuffer fills we carry on next block
+		while (next<m_Queue.size() && m_Queue[next].Time<t+blocktime)
+		{
+			const TimedCommand &tc=m_Queue[next];
+			CommandRingBuffer::Command cmd(tc.Name.c_str(),tc.Types.c_str(),tc.Data.c_str(),tc.Data.size());
+			if (!m_Commands.Send(cmd)) break;
+			next++;
+		}
+		
+		Fluxa::Run(&fluxa,m_BufSize);
+		
+		const Sample &left=fluxa.GetLeft();
+		const Sample &right=fluxa.GetRight();
+		for (unsigned int n=0; n<m_BufSize; n++)
+		{
+			interleaved[n*2]=left[n];
+			interleaved[n*2+1]=right[n];
+		}
+		sf_writef_float(file,interleaved,m_BufSize);
+		rendered+=blocktime;
+	}
+	
+	double elapsed=WallTime()-wallstart;
+	delete[] interleaved;
+	sf_close(file);
+	
+	double factor=elapsed>0?rendered/elapsed:0;
+	cerr<<"rendered "<<rendered<<" seconds to "<<filename<<" in "<<elapsed
+		<<" seconds ("<<factor<<"x realtime)"<<endl;
+	return factor;
+}
+
+// a little helper for building synth definitions in code
+class DefBuilder
+{
+public:
+	DefBuilder(Graph &graph, unsigned int id) : 
+	m_Graph(graph), m_ID(id), m_Count(0) 
+	{ 
+		// the first node made is the root
+		m_Graph.Define(id,0); 
+	}
+	
+	unsigned int Op(Graph::Type t) { m_Graph.DefineNode(m_ID,t,0,-1); return m_Count++; }
+	unsigned int Value(float v) { m_Graph.DefineNode(m_ID,Graph::TERMINAL,v,-1); return m_Count++; }
+	unsigned int Param(int p) { m_Graph.DefineNode(m_ID,Graph::TERMINAL,0,p); return m_Count++; }
+	void Link(unsigned int node, unsigned int arg, unsigned int to) { m_Graph.DefineLink(m_ID,node,arg,to); }
+	
+	// a long envelope, so the voices keep going for the whole test
+	unsigned int Envelope()
+	{
+		unsigned int env=Op(Graph::ADSR);
+		Link(env,0,Value(0.01));
+		Link(env,1,Value(0.01));
+		Link(env,2,Value(1));
+		Link(env,3,Value(60));
+		return env;
+	}
+	
+private:
+	Graph &m_Graph;
+	unsigned int m_ID;
+	unsigned int m_Count;
+};
+
+void OfflineRenderer::Benchmark(double seconds)
+{
+	static const char *shapes[] = {"sine","saw-filter","fm"};
+	static const unsigned int numshapes=3;
+	static const unsigned int voicecounts[] = {1,16,64,256};
+	static const unsigned int numvoicecounts=4;
+	
+	cerr<<"fluxa benchmark, "<<m_SampleRate<<"Hz, "<<m_BufSize<<" sample blocks, "
+		<<seconds<<" seconds per test"<<endl;
+	cerr<<"shape\tvoices\trealtime factor"<<endl;
+	
+	for (unsigned int shape=0; shape<numshapes; shape++)
+	{
+		for (unsigned int vc=0; vc<numvoicecounts; vc++)
+		{
+			unsigned int voices=voicecounts[vc];
+			Fluxa fluxa(&m_Commands,m_SampleRate,m_BufSize);
+			Graph &graph=fluxa.GetGraph();
+			
+			graph.SetMaxPlaying(voices);
+			for (unsigned int t=0; t<Graph::NUMTYPES; t++)
+			{
+				graph.SetPoolSize((Graph::Type)t,voices*(t==Graph::TERMINAL?10:3));
+			}
+			
+			DefBuilder def(graph,0);
+			unsigned int root=def.Op(Graph::MUL);
+			def.Link(root,0,def.Envelope());
+			switch (shape)
+			{
+				case 0: 
+				{
+					unsigned int osc=def.Op(Graph::SINOSC);
+					def.Link(osc,0,def.Param(0));
+					def.Link(root,1,osc);
+				}
+				break;
+				case 1: 
+				{
+					unsigned int osc=def.Op(Graph::SAWOSC);
+					def.Link(osc,0,def.Param(0));
+					unsigned int filter=def.Op(Graph::MOOGLP);
+					def.Link(filter,0,osc);
+					def.Link(filter,1,def.Value(0.3));
+					def.Link(filter,2,def.Value(0.3));
+					def.Link(root,1,filter);
+				}
+				break;
+				case 2:
+				{
+					unsigned int mod=def.Op(Graph::SINOSC);
+					def.Link(mod,0,def.Param(1));
+					unsigned int depth=def.Op(Graph::MUL);
+					def.Link(depth,0,mod);
+					def.Link(depth,1,def.Value(100));
+					unsigned int freq=def.Op(Graph::ADD);
+					def.Link(freq,0,def.Param(0));
+					def.Link(freq,1,depth);
+					unsigned int osc=def.Op(Graph::SINOSC);
+					def.Link(osc,0,freq);
+					def.Link(root,1,osc);
+				}
+				break;
+			}
+			
+			for (unsigned int v=0; v<voices; v++)
+			{
+				float params[2] = { 110.0f+v*3.0f, 220.0f+v*5.0f };
+				graph.PlayDef(0,0,params,2,0);
+			}
+			
+			unsigned int blocks=(unsigned int)(seconds*m_SampleRate/m_BufSize);
+			double wallstart=WallTime();
+			for (unsigned int b=0; b<blocks; b++)
+			{
+				Fluxa::Run(&fluxa,m_BufSize);
+			}
+			double elapsed=WallTime()-wallstart;
+			double rendered=blocks*m_BufSize/(double)m_SampleRate;
+			
+			cerr<<shapes[shape]<<"\t"<<voices<<"\t"<<(elapsed>0?rendered/elapsed:0)<<endl;
+		}
+	}
+}
+
+// builds a graph around the node type, plays a couple of voices and
+// keeps the output, returns false if the type can't be tested alone
+bool OfflineRenderer::RenderTest(Graph::Type type, double seconds, vector<float> &out)
+{
+	// the noise tables and filters use rand
+	srand(1);
+	Fluxa fluxa(&m_Commands,m_SampleRate,m_BufSize);
+	Graph &graph=fluxa.GetGraph();
+	
+	DefBuilder def(graph,0);
+	unsigned int root=def.Op(Graph::MUL);
+	def.Link(root,0,def.Envelope());
+	
+	switch (type)
+	{
+		case Graph::TERMINAL:
+		case Graph::ADSR:
+		case Graph::SINOSC: case Graph::SAWOSC: case Graph::TRIOSC: 
+		case Graph::SQUOSC: case Graph::WHITEOSC: case Graph::PINKOSC:
+		{
+			unsigned int osc=def.Op(type==Graph::TERMINAL || type==Graph::ADSR?Graph::SINOSC:type);
+			def.Link(osc,0,def.Param(0));
+			def.Link(root,1,osc);
+		}
+		break;
+		case Graph::ADD: case Graph::SUB: case Graph::MUL: case Graph::DIV: case Graph::POW:
+		{
+			unsigned int osc=def.Op(Graph::SINOSC);
+			def.Link(osc,0,def.Param(0));
+			unsigned int op=def.Op(type);
+			def.Link(op,0,osc);
+			def.Link(op,1,def.Value(2));
+			def.Link(root,1,op);
+		}
+		break;
+		case Graph::MOOGLP: case Graph::MOOGBP: case Graph::MOOGHP: case Graph::FORMANT:
+		case Graph::CRUSH: case Graph::DISTORT: case Graph::CLIP: case Graph::DELAY:
+		{
+			unsigned int osc=def.Op(Graph::SAWOSC);
+			def.Link(osc,0,def.Param(0));
+			unsigned int node=def.Op(type);
+			def.Link(node,0,osc);
+			def.Link(node,1,def.Value(0.3));
+			def.Link(node,2,def.Value(0.3));
+			def.Link(root,1,node);
+		}
+		break;
+		case Graph::KS:
+		{
+			unsigned int ks=def.Op(Graph::KS);
+			def.Link(ks,0,def.Param(0));
+			def.Link(ks,1,def.Value(0.3));
+			def.Link(ks,2,def.Value(0.3));
+			def.Link(root,1,ks);
+		}
+		break;
+		// needs a sample loaded
+		default: return false;
+	}
+	
+	float params[2][1] = { {110.0f}, {330.0f} };
+	graph.PlayDef(0,0,params[0],1,-0.5);
+	graph.PlayDef(0,0,params[1],1,0.5);
+	
+	unsigned int blocks=(unsigned int)(seconds*m_SampleRate/m_BufSize);
+	out.clear();
+	out.reserve(blocks*m_BufSize*2);
+	for (unsigned int b=0; b<blocks; b++)
+	{
+		Fluxa::Run(&fluxa,m_BufSize);
+		const Sample &left=fluxa.GetLeft();
+		const Sample &right=fluxa.GetRight();
+		for (unsigned int n=0; n<m_BufSize; n++)
+		{
+			out.push_back(left[n]);
+			out.push_back(right[n]);
+		}
+	}
+	return true;
+}
+
+unsigned int OfflineRenderer::Test(double seconds)
+{
+	// anything louder than this has got out of hand
+	static const float bound=4.0f;
+	
+	cerr<<"fluxa test, "<<m_SampleRate<<"Hz, "<<m_BufSize<<" sample blocks, "
+		<<seconds<<" seconds per test"<<endl;
+	cerr<<"type\tpeak\tchecksum\tresult"<<endl;
+	
+	unsigned int failures=0;
+	for (unsigned int t=0; t<Graph::NUMTYPES; t++)
+	{
+		Graph::Type type=(Graph::Type)t;
+		vector<float> first,second;
+		if (!RenderTest(type,seconds,first)) continue;
+		RenderTest(type,seconds,second);
+		
+		string error;
+		float peak=0;
+		double checksum=0;
+		for (unsigned int n=0; n<first.size(); n++)
+		{
+			if (!isfinite(first[n]))
+			{
+				error="not finite";
+				break;
+			}
+			float s=fabsf(first[n]);
+			if (s>peak) peak=s;
+			checksum+=s*(n%1000+1);
+		}
+		
+		if (error=="")
+		{
+			if (peak>bound) error="too loud";
+			else if (peak==0) error="silent";
+			else if (first!=second) error="not the same twice";
+		}
+		
+		if (error!="") failures++;
+		cerr<<Graph::GetTypeName(type)<<"\t"<<peak<<"\t"<<checksum<<"\t"
+			<<(error==""?"ok":error)<<endl;
+	}
+	
+	cerr<<failures<<" failures"<<endl;
+	return failures;
+}
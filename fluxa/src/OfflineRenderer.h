@@ -0,0 +1,69 @@
+// Copyright (C) 2010 David Griffiths <dave@pawfal.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include <string>
+#include <vector>
+#include "Fluxa.h"
+
+#ifndef OFFLINE_RENDERER
+#define OFFLINE_RENDERER
+
+// runs fluxa as fast as possible without jack, from a file of timestamped 
+// commands as written by fluxa -record, and writes the result with libsndfile
+//
+// the command file has one message per line: 
+// time-in-seconds /path types arguments...
+// where strings are in double quotes, and "-" means no arguments.
+class OfflineRenderer
+{
+public:
+	OfflineRenderer(unsigned int samplerate, unsigned int bufsize);
+	~OfflineRenderer();
+	
+	bool LoadCommands(const string &filename);
+	bool ParseCommand(const string &line);
+	
+	// renders to a wav or flac file (picked from the extension) until the
+	// last command plus the tail, returns the realtime factor or 0 on error
+	double Render(const string &filename, double tail);
+	
+	// voice counts x graph shapes, printed as realtime factors
+	void Benchmark(double seconds);
+	
+	// renders a small graph around each node type twice, checking the output
+	// is finite, bounded, not silent and the same both times, returns the 
+	// number of failures
+	unsigned int Test(double seconds);
+	
+private:
+	bool RenderTest(Graph::Type type, double seconds, vector<float> &out);
+	
+	// kept packed, as commands are big and sessions can be long
+	struct TimedCommand
+	{
+		double Time;
+		string Name;
+		string Types;
+		string Data;
+	};
+	
+	unsigned int m_SampleRate;
+	unsigned int m_BufSize;
+	CommandRingBuffer m_Commands;
+	vector<TimedCommand> m_Queue;
+};
+
+#endif
@@ -14,6 +14,9 @@
 // along with this program; if not, write to the Free Software
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
+#ifndef RINGBUFFER
+#define RINGBUFFER
+
 // ringbuffer for processing commands between asycronous threads, either may be
 // realtime and non blocking, so all code should be realtime capable
 
@@ -30,10 +33,12 @@ public:
 	bool Write(char *src, unsigned int size);
 	bool Read(char *dest, unsigned int size);
 	void Dump();
-
-private:
+	
 	unsigned int WriteSpace();
 	unsigned int ReadSpace();
+	unsigned int GetSize() { return m_Size; }
+
+private:
 	
 	unsigned int m_ReadPos;
 	unsigned int m_WritePos;
@@ -41,3 +46,5 @@ private:
 	unsigned int m_SizeMask;	
 	char *m_Buffer;	
 };
+
+#endif
@@ -21,11 +21,12 @@
 
 using namespace spiralcore;
 
-Allocator *Sample::m_Allocator = new MallocAllocator();
+Allocator *Sample::m_Allocator = new PoolAllocator();
 
 Sample::Sample(unsigned int Len) :
 m_Data(NULL),
-m_Length(0)
+m_Length(0),
+m_Borrowed(false)
 {	
 	if (Len) 
 	{
@@ -36,7 +37,8 @@ m_Length(0)
 
 Sample::Sample(const Sample &rhs):
 m_Data(NULL),
-m_Length(0)
+m_Length(0),
+m_Borrowed(false)
 {
 	*this=rhs;
 }
@@ -44,7 +46,8 @@ m_Length(0)
 
 Sample::Sample(const AudioType *S, unsigned int Len):
 m_Data(NULL),
-m_Length(0)
+m_Length(0),
+m_Borrowed(false)
 {
 	assert(S);
 	Allocate(Len);		
@@ -59,26 +62,56 @@ Sample::~Sample()
 
 
 	
+// if the allocator refuses (eg. out of pooled memory in the audio 
+// thread) we keep the old buffer, so callers can carry on safely
 bool Sample::Allocate(unsigned int Size)
 {
-	Clear();
+	AudioType *Data = (AudioType*) m_Allocator->New(Size*sizeof(AudioType));
+	if (Data==NULL)
+	{
+		return false;
+	}
 	
-	m_Data = (AudioType*) m_Allocator->New(Size*sizeof(AudioType));
+	Clear();
+	m_Data=Data;
 	m_Length=Size;
 	
 	memset(m_Data,0,GetLengthInBytes());
 	
-	return (m_Data);
+	return true;
 }
 
 void Sample::Clear()
 {
 	if (m_Data)
 	{
-		m_Allocator->Delete((char*)m_Data);
+		if (!m_Borrowed) m_Allocator->Delete((char*)m_Data);
 		m_Length=0;
 		m_Data=NULL;
 	}
+	m_Borrowed=false;
+}
+
+void Sample::Borrow(AudioType *Data, unsigned int Length)
+{
+	Clear();
+	m_Data=Data;
+	m_Borrowed=true;
+	__sync_synchronize();
+	m_Length=Length;
+}
+
+void Sample::Take(Sample &S)
+{
+	Clear();
+	m_Data=S.m_Data;
+	m_Borrowed=S.m_Borrowed;
+	__sync_synchronize();
+	m_Length=S.m_Length;
+	
+	S.m_Data=NULL;
+	S.m_Length=0;
+	S.m_Borrowed=false;
 }
 
 void Sample::Zero()
@@ -101,6 +134,7 @@ void Sample::Insert(const Sample &S, unsigned int Pos)
 
 	unsigned int NewLen = GetLength()+S.GetLength();
 	AudioType *NewBuf = (AudioType*) m_Allocator->New(NewLen*sizeof(AudioType));
+	if (NewBuf==NULL) return;
 	unsigned int FromPos=0, ToPos=0, TempBufPos=0;
 	
 	while (FromPos<=GetLength())
@@ -155,21 +189,22 @@ void Sample::Mix(const Sample &S, unsigned int Pos)
 
 void Sample::MulMix(const Sample &S, float m)
 {
+	if (GetLength()==0) return;
 	unsigned int ToPos=0;
 	
 	for (unsigned int FromPos=0; FromPos<S.GetLength(); FromPos++)
 	{
 		float t=S[FromPos]*m;
 	
+		if (ToPos>=GetLength()) ToPos=0;
 		m_Data[ToPos]=m_Data[ToPos]+t;
-		
-		if (ToPos>GetLength()) ToPos=0;
 		ToPos++;
 	}
 }
 
 void Sample::MulClipMix(const Sample &S, float m)
 {
+	if (GetLength()==0) return;
 	unsigned int ToPos=0;
 	
 	for (unsigned int FromPos=0; FromPos<S.GetLength(); FromPos++)
@@ -178,9 +213,8 @@ void Sample::MulClipMix(const Sample &S, float m)
 		if (t>m) t=m;
 		else if (t<-m) t=-m;
 	
+		if (ToPos>=GetLength()) ToPos=0;
 		m_Data[ToPos]=m_Data[ToPos]+t;
-		
-		if (ToPos>GetLength()) ToPos=0;
 		ToPos++;
 	}
 }
@@ -202,6 +236,7 @@ void Sample::Remove(unsigned int Start, unsigned int End)
 	unsigned int NewLen = GetLength()-CutLen;
 
 	AudioType *TempBuf = (AudioType*) m_Allocator->New(NewLen*sizeof(AudioType));
+	if (TempBuf==NULL) return;
 		
 	unsigned int ToPos=0;
 	
@@ -233,6 +268,7 @@ void Sample::Reverse(unsigned int Start, unsigned int End)
 	
 	unsigned int NewLen = End-Start;
 	AudioType *TempBuf = (AudioType*) m_Allocator->New(NewLen*sizeof(AudioType));
+	if (TempBuf==NULL) return;
 	unsigned int ToPos=0;
 	unsigned int FromPos=0;
 	
@@ -259,6 +295,7 @@ void Sample::Move(unsigned int Dist)
 {
 	unsigned int Length=GetLength();
 	AudioType *TempBuf = (AudioType*) m_Allocator->New(Length*sizeof(AudioType));
+	if (TempBuf==NULL) return;
 	unsigned int ToPos=0;
 	unsigned int FromPos=Dist;
 	
@@ -301,6 +338,7 @@ void Sample::CropTo(unsigned int NewLength)
 	assert (NewLength<GetLength());
 	
 	AudioType *temp = (AudioType*) m_Allocator->New(NewLength*sizeof(AudioType));
+	if (temp==NULL) return;
 		
 	for(unsigned int n=0; n<NewLength; n++)
 	{
@@ -328,6 +366,7 @@ void Sample::Shrink(unsigned int Length)
 	assert(NewLength>0 && NewLength<=GetLength());
 	
 	AudioType *temp = (AudioType*) m_Allocator->New(NewLength*sizeof(AudioType));
+	if (temp==NULL) return;
 	
 	for(unsigned int n=0; n<NewLength; n++)
 	{
@@ -72,6 +72,12 @@ public:
 	void Expand(unsigned int Length);
 	void Shrink(unsigned int Length);
 	void CropTo(unsigned int NewLength);
+	// use memory we don't own (eg. mmapped files), it won't be freed
+	void Borrow(AudioType *Data, unsigned int Length);
+	// takes over the buffer from S, for publishing samples filled in 
+	// another thread - the data is set before the length, so a reader 
+	// never sees a length longer than the buffer
+	void Take(Sample &S);
 
 	AudioType &operator[](unsigned int i) const
 	{		
@@ -109,7 +115,7 @@ public:
 	
 	Sample &operator=(const Sample &rhs)
 	{
-		if (GetLength()!=rhs.GetLength()) Allocate(rhs.GetLength());		
+		if (GetLength()!=rhs.GetLength() && !Allocate(rhs.GetLength())) return *this;
 		memcpy(m_Data,rhs.GetBuffer(),GetLengthInBytes());
 		return *this;
 	}
@@ -117,6 +123,7 @@ public:
 private:
 	AudioType *m_Data;
 	unsigned int m_Length;
+	bool m_Borrowed;
 	
     SampleType m_SampleType;
 	static Allocator *m_Allocator;
@@ -37,6 +37,21 @@ void SampleStore::LoadQueue()
 {
 	AsyncSampleLoader::Get()->LoadQueue();
 }
+
+void SampleStore::RetryLoadQueue()
+{
+	AsyncSampleLoader::Get()->RetryLoadQueue();
+}
+
+unsigned int SampleStore::GetNumDeferred()
+{
+	return AsyncSampleLoader::Get()->GetNumDeferred();
+}
+
+void SampleStore::LoadQueueNow()
+{
+	AsyncSampleLoader::Get()->LoadQueueNow();
+}
 	
 void SampleStore::Unload(SampleID ID)
 {
@@ -31,6 +31,11 @@ public:
 
 	void AddToQueue(SampleID ID, const string &Filename);
 	void LoadQueue();
+	// hands over anything LoadQueue couldn't last time
+	void RetryLoadQueue();
+	unsigned int GetNumDeferred();
+	// blocks until everything queued is loaded
+	void LoadQueueNow();
 	void Unload(SampleID ID);
 	void UnloadAll();
 
@@ -23,6 +23,8 @@
 
 static const unsigned int SAFETY_MAX_CHANNELS=30;
 
+unsigned int Sampler::m_Missed=0;
+
 Sampler::Sampler(unsigned int samplerate) :
 m_SampleRate(samplerate),
 m_Poly(true),
@@ -39,12 +41,19 @@ Sampler::~Sampler()
 EventID Sampler::Play(float timeoffset, const Event &event)
 {
 	Sample* sample = SampleStore::Get()->GetSample(event.ID);
+	if (sample!=NULL && sample->GetLength()==0)
+	{
+		// not loaded yet
+		m_Missed++;
+		return 0;
+	}
+	
 	if (sample!=NULL)
 	{
 		Event Copy = event;
 		if (Copy.Frequency==0)
 		{
-			cerr<<"Cancelling zero speed sample"<<endl;
+			m_Missed++;
 			return 0;
 		}
 		
@@ -87,7 +96,7 @@ EventID Sampler::Play(float timeoffset, const Event &event)
 	}
 	else
 	{
-		cerr<<"Could not find sample "<<event.ID<<" to play"<<endl;
+		m_Missed++;
 	}
 
 	return 0;
@@ -110,7 +119,7 @@ void Sampler::Process(uint32 BufSize, Sample &left, Sample &right)
 		Event *ch = &i->second;
 		Sample *sample = SampleStore::Get()->GetSample(ch->ID);
 		// check we still have the sample
-		if (sample != NULL)
+		if (sample != NULL && sample->GetLength()>0)
 		{			
 			float Volume = ch->Volume*m_Globals.Volume*10.0f;
 			float Speed =  (ch->Frequency/440.0)*(m_Globals.Frequency/440.0);
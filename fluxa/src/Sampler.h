@@ -45,8 +45,14 @@ public:
 	
 	void SetPoly(bool s) { m_Poly=s; }
 	void SetReverse(bool s) { m_Reverse=s; }
+	unsigned int GetNumChannels() { return m_ChannelMap.size(); }
+	// plays of samples that weren't loaded, didn't exist or were at zero 
+	// speed, over all samplers - counted as we can't log in the audio thread
+	static unsigned int GetNumMissed() { return m_Missed; }
 	
 private:
+	static unsigned int m_Missed;
+	
 	unsigned int m_SampleRate;
 	
 	bool m_Poly;
@@ -0,0 +1,113 @@
+// Copyright (C) 2010 David Griffiths <dave@pawfal.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include "Stats.h"
+
+using namespace spiralcore;
+
+// how quickly the average load follows the current load
+static const float STATS_LOAD_SMOOTHING = 0.99f;
+
+Stats::Stats() :
+m_Sequence(0)
+{
+	m_Start.tv_sec=0;
+	m_Start.tv_nsec=0;
+}
+
+void Stats::StartBlock()
+{
+	clock_gettime(CLOCK_MONOTONIC,&m_Start);
+}
+
+void Stats::EndBlock(unsigned int blocksize, unsigned int samplerate)
+{
+	timespec end;
+	clock_gettime(CLOCK_MONOTONIC,&end);
+	double elapsed=(end.tv_sec-m_Start.tv_sec)+(end.tv_nsec-m_Start.tv_nsec)/1000000000.0;
+	double period=blocksize/(double)samplerate;
+	
+	m_Working.SampleRate=samplerate;
+	m_Working.BlockSize=blocksize;
+	m_Working.Callbacks++;
+	m_Working.Load=elapsed/period*100.0;
+	
+	if (m_Working.Callbacks==1) m_Working.AverageLoad=m_Working.Load;
+	else m_Working.AverageLoad=m_Working.AverageLoad*STATS_LOAD_SMOOTHING+
+		m_Working.Load*(1.0f-STATS_LOAD_SMOOTHING);
+	if (m_Working.Load>m_Working.PeakLoad) m_Working.PeakLoad=m_Working.Load;
+	
+	unsigned int bucket=(unsigned int)(m_Working.Load/10.0f);
+	if (bucket>=STATS_HISTOGRAM_SIZE) bucket=STATS_HISTOGRAM_SIZE-1;
+	m_Working.Histogram[bucket]++;
+	if (m_Working.Load>=100.0f) m_Working.Overruns++;
+	
+	Publish();
+}
+
+void Stats::Reset()
+{
+	Block fresh;
+	// these describe the current state rather than history, so keep them
+	fresh.NumNodeTypes=m_Working.NumNodeTypes;
+	memcpy(fresh.NodesTotal,m_Working.NodesTotal,sizeof(fresh.NodesTotal));
+	fresh.MaxVoices=m_Working.MaxVoices;
+	fresh.CommandBufferSize=m_Working.CommandBufferSize;
+	m_Working=fresh;
+	Publish();
+}
+
+// odd while the audio thread is writing
+void Stats::Publish()
+{
+	m_Sequence++;
+	__sync_synchronize();
+	m_Published=m_Working;
+	__sync_synchronize();
+	m_Sequence++;
+}
+
+void Stats::Read(Block &out) const
+{
+	unsigned int before,after;
+	do
+	{
+		before=m_Sequence;
+		__sync_synchronize();
+		out=m_Published;
+		__sync_synchronize();
+		after=m_Sequence;
+	}
+	while (before!=after || before&1);
+}
+
+void Stats::Print(const Block &b, ostream &out)
+{
+	out<<"load "<<b.Load<<"% avg "<<b.AverageLoad<<"% peak "<<b.PeakLoad<<"% ("
+		<<b.BlockSize<<" samples at "<<b.SampleRate<<"Hz)"<<endl;
+	out<<"callbacks "<<b.Callbacks<<" overruns "<<b.Overruns<<" xruns "<<b.Xruns<<endl;
+	out<<"load histogram:";
+	for (unsigned int n=0; n<STATS_HISTOGRAM_SIZE; n++) out<<" "<<b.Histogram[n];
+	out<<endl;
+	out<<"voices "<<b.Voices<<"/"<<b.MaxVoices<<" sampler channels "<<b.SamplerChannels<<endl;
+	out<<"nodes in use:";
+	for (unsigned int n=0; n<b.NumNodeTypes; n++) out<<" "<<b.NodesInUse[n]<<"/"<<b.NodesTotal[n];
+	out<<endl;
+	out<<"queued events "<<b.QueuedEvents<<" commands "<<b.CommandBytes<<"/"<<b.CommandBufferSize
+		<<" bytes, late events "<<b.LateEvents<<" dropped events "<<b.DroppedEvents
+		<<" alloc failures "<<b.AllocFailures<<" missed samples "<<b.MissedSamples
+		<<" deferred loads "<<b.DeferredLoads<<endl;
+}
@@ -0,0 +1,93 @@
+// Copyright (C) 2010 David Griffiths <dave@pawfal.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include <time.h>
+#include <string.h>
+#include <iostream>
+
+using namespace std;
+
+#ifndef SPIRALCORE_STATS
+#define SPIRALCORE_STATS
+
+namespace spiralcore
+{
+
+// 10% of the buffer period per bucket, the last is everything over 100%
+static const unsigned int STATS_HISTOGRAM_SIZE = 11;
+static const unsigned int STATS_MAX_NODE_TYPES = 32;
+
+// realtime health of the engine. the audio thread fills in the working
+// block and publishes it once per callback, readers copy it out using 
+// a sequence count so the audio thread never has to wait for them
+class Stats
+{
+public:
+	struct Block
+	{
+		Block() { memset(this,0,sizeof(Block)); }
+		
+		unsigned int SampleRate;
+		unsigned int BlockSize;
+		unsigned int Callbacks;
+		// percent of the buffer period spent in the callback
+		float Load;
+		float AverageLoad;
+		float PeakLoad;
+		unsigned int Histogram[STATS_HISTOGRAM_SIZE];
+		// callbacks we took too long over, and xruns jack told us about
+		unsigned int Overruns;
+		unsigned int Xruns;
+		unsigned int Voices;
+		unsigned int MaxVoices;
+		unsigned int NumNodeTypes;
+		unsigned int NodesInUse[STATS_MAX_NODE_TYPES];
+		unsigned int NodesTotal[STATS_MAX_NODE_TYPES];
+		unsigned int SamplerChannels;
+		unsigned int QueuedEvents;
+		unsigned int CommandBytes;
+		unsigned int CommandBufferSize;
+		unsigned int LateEvents;
+		unsigned int DroppedEvents;
+		unsigned int AllocFailures;
+		unsigned int MissedSamples;
+		unsigned int DeferredLoads;
+	};
+	
+	Stats();
+	
+	// audio thread only
+	void StartBlock();
+	void EndBlock(unsigned int blocksize, unsigned int samplerate);
+	Block &GetWorking() { return m_Working; }
+	void Reset();
+	
+	// any thread
+	void Read(Block &out) const;
+	static void Print(const Block &b, ostream &out);
+	
+private:
+	void Publish();
+	
+	Block m_Working;
+	Block m_Published;
+	volatile unsigned int m_Sequence;
+	timespec m_Start;
+};
+
+}
+
+#endif
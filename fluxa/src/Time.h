@@ -44,7 +44,7 @@ public:
 	Time &operator+=(double s);
 	void Print() const;
 	double GetFraction() const { return Fraction*ONE_OVER_UINT_MAX; }
-	void SetFraction(double s) { Fraction = (int)(s*(double)UINT_MAX); }
+	void SetFraction(double s) { Fraction = (unsigned int)(s*(double)UINT_MAX); }
 	bool IsEmpty() { return (!Seconds && !Fraction); }
 	double GetDifference(const Time& other);
 	
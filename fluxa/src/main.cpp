@@ -15,12 +15,19 @@
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
 #include <iostream>
+#include <cstdlib>
 #include "Fluxa.h"
 #include "JackClient.h"
+#include "OfflineRenderer.h"
+#include "AsyncSampleLoader.h"
 
 void printusage()
 {
-	cerr<<"usage: fluxa [-osc oscportnumber] [-jackports leftport rightport]"<<endl;
+	cerr<<"usage: fluxa [-osc oscportnumber] [-jackports leftport rightport] [-record commandfile]"<<endl;
+	cerr<<"             [-cachedir dir] [-nocache] [-stats logseconds]"<<endl;
+	cerr<<"       fluxa -render commandfile outfile.wav|flac [-samplerate rate] [-tail seconds]"<<endl;
+	cerr<<"       fluxa -bench [-samplerate rate]"<<endl;
+	cerr<<"       fluxa -test [-samplerate rate]"<<endl;
 	exit(-1);
 }
 
@@ -34,6 +41,14 @@ int main(int argc, char **argv)
 	string rightport("alsa_pcm:playback_2");
 #endif
 	string port("4004");
+	string recordfile;
+	string commandfile;
+	string outfile;
+	bool bench=false;
+	bool test=false;
+	float statslog=0;
+	unsigned int samplerate=44100;
+	double tail=5;
 
 	int arg=1;
 	while(arg<argc)
@@ -52,13 +67,79 @@ int main(int argc, char **argv)
 			}
 			else printusage();
 		}
+		if (!strcmp(argv[arg],"-record"))
+		{
+			if (arg+1 < argc) recordfile=argv[arg+1];
+			else printusage();
+		}
+		if (!strcmp(argv[arg],"-render"))
+		{
+			if (arg+2 < argc) 
+			{
+				commandfile=argv[arg+1];
+				outfile=argv[arg+2];
+			}
+			else printusage();
+		}
+		if (!strcmp(argv[arg],"-stats"))
+		{
+			if (arg+1 < argc) statslog=atof(argv[arg+1]);
+			else printusage();
+		}
+		if (!strcmp(argv[arg],"-bench"))
+		{
+			bench=true;
+		}
+		if (!strcmp(argv[arg],"-test"))
+		{
+			test=true;
+		}
+		if (!strcmp(argv[arg],"-samplerate"))
+		{
+			if (arg+1 < argc) samplerate=atoi(argv[arg+1]);
+			else printusage();
+		}
+		if (!strcmp(argv[arg],"-cachedir"))
+		{
+			if (arg+1 < argc) AsyncSampleLoader::Get()->SetCacheDir(argv[arg+1]);
+			else printusage();
+		}
+		if (!strcmp(argv[arg],"-nocache"))
+		{
+			AsyncSampleLoader::Get()->SetCacheDir("");
+		}
+		if (!strcmp(argv[arg],"-tail"))
+		{
+			if (arg+1 < argc) tail=atof(argv[arg+1]);
+			else printusage();
+		}
 		arg++;
 	}
+	
+	// non realtime, no jack or osc needed
+	if (bench || test || commandfile!="")
+	{
+		OfflineRenderer renderer(samplerate,256);
+		if (test)
+		{
+			return renderer.Test(2)>0?1:0;
+		}
+		if (bench)
+		{
+			renderer.Benchmark(10);
+			return 0;
+		}
+		if (!renderer.LoadCommands(commandfile)) return 1;
+		return renderer.Render(outfile,tail)>0?0:1;
+	}
 
 	OSCServer server(port);
+	if (recordfile!="") server.Record(recordfile);
 	JackClient* jack=JackClient::Get();
 	jack->Attach("fluxa");
 	Fluxa engine(&server,jack,leftport,rightport);
+	server.SetStats(&engine.GetStats());
+	server.SetStatsLog(statslog);
 	server.Run();
 	return 0;
 }
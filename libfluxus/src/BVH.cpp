@@ -0,0 +1,270 @@
+// Copyright (C) 2005 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+
+#include <algorithm>
+#include <float.h>
+#include "BVH.h"
+
+using namespace Fluxus;
+
+// most items in a leaf
+static const unsigned int BVH_LEAF_SIZE=4;
+// deeper than a median split tree can get
+static const unsigned int BVH_STACK_SIZE=64;
+
+// for sorting items along an axis by their centres
+class CentreLess
+{
+public:
+	CentreLess(const vector<float> &centres, unsigned int axis) : m_Centres(centres), m_Axis(axis) {}
+	bool operator()(unsigned int a, unsigned int b) const 
+	{ 
+		return m_Centres[a*3+m_Axis]<m_Centres[b*3+m_Axis]; 
+	}
+private:
+	const vector<float> &m_Centres;
+	unsigned int m_Axis;
+};
+
+BVH::BVH() :
+m_Refits(0)
+{
+}
+
+BVH::~BVH()
+{
+}
+
+void BVH::Clear()
+{
+	m_Nodes.clear();
+	m_Items.clear();
+	m_Refits=0;
+}
+
+void BVH::Build(const vector<dBoundingBox> &boxes)
+{
+	Clear();
+	if (boxes.empty()) return;
+	
+	m_Items.resize(boxes.size());
+	vector<float> centres(boxes.size()*3);
+	for (unsigned int i=0; i<boxes.size(); i++) 
+	{
+		m_Items[i]=i;
+		centres[i*3]=(boxes[i].min.x+boxes[i].max.x)*0.5f;
+		centres[i*3+1]=(boxes[i].min.y+boxes[i].max.y)*0.5f;
+		centres[i*3+2]=(boxes[i].min.z+boxes[i].max.z)*0.5f;
+	}
+	
+	m_Nodes.reserve(boxes.size()/BVH_LEAF_SIZE*2+1);
+	BuildNode(boxes,centres,0,boxes.size());
+}
+
+unsigned int BVH::BuildNode(const vector<dBoundingBox> &boxes, vector<float> &centres, 
+                            unsigned int start, unsigned int end)
+{
+	unsigned int index=m_Nodes.size();
+	m_Nodes.push_back(Node());
+	
+	Node node;
+	SetBox(node,boxes[m_Items[start]]);
+	float cmin[3],cmax[3];
+	for (int a=0; a<3; a++) cmin[a]=cmax[a]=centres[m_Items[start]*3+a];
+	for (unsigned int i=start+1; i<end; i++)
+	{
+		const dBoundingBox &box=boxes[m_Items[i]];
+		node.Min[0]=min(node.Min[0],box.min.x); node.Max[0]=max(node.Max[0],box.max.x);
+		node.Min[1]=min(node.Min[1],box.min.y); node.Max[1]=max(node.Max[1],box.max.y);
+		node.Min[2]=min(node.Min[2],box.min.z); node.Max[2]=max(node.Max[2],box.max.z);
+		for (int a=0; a<3; a++) 
+		{
+			cmin[a]=min(cmin[a],centres[m_Items[i]*3+a]);
+			cmax[a]=max(cmax[a],centres[m_Items[i]*3+a]);
+		}
+	}
+	
+	if (end-start<=BVH_LEAF_SIZE)
+	{
+		node.First=start;
+		node.Count=end-start;
+		m_Nodes[index]=node;
+		return index;
+	}
+	
+	// split at the median along the longest side of the centres
+	unsigned int axis=0;
+	if (cmax[1]-cmin[1]>cmax[axis]-cmin[axis]) axis=1;
+	if (cmax[2]-cmin[2]>cmax[axis]-cmin[axis]) axis=2;
+	unsigned int mid=(start+end)/2;
+	nth_element(m_Items.begin()+start,m_Items.begin()+mid,m_Items.begin()+end,CentreLess(centres,axis));
+	
+	// the left child always follows its parent
+	BuildNode(boxes,centres,start,mid);
+	node.First=BuildNode(boxes,centres,mid,end);
+	node.Count=0;
+	m_Nodes[index]=node;
+	return index;
+}
+
+void BVH::SetBox(Node &node, const dBoundingBox &box)
+{
+	node.Min[0]=box.min.x; node.Min[1]=box.min.y; node.Min[2]=box.min.z;
+	node.Max[0]=box.max.x; node.Max[1]=box.max.y; node.Max[2]=box.max.z;
+}
+
+void BVH::Refit(const vector<dBoundingBox> &boxes)
+{
+	if (boxes.size()!=m_Items.size())
+	{
+		Build(boxes);
+		return;
+	}
+	
+	// children always come after their parents
+	for (int i=m_Nodes.size()-1; i>=0; i--)
+	{
+		Node &node=m_Nodes[i];
+		if (node.Count>0)
+		{
+			SetBox(node,boxes[m_Items[node.First]]);
+			for (unsigned int n=node.First+1; n<node.First+node.Count; n++)
+			{
+				const dBoundingBox &box=boxes[m_Items[n]];
+				node.Min[0]=min(node.Min[0],box.min.x); node.Max[0]=max(node.Max[0],box.max.x);
+				node.Min[1]=min(node.Min[1],box.min.y); node.Max[1]=max(node.Max[1],box.max.y);
+				node.Min[2]=min(node.Min[2],box.min.z); node.Max[2]=max(node.Max[2],box.max.z);
+			}
+		}
+		else
+		{
+			const Node &left=m_Nodes[i+1];
+			const Node &right=m_Nodes[node.First];
+			for (int a=0; a<3; a++)
+			{
+				node.Min[a]=min(left.Min[a],right.Min[a]);
+				node.Max[a]=max(left.Max[a],right.Max[a]);
+			}
+		}
+	}
+	m_Refits++;
+}
+
+void BVH::IntersectLine(const dVector &start, const dVector &end, LineVisitor &visitor) const
+{
+	if (m_Nodes.empty()) return;
+	
+	float s[3] = { start.x, start.y, start.z };
+	float d[3] = { end.x-start.x, end.y-start.y, end.z-start.z };
+	float inv[3];
+	for (int a=0; a<3; a++) inv[a]=d[a]!=0?1/d[a]:0;
+	
+	unsigned int stack[BVH_STACK_SIZE];
+	unsigned int top=0;
+	stack[top++]=0;
+	while (top>0)
+	{
+		const Node &node=m_Nodes[stack[--top]];
+		
+		// clip the line to the box
+		float tmin=0, tmax=1;
+		for (int a=0; a<3 && tmin<=tmax; a++)
+		{
+			if (d[a]==0)
+			{
+				if (s[a]<node.Min[a] || s[a]>node.Max[a]) tmax=-1;
+			}
+			else
+			{
+				float t0=(node.Min[a]-s[a])*inv[a];
+				float t1=(node.Max[a]-s[a])*inv[a];
+				if (t0>t1) swap(t0,t1);
+				tmin=max(tmin,t0);
+				tmax=min(tmax,t1);
+			}
+		}
+		if (tmin>tmax) continue;
+		
+		if (node.Count>0)
+		{
+			for (unsigned int n=node.First; n<node.First+node.Count; n++) 
+			{
+				visitor.Visit(m_Items[n]);
+			}
+		}
+		else
+		{
+			unsigned int index=&node-&m_Nodes[0];
+			stack[top++]=node.First;
+			stack[top++]=index+1;
+		}
+	}
+}
+
+float BVH::BoxDist2(const Node &node, const dVector &point) const
+{
+	float p[3] = { point.x, point.y, point.z };
+	float d2=0;
+	for (int a=0; a<3; a++)
+	{
+		float d=0;
+		if (p[a]<node.Min[a]) d=node.Min[a]-p[a];
+		else if (p[a]>node.Max[a]) d=p[a]-node.Max[a];
+		d2+=d*d;
+	}
+	return d2;
+}
+
+void BVH::Nearest(const dVector &point, float radius2, NearestVisitor &visitor) const
+{
+	if (m_Nodes.empty()) return;
+	
+	unsigned int stack[BVH_STACK_SIZE];
+	float dists[BVH_STACK_SIZE];
+	unsigned int top=0;
+	stack[top]=0;
+	dists[top++]=BoxDist2(m_Nodes[0],point);
+	while (top>0)
+	{
+		top--;
+		if (dists[top]>radius2) continue;
+		const Node &node=m_Nodes[stack[top]];
+		
+		if (node.Count>0)
+		{
+			for (unsigned int n=node.First; n<node.First+node.Count; n++) 
+			{
+				radius2=visitor.Visit(m_Items[n]);
+			}
+		}
+		else
+		{
+			// push the nearer child last, so it's looked at first
+			unsigned int left=&node-&m_Nodes[0]+1;
+			unsigned int right=node.First;
+			float dl=BoxDist2(m_Nodes[left],point);
+			float dr=BoxDist2(m_Nodes[right],point);
+			if (dl<dr) 
+			{
+				swap(left,right);
+				swap(dl,dr);
+			}
+			if (dl<=radius2) { stack[top]=left; dists[top++]=dl; }
+			if (dr<=radius2) { stack[top]=right; dists[top++]=dr; }
+		}
+	}
+}
@@ -0,0 +1,95 @@
+// Copyright (C) 2005 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+
+#ifndef N_BVH
+#define N_BVH
+
+#include <vector>
+#include "dada.h"
+
+using namespace std;
+
+namespace Fluxus
+{
+
+///////////////////////////////////////////////////
+/// A bounding volume hierarchy over a list of 
+/// boxes, for finding the items along a line or 
+/// nearest to a point without looking at them all.
+/// If the items move but stay the same in number 
+/// it can be refitted, which is much quicker than 
+/// a rebuild, but the tree gets looser over time.
+class BVH
+{
+public:
+	BVH();
+	~BVH();
+	
+	void Build(const vector<dBoundingBox> &boxes);
+	void Refit(const vector<dBoundingBox> &boxes);
+	void Clear();
+	unsigned int NumItems() const { return m_Items.size(); }
+	/// How many refits since the last build
+	unsigned int GetRefits() const { return m_Refits; }
+
+	class LineVisitor
+	{
+	public:
+		virtual ~LineVisitor() {}
+		/// Called for each item whose box the line crosses
+		virtual void Visit(unsigned int item)=0;
+	};
+	
+	class NearestVisitor
+	{
+	public:
+		virtual ~NearestVisitor() {}
+		/// Called for items whose boxes are within the search 
+		/// radius, returns the new squared radius to search in
+		virtual float Visit(unsigned int item)=0;
+	};
+	
+	void IntersectLine(const dVector &start, const dVector &end, LineVisitor &visitor) const;
+	/// Items further than sqrt(radius2) are skipped, the 
+	/// closest boxes are looked at first
+	void Nearest(const dVector &point, float radius2, NearestVisitor &visitor) const;
+
+private:
+	class Node
+	{
+	public:
+		float Min[3];
+		float Max[3];
+		// leaves have a count of items starting at first, 
+		// others have children at index+1 and second
+		unsigned int First;
+		unsigned int Count;
+	};
+	
+	unsigned int BuildNode(const vector<dBoundingBox> &boxes, vector<float> &centres, 
+	                       unsigned int start, unsigned int end);
+	void SetBox(Node &node, const dBoundingBox &box);
+	float BoxDist2(const Node &node, const dVector &point) const;
+	
+	vector<Node> m_Nodes;
+	vector<unsigned int> m_Items;
+	unsigned int m_Refits;
+};
+
+}
+
+#endif
@@ -18,11 +18,80 @@
 #include "BlobbyPrimitive.h"
 #include "State.h"
 #include "ImplicitSurface.h"
+#include "WorkerPool.h"
 
 using namespace Fluxus;
 
+// influences are cut off where they fall below this fraction of the isolevel
+static const float BLOBBY_CUTOFF=0.05;
+
+// only the lattice near the influences is polygonised, which relies
+// on the untouched field (zero) being outside the surface
+static const float BLOBBY_MIN_ISOLEVEL=0.001;
+
+// the lattice offset of each of the cell corners, in the order the 
+// marching cubes tables use them
+static const int CornerOffset[8][3] = {
+	{0,1,0}, {0,1,1}, {0,0,1}, {0,0,0},
+	{1,1,0}, {1,1,1}, {1,0,1}, {1,0,0} };
+
+// the lattice edge of each of the cell edges, as the offset 
+// of its lower corner and the axis it runs along
+static const int EdgeOffset[12][4] = {
+	{0,1,0,2}, {0,0,1,1}, {0,0,0,2}, {0,0,0,1},
+	{1,1,0,2}, {1,0,1,1}, {1,0,0,2}, {1,0,0,1},
+	{0,1,0,0}, {0,1,1,0}, {0,0,1,0}, {0,0,0,0} };
+
+namespace Fluxus
+{
+
+class BlobbySplatJob : public WorkerPool::Job
+{
+public:
+	BlobbySplatJob(BlobbyPrimitive *blob) : m_Blob(blob) {}
+	virtual void Run(unsigned int start, unsigned int end) 
+		{ for (unsigned int x=start; x<end; x++) m_Blob->SplatPlane(x); }
+private:
+	BlobbyPrimitive *m_Blob;
+};
+
+class BlobbyVertexJob : public WorkerPool::Job
+{
+public:
+	BlobbyVertexJob(BlobbyPrimitive *blob) : m_Blob(blob) {}
+	virtual void Run(unsigned int start, unsigned int end) 
+		{ for (unsigned int x=start; x<end; x++) m_Blob->MakeVertices(x); }
+private:
+	BlobbyPrimitive *m_Blob;
+};
+
+class BlobbyTriangleJob : public WorkerPool::Job
+{
+public:
+	BlobbyTriangleJob(BlobbyPrimitive *blob) : m_Blob(blob) {}
+	virtual void Run(unsigned int start, unsigned int end) 
+		{ for (unsigned int x=start; x<end; x++) m_Blob->MakeTriangles(x); }
+private:
+	BlobbyPrimitive *m_Blob;
+};
+
+}
+
 BlobbyPrimitive::BlobbyPrimitive(int dimx, int dimy, int dimz, dVector size) :
-    m_LockVoxels(false)
+m_Width(dimx),
+m_Height(dimy),
+m_Depth(dimz),
+m_CellSize(size.x/(float)dimx,size.y/(float)dimy,size.z/(float)dimz),
+m_PosVersion(0),
+m_StrengthVersion(0),
+m_ColVersion(0),
+m_FieldCutoff(0),
+m_FieldColour(false),
+m_FieldSerial(1),
+m_MeshSerial(0),
+m_MeshIsolevel(0),
+m_Isolevel(0),
+m_LockVoxels(false)
 {
 	AddData("p",new TypedPData<dVector>);
 	AddData("c",new TypedPData<dColour>);
@@ -31,52 +100,40 @@ BlobbyPrimitive::BlobbyPrimitive(int dimx, int dimy, int dimz, dVector size) :
 	// setup the direct access for speed
 	PDataDirty();
 
-	float sx=size.x/(float)dimx;
-	float sy=size.y/(float)dimy;
-	float sz=size.z/(float)dimz;
-
-	m_Width = dimx;
-	m_Height = dimy;
-	m_Depth = dimz;
-
-	for (int x=0; x<dimx; x++)
-	{
-		for (int y=0; y<dimy; y++)
-		{
-			for (int z=0; z<dimz; z++)
-			{
-				Cell cell;
-
-				cell.p[0]=dVector(sx*x,sy*y+sy,sz*z);
-				cell.p[1]=dVector(sx*x,sy*y+sy,sz*z+sz);
-				cell.p[2]=dVector(sx*x,sy*y,sz*z+sz);
-				cell.p[3]=dVector(sx*x,sy*y,sz*z);
-
-				cell.p[4]=dVector(sx*x+sx,sy*y+sy,sz*z);
-				cell.p[5]=dVector(sx*x+sx,sy*y+sy,sz*z+sz);
-				cell.p[6]=dVector(sx*x+sx,sy*y,sz*z+sz);
-				cell.p[7]=dVector(sx*x+sx,sy*y,sz*z);
-
-				cell.val[0]=0;
-				cell.val[1]=0;
-				cell.val[2]=0;
-				cell.val[3]=0;
-				cell.val[4]=0;
-				cell.val[5]=0;
-				cell.val[6]=0;
-				cell.val[7]=0;
-
-				m_Voxels.push_back(cell);
-			}
-		}
-	}
+	unsigned int points=(m_Width+1)*(m_Height+1)*(m_Depth+1);
+	m_Field.resize(points,0);
+	m_Gradient.resize(points,dVector(0,0,0));
+	m_FieldCol.resize(points,dColour(0,0,0));
+	m_Bounds.resize(m_Width+1);
+	for (unsigned int x=0; x<=m_Width; x++) m_Bounds[x].Clear();
+	m_Slabs.resize(m_Width+1);
 }
 
 BlobbyPrimitive::BlobbyPrimitive(const BlobbyPrimitive &other) :
 Primitive(other),
-m_Voxels(other.m_Voxels)
+m_Width(other.m_Width),
+m_Height(other.m_Height),
+m_Depth(other.m_Depth),
+m_CellSize(other.m_CellSize),
+m_Field(other.m_Field),
+m_Gradient(other.m_Gradient),
+m_FieldCol(other.m_FieldCol),
+m_Bounds(other.m_Bounds),
+m_PosVersion(other.m_PosVersion),
+m_StrengthVersion(other.m_StrengthVersion),
+m_ColVersion(other.m_ColVersion),
+m_FieldCutoff(other.m_FieldCutoff),
+m_FieldColour(other.m_FieldColour),
+m_FieldSerial(1),
+m_MeshSerial(0),
+m_MeshIsolevel(0),
+m_Isolevel(0),
+m_LockVoxels(other.m_LockVoxels)
 {
 	PDataDirty();
+	m_Slabs.resize(m_Width+1);
+	// the pdata is copied, so make sure the field gets remade
+	m_PosVersion=0;
 }
 
 BlobbyPrimitive* BlobbyPrimitive::Clone() const 
@@ -101,67 +158,349 @@ void BlobbyPrimitive::AddInfluence(const dVector &Vert, float Strength)
 	m_PosData->push_back(Vert); 
 	m_StrengthData->push_back(Strength); 
 	m_ColData->push_back(dColour(1,1,1)); 
+	GetDataRaw("p")->Touch();
 }	
 
-float BlobbyPrimitive::Sample(const dVector &pos)
+void BlobbyPrimitive::LockVoxels()
 {
-	float val=0;
+	m_LockVoxels=true;
+	// the whole field may have been written to
+	for (unsigned int x=0; x<=m_Width; x++)
+	{
+		m_Bounds[x].MinY=0;
+		m_Bounds[x].MaxY=m_Height;
+		m_Bounds[x].MinZ=0;
+		m_Bounds[x].MaxZ=m_Depth;
+	}
+	m_FieldColour=true;
+	m_FieldSerial++;
+}
+
+void BlobbyPrimitive::UpdateField(float isolevel, bool colour)
+{
+	if (m_LockVoxels) return;
+	
+	float cutoff=fabs(isolevel)*BLOBBY_CUTOFF;
+	if (cutoff<0.000001) cutoff=0.000001;
+	
+	unsigned int posversion=GetDataRaw("p")->GetVersion();
+	unsigned int strengthversion=GetDataRaw("s")->GetVersion();
+	unsigned int colversion=GetDataRaw("c")->GetVersion();
+	if (posversion==m_PosVersion && strengthversion==m_StrengthVersion && 
+		(!colour || colversion==m_ColVersion) && colour==m_FieldColour && 
+		cutoff==m_FieldCutoff)
+	{
+		return;
+	}
+	
+	m_PosVersion=posversion;
+	m_StrengthVersion=strengthversion;
+	m_ColVersion=colversion;
+	m_FieldColour=colour;
+	m_FieldCutoff=cutoff;
+	m_FieldSerial++;
+	
+	// work out the lattice box each influence reaches
+	int size[3] = { (int)m_Width, (int)m_Height, (int)m_Depth };
+	m_Influences.clear();
 	for (unsigned int n=0; n<m_PosData->size(); n++)
 	{
-		float distance=fabs((*m_PosData)[n].distsq(pos));
-		if (distance>0)
+		Influence inf;
+		inf.Pos=(*m_PosData)[n];
+		inf.Col=(*m_ColData)[n];
+		inf.Strength=(*m_StrengthData)[n];
+		if (inf.Strength==0) continue;
+		
+		inf.RadiusSq=fabs(inf.Strength)/cutoff;
+		inf.InvRadiusSq=1/inf.RadiusSq;
+		float radius=sqrt(inf.RadiusSq);
+		
+		bool outside=false;
+		for (int a=0; a<3; a++)
 		{
-			val+=(*m_StrengthData)[n]*(1/distance);
+			float cell=m_CellSize.arr()[a];
+			float pos=inf.Pos.arr()[a];
+			inf.Min[a]=(int)ceil((pos-radius)/cell);
+			inf.Max[a]=(int)floor((pos+radius)/cell);
+			if (inf.Min[a]<0) inf.Min[a]=0;
+			if (inf.Max[a]>size[a]) inf.Max[a]=size[a];
+			if (inf.Min[a]>inf.Max[a]) outside=true;
 		}
+		if (!outside) m_Influences.push_back(inf);
 	}
-	return val;
+	
+	BlobbySplatJob job(this);
+	WorkerPool::Get()->Run(job,m_Width+1,1);
 }
 
-float BlobbyPrimitive::SampleCol(const dVector &pos, dColour &col)
+void BlobbyPrimitive::SplatPlane(unsigned int x)
 {
-	float val=0;
-	col=dColour(0,0,0);
+	unsigned int rowsize=m_Depth+1;
+	PlaneBounds &bounds=m_Bounds[x];
 	
-	for (unsigned int n=0; n<m_PosData->size(); n++)
+	// clear what was written last time
+	if (!bounds.Empty())
+	{
+		for (int y=bounds.MinY; y<=bounds.MaxY; y++)
+		{
+			unsigned int row=LatticeIndex(x,y,0);
+			for (int z=bounds.MinZ; z<=bounds.MaxZ; z++)
+			{
+				m_Field[row+z]=0;
+				m_Gradient[row+z]=dVector(0,0,0);
+				m_FieldCol[row+z]=dColour(0,0,0);
+			}
+		}
+	}
+	bounds.Clear();
+	
+	float px=x*m_CellSize.x;
+	for (unsigned int n=0; n<m_Influences.size(); n++)
 	{
-		float distance=fabs((*m_PosData)[n].distsq(pos));
-		if (distance>0)
+		const Influence &inf=m_Influences[n];
+		if ((int)x<inf.Min[0] || (int)x>inf.Max[0]) continue;
+		
+		if (bounds.Empty())
 		{
-			float mul=1/distance;
-			val+=(*m_StrengthData)[n]*mul;
+			bounds.MinY=inf.Min[1]; bounds.MaxY=inf.Max[1];
+			bounds.MinZ=inf.Min[2]; bounds.MaxZ=inf.Max[2];
+		}
+		else
+		{
+			bounds.MinY=min(bounds.MinY,inf.Min[1]); bounds.MaxY=max(bounds.MaxY,inf.Max[1]);
+			bounds.MinZ=min(bounds.MinZ,inf.Min[2]); bounds.MaxZ=max(bounds.MaxZ,inf.Max[2]);
+		}
+		
+		float dx=px-inf.Pos.x;
+		for (int y=inf.Min[1]; y<=inf.Max[1]; y++)
+		{
+			float dy=y*m_CellSize.y-inf.Pos.y;
+			float dxy=dx*dx+dy*dy;
+			if (dxy>=inf.RadiusSq) continue;
 			
-			//col+=(*m_ColData)[n]*mul;
+			unsigned int row=(x*(m_Height+1)+y)*rowsize;
+			for (int z=inf.Min[2]; z<=inf.Max[2]; z++)
+			{
+				float dz=z*m_CellSize.z-inf.Pos.z;
+				float distsq=dxy+dz*dz;
+				if (distsq>=inf.RadiusSq || distsq<=0) continue;
+				
+				// s/d^2 with the value at the cutoff radius taken off, 
+				// so it falls smoothly to zero
+				float inv=1/distsq;
+				float weight=inv-inf.InvRadiusSq;
+				m_Field[row+z]+=inf.Strength*weight;
+				
+				// and its gradient, -2s(p-q)/d^4
+				float g=-2*inf.Strength*inv*inv;
+				dVector &grad=m_Gradient[row+z];
+				grad.x+=g*dx;
+				grad.y+=g*dy;
+				grad.z+=g*dz;
+				
+				if (m_FieldColour)
+				{
+					dColour &col=m_FieldCol[row+z];
+					col.r+=inf.Col.r*weight;
+					col.g+=inf.Col.g*weight;
+					col.b+=inf.Col.b*weight;
+				}
+			}
+		}
+	}
+}
 
-			col.r+=(*m_ColData)[n].r*mul;
-			col.g+=(*m_ColData)[n].g*mul;
-			col.b+=(*m_ColData)[n].b*mul;
+bool BlobbyPrimitive::ActiveRegion(unsigned int x, int &miny, int &maxy, int &minz, int &maxz, bool cells) const
+{
+	// the lattice edges (or cells) starting in this plane can only be 
+	// crossed if one of their ends was written to, which could be in 
+	// the next plane or one step up in y or z
+	miny=m_Bounds[x].MinY; maxy=m_Bounds[x].MaxY;
+	minz=m_Bounds[x].MinZ; maxz=m_Bounds[x].MaxZ;
+	if (x<m_Width && !m_Bounds[x+1].Empty())
+	{
+		if (m_Bounds[x].Empty())
+		{
+			miny=m_Bounds[x+1].MinY; maxy=m_Bounds[x+1].MaxY;
+			minz=m_Bounds[x+1].MinZ; maxz=m_Bounds[x+1].MaxZ;
 		}
-	}		
-	return val;	
+		else
+		{
+			miny=min(miny,m_Bounds[x+1].MinY); maxy=max(maxy,m_Bounds[x+1].MaxY);
+			minz=min(minz,m_Bounds[x+1].MinZ); maxz=max(maxz,m_Bounds[x+1].MaxZ);
+		}
+	}
+	if (miny>maxy) return false;
+	
+	miny=max(miny-1,0);
+	minz=max(minz-1,0);
+	if (cells)
+	{
+		maxy=min(maxy,(int)m_Height-1);
+		maxz=min(maxz,(int)m_Depth-1);
+	}
+	return miny<=maxy && minz<=maxz;
 }
 
-void BlobbyPrimitive::Render()
+dVector BlobbyPrimitive::LatticeGradient(unsigned int x, unsigned int y, unsigned int z) const
 {
+	// central differences, for fields without influences
+	unsigned int x0=x>0?x-1:x, x1=x<m_Width?x+1:x;
+	unsigned int y0=y>0?y-1:y, y1=y<m_Height?y+1:y;
+	unsigned int z0=z>0?z-1:z, z1=z<m_Depth?z+1:z;
+	return dVector(m_Field[LatticeIndex(x1,y,z)]-m_Field[LatticeIndex(x0,y,z)],
+	               m_Field[LatticeIndex(x,y1,z)]-m_Field[LatticeIndex(x,y0,z)],
+	               m_Field[LatticeIndex(x,y,z1)]-m_Field[LatticeIndex(x,y,z0)]);
+}
 
-    if (!m_LockVoxels)
-    {
-        for (unsigned int i=0; i<m_Voxels.size(); i++)
-        {
-            for (int c=0; c<8; c++)
-            {
-                dVector pos = m_Voxels[i].p[c];
-                
-                if (m_State.Hints & HINT_VERTCOLS)
-                {
-                    m_Voxels[i].val[c]=SampleCol(pos,m_Voxels[i].col[c]);
-                }
-                else
-                {
-                    m_Voxels[i].val[c]=Sample(pos);
-                }
-            }
-        }
-    }
+void BlobbyPrimitive::MakeVertices(unsigned int x)
+{
+	Slab &slab=m_Slabs[x];
+	slab.Verts.clear();
+	slab.Normals.clear();
+	slab.Colours.clear();
+	
+	int miny,maxy,minz,maxz;
+	if (!ActiveRegion(x,miny,maxy,minz,maxz,false)) return;
+	
+	unsigned int stride[3] = { (m_Height+1)*(m_Depth+1), m_Depth+1, 1 };
+	unsigned int size[3] = { m_Width, m_Height, m_Depth };
+	
+	for (int y=miny; y<=maxy; y++)
+	{
+		for (int z=minz; z<=maxz; z++)
+		{
+			unsigned int pos[3] = { x, (unsigned int)y, (unsigned int)z };
+			unsigned int a=LatticeIndex(x,y,z);
+			float vala=m_Field[a];
+			bool ina=vala<m_Isolevel;
+			
+			for (int axis=0; axis<3; axis++)
+			{
+				if (pos[axis]>=size[axis]) continue;
+				unsigned int b=a+stride[axis];
+				float valb=m_Field[b];
+				if ((valb<m_Isolevel)==ina) continue;
+				
+				float mu=(m_Isolevel-vala)/(valb-vala);
+				dVector point(x*m_CellSize.x,y*m_CellSize.y,z*m_CellSize.z);
+				point.arr()[axis]+=mu*m_CellSize.arr()[axis];
+				
+				dVector grada,gradb;
+				if (m_LockVoxels)
+				{
+					grada=LatticeGradient(x,y,z);
+					gradb=LatticeGradient(axis==0?x+1:x,axis==1?y+1:y,axis==2?z+1:z);
+				}
+				else
+				{
+					grada=m_Gradient[a];
+					gradb=m_Gradient[b];
+				}
+				// the field falls away from the surface
+				dVector normal=-lerp(grada,gradb,mu);
+				if (normal.magsq()>0) normal.normalise();
+				
+				dColour col;
+				const dColour &cola=m_FieldCol[a];
+				const dColour &colb=m_FieldCol[b];
+				col.r=cola.r+mu*(colb.r-cola.r);
+				col.g=cola.g+mu*(colb.g-cola.g);
+				col.b=cola.b+mu*(colb.b-cola.b);
+				
+				m_EdgeVerts[a*3+axis]=slab.Verts.size();
+				slab.Verts.push_back(point);
+				slab.Normals.push_back(normal);
+				slab.Colours.push_back(col);
+			}
+		}
+	}
+}
+
+void BlobbyPrimitive::MakeTriangles(unsigned int x)
+{
+	Slab &slab=m_Slabs[x];
+	slab.Index.clear();
+	
+	int miny,maxy,minz,maxz;
+	if (x>=m_Width || !ActiveRegion(x,miny,maxy,minz,maxz,true)) return;
+	
+	unsigned int corner[8];
+	for (int c=0; c<8; c++)
+	{
+		corner[c]=LatticeIndex(CornerOffset[c][0],CornerOffset[c][1],CornerOffset[c][2]);
+	}
+	
+	for (int y=miny; y<=maxy; y++)
+	{
+		for (int z=minz; z<=maxz; z++)
+		{
+			unsigned int base=LatticeIndex(x,y,z);
+			
+			//  Determine the index into the edge table which
+			//  tells us which vertices are inside of the surface
+			int cubeindex=0;
+			for (int c=0; c<8; c++)
+			{
+				if (m_Field[base+corner[c]] < m_Isolevel) cubeindex |= 1<<c;
+			}
+			
+			// Cube is entirely in/out of the surface 
+			if (ImplicitSurfaceEdges[cubeindex] == 0) continue;
+			
+			for (int i=0; ImplicitSurfaceTriangles[cubeindex][i]!=-1; i++)
+			{
+				const int *edge=EdgeOffset[ImplicitSurfaceTriangles[cubeindex][i]];
+				unsigned int lattice=LatticeIndex(x+edge[0],y+edge[1],z+edge[2]);
+				slab.Index.push_back(m_Slabs[x+edge[0]].Offset+m_EdgeVerts[lattice*3+edge[3]]);
+			}
+		}
+	}
+}
+
+void BlobbyPrimitive::Polygonise(float isolevel)
+{
+	if (m_MeshSerial==m_FieldSerial && m_MeshIsolevel==isolevel) return;
+	m_MeshSerial=m_FieldSerial;
+	m_MeshIsolevel=isolevel;
+	m_Isolevel=isolevel;
+	
+	m_EdgeVerts.resize(m_Field.size()*3);
+	
+	BlobbyVertexJob vertjob(this);
+	WorkerPool::Get()->Run(vertjob,m_Width+1,1);
+	
+	unsigned int offset=0;
+	for (unsigned int x=0; x<=m_Width; x++)
+	{
+		m_Slabs[x].Offset=offset;
+		offset+=m_Slabs[x].Verts.size();
+	}
+	
+	BlobbyTriangleJob trijob(this);
+	WorkerPool::Get()->Run(trijob,m_Width,1);
+	
+	// join the slabs together
+	m_Verts.clear();
+	m_Normals.clear();
+	m_Colours.clear();
+	m_Index.clear();
+	for (unsigned int x=0; x<=m_Width; x++)
+	{
+		const Slab &slab=m_Slabs[x];
+		m_Verts.insert(m_Verts.end(),slab.Verts.begin(),slab.Verts.end());
+		m_Normals.insert(m_Normals.end(),slab.Normals.begin(),slab.Normals.end());
+		m_Colours.insert(m_Colours.end(),slab.Colours.begin(),slab.Colours.end());
+		m_Index.insert(m_Index.end(),slab.Index.begin(),slab.Index.end());
+	}
+}
+
+void BlobbyPrimitive::Render()
+{
+	UpdateField(1,m_State.Hints & HINT_VERTCOLS);
+	Polygonise(1);
+	
+	if (m_Index.empty()) return;
 
 	if (m_State.Hints & HINT_SPHERE_MAP)
 	{
@@ -171,13 +510,26 @@ void BlobbyPrimitive::Render()
 		glTexGeni(GL_T, GL_TEXTURE_GEN_MODE, GL_SPHERE_MAP);
 	}
 
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	glVertexPointer(3,GL_FLOAT,sizeof(dVector),(void*)m_Verts[0].arr());
+	glNormalPointer(GL_FLOAT,sizeof(dVector),(void*)m_Normals[0].arr());
+
 	if (m_State.Hints & HINT_SOLID)
 	{
-		glBegin(GL_TRIANGLES);
-		Draw(1, true, m_State.Hints & HINT_VERTCOLS);
-		glEnd();
+		if (m_State.Hints & HINT_VERTCOLS)
+		{
+			glEnableClientState(GL_COLOR_ARRAY);
+			glColorPointer(4,GL_FLOAT,sizeof(dColour),(void*)m_Colours[0].arr());
+		}
+		else
+		{
+			glDisableClientState(GL_COLOR_ARRAY);
+		}
+		glDrawElements(GL_TRIANGLES,m_Index.size(),GL_UNSIGNED_INT,&m_Index[0]);
 	}
 
+	glDisableClientState(GL_COLOR_ARRAY);
+	
 	if (m_State.Hints & HINT_WIRE)
 	{
 		glPolygonOffset(1,1);
@@ -189,9 +541,7 @@ void BlobbyPrimitive::Render()
 			glEnable(GL_LINE_STIPPLE);
 			glLineStipple(m_State.StippleFactor, m_State.StipplePattern);
 		}
-		glBegin(GL_TRIANGLES);
-		Draw(1, false, false);
-		glEnd();
+		glDrawElements(GL_TRIANGLES,m_Index.size(),GL_UNSIGNED_INT,&m_Index[0]);
 		glPolygonMode(GL_FRONT_AND_BACK,GL_FILL);
 		glEnable(GL_LIGHTING);
 		if ((m_State.Hints & HINT_WIRE_STIPPLED) > HINT_WIRE)
@@ -200,6 +550,9 @@ void BlobbyPrimitive::Render()
 		}
 	}
 
+	glEnableClientState(GL_COLOR_ARRAY);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+
 	if (m_State.Hints & HINT_SPHERE_MAP)
 	{
 		glDisable(GL_TEXTURE_GEN_S);
@@ -240,289 +593,22 @@ void BlobbyPrimitive::ApplyTransform(bool ScaleRotOnly)
 		}
 	}
 	
+	GetDataRaw("p")->Touch();
 	GetState()->Transform.init();
 }
 
-// this implicit surface implementation is modified from Paul Bourke's which can be found here:
-// http://astronomy.swin.edu.au/~pbourke/modelling/polygonise/
-
-void BlobbyPrimitive::Draw(float isolevel, bool calcnormals, bool colour)
-{
-   int i;
-   int cubeindex;
-   dVertex vertlist[12];
-
-	for (unsigned int cell=0; cell<m_Voxels.size(); cell++)
-	{ 
-		//  Determine the index into the edge table which
-		//  tells us which vertices are inside of the surface
-		cubeindex = 0;
-		if (m_Voxels[cell].val[0] < isolevel) cubeindex |= 1;
-		if (m_Voxels[cell].val[1] < isolevel) cubeindex |= 2;
-		if (m_Voxels[cell].val[2] < isolevel) cubeindex |= 4;
-		if (m_Voxels[cell].val[3] < isolevel) cubeindex |= 8;
-		if (m_Voxels[cell].val[4] < isolevel) cubeindex |= 16;
-		if (m_Voxels[cell].val[5] < isolevel) cubeindex |= 32;
-		if (m_Voxels[cell].val[6] < isolevel) cubeindex |= 64;
-		if (m_Voxels[cell].val[7] < isolevel) cubeindex |= 128;
-
-		// Cube is entirely in/out of the surface 
-		if (ImplicitSurfaceEdges[cubeindex] != 0)
-		{
-
-			// Find the vertices where the surface intersects the cube
-			if (ImplicitSurfaceEdges[cubeindex] & 1) Interpolate(vertlist[0],isolevel,cell,0,1);
-			if (ImplicitSurfaceEdges[cubeindex] & 2) Interpolate(vertlist[1],isolevel,cell,1,2);
-			if (ImplicitSurfaceEdges[cubeindex] & 4) Interpolate(vertlist[2],isolevel,cell,2,3);
-			if (ImplicitSurfaceEdges[cubeindex] & 8) Interpolate(vertlist[3],isolevel,cell,3,0);
-			if (ImplicitSurfaceEdges[cubeindex] & 16) Interpolate(vertlist[4],isolevel,cell,4,5);
-			if (ImplicitSurfaceEdges[cubeindex] & 32) Interpolate(vertlist[5],isolevel,cell,5,6);
-			if (ImplicitSurfaceEdges[cubeindex] & 64) Interpolate(vertlist[6],isolevel,cell,6,7);
-			if (ImplicitSurfaceEdges[cubeindex] & 128) Interpolate(vertlist[7],isolevel,cell,7,4);
-			if (ImplicitSurfaceEdges[cubeindex] & 256) Interpolate(vertlist[8],isolevel,cell,0,4);
-			if (ImplicitSurfaceEdges[cubeindex] & 512) Interpolate(vertlist[9],isolevel,cell,1,5);
-			if (ImplicitSurfaceEdges[cubeindex] & 1024) Interpolate(vertlist[10],isolevel,cell,2,6);
-			if (ImplicitSurfaceEdges[cubeindex] & 2048) Interpolate(vertlist[11],isolevel,cell,3,7);
-
-			// Create the triangle 
-			for (i=0; ImplicitSurfaceTriangles[cubeindex][i]!=-1; i+=3) 
-			{
-				dVertex a=vertlist[ImplicitSurfaceTriangles[cubeindex][i]];
-				dVertex b=vertlist[ImplicitSurfaceTriangles[cubeindex][i+1]];
-				dVertex c=vertlist[ImplicitSurfaceTriangles[cubeindex][i+2]];
-			
-				dVector normal;
-				float val=0;
-				
-				if (calcnormals)
-   				{
-					val=Sample(a.point);
-					normal.x=val-Sample(a.point+dVector(0.001,0,0));
-					normal.y=val-Sample(a.point+dVector(0,0.001,0));
-					normal.z=val-Sample(a.point+dVector(0,0,0.001));
-					normal.normalise();
-					glNormal3fv(normal.arr());
-				}
-				
-				if (colour) glColor3fv(a.col.arr());
-   				glVertex3fv(a.point.arr());
-				
-				if (calcnormals)
-   				{
-					val=Sample(b.point);
-					normal.x=val-Sample(b.point+dVector(0.001,0,0));
-					normal.y=val-Sample(b.point+dVector(0,0.001,0));
-					normal.z=val-Sample(b.point+dVector(0,0,0.001));
-					normal.normalise();
-					glNormal3fv(normal.arr());
-				}
-				
- 				if (colour) glColor3fv(b.col.arr());
-				glVertex3fv(b.point.arr());
-				
-				if (calcnormals)
-   				{
-					val=Sample(c.point);
-					normal.x=val-Sample(c.point+dVector(0.001,0,0));
-					normal.y=val-Sample(c.point+dVector(0,0.001,0));
-					normal.z=val-Sample(c.point+dVector(0,0,0.001));
-					normal.normalise();
-					glNormal3fv(normal.arr());
-				}
-				
-				if (colour) glColor3fv(c.col.arr());
-				glVertex3fv(c.point.arr());
-			}
-		}
-	}
-}
-
 // generate a poly mesh
 void BlobbyPrimitive::ConvertToPoly(PolyPrimitive &poly, float isolevel)
 {
-	if (!m_LockVoxels)
-	{
-		// evaluate the field
-		for (unsigned int i=0; i<m_Voxels.size(); i++)
-		{
-			for (int c=0; c<8; c++)
-			{
-				dVector pos = m_Voxels[i].p[c];
-
-				if (m_State.Hints & HINT_VERTCOLS)
-				{
-					m_Voxels[i].val[c]=SampleCol(pos,m_Voxels[i].col[c]);
-				}
-				else
-				{
-					m_Voxels[i].val[c]=Sample(pos);
-				}
-			}
-		}
-	}
-
-	int i;
-	int cubeindex;
-	dVertex vertlist[12];
-	dVector grads[12]; // gradient calculated from field values
-
-	for (unsigned int cell=0; cell<m_Voxels.size(); cell++)
-	{
-		//  Determine the index into the edge table which
-		//  tells us which vertices are inside of the surface
-		cubeindex = 0;
-		if (m_Voxels[cell].val[0] < isolevel) cubeindex |= 1;
-		if (m_Voxels[cell].val[1] < isolevel) cubeindex |= 2;
-		if (m_Voxels[cell].val[2] < isolevel) cubeindex |= 4;
-		if (m_Voxels[cell].val[3] < isolevel) cubeindex |= 8;
-		if (m_Voxels[cell].val[4] < isolevel) cubeindex |= 16;
-		if (m_Voxels[cell].val[5] < isolevel) cubeindex |= 32;
-		if (m_Voxels[cell].val[6] < isolevel) cubeindex |= 64;
-		if (m_Voxels[cell].val[7] < isolevel) cubeindex |= 128;
-
-		// Cube is entirely in/out of the surface
-		if (ImplicitSurfaceEdges[cubeindex] != 0)
-		{
-			// Find the vertices where the surface intersects the cube
-			if (ImplicitSurfaceEdges[cubeindex] & 1) Interpolate(vertlist[0], grads[0], isolevel, cell, 0, 1);
-			if (ImplicitSurfaceEdges[cubeindex] & 2) Interpolate(vertlist[1], grads[1], isolevel, cell, 1, 2);
-			if (ImplicitSurfaceEdges[cubeindex] & 4) Interpolate(vertlist[2], grads[2], isolevel, cell, 2, 3);
-			if (ImplicitSurfaceEdges[cubeindex] & 8) Interpolate(vertlist[3], grads[3], isolevel, cell, 3, 0);
-			if (ImplicitSurfaceEdges[cubeindex] & 16) Interpolate(vertlist[4], grads[4], isolevel, cell, 4, 5);
-			if (ImplicitSurfaceEdges[cubeindex] & 32) Interpolate(vertlist[5], grads[5], isolevel, cell, 5, 6);
-			if (ImplicitSurfaceEdges[cubeindex] & 64) Interpolate(vertlist[6], grads[6], isolevel, cell, 6, 7);
-			if (ImplicitSurfaceEdges[cubeindex] & 128) Interpolate(vertlist[7], grads[7], isolevel, cell, 7, 4);
-			if (ImplicitSurfaceEdges[cubeindex] & 256) Interpolate(vertlist[8], grads[8], isolevel, cell, 0, 4);
-			if (ImplicitSurfaceEdges[cubeindex] & 512) Interpolate(vertlist[9], grads[9], isolevel, cell, 1, 5);
-			if (ImplicitSurfaceEdges[cubeindex] & 1024) Interpolate(vertlist[10], grads[10], isolevel, cell, 2, 6);
-			if (ImplicitSurfaceEdges[cubeindex] & 2048) Interpolate(vertlist[11], grads[11], isolevel, cell, 3, 7);
-
-			// Create the triangle
-			for (i=0; ImplicitSurfaceTriangles[cubeindex][i]!=-1; i+=3)
-			{
-				int idxa = ImplicitSurfaceTriangles[cubeindex][i];
-				int idxb = ImplicitSurfaceTriangles[cubeindex][i + 1];
-				int idxc = ImplicitSurfaceTriangles[cubeindex][i + 2];
-				dVertex a=vertlist[idxa];
-				dVertex b=vertlist[idxb];
-				dVertex c=vertlist[idxc];
-
-				dVector normal;
-				float val=0;
-
-				if (m_LockVoxels) // when converted from voxels use the cell gradient
-				{
-					normal = grads[idxa];
-				}
-				else
-				{
-					val=Sample(a.point);
-					normal.x=val-Sample(a.point+dVector(0.001,0,0));
-					normal.y=val-Sample(a.point+dVector(0,0.001,0));
-					normal.z=val-Sample(a.point+dVector(0,0,0.001));
-					normal.normalise();
-				}
-
-				poly.AddVertex(dVertex(a.point,normal,a.col));
-
-				if (m_LockVoxels)
-				{
-					normal = grads[idxb];
-				}
-				else
-				{
-					val=Sample(b.point);
-					normal.x=val-Sample(b.point+dVector(0.001,0,0));
-					normal.y=val-Sample(b.point+dVector(0,0.001,0));
-					normal.z=val-Sample(b.point+dVector(0,0,0.001));
-					normal.normalise();
-				}
-
-				poly.AddVertex(dVertex(b.point,normal,b.col));
-
-				if (m_LockVoxels)
-				{
-					normal = grads[idxc];
-				}
-				else
-				{
-					val=Sample(c.point);
-					normal.x=val-Sample(c.point+dVector(0.001,0,0));
-					normal.y=val-Sample(c.point+dVector(0,0.001,0));
-					normal.z=val-Sample(c.point+dVector(0,0,0.001));
-					normal.normalise();
-				}
-
-				poly.AddVertex(dVertex(c.point,normal,c.col));
-			}
-		}
-	}
-}
-
-//   Linearly interpolate the position where an isosurface cuts
-//   an edge between two vertices, each with their own scalar value
-void BlobbyPrimitive::Interpolate(dVertex &vert, float isolevel, int cell, int a, int b)
-{
-	float mu;
-
-	dVector posa = m_Voxels[cell].p[a];
-	dVector posb = m_Voxels[cell].p[b];
-	dColour cola = m_Voxels[cell].col[a];
-	dColour colb = m_Voxels[cell].col[b];
-	float vala = m_Voxels[cell].val[a];
-	float valb = m_Voxels[cell].val[b];
-
-	mu = (isolevel - vala) / (valb - vala);
-	vert.point.x = posa.x + mu * (posb.x - posa.x);
-	vert.point.y = posa.y + mu * (posb.y - posa.y);
-	vert.point.z = posa.z + mu * (posb.z - posa.z);
-
-	vert.col.r = cola.r + mu * (colb.r - cola.r);
-	vert.col.g = cola.g + mu * (colb.g - cola.g);
-	vert.col.b = cola.b + mu * (colb.b - cola.b);
-}
-
-inline float BlobbyPrimitive::SafeVal(int cell, int a)
-{
-	if ((cell >= 0) && ((unsigned)cell < m_Voxels.size()))
-	{
-		return m_Voxels[cell].val[a];
-	}
-	else
+	if (isolevel<BLOBBY_MIN_ISOLEVEL) isolevel=BLOBBY_MIN_ISOLEVEL;
+	UpdateField(isolevel,m_State.Hints & HINT_VERTCOLS);
+	Polygonise(isolevel);
+	
+	// the mesh is shared, but the poly gets a plain triangle list 
+	// so it can still be made faceted
+	for (unsigned int i=0; i<m_Index.size(); i++)
 	{
-		return 0;
+		unsigned int v=m_Index[i];
+		poly.AddVertex(dVertex(m_Verts[v],m_Normals[v],m_Colours[v]));
 	}
 }
-
-// Same as above, but also calculate the gradient
-void BlobbyPrimitive::Interpolate(dVertex &vert, dVector &grad, float isolevel, int cell, int a, int b)
-{
-	float mu;
-
-	dVector posa = m_Voxels[cell].p[a];
-	dVector posb = m_Voxels[cell].p[b];
-	dColour cola = m_Voxels[cell].col[a];
-	dColour colb = m_Voxels[cell].col[b];
-	float vala = m_Voxels[cell].val[a];
-	float valb = m_Voxels[cell].val[b];
-
-	dVector grada(SafeVal(cell - m_Depth * m_Height, a) - SafeVal(cell + m_Depth * m_Height, a),
-				  SafeVal(cell - m_Depth, a) - SafeVal(cell + m_Depth, a),
-				  SafeVal(cell - 1, a) - SafeVal(cell + 1, a));
-	dVector gradb(SafeVal(cell - m_Depth * m_Height, b) - SafeVal(cell + m_Depth * m_Height, b),
-				  SafeVal(cell - m_Depth, b) - SafeVal(cell + m_Depth, b),
-				  SafeVal(cell - 1, b) - SafeVal(cell + 1, b));
-
-	mu = (isolevel - vala) / (valb - vala);
-	vert.point.x = posa.x + mu * (posb.x - posa.x);
-	vert.point.y = posa.y + mu * (posb.y - posa.y);
-	vert.point.z = posa.z + mu * (posb.z - posa.z);
-
-	vert.col.r = cola.r + mu * (colb.r - cola.r);
-	vert.col.g = cola.g + mu * (colb.g - cola.g);
-	vert.col.b = cola.b + mu * (colb.b - cola.b);
-
-	grad = lerp(grada, gradb, mu);
-	grad.normalise();
-}
-
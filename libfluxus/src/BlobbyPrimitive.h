@@ -30,6 +30,15 @@ namespace Fluxus
 /// generated by defining spherical influences
 /// which are summed, and meshed to give a smooth
 /// polygonal surface.
+///
+/// The field is kept on a lattice with a point at 
+/// each cell corner. Influences only reach as far 
+/// as where they fall below a small fraction of the
+/// isolevel, so only the lattice near them is touched,
+/// and only cells in touched regions are meshed. The
+/// mesh is built as an indexed triangle list, in 
+/// slabs split between threads, and is only rebuilt
+/// when the influences change.
 class BlobbyPrimitive : public Primitive
 {
 public:
@@ -47,6 +56,7 @@ public:
 	virtual void RecalculateNormals(bool smooth);
 	virtual void ApplyTransform(bool ScaleRotOnly=false);
 	virtual string GetTypeName() { return "BlobbyPrimitive"; }
+	virtual bool IsLit() { return !(m_State.Hints & HINT_UNLIT); }
 	virtual Evaluator *MakeEvaluator() { return NULL; }
 	///@}
 
@@ -56,29 +66,67 @@ public:
 	virtual void AddInfluence(const dVector &Vert, float Strength);
 
 	/// Fills supplied polygon primitive with the mesh
-	/// (needs to be an empty triangle list)
+	/// (needs to be an empty triangle list), isolevels
+	/// below 0.001 are clamped to it
 	void ConvertToPoly(PolyPrimitive &poly, float isolevel=1.0f);
 
-	class Cell
+	///////////////////////////////////////////////////
+	///@name Field access
+	/// For filling in the field directly, call LockVoxels()
+	/// afterwards to stop the influences overwriting it.
+	///@{
+	unsigned int LatticeIndex(unsigned int x, unsigned int y, unsigned int z) const 
+		{ return (x*(m_Height+1)+y)*(m_Depth+1)+z; }
+	vector<float> &GetField() { return m_Field; }
+	vector<dColour> &GetFieldColours() { return m_FieldCol; }
+	void LockVoxels();
+	///@}
+
+protected:
+
+	class Influence
 	{
 	public:
-		dVector p[8];
-		float val[8];
-		dColour col[8];
+		dVector Pos;
+		dColour Col;
+		float Strength;
+		float RadiusSq;
+		float InvRadiusSq;
+		int Min[3];
+		int Max[3];
 	};
 
-	vector<Cell> &GetVoxels() { return m_Voxels; }
+	// the region of each lattice plane that's been written to
+	class PlaneBounds
+	{
+	public:
+		void Clear() { MinY=MinZ=1; MaxY=MaxZ=0; }
+		bool Empty() const { return MinY>MaxY; }
+		int MinY,MaxY,MinZ,MaxZ;
+	};
 
-    void LockVoxels() { m_LockVoxels=true; }
+	// the part of the mesh made from one lattice plane
+	class Slab
+	{
+	public:
+		vector<dVector> Verts;
+		vector<dVector> Normals;
+		vector<dColour> Colours;
+		vector<unsigned int> Index;
+		unsigned int Offset;
+	};
 
-protected:
+	friend class BlobbySplatJob;
+	friend class BlobbyVertexJob;
+	friend class BlobbyTriangleJob;
 
-	void Draw(float isolevel, bool calcnormals, bool colour);
-	void Interpolate(dVertex &vert, float isolevel, int cell, int a, int b);
-	void Interpolate(dVertex &vert, dVector &grad, float isolevel, int cell, int a, int b);
-	float Sample(const dVector &pos);
-	float SampleCol(const dVector &pos, dColour &col);
-	inline float SafeVal(int cell, int a);
+	void UpdateField(float isolevel, bool colour);
+	void Polygonise(float isolevel);
+	void SplatPlane(unsigned int x);
+	void MakeVertices(unsigned int x);
+	void MakeTriangles(unsigned int x);
+	bool ActiveRegion(unsigned int x, int &miny, int &maxy, int &minz, int &maxz, bool cells) const;
+	dVector LatticeGradient(unsigned int x, unsigned int y, unsigned int z) const;
 
 	virtual void PDataDirty();
 
@@ -86,10 +134,36 @@ protected:
 	vector<float,FLX_ALLOC(float) > *m_StrengthData;
 	vector<dColour,FLX_ALLOC(dColour) > *m_ColData;
 
-	vector<Cell> m_Voxels;
 	unsigned m_Width;
 	unsigned m_Height;
 	unsigned m_Depth;
+	dVector m_CellSize;
+
+	// the lattice
+	vector<float> m_Field;
+	vector<dVector> m_Gradient;
+	vector<dColour> m_FieldCol;
+	vector<PlaneBounds> m_Bounds;
+	vector<Influence> m_Influences;
+
+	// what the field was last made from
+	unsigned int m_PosVersion;
+	unsigned int m_StrengthVersion;
+	unsigned int m_ColVersion;
+	float m_FieldCutoff;
+	bool m_FieldColour;
+	unsigned int m_FieldSerial;
+
+	// the mesh, and what it was made from
+	vector<int> m_EdgeVerts;
+	vector<Slab> m_Slabs;
+	vector<dVector> m_Verts;
+	vector<dVector> m_Normals;
+	vector<dColour> m_Colours;
+	vector<unsigned int> m_Index;
+	unsigned int m_MeshSerial;
+	float m_MeshIsolevel;
+	float m_Isolevel;
 
     bool m_LockVoxels;
 };
@@ -0,0 +1,186 @@
+// Copyright (C) 2010 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include <map>
+#include <math.h>
+#include "ConvexHull.h"
+
+using namespace Fluxus;
+
+namespace
+{
+
+class Face
+{
+public:
+	Face(const vector<dVector> &p, unsigned int a, unsigned int b, unsigned int c)
+	{
+		v[0]=a; v[1]=b; v[2]=c;
+		n=(p[b]-p[a]).cross(p[c]-p[a]);
+		float mag=n.mag();
+		if (mag>0) n/=mag;
+		d=n.dot(p[a]);
+		dead=false;
+	}
+	
+	float Distance(const dVector &p) const { return n.dot(p)-d; }
+	
+	unsigned int v[3];
+	dVector n;
+	float d;
+	bool dead;
+};
+
+}
+
+// a simple incremental hull, fine for the sizes of meshes 
+// we use for collision, and it's only built once per mesh
+bool Fluxus::ConvexHull(const vector<dVector> &points, vector<dVector> &hullpoints, vector<unsigned int> &triangles)
+{
+	hullpoints.clear();
+	triangles.clear();
+	if (points.size()<4) return false;
+
+	// scale the tolerance to the size of the thing
+	dBoundingBox box;
+	for (unsigned int i=0; i<points.size(); i++) box.expand(points[i]);
+	float eps=(box.max-box.min).mag()*0.00001f;
+	if (eps<=0) return false;
+	
+	// find a starting tetrahedron - the two furthest apart extremes in x...
+	unsigned int a=0, b=0;
+	for (unsigned int i=1; i<points.size(); i++)
+	{
+		if (points[i].x<points[a].x) a=i;
+		if (points[i].x>points[b].x) b=i;
+	}
+	if (points[a].dist(points[b])<eps) return false;
+	
+	// ...the furthest from that line
+	unsigned int c=a;
+	float best=0;
+	dVector ab=(points[b]-points[a]).normalise();
+	for (unsigned int i=0; i<points.size(); i++)
+	{
+		dVector ap=points[i]-points[a];
+		float dist=(ap-ab*ab.dot(ap)).mag();
+		if (dist>best) { best=dist; c=i; }
+	}
+	if (best<eps) return false;
+	
+	// ...and the furthest from that plane
+	Face base(points,a,b,c);
+	unsigned int d=a;
+	best=0;
+	for (unsigned int i=0; i<points.size(); i++)
+	{
+		float dist=fabs(base.Distance(points[i]));
+		if (dist>best) { best=dist; d=i; }
+	}
+	if (best<eps) return false;
+	
+	vector<Face> faces;
+	if (base.Distance(points[d])>0)
+	{
+		faces.push_back(Face(points,a,c,b));
+		faces.push_back(Face(points,a,b,d));
+		faces.push_back(Face(points,b,c,d));
+		faces.push_back(Face(points,c,a,d));
+	}
+	else
+	{
+		faces.push_back(Face(points,a,b,c));
+		faces.push_back(Face(points,a,d,b));
+		faces.push_back(Face(points,b,d,c));
+		faces.push_back(Face(points,c,d,a));
+	}
+	
+	map<pair<unsigned int,unsigned int>,unsigned int> edges;
+	vector<pair<unsigned int,unsigned int> > horizon;
+	
+	for (unsigned int p=0; p<points.size(); p++)
+	{
+		if (p==a || p==b || p==c || p==d) continue;
+		
+		// remove the faces this point can see
+		edges.clear();
+		bool visible=false;
+		for (unsigned int f=0; f<faces.size(); f++)
+		{
+			if (faces[f].dead) continue;
+			if (faces[f].Distance(points[p])>eps)
+			{
+				faces[f].dead=true;
+				visible=true;
+				for (int e=0; e<3; e++)
+				{
+					edges[pair<unsigned int,unsigned int>(faces[f].v[e],faces[f].v[(e+1)%3])]=f;
+				}
+			}
+		}
+		if (!visible) continue;
+		
+		// the horizon is the edges of the removed faces which aren't shared
+		horizon.clear();
+		for (map<pair<unsigned int,unsigned int>,unsigned int>::iterator e=edges.begin(); e!=edges.end(); ++e)
+		{
+			if (edges.find(pair<unsigned int,unsigned int>(e->first.second,e->first.first))==edges.end())
+			{
+				horizon.push_back(e->first);
+			}
+		}
+		
+		// and fill it in with a fan to the new point
+		for (unsigned int e=0; e<horizon.size(); e++)
+		{
+			faces.push_back(Face(points,horizon[e].first,horizon[e].second,p));
+		}
+		
+		// compact every so often, so we don't keep testing dead faces
+		if (faces.size()>64)
+		{
+			unsigned int live=0;
+			for (unsigned int f=0; f<faces.size(); f++)
+			{
+				if (!faces[f].dead) faces[live++]=faces[f];
+			}
+			faces.erase(faces.begin()+live,faces.end());
+		}
+	}
+	
+	// only keep the points the hull uses
+	map<unsigned int,unsigned int> remap;
+	for (unsigned int f=0; f<faces.size(); f++)
+	{
+		if (faces[f].dead) continue;
+		for (int e=0; e<3; e++)
+		{
+			map<unsigned int,unsigned int>::iterator i=remap.find(faces[f].v[e]);
+			if (i==remap.end())
+			{
+				remap[faces[f].v[e]]=hullpoints.size();
+				triangles.push_back(hullpoints.size());
+				hullpoints.push_back(points[faces[f].v[e]]);
+			}
+			else
+			{
+				triangles.push_back(i->second);
+			}
+		}
+	}
+	
+	return true;
+}
@@ -0,0 +1,33 @@
+// Copyright (C) 2010 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#ifndef N_CONVEXHULL
+#define N_CONVEXHULL
+
+#include <vector>
+#include "dada.h"
+
+namespace Fluxus
+{
+
+/// Builds the convex hull of the points as a list of outward facing 
+/// triangles, indexing into hullpoints. Returns false if the points 
+/// are flat or there aren't enough of them.
+bool ConvexHull(const vector<dVector> &points, vector<dVector> &hullpoints, vector<unsigned int> &triangles);
+
+}
+
+#endif
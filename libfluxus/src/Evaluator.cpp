@@ -26,3 +26,27 @@ Evaluator::~Evaluator()
 {
 }
 
+
+void Evaluator::Hits::Clear()
+{
+	Line.clear();
+	T.clear();
+	Element.clear();
+	Bary.clear();
+}
+
+void Evaluator::Hits::Add(unsigned int line, float t, unsigned int element, const dVector &bary)
+{
+	Line.push_back(line);
+	T.push_back(t);
+	Element.push_back(element);
+	Bary.push_back(bary);
+}
+
+void Evaluator::Hits::Append(const Hits &other)
+{
+	Line.insert(Line.end(),other.Line.begin(),other.Line.end());
+	T.insert(T.end(),other.T.begin(),other.T.end());
+	Element.insert(Element.end(),other.Element.begin(),other.Element.end());
+	Bary.insert(Bary.end(),other.Bary.begin(),other.Bary.end());
+}
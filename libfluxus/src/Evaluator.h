@@ -28,44 +28,72 @@ namespace Fluxus
 
 //////////////////////////////////////////////////
 /// The base Evaluator class. 
-/// Abstract interface for primitive evaluators
+/// Abstract interface for primitive evaluators.
+/// Results go into a Hits buffer, which can be 
+/// kept and reused so queries don't allocate, and
+/// pdata is only blended at the hits when asked for.
 class Evaluator
 {
 public:
 	Evaluator();
 	virtual ~Evaluator();
 	
-	class Blend 
+	/// The results of line or closest point queries
+	class Hits
 	{
 	public:
-		Blend(char t): m_Type(t) {}
-		string m_Name;
-		char m_Type;
-	};
-
-	template<class T>
-	class TypedBlend : public Blend
-	{	
-	public:		
-		TypedBlend(char t, T b) : Blend(t), m_Blend(b) {}
-		T m_Blend;
+		/// Keeps the memory for next time
+		void Clear();
+		unsigned int Size() const { return T.size(); }
+		void Add(unsigned int line, float t, unsigned int element, const dVector &bary);
+		void Append(const Hits &other);
+		
+		/// Which line (or point) of the query the hit is from
+		vector<unsigned int> Line;
+		/// The distance along the line, or from the point
+		vector<float> T;
+		/// The triangle (or whatever the primitive is made of)
+		vector<unsigned int> Element;
+		/// Weights for the element's vertices
+		vector<dVector> Bary;
 	};
 	
-	class Point
-	{
-	public:
-      float m_T; // the distance along the orginating ray
-      vector<Blend*> m_Blends;
-	};
+	/// Adds the hits along the line, in order from the start
+	virtual bool IntersectLine(const dVector &start, const dVector &end, Hits &hits)=0;
+	/// Lots of lines at once, maybe split between threads. 
+	/// The hits are in line order, then along each line.
+	virtual void IntersectLines(const vector<dVector> &starts, const vector<dVector> &ends, Hits &hits)=0;
+	/// Adds the nearest point on the surface
+	virtual bool ClosestPoint(const dVector &position, Hits &hits)=0;
 	
-	virtual bool IntersectLine(const dVector &start, const dVector &end,  vector<Point> &points)=0;
-	virtual Point ClosestPoint(const dVector &position)=0;
+	/// Blends a pdata array at each hit, returns false if 
+	/// it doesn't exist or isn't of this type
+	template<class T>
+	bool Interpolate(const string &name, const Hits &hits, vector<T> &result);
 	
-private:
-
-
+protected:
+	virtual PDataContainer *GetPData()=0;
+	/// The vertices making up an element
+	virtual void GetElement(unsigned int element, unsigned int *verts)=0;
 };
 
+template<class T>
+bool Evaluator::Interpolate(const string &name, const Hits &hits, vector<T> &result)
+{
+	vector<T,FLX_ALLOC(T) > *data=GetPData()->GetDataVec<T>(name);
+	if (data==NULL) return false;
+	
+	result.resize(hits.Size());
+	for (unsigned int i=0; i<hits.Size(); i++)
+	{
+		unsigned int v[3];
+		GetElement(hits.Element[i],v);
+		const dVector &bary=hits.Bary[i];
+		result[i]=(*data)[v[0]]*bary.x+(*data)[v[1]]*bary.y+(*data)[v[2]]*bary.z;
+	}
+	return true;
+}
+
 }
 
 #endif
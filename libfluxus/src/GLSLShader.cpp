@@ -352,6 +352,15 @@ void GLSLShader::SetColourArray(const string &name, const vector<dColour,FLX_ALL
 	#endif
 }
 
+void GLSLShader::SetMatrixArray(const string &name, const vector<dMatrix> &s)
+{
+	#ifdef GLSL
+	if (!m_Enabled || s.empty()) return;
+	GLuint param = glGetUniformLocation(m_Program, name.c_str());
+	glUniformMatrix4fv(param,s.size(),false,s[0].m[0]);
+	#endif
+}
+
 void GLSLShader::SetFloatAttrib(const string &name, const vector<float,FLX_ALLOC(float) > &s)
 {
 	#ifdef GLSL
@@ -88,6 +88,7 @@ public:
 	void SetFloatArray(const string &name, const vector<float,FLX_ALLOC(float) > &s);
 	void SetVectorArray(const string &name, const vector<dVector,FLX_ALLOC(dVector) > &s);
 	void SetColourArray(const string &name, const vector<dColour,FLX_ALLOC(dColour) > &s);
+	void SetMatrixArray(const string &name, const vector<dMatrix> &s);
 	///@}
 
 	/////////////////////////////////////////////
@@ -15,11 +15,13 @@
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
 #include <stdio.h>
+#include <algorithm>
 #include <float.h>
 #include "GenSkinWeightsPrimFunc.h"
 #include "Primitive.h"
 #include "SceneGraph.h"
 #include "Geometry.h"
+#include "BVH.h"
 
 using namespace Fluxus;
 
@@ -31,13 +33,50 @@ GenSkinWeightsPrimFunc::~GenSkinWeightsPrimFunc()
 {
 }
 
+// keeps the nearest few bones seen so far, nearest first
+class NearestBones : public BVH::NearestVisitor
+{
+public:
+	NearestBones(unsigned int count, const vector<pair<dVector,dVector> > &bones) :
+	m_Count(count), m_Bones(bones) {}
+	
+	void Reset(const dVector &point)
+	{
+		m_Point=point;
+		m_Nearest.clear();
+	}
+	
+	virtual float Visit(unsigned int item)
+	{
+		// ties go to the lowest bone, so it doesn't depend on the search order
+		pair<float,unsigned int> bone(PointLineDist(m_Point,m_Bones[item].first,m_Bones[item].second),item);
+		if (m_Nearest.size()<m_Count || bone<m_Nearest.back())
+		{
+			if (m_Nearest.size()==m_Count) m_Nearest.pop_back();
+			m_Nearest.insert(lower_bound(m_Nearest.begin(),m_Nearest.end(),bone),bone);
+		}
+		if (m_Nearest.size()<m_Count) return FLT_MAX;
+		// with a little slack, so bones at the same distance 
+		// (sharing a joint) aren't lost to rounding
+		float r=m_Nearest.back().first*1.0001f;
+		return r*r;
+	}
+	
+	vector<pair<float,unsigned int> > m_Nearest;
+
+private:
+	unsigned int m_Count;
+	const vector<pair<dVector,dVector> > &m_Bones;
+	dVector m_Point;
+};
+
 void GenSkinWeightsPrimFunc::Run(Primitive &prim, const SceneGraph &world)
 {
 	int rootid = GetArg<int>("skeleton-root",0);
 	float sharpness = GetArg<float>("sharpness",0);
+	int influences = GetArg<int>("influences",4);
 	vector<dVector, FLX_ALLOC(dVector) > *p = prim.GetDataVec<dVector>("p");
 	vector<TypedPData<float> *> weights;
-	int bone=0;
 	vector<pair<const SceneNode*,const SceneNode*> > skeleton;
 
 	const SceneNode *root = static_cast<const SceneNode *>(world.FindNode(rootid));
@@ -49,66 +88,91 @@ void GenSkinWeightsPrimFunc::Run(Primitive &prim, const SceneGraph &world)
 
 	world.GetConnections(root, skeleton);
 
-	// first pass, put inverse distances for each bone
+	// find the bone positions
+	vector<pair<dVector,dVector> > bones;
+	vector<dBoundingBox> boxes;
 	for (vector<pair<const SceneNode*,const SceneNode*> >::iterator i=skeleton.begin();
 		 i!=skeleton.end(); i++)
 	{
 		assert(i->first && i->second);
-
-		// make a skinweight pdata array
-		weights.push_back(new TypedPData<float>(prim.Size()));
-
-		// find the bone position
 		dVector startbone = world.GetGlobalTransform(i->first).transform(dVector(0,0,0));
 		dVector endbone   = world.GetGlobalTransform(i->second).transform(dVector(0,0,0));
-
-		for (unsigned int n=0; n<prim.Size(); n++)
-		{
-			float d=PointLineDist((*p)[n],startbone,endbone);
-			if (d==0) weights[bone]->m_Data[n]=2;
-			else weights[bone]->m_Data[n]=(1/d);
-		}
-
-		bone++;
+		bones.push_back(pair<dVector,dVector>(startbone,endbone));
+		
+		dBoundingBox box;
+		box.min=dVector(min(startbone.x,endbone.x),min(startbone.y,endbone.y),min(startbone.z,endbone.z));
+		box.max=dVector(max(startbone.x,endbone.x),max(startbone.y,endbone.y),max(startbone.z,endbone.z));
+		boxes.push_back(box);
 	}
+	
+	BVH bvh;
+	bvh.Build(boxes);
 
-	weights.push_back(new TypedPData<float>(prim.Size()));
-	for (unsigned int n=0; n<prim.Size(); n++)
+	// one more than the bones, as there is a node at each end
+	for (unsigned int bone=0; bone<=bones.size(); bone++)
 	{
-		weights[bone]->m_Data[n]=0;
+		weights.push_back(new TypedPData<float>(prim.Size()));
+		weights[bone]->m_Data.assign(prim.Size(),0);
 	}
 
-	// second pass, pow the weights to allow
-	// us to control the creasing
+	if (influences<1) influences=1;
+	NearestBones nearest(influences,bones);
 	for (unsigned int n=0; n<prim.Size(); n++)
 	{
-		for (unsigned int bone=0; bone<weights.size(); bone++)
+		nearest.Reset((*p)[n]);
+		if ((unsigned int)influences<bones.size()) bvh.Nearest((*p)[n],FLT_MAX,nearest);
+		else
 		{
-			weights[bone]->m_Data[n]=powf(weights[bone]->m_Data[n],sharpness);
+			// all of them, so no need to search
+			for (unsigned int bone=0; bone<bones.size(); bone++)
+			{
+				nearest.m_Nearest.push_back(pair<float,unsigned int>(
+					PointLineDist((*p)[n],bones[bone].first,bones[bone].second),bone));
+			}
 		}
-	}
-
-	// third pass, normalise the weights
-	for (unsigned int n=0; n<prim.Size(); n++)
-	{
+		
+		// inverse distances, powed to allow us 
+		// to control the creasing, then normalised
 		float m=0;
-		for (unsigned int bone=0; bone<weights.size(); bone++)
+		for (vector<pair<float,unsigned int> >::iterator i=nearest.m_Nearest.begin(); 
+			 i!=nearest.m_Nearest.end(); ++i)
 		{
-			m+=weights[bone]->m_Data[n];
+			float w=i->first==0?2:1/i->first;
+			w=powf(w,sharpness);
+			weights[i->second]->m_Data[n]=w;
+			m+=w;
 		}
-
-		for (unsigned int bone=0; bone<weights.size(); bone++)
+		
+		for (vector<pair<float,unsigned int> >::iterator i=nearest.m_Nearest.begin(); 
+			 i!=nearest.m_Nearest.end(); ++i)
 		{
-			weights[bone]->m_Data[n]/=m;
+			weights[i->second]->m_Data[n]/=m;
 		}
 	}
 
-
 	// finally, add the weights to the primitive
 	for (unsigned int bone=0; bone<weights.size(); bone++)
 	{
 		char wname[256];
 		snprintf(wname,256,"w%d",bone);
-		prim.AddData(wname, weights[bone]);
+		// GetDataVec complains if it's not there, which it won't be the first time
+		PData *raw = prim.GetDataRaw(wname);
+		TypedPData<float> *existing = dynamic_cast<TypedPData<float>*>(raw);
+		if (existing)
+		{
+			// run before, so update them instead
+			existing->m_Data.swap(weights[bone]->m_Data);
+			existing->Touch();
+			delete weights[bone];
+		}
+		else if (raw)
+		{
+			// something else with the same name, replace it
+			prim.SetDataRaw(wname, weights[bone]);
+		}
+		else
+		{
+			prim.AddData(wname, weights[bone]);
+		}
 	}
 }
@@ -27,7 +27,9 @@ namespace Fluxus
 {
 
 //////////////////////////////////////////////////
-/// A primitive function for generating skin weights
+/// A primitive function for generating skin weights.
+/// Each vertex is weighted to its nearest few bones,
+/// found with a bvh of the bones.
 class GenSkinWeightsPrimFunc : public PrimitiveFunction
 {
 public:
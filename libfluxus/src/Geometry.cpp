@@ -87,3 +87,73 @@ float Fluxus::IntersectLineTriangle(const dVector &start, const dVector &end,
     return r;
 }
 
+
+float Fluxus::ClosestPointTriangle(const dVector &p, 
+	const dVector &a, const dVector &b, const dVector &c, 
+	dVector &bary)
+{
+	// work out which region of the triangle p is nearest to, 
+	// the corners, the edges or the face
+	dVector ab = b-a;
+	dVector ac = c-a;
+	dVector ap = p-a;
+	float d1 = ab.dot(ap);
+	float d2 = ac.dot(ap);
+	if (d1<=0 && d2<=0) 
+	{
+		bary=dVector(1,0,0);
+		return ap.dot(ap);
+	}
+	
+	dVector bp = p-b;
+	float d3 = ab.dot(bp);
+	float d4 = ac.dot(bp);
+	if (d3>=0 && d4<=d3) 
+	{
+		bary=dVector(0,1,0);
+		return bp.dot(bp);
+	}
+	
+	float vc = d1*d4-d3*d2;
+	if (vc<=0 && d1>=0 && d3<=0)
+	{
+		float v = d1/(d1-d3);
+		bary=dVector(1-v,v,0);
+		dVector d = p-(a+ab*v);
+		return d.dot(d);
+	}
+	
+	dVector cp = p-c;
+	float d5 = ab.dot(cp);
+	float d6 = ac.dot(cp);
+	if (d6>=0 && d5<=d6) 
+	{
+		bary=dVector(0,0,1);
+		return cp.dot(cp);
+	}
+	
+	float vb = d5*d2-d1*d6;
+	if (vb<=0 && d2>=0 && d6<=0)
+	{
+		float w = d2/(d2-d6);
+		bary=dVector(1-w,0,w);
+		dVector d = p-(a+ac*w);
+		return d.dot(d);
+	}
+	
+	float va = d3*d6-d5*d4;
+	if (va<=0 && (d4-d3)>=0 && (d5-d6)>=0)
+	{
+		float w = (d4-d3)/((d4-d3)+(d5-d6));
+		bary=dVector(0,1-w,w);
+		dVector d = p-(b+(c-b)*w);
+		return d.dot(d);
+	}
+	
+	float denom = 1/(va+vb+vc);
+	float v = vb*denom;
+	float w = vc*denom;
+	bary=dVector(1-v-w,v,w);
+	dVector d = p-(a+ab*v+ac*w);
+	return d.dot(d);
+}
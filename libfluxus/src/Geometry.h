@@ -32,6 +32,12 @@ float IntersectLineTriangle(const dVector &start, const dVector &end,
 	const dVector &a, const dVector &b, const dVector &c, 
 	dVector &bary);
 
+// returns the squared distance from p to the nearest point on the 
+// triangle, with the weights of a, b and c for that point in bary
+float ClosestPointTriangle(const dVector &p, 
+	const dVector &a, const dVector &b, const dVector &c, 
+	dVector &bary);
+
 /*bool IntersectLineQuad(const dVector &start, const dVector &end, 
 	const dVector &a, const dVector &b, const dVector &c, const dVector &d, 
 	std::vector<dVector> &intersections);*/
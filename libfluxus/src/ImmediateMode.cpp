@@ -38,7 +38,7 @@ void ImmediateMode::Add(Primitive *p, State *s, bool del /* = false */)
 	m_IMRecord.push_back(newitem);
 }
 
-void ImmediateMode::Render(unsigned int CamIndex, ShadowVolumeGen *shadowgen)
+void ImmediateMode::Render(unsigned int CamIndex, ShadowVolumeGen *shadowgen, SceneGraph::Mode rendermode)
 {
 	///\todo: not using camera visibility in immediate mode...
 	for(vector<IMItem*>::iterator i=m_IMRecord.begin(); i!=m_IMRecord.end(); ++i)
@@ -49,8 +49,12 @@ void ImmediateMode::Render(unsigned int CamIndex, ShadowVolumeGen *shadowgen)
 		// render call acts on. need to look at this.
 		assert((*i)->m_Primitive!=NULL);
 	    (*i)->m_Primitive->SetState(&(*i)->m_State);
-		(*i)->m_Primitive->Prerender();
-		(*i)->m_Primitive->Render();
+		if (rendermode==SceneGraph::RENDER)
+		{
+			(*i)->m_Primitive->Prerender();
+			(*i)->m_Primitive->Render();
+		}
+		else SceneGraph::RenderPass((*i)->m_Primitive,rendermode);
 
 		if (shadowgen && (*i)->m_Primitive->GetState()->Hints & HINT_CAST_SHADOW)
 		{
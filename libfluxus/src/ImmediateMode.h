@@ -19,6 +19,7 @@
 
 #include "Primitive.h"
 #include "ShadowVolumeGen.h"
+#include "SceneGraph.h"
 #include "State.h"
 
 namespace Fluxus
@@ -37,7 +38,8 @@ public:
 	~ImmediateMode();
 
 	void Add(Primitive *p, State *s, bool del = false);
-	void Render(unsigned int CamIndex, ShadowVolumeGen *shadowgen = NULL);
+	void Render(unsigned int CamIndex, ShadowVolumeGen *shadowgen = NULL,
+	            SceneGraph::Mode rendermode = SceneGraph::RENDER);
 	void Clear();
 
 private:
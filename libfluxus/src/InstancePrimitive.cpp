@@ -0,0 +1,100 @@
+// Copyright (C) 2010 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include "Renderer.h"
+#include "InstancePrimitive.h"
+#include "State.h"
+
+using namespace Fluxus;
+	
+InstancePrimitive::InstancePrimitive(const Primitive *source, unsigned int count) :
+m_Source(source->Clone())
+{
+	AddData("m",new TypedPData<dMatrix>);
+	GetDataVec<dMatrix>("m")->resize(count);
+
+	// the instances carry the transform of the source
+	dMatrix m=source->GetState()->Transform;
+	for (unsigned int i=0; i<count; i++) (*GetDataVec<dMatrix>("m"))[i]=m;
+	m_Source->GetState()->Transform.init();
+
+	PDataDirty();
+}
+
+InstancePrimitive::InstancePrimitive(const InstancePrimitive &other) :
+Primitive(other),
+m_Source(other.m_Source->Clone())
+{
+	PDataDirty();
+}
+
+InstancePrimitive::~InstancePrimitive()
+{
+	delete m_Source;
+}
+
+InstancePrimitive* InstancePrimitive::Clone() const 
+{
+	return new InstancePrimitive(*this); 
+}
+
+void InstancePrimitive::PDataDirty()
+{
+	m_MatrixData=GetDataVec<dMatrix>("m");
+}
+
+void InstancePrimitive::Render()
+{
+	if (m_MatrixData==NULL) return;
+	
+	// draw the source with our hints, colours and textures
+	m_Source->SetState(&m_State);
+	
+	for (vector<dMatrix,FLX_ALLOC(dMatrix) >::iterator i=m_MatrixData->begin(); i!=m_MatrixData->end(); ++i)
+	{
+		glPushMatrix();
+		glMultMatrixf(i->arr());
+		m_Source->Render();
+		glPopMatrix();
+	}
+}
+
+dBoundingBox InstancePrimitive::GetBoundingBox(const dMatrix &space)
+{	
+	dBoundingBox box;
+	if (m_MatrixData==NULL) return box;
+	
+	for (vector<dMatrix,FLX_ALLOC(dMatrix) >::iterator i=m_MatrixData->begin(); i!=m_MatrixData->end(); ++i)
+	{
+		box.expand(m_Source->GetBoundingBox(space*(*i)));
+	}
+	return box;
+}
+
+void InstancePrimitive::ApplyTransform(bool ScaleRotOnly)
+{
+	if (m_MatrixData==NULL) return;
+	
+	dMatrix t=GetState()->Transform;
+	if (ScaleRotOnly) t.settranslate(dVector(0,0,0));
+	
+	for (vector<dMatrix,FLX_ALLOC(dMatrix) >::iterator i=m_MatrixData->begin(); i!=m_MatrixData->end(); ++i)
+	{
+		*i=t*(*i);
+	}
+
+	GetState()->Transform.init();
+}
@@ -0,0 +1,61 @@
+// Copyright (C) 2010 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#ifndef N_INSTANCEPRIM
+#define N_INSTANCEPRIM
+
+#include "Primitive.h"
+
+namespace Fluxus
+{
+
+///////////////////////////////////////////////////
+/// Draws one shared primitive many times, once for 
+/// each matrix in the "m" pdata array. Much cheaper than 
+/// separate primitives as there is no scenegraph traversal 
+/// or state change between the instances.
+class InstancePrimitive : public Primitive
+{
+public:
+	/// Takes a copy of the source primitive
+	InstancePrimitive(const Primitive *source, unsigned int count);
+	InstancePrimitive(const InstancePrimitive &other);
+	virtual ~InstancePrimitive();
+	
+	///////////////////////////////////////////////////
+	///@name Primitive Interface
+	///@{
+	virtual InstancePrimitive* Clone() const;
+	virtual void Render();
+	virtual dBoundingBox GetBoundingBox(const dMatrix &space);
+	virtual void ApplyTransform(bool ScaleRotOnly=false);
+	virtual string GetTypeName() { return "InstancePrimitive"; }
+	virtual Evaluator *MakeEvaluator() { return NULL; }
+	///@}
+	
+	Primitive *GetSource() { return m_Source; }
+	
+protected:
+
+	virtual void PDataDirty();
+
+	Primitive *m_Source;
+	vector<dMatrix,FLX_ALLOC(dMatrix) > *m_MatrixData;
+};
+
+}
+
+#endif
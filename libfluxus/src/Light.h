@@ -55,6 +55,19 @@ public:
 	void SetAttenuation(int type, float s);
 	void SetDirection(dVector s);
 	dVector GetPosition() { return m_Position; }
+	dVector GetDirection() { return m_Direction; }
+	Type GetType() { return m_Type; }
+	int GetIndex() { return m_Index; }
+	float GetSpotAngle() { return m_SpotAngle; }
+	///@}
+	
+	///////////////////////////
+	///@name Shadow mapping
+	/// Whether the light casts shadows 
+	/// with shadow maps
+	///@{
+	void SetCastShadow(bool s)  { m_CastShadow=s; }
+	bool GetCastShadow()   { return m_CastShadow; }
 	///@}
 	
 	///////////////////////////
@@ -76,8 +89,11 @@ protected:
 	dVector m_Position;
 	dVector m_Direction;
 	
+	float m_SpotAngle;
+	
 	Type m_Type;
 	bool m_CameraLock;
+	bool m_CastShadow;
 	
 private:
 	
@@ -0,0 +1,375 @@
+// Copyright (C) 2005 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include <math.h>
+#include "NormalGen.h"
+#include "WorkerPool.h"
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+using namespace Fluxus;
+
+// below these it's not worth splitting the work
+static const unsigned int NORMALS_CHUNK=4096;
+// more than this fraction of verts moved and we redo everything
+static const float NORMALS_INCREMENTAL_LIMIT=0.25;
+
+///////////////////////////////////////////////////
+// a little 3 vector, using sse where we have it
+
+#ifdef __SSE__
+
+typedef __m128 vec3;
+
+static inline vec3 Load(const dVector &v) { return _mm_setr_ps(v.x,v.y,v.z,0); }
+static inline void Store(vec3 a, dVector &v) 
+{ 
+	float f[4]; 
+	_mm_storeu_ps(f,a); 
+	v.x=f[0]; v.y=f[1]; v.z=f[2]; 
+}
+static inline vec3 Zero() { return _mm_setzero_ps(); }
+static inline vec3 Add(vec3 a, vec3 b) { return _mm_add_ps(a,b); }
+static inline vec3 Sub(vec3 a, vec3 b) { return _mm_sub_ps(a,b); }
+static inline vec3 Scale(vec3 a, float s) { return _mm_mul_ps(a,_mm_set1_ps(s)); }
+static inline float Dot(vec3 a, vec3 b) 
+{ 
+	__m128 m=_mm_mul_ps(a,b);
+	__m128 s=_mm_add_ps(m,_mm_movehl_ps(m,m));
+	s=_mm_add_ss(s,_mm_shuffle_ps(s,s,1));
+	return _mm_cvtss_f32(s);
+}
+static inline vec3 Cross(vec3 a, vec3 b)
+{
+	__m128 ayzx=_mm_shuffle_ps(a,a,_MM_SHUFFLE(3,0,2,1));
+	__m128 byzx=_mm_shuffle_ps(b,b,_MM_SHUFFLE(3,0,2,1));
+	__m128 c=_mm_sub_ps(_mm_mul_ps(a,byzx),_mm_mul_ps(ayzx,b));
+	return _mm_shuffle_ps(c,c,_MM_SHUFFLE(3,0,2,1));
+}
+
+#else
+
+class vec3
+{
+public:
+	float x,y,z;
+};
+
+static inline vec3 Make(float x, float y, float z) { vec3 r; r.x=x; r.y=y; r.z=z; return r; }
+static inline vec3 Load(const dVector &v) { return Make(v.x,v.y,v.z); }
+static inline void Store(vec3 a, dVector &v) { v.x=a.x; v.y=a.y; v.z=a.z; }
+static inline vec3 Zero() { return Make(0,0,0); }
+static inline vec3 Add(vec3 a, vec3 b) { return Make(a.x+b.x,a.y+b.y,a.z+b.z); }
+static inline vec3 Sub(vec3 a, vec3 b) { return Make(a.x-b.x,a.y-b.y,a.z-b.z); }
+static inline vec3 Scale(vec3 a, float s) { return Make(a.x*s,a.y*s,a.z*s); }
+static inline float Dot(vec3 a, vec3 b) { return a.x*b.x+a.y*b.y+a.z*b.z; }
+static inline vec3 Cross(vec3 a, vec3 b) 
+{ 
+	return Make(a.y*b.z-a.z*b.y,a.z*b.x-a.x*b.z,a.x*b.y-a.y*b.x); 
+}
+
+#endif
+
+static inline vec3 Normalise(vec3 a, float &length)
+{
+	length=sqrtf(Dot(a,a));
+	if (length>0) return Scale(a,1/length);
+	return a;
+}
+
+///////////////////////////////////////////////////
+
+namespace Fluxus
+{
+
+class FaceJob : public WorkerPool::Job
+{
+public:
+	FaceJob(NormalGen *gen) : m_Gen(gen) {}
+	virtual void Run(unsigned int start, unsigned int end) { m_Gen->DoFaces(start,end); }
+private:
+	NormalGen *m_Gen;
+};
+
+class GatherJob : public WorkerPool::Job
+{
+public:
+	GatherJob(NormalGen *gen) : m_Gen(gen) {}
+	virtual void Run(unsigned int start, unsigned int end) { m_Gen->DoGather(start,end); }
+private:
+	NormalGen *m_Gen;
+};
+
+}
+
+NormalGen::NormalGen() :
+m_Weighting(WEIGHT_NONE),
+m_Stride(0),
+m_NumCorners(0),
+m_NumFaces(0),
+m_Verts(NULL),
+m_Index(NULL),
+m_Topology(NULL),
+m_Normals(NULL),
+m_Smooth(false),
+m_AllDirty(true)
+{
+}
+
+void NormalGen::Reset()
+{
+	m_Positions.clear();
+	m_FaceNormals.clear();
+	m_AllDirty=true;
+}
+
+void NormalGen::UpdateFaces(const vector<dVector,FLX_ALLOC(dVector) > &verts, 
+                            const vector<unsigned int> *index, const PolyTopology &topology,
+                            unsigned int stride, Weighting weighting)
+{
+	m_Verts=&verts;
+	m_Index=index;
+	m_Topology=&topology;
+	
+	unsigned int numcorners=index?index->size():verts.size();
+	unsigned int numfaces=stride?(numcorners+stride-1)/stride:0;
+	
+	bool full=weighting!=m_Weighting || stride!=m_Stride || numcorners!=m_NumCorners ||
+	          verts.size()!=m_Positions.size() || m_FaceNormals.size()!=numcorners;
+	
+	m_Weighting=weighting;
+	m_Stride=stride;
+	m_NumCorners=numcorners;
+	m_NumFaces=numfaces;
+	m_FaceDirty.resize(numfaces,0);
+	
+	if (!full)
+	{
+		// find the verts that moved, and mark the faces using them
+		unsigned int limit=(unsigned int)(verts.size()*NORMALS_INCREMENTAL_LIMIT);
+		unsigned int moved=0;
+		unsigned int firstdirty=m_DirtyFaces.size();
+		for (unsigned int v=0; v<verts.size() && !full; v++)
+		{
+			const dVector &a=verts[v];
+			const dVector &b=m_Positions[v];
+			if (a.x!=b.x || a.y!=b.y || a.z!=b.z)
+			{
+				if (++moved>limit) full=true;
+				else if (index)
+				{
+					unsigned int count=0;
+					const unsigned int *corners=topology.GetVertCorners(v,count);
+					for (unsigned int n=0; n<count; n++) MarkCorner(corners[n]);
+				}
+				else MarkCorner(v);
+			}
+		}
+		
+		if (!full)
+		{
+			for (unsigned int i=firstdirty; i<m_DirtyFaces.size(); i++)
+			{
+				DoFaces(m_DirtyFaces[i],m_DirtyFaces[i]+1);
+			}
+		}
+	}
+	
+	if (full)
+	{
+		m_FaceNormals.resize(numcorners);
+		m_Weighted.resize(numcorners);
+		FaceJob job(this);
+		WorkerPool::Get()->Run(job,numfaces,NORMALS_CHUNK/(stride?stride:1));
+		
+		for (unsigned int i=0; i<m_DirtyFaces.size(); i++) m_FaceDirty[m_DirtyFaces[i]]=0;
+		m_DirtyFaces.clear();
+		m_AllDirty=true;
+	}
+	
+	m_Positions.assign(verts.begin(),verts.end());
+}
+
+void NormalGen::MarkCorner(unsigned int corner)
+{
+	// the faces whose first three corners include this one
+	unsigned int faces[3];
+	unsigned int count=0;
+	faces[count++]=corner/m_Stride;
+	if (m_Stride<3 && corner>=m_Stride) faces[count++]=corner/m_Stride-1;
+	// the last face may borrow corners from the one before
+	if (corner+3>=m_NumCorners) faces[count++]=m_NumFaces-1;
+	
+	for (unsigned int i=0; i<count; i++)
+	{
+		if (faces[i]<m_NumFaces && !m_FaceDirty[faces[i]])
+		{
+			m_FaceDirty[faces[i]]=1;
+			m_DirtyFaces.push_back(faces[i]);
+		}
+	}
+}
+
+void NormalGen::DoFaces(unsigned int start, unsigned int end)
+{
+	const vector<dVector,FLX_ALLOC(dVector) > &verts=*m_Verts;
+	
+	for (unsigned int f=start; f<end; f++)
+	{
+		unsigned int first=f*m_Stride;
+		unsigned int last=first+m_Stride;
+		if (last>m_NumCorners) last=m_NumCorners;
+		
+		// a short face at the end uses the last three corners
+		unsigned int c=first;
+		if (c+2>=m_NumCorners) c=m_NumCorners>=3?m_NumCorners-3:0;
+		
+		vec3 normal=Zero();
+		float area=0;
+		if (c+2<m_NumCorners)
+		{
+			vec3 a=Load(verts[Vert(c)]);
+			vec3 b=Load(verts[Vert(c+1)]);
+			vec3 d=Load(verts[Vert(c+2)]);
+			normal=Normalise(Cross(Sub(a,b),Sub(b,d)),area);
+		}
+		
+		for (unsigned int n=first; n<last; n++)
+		{
+			float weight=1;
+			if (m_Weighting==WEIGHT_AREA) 
+			{
+				weight=area;
+			}
+			else if (m_Weighting==WEIGHT_ANGLE && m_Stride>2 && last-first==m_Stride)
+			{
+				// the angle between the edges either side of this corner
+				unsigned int prev=n==first?last-1:n-1;
+				unsigned int next=n+1==last?first:n+1;
+				vec3 p=Load(verts[Vert(n)]);
+				float la,lb;
+				vec3 ea=Normalise(Sub(Load(verts[Vert(prev)]),p),la);
+				vec3 eb=Normalise(Sub(Load(verts[Vert(next)]),p),lb);
+				float cosangle=Dot(ea,eb);
+				if (cosangle>1) cosangle=1;
+				if (cosangle<-1) cosangle=-1;
+				weight=acosf(cosangle);
+			}
+			
+			Store(normal,m_FaceNormals[n]);
+			Store(Scale(normal,weight),m_Weighted[n]);
+		}
+	}
+}
+
+void NormalGen::UpdateNormals(const PolyTopology &topology, const vector<unsigned int> *index, 
+                              bool smooth, bool full, vector<dVector,FLX_ALLOC(dVector) > &normals)
+{
+	m_Topology=&topology;
+	m_Index=index;
+	m_Normals=&normals;
+	m_Smooth=smooth;
+	
+	// check the topology matches what the face pass was done with
+	if (m_FaceNormals.size()!=m_NumCorners || topology.NumCorners()!=m_NumCorners ||
+		(index && topology.NumVerts()!=normals.size()) ||
+		(!index && normals.size()!=m_NumCorners))
+	{
+		return;
+	}
+	
+	if (full || m_AllDirty)
+	{
+		unsigned int targets=m_NumCorners;
+		if (index) targets=topology.NumVerts();
+		else if (smooth) targets=topology.NumPoints();
+		
+		GatherJob job(this);
+		WorkerPool::Get()->Run(job,targets,NORMALS_CHUNK);
+	}
+	else
+	{
+		// collect the points or verts around the changed faces
+		m_TargetDirty.resize(index?topology.NumVerts():topology.NumPoints(),0);
+		m_Targets.clear();
+		for (unsigned int i=0; i<m_DirtyFaces.size(); i++)
+		{
+			unsigned int first=m_DirtyFaces[i]*m_Stride;
+			unsigned int last=first+m_Stride;
+			if (last>m_NumCorners) last=m_NumCorners;
+			for (unsigned int c=first; c<last; c++)
+			{
+				if (!index && !smooth) 
+				{
+					Gather(c);
+					continue;
+				}
+				
+				unsigned int target=index?(*index)[c]:topology.GetPoint(c);
+				if (target<m_TargetDirty.size() && !m_TargetDirty[target])
+				{
+					m_TargetDirty[target]=1;
+					m_Targets.push_back(target);
+				}
+			}
+		}
+		
+		for (unsigned int i=0; i<m_Targets.size(); i++)
+		{
+			Gather(m_Targets[i]);
+			m_TargetDirty[m_Targets[i]]=0;
+		}
+	}
+	
+	for (unsigned int i=0; i<m_DirtyFaces.size(); i++) m_FaceDirty[m_DirtyFaces[i]]=0;
+	m_DirtyFaces.clear();
+	m_AllDirty=false;
+}
+
+void NormalGen::DoGather(unsigned int start, unsigned int end)
+{
+	for (unsigned int t=start; t<end; t++) Gather(t);
+}
+
+void NormalGen::Gather(unsigned int target)
+{
+	vector<dVector,FLX_ALLOC(dVector) > &normals=*m_Normals;
+	
+	if (!m_Index && !m_Smooth)
+	{
+		normals[target]=m_FaceNormals[target];
+		return;
+	}
+	
+	unsigned int count=0;
+	const unsigned int *corners=m_Index?m_Topology->GetVertCorners(target,count):
+	                                    m_Topology->GetPointCorners(target,count);
+	vec3 sum=Zero();
+	for (unsigned int n=0; n<count; n++)
+	{
+		sum=Add(sum,Load(m_Weighted[corners[n]]));
+	}
+	
+	float length;
+	sum=Normalise(sum,length);
+	// leave verts with nothing around them alone
+	if (length==0) return;
+	
+	if (m_Index) Store(sum,normals[target]);
+	else for (unsigned int n=0; n<count; n++) Store(sum,normals[corners[n]]);
+}
@@ -0,0 +1,100 @@
+// Copyright (C) 2005 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#ifndef N_NORMALGEN
+#define N_NORMALGEN
+
+#include <vector>
+#include "dada.h"
+#include "Allocator.h"
+#include "PolyTopology.h"
+
+using namespace std;
+
+namespace Fluxus
+{
+
+///////////////////////////////////////////////////
+/// Works out normals for polygon primitives in two
+/// passes - a face pass for the normal and weight of
+/// each face at each corner, then a vertex pass to 
+/// gather these around each welded point (or indexed 
+/// vertex). Big meshes are split between threads. It
+/// remembers the positions from last time, so if only 
+/// a few verts have moved only the faces around them 
+/// are redone.
+class NormalGen
+{
+public:
+	enum Weighting {WEIGHT_NONE, WEIGHT_AREA, WEIGHT_ANGLE};
+
+	NormalGen();
+	
+	/// Forget everything, so the next update does the lot
+	void Reset();
+	
+	/// The face pass, faces are runs of stride corners using 
+	/// the first three for the normal (so strips can overlap)
+	void UpdateFaces(const vector<dVector,FLX_ALLOC(dVector) > &verts, 
+	                 const vector<unsigned int> *index, const PolyTopology &topology,
+	                 unsigned int stride, Weighting weighting);
+	
+	/// The vertex pass, for the faces changed since the last call, 
+	/// or everything if full is set. Non smooth normals are just 
+	/// the face normals, indexed ones are always smooth.
+	void UpdateNormals(const PolyTopology &topology, const vector<unsigned int> *index, 
+	                   bool smooth, bool full, vector<dVector,FLX_ALLOC(dVector) > &normals);
+	
+	/// A normalised face normal for each corner
+	const vector<dVector> &GetFaceNormals() const { return m_FaceNormals; }
+
+private:
+	friend class FaceJob;
+	friend class GatherJob;
+	
+	void DoFaces(unsigned int start, unsigned int end);
+	void DoGather(unsigned int start, unsigned int end);
+	void Gather(unsigned int target);
+	void MarkCorner(unsigned int corner);
+	unsigned int Vert(unsigned int corner) const { return m_Index?(*m_Index)[corner]:corner; }
+	
+	Weighting m_Weighting;
+	unsigned int m_Stride;
+	unsigned int m_NumCorners;
+	unsigned int m_NumFaces;
+	
+	// what the current pass is working on
+	const vector<dVector,FLX_ALLOC(dVector) > *m_Verts;
+	const vector<unsigned int> *m_Index;
+	const PolyTopology *m_Topology;
+	vector<dVector,FLX_ALLOC(dVector) > *m_Normals;
+	bool m_Smooth;
+	
+	vector<dVector> m_FaceNormals;
+	vector<dVector> m_Weighted;
+	vector<dVector> m_Positions;
+	
+	// faces changed since the last vertex pass
+	bool m_AllDirty;
+	vector<unsigned int> m_DirtyFaces;
+	vector<unsigned char> m_FaceDirty;
+	vector<unsigned int> m_Targets;
+	vector<unsigned char> m_TargetDirty;
+};
+
+}
+
+#endif
@@ -18,3 +18,8 @@
 
 using namespace Fluxus;
 
+unsigned int PData::NextVersion()
+{
+	static unsigned int version=0;
+	return ++version;
+}
@@ -32,7 +32,7 @@ namespace Fluxus
 class PData
 {
 public:
-	PData() {}
+	PData() : m_Version(NextVersion()) {}
 	virtual ~PData() {}
 	virtual PData *Copy() const=0;
 	virtual unsigned int Size() const=0;
@@ -40,11 +40,20 @@ public:
 	
 	char GetType() const { return m_Type; }
 	
+	/// A number unique to this array and its contents, so things derived
+	/// from it can tell when they are out of date. Anything writing to 
+	/// the data directly needs to call Touch() afterwards.
+	unsigned int GetVersion() const { return m_Version; }
+	void Touch() { m_Version=NextVersion(); }
+	
 protected:
 	void SetType(const char s) { m_Type=s; }
 	
 private:
+	static unsigned int NextVersion();
+	
 	char m_Type;
+	unsigned int m_Version;
 };
 
 /////////////////////////////////////////////////
@@ -74,6 +83,7 @@ public:
 	virtual void Resize(unsigned int size)
 	{
 		m_Data.resize(size);
+		Touch();
 	}
 	
 	///\todo add operator[] and make m_Data private
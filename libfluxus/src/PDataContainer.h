@@ -72,7 +72,8 @@ public:
 	bool GetDataInfo(const string &name, char &type, unsigned int &size) const;
 	
 	/// Sets an element of the array. Not checked, for 
-	/// speed - use GetDataInfo() to check
+	/// speed - use GetDataInfo() to check. Writes via
+	/// GetDataVec() need to Touch() the array themselves
 	template<class T> void SetData(const string &name, unsigned int index, T s);
 	
 	/// Gets an element of the array. Not checked, for 
@@ -118,7 +119,9 @@ protected:
 template<class T> 
 void PDataContainer::SetData(const string &name, unsigned int index, T s)	
 {
-	static_cast<TypedPData<T>*>(m_PData[name])->m_Data[index]=s;
+	TypedPData<T> *data=static_cast<TypedPData<T>*>(m_PData[name]);
+	data->m_Data[index]=s;
+	data->Touch();
 }
 
 ///Todo: no const [] for m_PData[name] so m_PData has to be mutable???
@@ -158,25 +161,29 @@ PData *PDataContainer::DataOp(const string &op, const string &name, T operand)
 		return NULL;
 	}
 	
+	PData *ret=NULL;
 	TypedPData<dVector> *data = dynamic_cast<TypedPData<dVector>*>(i->second);	
-	if (data) return FindOperate<dVector,T>(op, data, operand);
+	if (data) ret=FindOperate<dVector,T>(op, data, operand);
 	else
 	{
 		TypedPData<dColour> *data = dynamic_cast<TypedPData<dColour>*>(i->second);
-		if (data) return FindOperate<dColour, T>(op, data, operand);
+		if (data) ret=FindOperate<dColour, T>(op, data, operand);
 		else 
 		{
 			TypedPData<float> *data = dynamic_cast<TypedPData<float>*>(i->second);
-			if (data) return FindOperate<float, T>(op, data, operand);
+			if (data) ret=FindOperate<float, T>(op, data, operand);
 			else 
 			{
 				TypedPData<dMatrix> *data = dynamic_cast<TypedPData<dMatrix>*>(i->second);
-				if (data) return FindOperate<dMatrix, T>(op, data, operand);
+				if (data) ret=FindOperate<dMatrix, T>(op, data, operand);
 			}
 		}
 	}
 	
-	return NULL;
+	// operators that work in place don't return a new array, so
+	// the caches built from this one need to know it has changed
+	if (ret==NULL || ret==i->second) i->second->Touch();
+	return ret;
 }
 
 template <class S, class T>
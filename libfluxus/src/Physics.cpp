@@ -15,15 +15,132 @@
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
 #include <ode/ode.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <math.h>
+#include <stdlib.h>
 #include "Physics.h"
 #include "State.h"
 #include "Primitive.h"
+#include "ConvexHull.h"
 
 using namespace Fluxus;
 
+// the step used when not running with a fixed timestep
+static const dReal PHYSICS_FRAME_STEP = 0.05;
+// below this many pairs it's not worth waking the workers
+static const unsigned int PHYSICS_MIN_PARALLEL_PAIRS = 256;
+// pairs each worker takes at a time
+static const int PHYSICS_PAIR_CHUNK = 64;
+// contacts generated per pair
+static const int PHYSICS_MAX_CONTACTS = 10;
+// collision events kept per frame, any more are dropped
+static const unsigned int PHYSICS_MAX_EVENTS = 16384;
+
+static double WallTime()
+{
+	timeval tv;
+	gettimeofday(&tv,0);
+	return tv.tv_sec+tv.tv_usec*0.000001;
+}
+
+// holds the physics lock for the scope it's in
+class PhysicsLock
+{
+public:
+	PhysicsLock(pthread_mutex_t *m) : m_Mutex(m) { pthread_mutex_lock(m_Mutex); }
+	~PhysicsLock() { pthread_mutex_unlock(m_Mutex); }
+private:
+	pthread_mutex_t *m_Mutex;
+};
+
+static void Slerp(const dQuaternion a, const dQuaternion b, float t, dQuaternion out)
+{
+	dReal cosom=a[0]*b[0]+a[1]*b[1]+a[2]*b[2]+a[3]*b[3];
+	dReal sign=1;
+	// go the short way round
+	if (cosom<0) { cosom=-cosom; sign=-1; }
+	
+	dReal sa=1-t, sb=t;
+	if (cosom<0.999)
+	{
+		dReal omega=acos(cosom);
+		dReal sinom=sin(omega);
+		sa=sin((1-t)*omega)/sinom;
+		sb=sin(t*omega)/sinom;
+	}
+	
+	sb*=sign;
+	for (int i=0; i<4; i++) out[i]=sa*a[i]+sb*b[i];
+	dNormalize4(out);
+}
+
+static void StoreBody(dBodyID body, dReal *prevpos, dReal *prevrot)
+{
+	const dReal *pos=dBodyGetPosition(body);
+	const dReal *rot=dBodyGetQuaternion(body);
+	for (int n=0; n<3; n++) prevpos[n]=pos[n];
+	for (int n=0; n<4; n++) prevrot[n]=rot[n];
+}
+
+// takes the scale off the axes of an instance matrix, for putting back
+// afterwards with dMatrix::scale - remove_scale works on the rows
+// instead, which is only the same for uniform scales
+static dVector SplitScale(dMatrix &m)
+{
+	dVector i=m.get_vert_i(), j=m.get_vert_j(), k=m.get_vert_k();
+	dVector s(i.mag(),j.mag(),k.mag());
+	if (s.x>0) m.set_vert_i(i/s.x);
+	if (s.y>0) m.set_vert_j(j/s.y);
+	if (s.z>0) m.set_vert_k(k/s.z);
+	return s;
+}
+
+// the body transform, alpha of the way from the stored previous state
+static dMatrix BodyTransform(dBodyID body, const dReal *prevpos, const dReal *prevrot, float alpha)
+{
+	const dReal *pos=dBodyGetPosition(body);
+	dVector PosVec(pos[0],pos[1],pos[2]);
+	dMatrix3 R;
+	
+	if (alpha<1)
+	{
+		dVector PrevVec(prevpos[0],prevpos[1],prevpos[2]);
+		PosVec=PrevVec+(PosVec-PrevVec)*alpha;
+		dQuaternion q;
+		Slerp(prevrot,dBodyGetQuaternion(body),alpha,q);
+		dQtoR(q,R);
+	}
+	else
+	{
+		const dReal *rot=dBodyGetRotation(body);
+		for (int n=0; n<12; n++) R[n]=rot[n];
+	}
+	
+	dMatrix Rot(R[0], R[1], R[2], R[3], R[4], R[5], R[6], R[7], 
+	            R[8], R[9], R[10], R[11], 0,0,0,1);
+	Rot.settranslate(PosVec);
+	return Rot;
+}
+
+Physics::MeshData::MeshData() :
+Hash(0),
+RefCount(1),
+Cached(false),
+TriMesh(0),
+HullBuilt(false)
+{
+}
+
+Physics::MeshData::~MeshData()
+{
+	if (TriMesh) dGeomTriMeshDataDestroy(TriMesh);
+}
+
 Physics::Object::Object()
 {
 	Prim=NULL;
+	Mesh=NULL;
 }
 
 Physics::Object::~Object()
@@ -32,6 +149,17 @@ Physics::Object::~Object()
 	dGeomDestroy(Bound);
 }
 
+Physics::Swarm::Swarm()
+{
+	Prim=NULL;
+}
+
+Physics::Swarm::~Swarm()
+{
+	for (unsigned int i=0; i<Bodies.size(); i++) dBodyDestroy(Bodies[i]);
+	for (unsigned int i=0; i<Bounds.size(); i++) dGeomDestroy(Bounds[i]);
+}
+
 Physics::JointObject::JointObject()
 {
 }
@@ -54,7 +182,26 @@ m_Collisions(false),
 m_Slip1(0.9),
 m_Slip2(0.9),
 m_SoftErp(0.25),
-m_SoftCfm(0.15)
+m_SoftCfm(0.15),
+m_MeshHulls(false),
+m_Broadphase(HASH),
+m_CollisionEvents(false),
+m_StepEvents(0),
+m_WorkGeneration(0),
+m_WorkersBusy(0),
+m_WorkersRunning(false),
+m_NextPair(0),
+#ifdef ODE_THREADING
+m_ThreadingImpl(NULL),
+m_ThreadPool(NULL),
+#endif
+m_StepSize(0),
+m_MaxSubSteps(4),
+m_Accumulator(0),
+m_Interpolate(true),
+m_Threaded(false),
+m_ThreadRunning(false),
+m_LastAdvance(0)
 {
 	if (!m_ODEInited)	// init ODE only once
 	{
@@ -67,27 +214,597 @@ m_SoftCfm(0.15)
 	}
 
 	m_World = dWorldCreate();
-	m_Space = dHashSpaceCreate(0);
+	m_Space = CreateSpace(m_Broadphase);
 	m_ContactGroup = dJointGroupCreate(0);
+	m_ContactBuffers.resize(1);
 	dWorldSetGravity(m_World,0,-5,0);
+	
+	// recursive, as Free and MakeActive call other locking functions
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr,PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&m_Mutex,&attr);
+	pthread_mutexattr_destroy(&attr);
+	
+	pthread_mutex_init(&m_WorkMutex,NULL);
+	pthread_cond_init(&m_WorkCond,NULL);
+	pthread_cond_init(&m_DoneCond,NULL);
 }
 
 Physics::~Physics()
 {
+	SetThreaded(false);
+	SetThreads(1);
+	pthread_cond_destroy(&m_DoneCond);
+	pthread_cond_destroy(&m_WorkCond);
+	pthread_mutex_destroy(&m_WorkMutex);
+	pthread_mutex_destroy(&m_Mutex);
 	dCloseODE();
 }
 
 void Physics::Tick()
 {
-	m_CollisionRecord.clear();
+	PhysicsLock lock(&m_Mutex);
+	
+	if (!m_Threaded)
+	{
+		if (m_StepSize>0) Advance(m_Renderer->GetDelta());
+		else Step(PHYSICS_FRAME_STEP);
+	}
+	
+	// collisions from all the steps since the last frame
+	m_CollisionRecord.swap(m_PendingCollisions);
+	m_PendingCollisions.clear();
+	m_Events.swap(m_PendingEvents);
+	m_PendingEvents.clear();
+
+	float alpha=1;
+	if (m_StepSize>0 && m_Interpolate)
+	{
+		double acc=m_Accumulator;
+		if (m_Threaded) acc+=WallTime()-m_LastAdvance;
+		alpha=acc/m_StepSize;
+		if (alpha>1) alpha=1;
+	}
+	
+    UpdatePrimitives(alpha);
+}
 
-	dSpaceCollide(m_Space,this,&NearCallback);
-    dWorldQuickStep(m_World,0.05);
+void Physics::Advance(double delta)
+{
+	if (delta<0) return;
+	m_Accumulator+=delta;
+	
+	int steps=0;
+	while (m_Accumulator>=m_StepSize && steps<m_MaxSubSteps)
+	{
+		Step(m_StepSize);
+		m_Accumulator-=m_StepSize;
+		steps++;
+	}
+	
+	// we can't keep up, so let the simulation slow down 
+	// rather than trying to catch up later
+	if (m_Accumulator>=m_StepSize) m_Accumulator=fmod(m_Accumulator,(double)m_StepSize);
+}
+
+void Physics::Step(dReal step)
+{
+	for(map<int,Object*>::iterator i=m_ObjectMap.begin(); i!=m_ObjectMap.end(); ++i)
+	{
+		if (i->second->Type==ACTIVE) StorePrevious(i->second);
+	}
+	
+	for(map<int,Swarm*>::iterator i=m_SwarmMap.begin(); i!=m_SwarmMap.end(); ++i)
+	{
+		Swarm *swarm=i->second;
+		for (unsigned int b=0; b<swarm->Bodies.size(); b++)
+		{
+			StoreBody(swarm->Bodies[b],&swarm->PrevPos[b*3],&swarm->PrevRot[b*4]);
+		}
+	}
+
+	StepWorld(step);
+}
+
+void Physics::StepWorld(dReal step)
+{
+	m_StepEvents=m_PendingEvents.size();
+	m_EventFeedback.clear();
+	
+	Collide();
+    dWorldQuickStep(m_World,step);
+	
+	// now the forces are known
+	for (unsigned int e=0; e<m_EventFeedback.size(); e++)
+	{
+		float impulse=0;
+		for (unsigned int f=m_EventFeedback[e].first; f<m_EventFeedback[e].first+m_EventFeedback[e].second; f++)
+		{
+			dVector f1(m_Feedback[f].f1[0],m_Feedback[f].f1[1],m_Feedback[f].f1[2]);
+			dVector f2(m_Feedback[f].f2[0],m_Feedback[f].f2[1],m_Feedback[f].f2[2]);
+			impulse+=max(f1.mag(),f2.mag())*step;
+		}
+		m_PendingEvents[m_StepEvents+e].Impulse=impulse;
+	}
 
     // remove all contact joints
     dJointGroupEmpty(m_ContactGroup);
+}
+
+void Physics::Collide()
+{
+	if (!m_Collisions) return;
+	// read once, the feedback array is only sized if it was set
+	bool events=m_CollisionEvents;
+
+	// the broadphase just collects the pairs
+	m_Pairs.clear();
+	m_SerialPairs.clear();
+	dSpaceCollide(m_Space,this,&NearCallback);
+	
+	for (unsigned int i=0; i<m_ContactBuffers.size(); i++) m_ContactBuffers[i].clear();
+	
+	if (!m_Workers.empty() && m_Pairs.size()>=PHYSICS_MIN_PARALLEL_PAIRS)
+	{
+		pthread_mutex_lock(&m_WorkMutex);
+		m_NextPair=0;
+		m_WorkersBusy=m_Workers.size();
+		m_WorkGeneration++;
+		pthread_cond_broadcast(&m_WorkCond);
+		pthread_mutex_unlock(&m_WorkMutex);
+		
+		// do the trimeshes while they get going, then help out
+		for (unsigned int i=0; i<m_SerialPairs.size(); i++) 
+		{
+			CollidePair(m_SerialPairs[i].first,m_SerialPairs[i].second,m_ContactBuffers[0]);
+		}
+		CollideShared(m_ContactBuffers[0]);
+		
+		pthread_mutex_lock(&m_WorkMutex);
+		while (m_WorkersBusy>0) pthread_cond_wait(&m_DoneCond,&m_WorkMutex);
+		pthread_mutex_unlock(&m_WorkMutex);
+	}
+	else
+	{
+		for (unsigned int i=0; i<m_SerialPairs.size(); i++) 
+		{
+			CollidePair(m_SerialPairs[i].first,m_SerialPairs[i].second,m_ContactBuffers[0]);
+		}
+		for (unsigned int i=0; i<m_Pairs.size(); i++) 
+		{
+			CollidePair(m_Pairs[i].first,m_Pairs[i].second,m_ContactBuffers[0]);
+		}
+	}
+	
+	if (events)
+	{
+		unsigned int total=0;
+		for (unsigned int b=0; b<m_ContactBuffers.size(); b++) total+=m_ContactBuffers[b].size();
+		// don't move these while the joints point at them
+		m_Feedback.resize(total);
+	}
+	
+	// joints have to be made one at a time
+	unsigned int feedback=0;
+	for (unsigned int b=0; b<m_ContactBuffers.size(); b++)
+	{
+		vector<dContact> &contacts=m_ContactBuffers[b];
+		for (unsigned int i=0; i<contacts.size(); i++)
+		{
+			dJointID c = dJointCreateContact(m_World,m_ContactGroup,&contacts[i]);
+			dBodyID geom1 = dGeomGetBody(contacts[i].geom.g1);
+			dBodyID geom2 = dGeomGetBody(contacts[i].geom.g2);
+			dJointAttach(c,geom1,geom2);
+			m_PendingCollisions.insert(geom1);
+			m_PendingCollisions.insert(geom2);
+			
+			if (events)
+			{
+				dJointSetFeedback(c,&m_Feedback[feedback]);
+				AddEvent(contacts[i],feedback);
+				feedback++;
+			}
+		}
+	}
+}
+
+void Physics::AddEvent(const dContact &contact, unsigned int feedback)
+{
+	// the contacts for a pair are always next to each other
+	if (!m_EventFeedback.empty() && m_EventFeedback.back().first+m_EventFeedback.back().second==feedback)
+	{
+		CollisionEvent &last=m_PendingEvents.back();
+		const GeomInfo *info1=(const GeomInfo*)dGeomGetData(contact.geom.g1);
+		const GeomInfo *info2=(const GeomInfo*)dGeomGetData(contact.geom.g2);
+		int ob1=info1?info1->ID:0, index1=info1?info1->Index:0;
+		int ob2=info2?info2->ID:0, index2=info2?info2->Index:0;
+		if (last.Ob1==ob1 && last.Index1==index1 && last.Ob2==ob2 && last.Index2==index2)
+		{
+			m_EventFeedback.back().second++;
+			if (contact.geom.depth>last.Depth)
+			{
+				last.Pos=dVector(contact.geom.pos[0],contact.geom.pos[1],contact.geom.pos[2]);
+				last.Normal=dVector(contact.geom.normal[0],contact.geom.normal[1],contact.geom.normal[2]);
+				last.Depth=contact.geom.depth;
+			}
+			return;
+		}
+	}
+	
+	if (m_PendingEvents.size()>=PHYSICS_MAX_EVENTS) return;
+	
+	CollisionEvent e;
+	const GeomInfo *info1=(const GeomInfo*)dGeomGetData(contact.geom.g1);
+	const GeomInfo *info2=(const GeomInfo*)dGeomGetData(contact.geom.g2);
+	e.Ob1=info1?info1->ID:0;
+	e.Index1=info1?info1->Index:0;
+	e.Ob2=info2?info2->ID:0;
+	e.Index2=info2?info2->Index:0;
+	
+	if (!m_Subscriptions.empty() && 
+		m_Subscriptions.find(e.Ob1)==m_Subscriptions.end() &&
+		m_Subscriptions.find(e.Ob2)==m_Subscriptions.end()) 
+	{
+		return;
+	}
+	
+	e.Pos=dVector(contact.geom.pos[0],contact.geom.pos[1],contact.geom.pos[2]);
+	e.Normal=dVector(contact.geom.normal[0],contact.geom.normal[1],contact.geom.normal[2]);
+	e.Depth=contact.geom.depth;
+	e.Impulse=0;
+	m_PendingEvents.push_back(e);
+	m_EventFeedback.push_back(pair<unsigned int,unsigned int>(feedback,1));
+}
+
+void Physics::SetCollisionEvents(bool s)
+{
+	PhysicsLock lock(&m_Mutex);
+	m_CollisionEvents=s;
+}
+
+void Physics::Subscribe(int ID)
+{
+	PhysicsLock lock(&m_Mutex);
+	m_Subscriptions.insert(ID);
+}
+
+void Physics::Unsubscribe(int ID)
+{
+	PhysicsLock lock(&m_Mutex);
+	m_Subscriptions.erase(ID);
+}
+
+void Physics::CollidePair(dGeomID o1, dGeomID o2, vector<dContact> &contacts)
+{
+	dContact contact[PHYSICS_MAX_CONTACTS];
+
+	int n = dCollide(o1,o2,PHYSICS_MAX_CONTACTS,&contact[0].geom,sizeof(dContact));
+	for (int i=0; i<n; i++)
+	{
+		contact[i].surface.mode = dContactSlip1 | dContactSlip2 | dContactSoftERP | dContactSoftCFM | dContactApprox1;
+		contact[i].surface.mu = dInfinity;
+		contact[i].surface.slip1 = m_Slip1;
+		contact[i].surface.slip2 = m_Slip2;
+		contact[i].surface.soft_erp = m_SoftErp;
+		contact[i].surface.soft_cfm = m_SoftCfm;
+		contacts.push_back(contact[i]);
+	}
+}
+
+// called by the workers and the stepping thread, takes chunks 
+// of the shared pairs until there are none left
+void Physics::CollideShared(vector<dContact> &contacts)
+{
+	int size=m_Pairs.size();
+	int start;
+	while ((start=__sync_fetch_and_add(&m_NextPair,PHYSICS_PAIR_CHUNK))<size)
+	{
+		int end=start+PHYSICS_PAIR_CHUNK;
+		if (end>size) end=size;
+		for (int i=start; i<end; i++)
+		{
+			CollidePair(m_Pairs[i].first,m_Pairs[i].second,contacts);
+		}
+	}
+}
+
+void *Physics::WorkerEntry(void *p)
+{
+	WorkerArg *arg=(WorkerArg*)p;
+	arg->Owner->WorkerLoop(arg->Index);
+	return NULL;
+}
+
+void Physics::WorkerLoop(int index)
+{
+#ifndef GOODE_OLDE_ODE
+	dAllocateODEDataForThread(dAllocateMaskAll);
+#endif
+
+	int generation=m_WorkerArgs[index-1].Generation;
+	pthread_mutex_lock(&m_WorkMutex);
+	while (true)
+	{
+		while (m_WorkersRunning && m_WorkGeneration==generation) 
+		{
+			pthread_cond_wait(&m_WorkCond,&m_WorkMutex);
+		}
+		if (!m_WorkersRunning) break;
+		generation=m_WorkGeneration;
+		pthread_mutex_unlock(&m_WorkMutex);
+		
+		CollideShared(m_ContactBuffers[index]);
+		
+		pthread_mutex_lock(&m_WorkMutex);
+		m_WorkersBusy--;
+		if (m_WorkersBusy==0) pthread_cond_signal(&m_DoneCond);
+	}
+	pthread_mutex_unlock(&m_WorkMutex);
+
+#ifndef GOODE_OLDE_ODE
+	dCleanupODEAllDataForThread();
+#endif
+}
+
+void Physics::StopWorkers()
+{
+	if (m_Workers.empty()) return;
+	
+	pthread_mutex_lock(&m_WorkMutex);
+	m_WorkersRunning=false;
+	pthread_cond_broadcast(&m_WorkCond);
+	pthread_mutex_unlock(&m_WorkMutex);
+	
+	for (unsigned int i=0; i<m_Workers.size(); i++)
+	{
+		pthread_join(m_Workers[i],NULL);
+	}
+	m_Workers.clear();
+	m_WorkerArgs.clear();
+}
+
+void Physics::SetThreads(int count)
+{
+	PhysicsLock lock(&m_Mutex);
+	if (count<1) count=1;
+	
+	StopWorkers();
+	m_ContactBuffers.resize(count);
+	
+	// the stepping thread is the first one
+	if (count>1)
+	{
+		m_WorkersRunning=true;
+		m_WorkerArgs.resize(count-1);
+		for (int i=0; i<count-1; i++)
+		{
+			m_WorkerArgs[i].Owner=this;
+			m_WorkerArgs[i].Index=i+1;
+			m_WorkerArgs[i].Generation=m_WorkGeneration;
+			pthread_t thread;
+			if (pthread_create(&thread,NULL,WorkerEntry,&m_WorkerArgs[i])!=0)
+			{
+				Trace::Stream<<"Physics::SetThreads : could only start "<<i<<" workers"<<endl;
+				break;
+			}
+			m_Workers.push_back(thread);
+		}
+	}
+	
+#ifdef ODE_THREADING
+	if (m_ThreadingImpl!=NULL)
+	{
+		dThreadingImplementationShutdownProcessing(m_ThreadingImpl);
+		dThreadingFreeThreadPool(m_ThreadPool);
+		dWorldSetStepThreadingImplementation(m_World,NULL,NULL);
+		dThreadingFreeImplementation(m_ThreadingImpl);
+		m_ThreadingImpl=NULL;
+		m_ThreadPool=NULL;
+	}
+	
+	if (count>1)
+	{
+		m_ThreadingImpl=dThreadingAllocateMultiThreadedImplementation();
+		m_ThreadPool=dThreadingAllocateThreadPool(count,0,dAllocateFlagBasicData,NULL);
+		dThreadingThreadPoolServeMultiThreadedImplementation(m_ThreadPool,m_ThreadingImpl);
+		AttachThreading(m_World);
+	}
+#endif
+}
+
+void Physics::AttachThreading(dWorldID world)
+{
+#ifdef ODE_THREADING
+	if (m_ThreadingImpl!=NULL)
+	{
+		dWorldSetStepThreadingImplementation(world,dThreadingImplementationGetFunctions(m_ThreadingImpl),m_ThreadingImpl);
+	}
+#endif
+}
+
+dSpaceID Physics::CreateSpace(BroadphaseType type)
+{
+#ifndef GOODE_OLDE_ODE
+	if (type==SAP) return dSweepAndPruneSpaceCreate(0,dSAP_AXES_XZY);
+#endif
+	return dHashSpaceCreate(0);
+}
+
+void Physics::SetBroadphase(BroadphaseType type)
+{
+	PhysicsLock lock(&m_Mutex);
+	if (type==m_Broadphase) return;
+	
+	dSpaceID space=CreateSpace(type);
+	
+	// move everything over, the ground plane included
+	vector<dGeomID> geoms;
+	for (int i=0; i<dSpaceGetNumGeoms(m_Space); i++) geoms.push_back(dSpaceGetGeom(m_Space,i));
+	for (vector<dGeomID>::iterator i=geoms.begin(); i!=geoms.end(); ++i)
+	{
+		dSpaceRemove(m_Space,*i);
+		dSpaceAdd(space,*i);
+	}
+	
+	dSpaceDestroy(m_Space);
+	m_Space=space;
+	m_Broadphase=type;
+}
+
+float Physics::Benchmark(int count, bool rain, int steps)
+{
+	PhysicsLock lock(&m_Mutex);
+	if (count<1 || steps<1) return 0;
+	
+	// swap in a new world, so we run the same code as a real scene
+	dWorldID world=m_World;
+	dSpaceID space=m_Space;
+	dJointGroupID contactgroup=m_ContactGroup;
+	bool collisions=m_Collisions;
+	bool events=m_CollisionEvents;
+	m_CollisionEvents=false;
+	set<dBodyID> pending;
+	pending.swap(m_PendingCollisions);
+	
+	m_World=dWorldCreate();
+	m_Space=CreateSpace(m_Broadphase);
+	m_ContactGroup=dJointGroupCreate(0);
+	m_Collisions=true;
+	dWorldSetGravity(m_World,0,-9.8,0);
+	AttachThreading(m_World);
+	dCreatePlane(m_Space,0,1,0,0);
+	
+	int side=(int)ceil(sqrt((float)count));
+	dMass m;
+	dMassSetBox(&m,1,1,1,1);
+	for (int i=0; i<count; i++)
+	{
+		dBodyID body=dBodyCreate(m_World);
+		dBodySetMass(body,&m);
+		dGeomID geom=dCreateBox(m_Space,1,1,1);
+		dGeomSetBody(geom,body);
+		dBodySetAutoDisableFlag(body,1);
+		
+		if (rain)
+		{
+			dBodySetPosition(body,(rand()%(side*20))/10.0f-side,10+(rand()%(count*2))/10.0f,
+				(rand()%(side*20))/10.0f-side);
+			dBodySetLinearVel(body,0,-5,0);
+		}
+		else
+		{
+			// a stack of layers, the bottom layer on the ground
+			int layer=i/(side*side);
+			int n=i%(side*side);
+			dBodySetPosition(body,(n%side)*1.1f-side*0.55f,0.5f+layer*1.01f,(n/side)*1.1f-side*0.55f);
+		}
+	}
+	
+	double total=0;
+	double worst=0;
+	for (int s=0; s<steps; s++)
+	{
+		double start=WallTime();
+		StepWorld(0.02);
+		double t=WallTime()-start;
+		total+=t;
+		if (t>worst) worst=t;
+	}
+	
+	float average=total/steps*1000;
+	Trace::Stream<<"physics benchmark: "<<count<<" boxes "<<(rain?"raining":"in a pile")<<", "
+		<<m_ContactBuffers.size()<<" threads, "<<(m_Broadphase==SAP?"sap":"hash")<<" broadphase: "
+		<<average<<"ms per step, worst "<<worst*1000<<"ms"<<endl;
+	
+	dJointGroupDestroy(m_ContactGroup);
+	dSpaceDestroy(m_Space);
+	dWorldDestroy(m_World);
+	
+	m_World=world;
+	m_Space=space;
+	m_ContactGroup=contactgroup;
+	m_Collisions=collisions;
+	m_CollisionEvents=events;
+	m_PendingCollisions.swap(pending);
+	return average;
+}
+
+void Physics::StorePrevious(Object *ob)
+{
+	StoreBody(ob->Body,ob->PrevPos,ob->PrevRot);
+}
+
+void Physics::SetTimestep(float step, int maxsubsteps)
+{
+	if (step<=0) SetThreaded(false);
+	
+	PhysicsLock lock(&m_Mutex);
+	m_StepSize=step>0?step:0;
+	m_MaxSubSteps=maxsubsteps>0?maxsubsteps:1;
+	m_Accumulator=0;
+}
+
+void Physics::SetThreaded(bool s)
+{
+	if (s==m_Threaded) return;
+	
+	if (s)
+	{
+		if (m_StepSize<=0)
+		{
+			Trace::Stream<<"Physics::SetThreaded : threaded physics needs a fixed timestep"<<endl;
+			return;
+		}
+		
+		PhysicsLock lock(&m_Mutex);
+		m_ThreadRunning=true;
+		m_LastAdvance=WallTime();
+		if (pthread_create(&m_Thread,NULL,ThreadEntry,this)!=0)
+		{
+			Trace::Stream<<"Physics::SetThreaded : could not start physics thread"<<endl;
+			m_ThreadRunning=false;
+			return;
+		}
+		m_Threaded=true;
+	}
+	else
+	{
+		m_ThreadRunning=false;
+		pthread_join(m_Thread,NULL);
+		m_Threaded=false;
+	}
+}
+
+void *Physics::ThreadEntry(void *p)
+{
+	((Physics*)p)->ThreadLoop();
+	return NULL;
+}
 
-    UpdatePrimitives();
+void Physics::ThreadLoop()
+{
+#ifndef GOODE_OLDE_ODE
+	dAllocateODEDataForThread(dAllocateMaskAll);
+#endif
+
+	while (m_ThreadRunning)
+	{
+		double wait;
+		{
+			PhysicsLock lock(&m_Mutex);
+			double now=WallTime();
+			Advance(now-m_LastAdvance);
+			m_LastAdvance=now;
+			wait=m_StepSize-m_Accumulator;
+		}
+		
+		if (wait>0) usleep((useconds_t)(wait*1000000));
+	}
+
+#ifndef GOODE_OLDE_ODE
+	dCleanupODEAllDataForThread();
+#endif
 }
 
 void Physics::DrawLocator(dVector3 pos)
@@ -113,6 +830,7 @@ void Physics::DrawAxis(dVector3 pos, dVector3 dir)
 
 void Physics::Render()
 {
+	PhysicsLock lock(&m_Mutex);
 	glDisable(GL_LIGHTING);
 	glDisable(GL_DEPTH_TEST);
 
@@ -171,11 +889,13 @@ void Physics::Render()
 
 void Physics::SetGravity(const dVector &g)
 {
+	PhysicsLock lock(&m_Mutex);
 	dWorldSetGravity(m_World,g.x,g.y,g.z);
 }
 
 void Physics::GroundPlane(dVector ori, float off)
 {
+	PhysicsLock lock(&m_Mutex);
 	m_Ground = dCreatePlane(m_Space,ori.x,ori.y,ori.z,off);
 	m_GroundCreated=true;
 }
@@ -220,6 +940,7 @@ void Physics::SetupTransform(Primitive *p, dMatrix &rotation, dVector &Pos)
 
 void Physics::MakeActive(int ID, float Mass, BoundingType Bound)
 {	
+	PhysicsLock lock(&m_Mutex);
 	if (m_ObjectMap.find(ID)!=m_ObjectMap.end())
 	{
 		Trace::Stream<<"Physics::AddToGroup : Object ["<<ID<<"] already registered"<<endl;
@@ -278,22 +999,11 @@ void Physics::MakeActive(int ID, float Mass, BoundingType Bound)
         } break;
 		case MESH:
 		{
-			
 			PolyPrimitive *pp = dynamic_cast<PolyPrimitive *>(Ob->Prim);
 			if (pp!=NULL)
 			{
-				dTriMeshDataID TriMeshData=dGeomTriMeshDataCreate();
 				if (pp->GetType()==PolyPrimitive::TRILIST && pp->IsIndexed())
 				{                    
-					float *verts = (float*)(&((*pp->GetDataVec<dVector>("p"))[0]));
-					float *normals = (float*)(&((*pp->GetDataVec<dVector>("n"))[0]));
-					unsigned int *idx = (unsigned int *)(&(pp->GetIndex()[0]));
-				
-					dGeomTriMeshDataBuildSingle1(TriMeshData, (void*)verts,
-                    	   sizeof(dVector), pp->Size(),
-                    	   (void*)idx, pp->GetIndex().size(),
-                    	   sizeof(unsigned int)*3, (void*)normals);
-
 					dBoundingBox Box=Ob->Prim->GetBoundingBox(ident);
                     Box.fudgenonzerovolume();
 					dVector BoxSize=Box.max-Box.min;
@@ -301,7 +1011,17 @@ void Physics::MakeActive(int ID, float Mass, BoundingType Bound)
 					dMassSetBox(&m,1,BoxSize.x,BoxSize.y,BoxSize.z);
 					dMassAdjust(&m,Mass);
  					dBodySetMass(Ob->Body,&m);
-					Ob->Bound = dCreateTriMesh(m_Space,TriMeshData,NULL,NULL,NULL);
+					
+					Ob->Mesh=GetMesh(pp);
+					if (m_MeshHulls && BuildHull(Ob->Mesh))
+					{
+						Ob->Bound = dCreateConvex(m_Space,&Ob->Mesh->HullPlanes[0],Ob->Mesh->HullPlanes.size()/4,
+							&Ob->Mesh->HullPoints[0],Ob->Mesh->HullPoints.size()/3,&Ob->Mesh->HullPolygons[0]);
+					}
+					else
+					{
+						Ob->Bound = dCreateTriMesh(m_Space,Ob->Mesh->TriMesh,NULL,NULL,NULL);
+					}
 				}
 				else
 				{
@@ -348,6 +1068,9 @@ void Physics::MakeActive(int ID, float Mass, BoundingType Bound)
  	dGeomSetBody (Ob->Bound,Ob->Body);
 	
 	dBodySetAutoDisableFlag(Ob->Body, 1);
+	StorePrevious(Ob);
+	Ob->Info.ID=ID;
+	dGeomSetData(Ob->Bound,&Ob->Info);
 
   	m_ObjectMap[ID]=Ob;
   	m_History.push_back(ID);
@@ -364,6 +1087,7 @@ void Physics::MakeActive(int ID, float Mass, BoundingType Bound)
 
 void Physics::MakePassive(int ID, float Mass, BoundingType Bound)
 {	
+	PhysicsLock lock(&m_Mutex);
 	if (m_ObjectMap.find(ID)!=m_ObjectMap.end())
 	{
 		Trace::Stream<<"Physics::AddToGroup : Object ["<<ID<<"] already registered"<<endl;
@@ -416,19 +1140,10 @@ void Physics::MakePassive(int ID, float Mass, BoundingType Bound)
 			PolyPrimitive *pp = dynamic_cast<PolyPrimitive *>(Ob->Prim);
 			if (pp!=NULL)
 			{
-				dTriMeshDataID TriMeshData=dGeomTriMeshDataCreate();
 				if (pp->GetType()==PolyPrimitive::TRILIST && pp->IsIndexed())
 				{
-					float *verts = (float*)(&((*pp->GetDataVec<dVector>("p"))[0]));
-					float *normals = (float*)(&((*pp->GetDataVec<dVector>("n"))[0]));
-					unsigned int *idx = (unsigned int *)(&(pp->GetIndex()[0]));
-				
-					dGeomTriMeshDataBuildSingle1(TriMeshData, (void*)verts,
-                    	   sizeof(dVector), pp->Size(),
-                    	   (void*)idx, pp->GetIndex().size(),
-                    	   sizeof(unsigned int)*3, (void*)normals);
-
-					Ob->Bound = dCreateTriMesh(m_Space,TriMeshData,NULL,NULL,NULL);
+					Ob->Mesh=GetMesh(pp);
+					Ob->Bound = dCreateTriMesh(m_Space,Ob->Mesh->TriMesh,NULL,NULL,NULL);
 				}
 				else
 				{
@@ -469,13 +1184,364 @@ void Physics::MakePassive(int ID, float Mass, BoundingType Bound)
 	
   	dGeomSetPosition(Ob->Bound,Pos.x,Pos.y,Pos.z);
   	dGeomSetRotation(Ob->Bound,rot);
+	Ob->Info.ID=ID;
+	dGeomSetData(Ob->Bound,&Ob->Info);
 
   	
   	m_ObjectMap[ID]=Ob;
 }
 
+Physics::MeshData *Physics::GetMesh(PolyPrimitive *pp)
+{
+	// more bodies from a primitive that hasn't changed 
+	// can skip the copy and the hash
+	MeshSource source;
+	source.Version=pp->GetDataRaw("p")->GetVersion();
+	source.NumIndices=pp->GetIndex().size();
+	map<const PolyPrimitive*,MeshSource>::iterator s=m_MeshSources.find(pp);
+	if (s!=m_MeshSources.end() && s->second.Version==source.Version && 
+		s->second.NumIndices==source.NumIndices)
+	{
+		s->second.Mesh->RefCount++;
+		return s->second.Mesh;
+	}
+	
+	MeshData *mesh = new MeshData;
+	
+	vector<dVector,FLX_ALLOC(dVector) > *p=pp->GetDataVec<dVector>("p");
+	mesh->Verts.resize(p->size()*3);
+	for (unsigned int i=0; i<p->size(); i++)
+	{
+		mesh->Verts[i*3]=(*p)[i].x;
+		mesh->Verts[i*3+1]=(*p)[i].y;
+		mesh->Verts[i*3+2]=(*p)[i].z;
+	}
+	mesh->Indices=pp->GetIndex();
+	
+	// fnv over the data, copies of the same geometry will match
+	unsigned int hash=2166136261u;
+	const unsigned char *data=(const unsigned char*)&mesh->Verts[0];
+	for (unsigned int i=0; i<mesh->Verts.size()*sizeof(float); i++) hash=(hash^data[i])*16777619u;
+	data=(const unsigned char*)&mesh->Indices[0];
+	for (unsigned int i=0; i<mesh->Indices.size()*sizeof(unsigned int); i++) hash=(hash^data[i])*16777619u;
+	mesh->Hash=hash;
+	
+	pair<multimap<unsigned int,MeshData*>::iterator,multimap<unsigned int,MeshData*>::iterator> range=m_MeshCache.equal_range(hash);
+	for (multimap<unsigned int,MeshData*>::iterator i=range.first; i!=range.second; ++i)
+	{
+		if (i->second->Verts==mesh->Verts && i->second->Indices==mesh->Indices)
+		{
+			delete mesh;
+			i->second->RefCount++;
+			source.Mesh=i->second;
+			m_MeshSources[pp]=source;
+			return i->second;
+		}
+	}
+	
+	mesh->TriMesh=dGeomTriMeshDataCreate();
+	dGeomTriMeshDataBuildSingle(mesh->TriMesh, &mesh->Verts[0], sizeof(float)*3, mesh->Verts.size()/3,
+		&mesh->Indices[0], mesh->Indices.size(), sizeof(unsigned int)*3);
+	mesh->Cached=true;
+	m_MeshCache.insert(pair<unsigned int,MeshData*>(hash,mesh));
+	source.Mesh=mesh;
+	m_MeshSources[pp]=source;
+	return mesh;
+}
+
+void Physics::ReleaseMesh(MeshData *mesh)
+{
+	mesh->RefCount--;
+	if (mesh->RefCount>0) return;
+	
+	if (mesh->Cached)
+	{
+		pair<multimap<unsigned int,MeshData*>::iterator,multimap<unsigned int,MeshData*>::iterator> range=m_MeshCache.equal_range(mesh->Hash);
+		for (multimap<unsigned int,MeshData*>::iterator i=range.first; i!=range.second; ++i)
+		{
+			if (i->second==mesh) 
+			{
+				m_MeshCache.erase(i);
+				break;
+			}
+		}
+		
+		for (map<const PolyPrimitive*,MeshSource>::iterator i=m_MeshSources.begin(); i!=m_MeshSources.end();)
+		{
+			if (i->second.Mesh==mesh) m_MeshSources.erase(i++);
+			else ++i;
+		}
+	}
+	delete mesh;
+}
+
+bool Physics::BuildHull(MeshData *mesh)
+{
+	if (mesh->HullBuilt) return !mesh->HullPoints.empty();
+	mesh->HullBuilt=true;
+	
+	vector<dVector> points;
+	for (unsigned int i=0; i<mesh->Verts.size(); i+=3)
+	{
+		points.push_back(dVector(mesh->Verts[i],mesh->Verts[i+1],mesh->Verts[i+2]));
+	}
+	
+	vector<dVector> hull;
+	vector<unsigned int> triangles;
+	if (!ConvexHull(points,hull,triangles)) 
+	{
+		Trace::Stream<<"Physics::BuildHull : mesh is flat, using the triangles instead"<<endl;
+		return false;
+	}
+	
+	for (unsigned int i=0; i<hull.size(); i++)
+	{
+		mesh->HullPoints.push_back(hull[i].x);
+		mesh->HullPoints.push_back(hull[i].y);
+		mesh->HullPoints.push_back(hull[i].z);
+	}
+	
+	for (unsigned int i=0; i<triangles.size(); i+=3)
+	{
+		dVector &a=hull[triangles[i]];
+		dVector n=(hull[triangles[i+1]]-a).cross(hull[triangles[i+2]]-a);
+		n.normalise();
+		mesh->HullPlanes.push_back(n.x);
+		mesh->HullPlanes.push_back(n.y);
+		mesh->HullPlanes.push_back(n.z);
+		mesh->HullPlanes.push_back(n.dot(a));
+		mesh->HullPolygons.push_back(3);
+		mesh->HullPolygons.push_back(triangles[i]);
+		mesh->HullPolygons.push_back(triangles[i+1]);
+		mesh->HullPolygons.push_back(triangles[i+2]);
+	}
+	return true;
+}
+
+void Physics::UpdateMesh(int ID)
+{
+	PhysicsLock lock(&m_Mutex);
+	map<int,Object*>::iterator i = m_ObjectMap.find(ID);
+	if (i==m_ObjectMap.end() || i->second->Mesh==NULL)
+	{
+		Trace::Stream<<"Physics::UpdateMesh : Object ["<<ID<<"] isn't a mesh"<<endl;
+		return;
+	}
+	
+	Object *ob=i->second;
+	if (dGeomGetClass(ob->Bound)!=dTriMeshClass)
+	{
+		Trace::Stream<<"Physics::UpdateMesh : Object ["<<ID<<"] uses a convex hull, which can't be updated"<<endl;
+		return;
+	}
+	
+	vector<dVector,FLX_ALLOC(dVector) > *p=ob->Prim->GetDataVec<dVector>("p");
+	if (p==NULL || p->size()*3!=ob->Mesh->Verts.size())
+	{
+		Trace::Stream<<"Physics::UpdateMesh : Object ["<<ID<<"] has changed size, it needs to be remade"<<endl;
+		return;
+	}
+	
+	// take a copy of our own, so the other objects sharing it aren't changed
+	if (ob->Mesh->Cached)
+	{
+		MeshData *mesh = new MeshData;
+		mesh->Verts=ob->Mesh->Verts;
+		mesh->Indices=ob->Mesh->Indices;
+		mesh->TriMesh=dGeomTriMeshDataCreate();
+		dGeomTriMeshDataBuildSingle(mesh->TriMesh, &mesh->Verts[0], sizeof(float)*3, mesh->Verts.size()/3,
+			&mesh->Indices[0], mesh->Indices.size(), sizeof(unsigned int)*3);
+		dGeomTriMeshSetData(ob->Bound,mesh->TriMesh);
+		ReleaseMesh(ob->Mesh);
+		ob->Mesh=mesh;
+	}
+	
+	for (unsigned int n=0; n<p->size(); n++)
+	{
+		ob->Mesh->Verts[n*3]=(*p)[n].x;
+		ob->Mesh->Verts[n*3+1]=(*p)[n].y;
+		ob->Mesh->Verts[n*3+2]=(*p)[n].z;
+	}
+	dGeomTriMeshDataUpdate(ob->Mesh->TriMesh);
+}
+
+void Physics::MakeSwarm(int ID, float Mass, BoundingType Bound)
+{
+	PhysicsLock lock(&m_Mutex);
+	if (m_SwarmMap.find(ID)!=m_SwarmMap.end() || m_ObjectMap.find(ID)!=m_ObjectMap.end())
+	{
+		Trace::Stream<<"Physics::MakeSwarm : Object ["<<ID<<"] already registered"<<endl;
+		return;
+	}
+	
+	InstancePrimitive *prim = dynamic_cast<InstancePrimitive*>(m_Renderer->GetPrimitive(ID));
+	if (prim==NULL)
+	{
+		Trace::Stream<<"Physics::MakeSwarm : Object ["<<ID<<"] is not an instance primitive"<<endl;
+		return;
+	}
+	
+	if (Bound==MESH)
+	{
+		Trace::Stream<<"Physics::MakeSwarm : mesh bounds aren't supported for swarms"<<endl;
+		return;
+	}
+
+	// the instances move the primitive from now on
+	prim->ApplyTransform();
+	vector<dMatrix,FLX_ALLOC(dMatrix) > *matrices=prim->GetDataVec<dMatrix>("m");
+	
+	dMatrix ident;
+	dBoundingBox Box=prim->GetSource()->GetBoundingBox(ident);
+	Box.fudgenonzerovolume();
+	dVector BoxSize=Box.max-Box.min;
+	dVector Centre=Box.min+BoxSize/2;
+	float Radius=BoxSize.x/2;
+	
+	// all the bodies share the same mass distribution
+	dMass m;
+	switch (Bound)
+	{
+		case BOX: dMassSetBox(&m,1,BoxSize.x,BoxSize.y,BoxSize.z); break;
+		case SPHERE: dMassSetSphere(&m,1,Radius); break;
+		case CYLINDER: dMassSetCylinder(&m,1,2,Radius,BoxSize.y); break;
+		default: break;
+	}
+	dMassAdjust(&m,Mass);
+	
+	Swarm *swarm = new Swarm;
+	swarm->Prim = prim;
+	swarm->Offset = Centre*-1;
+	unsigned int count=matrices->size();
+	swarm->Bodies.resize(count);
+	swarm->Bounds.resize(count);
+	swarm->Infos.resize(count);
+	swarm->PrevPos.resize(count*3);
+	swarm->PrevRot.resize(count*4);
+	swarm->Scales.resize(count);
+	
+	for (unsigned int i=0; i<count; i++)
+	{
+		// scale isn't simulated, only the source geometry's size is used
+		dMatrix rotation=(*matrices)[i];
+		swarm->Scales[i]=SplitScale(rotation);
+		rotation.settranslate(dVector(0,0,0));
+		dVector Pos=(*matrices)[i].transform(Centre);
+		
+		dBodyID body = dBodyCreate(m_World);
+		dBodySetMass(body,&m);
+		
+		dGeomID geom = 0;
+		switch (Bound)
+		{
+			case BOX: geom = dCreateBox(m_Space,BoxSize.x,BoxSize.y,BoxSize.z); break;
+			case SPHERE: geom = dCreateSphere(m_Space,Radius); break;
+			case CYLINDER: geom = dCreateCylinder(m_Space,Radius,BoxSize.y); break;
+			default: break;
+		}
+		
+		dMatrix3 rot;
+		rot[0]=rotation.m[0][0]; rot[1]=rotation.m[1][0]; rot[2]=rotation.m[2][0]; rot[3]=0;
+		rot[4]=rotation.m[0][1]; rot[5]=rotation.m[1][1]; rot[6]=rotation.m[2][1]; rot[7]=0;
+		rot[8]=rotation.m[0][2]; rot[9]=rotation.m[1][2]; rot[10]=rotation.m[2][2]; rot[11]=0;
+		dBodySetRotation(body,rot);
+		dBodySetPosition(body,Pos.x,Pos.y,Pos.z);
+		dGeomSetBody(geom,body);
+		dBodySetAutoDisableFlag(body, 1);
+		
+		swarm->Bodies[i]=body;
+		swarm->Bounds[i]=geom;
+		swarm->Infos[i].ID=ID;
+		swarm->Infos[i].Index=i;
+		dGeomSetData(geom,&swarm->Infos[i]);
+		StoreBody(body,&swarm->PrevPos[i*3],&swarm->PrevRot[i*4]);
+	}
+	
+	m_SwarmMap[ID]=swarm;
+}
+
+Physics::Swarm *Physics::FindSwarm(const string &func, int ID, int &start, int &end)
+{
+	map<int,Swarm*>::iterator i = m_SwarmMap.find(ID);
+	if (i==m_SwarmMap.end())
+	{
+		Trace::Stream<<"Physics::"<<func<<" : Swarm ["<<ID<<"] doesn't exist"<<endl;
+		return NULL;
+	}
+	
+	int size=i->second->Bodies.size();
+	if (start<0) start=0;
+	if (end>size) end=size;
+	return i->second;
+}
+
+int Physics::GetSwarmSize(int ID)
+{
+	PhysicsLock lock(&m_Mutex);
+	map<int,Swarm*>::iterator i = m_SwarmMap.find(ID);
+	if (i==m_SwarmMap.end()) return 0;
+	return i->second->Bodies.size();
+}
+
+void Physics::SwarmKick(int ID, int start, int end, dVector v)
+{
+	PhysicsLock lock(&m_Mutex);
+	Swarm *swarm=FindSwarm("SwarmKick",ID,start,end);
+	if (swarm==NULL) return;
+	
+	for (int b=start; b<end; b++)
+	{
+		const dReal *cv = dBodyGetLinearVel(swarm->Bodies[b]);
+		dBodySetLinearVel(swarm->Bodies[b],cv[0]+v.x,cv[1]+v.y,cv[2]+v.z);
+		dBodyEnable(swarm->Bodies[b]);
+	}
+}
+
+void Physics::SwarmTwist(int ID, int start, int end, dVector v)
+{
+	PhysicsLock lock(&m_Mutex);
+	Swarm *swarm=FindSwarm("SwarmTwist",ID,start,end);
+	if (swarm==NULL) return;
+	
+	for (int b=start; b<end; b++)
+	{
+		const dReal *cv = dBodyGetAngularVel(swarm->Bodies[b]);
+		dBodySetAngularVel(swarm->Bodies[b],cv[0]+v.x,cv[1]+v.y,cv[2]+v.z);
+		dBodyEnable(swarm->Bodies[b]);
+	}
+}
+
+void Physics::SwarmAddForce(int ID, int start, int end, dVector v)
+{
+	PhysicsLock lock(&m_Mutex);
+	Swarm *swarm=FindSwarm("SwarmAddForce",ID,start,end);
+	if (swarm==NULL) return;
+	
+	for (int b=start; b<end; b++)
+	{
+		dBodyAddForce(swarm->Bodies[b],v.x,v.y,v.z);
+		dBodyEnable(swarm->Bodies[b]);
+	}
+}
+
+void Physics::SwarmCollided(int ID, int start, int end, vector<int> &result)
+{
+	PhysicsLock lock(&m_Mutex);
+	Swarm *swarm=FindSwarm("SwarmCollided",ID,start,end);
+	if (swarm==NULL) return;
+	
+	for (int b=start; b<end; b++)
+	{
+		if (m_CollisionRecord.find(swarm->Bodies[b])!=m_CollisionRecord.end())
+		{
+			result.push_back(b);
+		}
+	}
+}
+
 void Physics::SetMass(int ID, float mass)
 {
+	PhysicsLock lock(&m_Mutex);
 	map<int,Object*>::iterator i = m_ObjectMap.find(ID);
 	if (i==m_ObjectMap.end())
 	{
@@ -497,6 +1563,14 @@ void Physics::SetMass(int ID, float mass)
 
 void Physics::Free(int ID)
 {
+	PhysicsLock lock(&m_Mutex);
+	map<int,Swarm*>::iterator s = m_SwarmMap.find(ID);
+	if (s!=m_SwarmMap.end())
+	{
+		delete s->second;
+		m_SwarmMap.erase(s);
+	}
+	
 	map<int,Object*>::iterator i = m_ObjectMap.find(ID);
 	if (i!=m_ObjectMap.end())
 	{
@@ -516,7 +1590,9 @@ void Physics::Free(int ID)
             m_JointMap.erase(*j);
         }
         
+        MeshData *mesh=i->second->Mesh;
         delete i->second;
+        if (mesh!=NULL) ReleaseMesh(mesh);
         m_ObjectMap.erase(i);
     }
 
@@ -533,12 +1609,21 @@ void Physics::Free(int ID)
 
 void Physics::Clear()
 {
+	PhysicsLock lock(&m_Mutex);
 	for(map<int,Object*>::iterator i=m_ObjectMap.begin(); i!=m_ObjectMap.end(); ++i)
 	{
+		MeshData *mesh=i->second->Mesh;
 		delete i->second;
+		if (mesh!=NULL) ReleaseMesh(mesh);
 	}
 	m_ObjectMap.clear();
 
+	for(map<int,Swarm*>::iterator i=m_SwarmMap.begin(); i!=m_SwarmMap.end(); ++i)
+	{
+		delete i->second;
+	}
+	m_SwarmMap.clear();
+
 	for(map<int,JointObject*>::iterator i=m_JointMap.begin(); i!=m_JointMap.end(); ++i)
 	{
 		delete i->second;
@@ -546,6 +1631,10 @@ void Physics::Clear()
 	m_JointMap.clear();
 
 	m_History.clear();
+	m_CollisionRecord.clear();
+	m_PendingCollisions.clear();
+	m_Events.clear();
+	m_PendingEvents.clear();
 	if (m_GroundCreated)
 	{
 		dGeomDestroy(m_Ground);
@@ -555,32 +1644,37 @@ void Physics::Clear()
 	m_NextJointID=0;
 }
 
-void Physics::UpdatePrimitives()
+void Physics::UpdatePrimitives(float alpha)
 {
 	// for every object
 	for(map<int,Object*>::iterator i=m_ObjectMap.begin(); i!=m_ObjectMap.end(); ++i)
 	{
 		if (i->second->Type==ACTIVE)
 		{
-			float Pos[3]={dBodyGetPosition(i->second->Body)[0],
-			              dBodyGetPosition(i->second->Body)[1],
-						  dBodyGetPosition(i->second->Body)[2]};
-					
-			dMatrix Rot(dBodyGetRotation(i->second->Body)[0], dBodyGetRotation(i->second->Body)[1], dBodyGetRotation(i->second->Body)[2],
-			  			   dBodyGetRotation(i->second->Body)[3], dBodyGetRotation(i->second->Body)[4], dBodyGetRotation(i->second->Body)[5],
-			               dBodyGetRotation(i->second->Body)[6], dBodyGetRotation(i->second->Body)[7], dBodyGetRotation(i->second->Body)[8],
-			       		   dBodyGetRotation(i->second->Body)[9], dBodyGetRotation(i->second->Body)[10], dBodyGetRotation(i->second->Body)[11], 0,0,0,1);
-       		   		
-			dVector PosVec(Pos[0],Pos[1],Pos[2]);	
-				
-			i->second->Prim->GetState()->Transform=Rot;
-			i->second->Prim->GetState()->Transform.settranslate(PosVec);
+			Object *ob=i->second;
+			ob->Prim->GetState()->Transform=BodyTransform(ob->Body,ob->PrevPos,ob->PrevRot,alpha);
+		}
+	}
+	
+	// and every swarm, straight into the instance matrices
+	for(map<int,Swarm*>::iterator i=m_SwarmMap.begin(); i!=m_SwarmMap.end(); ++i)
+	{
+		Swarm *swarm=i->second;
+		vector<dMatrix,FLX_ALLOC(dMatrix) > *matrices=swarm->Prim->GetDataVec<dMatrix>("m");
+		if (matrices==NULL || matrices->size()<swarm->Bodies.size()) continue;
+		
+		for (unsigned int b=0; b<swarm->Bodies.size(); b++)
+		{
+			dMatrix m=BodyTransform(swarm->Bodies[b],&swarm->PrevPos[b*3],&swarm->PrevRot[b*4],alpha);
+			m.scale(swarm->Scales[b]);
+			(*matrices)[b]=m.translate(swarm->Offset);
 		}
 	}
 }
 
 void Physics::Kick(int ID, dVector v)
 {
+	PhysicsLock lock(&m_Mutex);
     map<int,Object*>::iterator i = m_ObjectMap.find(ID);
 	if (i==m_ObjectMap.end())
 	{
@@ -597,6 +1691,7 @@ void Physics::Kick(int ID, dVector v)
 
 void Physics::Twist(int ID, dVector v)
 {
+	PhysicsLock lock(&m_Mutex);
     map<int,Object*>::iterator i = m_ObjectMap.find(ID);
 	if (i==m_ObjectMap.end())
 	{
@@ -613,6 +1708,7 @@ void Physics::Twist(int ID, dVector v)
 
 void Physics::AddForce(int ID, dVector v)
 {
+	PhysicsLock lock(&m_Mutex);
     map<int,Object*>::iterator i = m_ObjectMap.find(ID);
 	if (i==m_ObjectMap.end())
 	{
@@ -628,6 +1724,7 @@ void Physics::AddForce(int ID, dVector v)
 
 void Physics::AddTorque(int ID, dVector v)
 {
+	PhysicsLock lock(&m_Mutex);
     map<int,Object*>::iterator i = m_ObjectMap.find(ID);
 	if (i==m_ObjectMap.end())
 	{
@@ -643,6 +1740,7 @@ void Physics::AddTorque(int ID, dVector v)
 
 void Physics::SetGravityMode(int ID, bool mode)
 {
+	PhysicsLock lock(&m_Mutex);
     map<int,Object*>::iterator i = m_ObjectMap.find(ID);
 	if (i==m_ObjectMap.end())
 	{
@@ -663,35 +1761,19 @@ void Physics::NearCallback(void *data, dGeomID o1, dGeomID o2)
 
 void Physics::NearCallback_i(dGeomID o1, dGeomID o2)
 {
-	if (m_Collisions)
+	if (dGeomGetClass(o1)==dTriMeshClass || dGeomGetClass(o2)==dTriMeshClass)
 	{
-  		const int N = 10;
-		dContact contact[N];
-
-		int n = dCollide(o1,o2,N,&contact[0].geom,sizeof(dContact));
-		if (n > 0)
-		{
-			for (int i=0; i<n; i++)
-			{
-				contact[i].surface.mode = dContactSlip1 | dContactSlip2 | dContactSoftERP | dContactSoftCFM | dContactApprox1;
-				contact[i].surface.mu = dInfinity;
-				contact[i].surface.slip1 = m_Slip1;
-				contact[i].surface.slip2 = m_Slip2;
-				contact[i].surface.soft_erp = m_SoftErp;
-				contact[i].surface.soft_cfm = m_SoftCfm;
-				dJointID c = dJointCreateContact(m_World,m_ContactGroup,&contact[i]);
-				dBodyID geom1 = dGeomGetBody(contact[i].geom.g1);
-				dBodyID geom2 = dGeomGetBody(contact[i].geom.g2);
-				dJointAttach(c,geom1,geom2);
-				m_CollisionRecord.insert(geom1);
-				m_CollisionRecord.insert(geom2);
-			}
-		}
+		m_SerialPairs.push_back(pair<dGeomID,dGeomID>(o1,o2));
+	}
+	else
+	{
+		m_Pairs.push_back(pair<dGeomID,dGeomID>(o1,o2));
 	}
 }
 
 int Physics::CreateJointHinge2(int Ob1, int Ob2, dVector Anchor, dVector Hinge[2])
 {
+	PhysicsLock lock(&m_Mutex);
 	map<int,Object*>::iterator i1 = m_ObjectMap.find(Ob1);
 	map<int,Object*>::iterator i2 = m_ObjectMap.find(Ob2);
 	
@@ -733,6 +1815,7 @@ int Physics::CreateJointHinge2(int Ob1, int Ob2, dVector Anchor, dVector Hinge[2
 
 int Physics::CreateJointHinge(int Ob1, int Ob2, dVector Anchor, dVector Hinge)
 {
+	PhysicsLock lock(&m_Mutex);
 	map<int,Object*>::iterator i1 = m_ObjectMap.find(Ob1);
 	map<int,Object*>::iterator i2 = m_ObjectMap.find(Ob2);
 	
@@ -772,6 +1855,7 @@ int Physics::CreateJointHinge(int Ob1, int Ob2, dVector Anchor, dVector Hinge)
 
 int Physics::CreateJointFixed(int Ob)
 {
+	PhysicsLock lock(&m_Mutex);
 	map<int,Object*>::iterator i = m_ObjectMap.find(Ob);
 	
 	if (i==m_ObjectMap.end())
@@ -802,6 +1886,7 @@ int Physics::CreateJointFixed(int Ob)
 
 int Physics::CreateJointSlider(int Ob1, int Ob2, dVector Hinge)
 {
+	PhysicsLock lock(&m_Mutex);
 	map<int,Object*>::iterator i1 = m_ObjectMap.find(Ob1);
 	map<int,Object*>::iterator i2 = m_ObjectMap.find(Ob2);
 	
@@ -839,6 +1924,7 @@ int Physics::CreateJointSlider(int Ob1, int Ob2, dVector Hinge)
 
 int Physics::CreateJointAMotor(int Ob1, int Ob2, dVector Axis)
 {
+	PhysicsLock lock(&m_Mutex);
 	map<int,Object*>::iterator i1 = m_ObjectMap.find(Ob1);
 	map<int,Object*>::iterator i2 = m_ObjectMap.find(Ob2);
 	
@@ -879,6 +1965,7 @@ int Physics::CreateJointAMotor(int Ob1, int Ob2, dVector Axis)
 
 int Physics::CreateJointBall(int Ob1, int Ob2, dVector Anchor)
 {
+	PhysicsLock lock(&m_Mutex);
 	map<int,Object*>::iterator i1 = m_ObjectMap.find(Ob1);
 	map<int,Object*>::iterator i2 = m_ObjectMap.find(Ob2);
 	
@@ -916,6 +2003,7 @@ int Physics::CreateJointBall(int Ob1, int Ob2, dVector Anchor)
 
 void Physics::SetJointAngle(int ID, float vel, float angle)
 {
+	PhysicsLock lock(&m_Mutex);
 	map<int,JointObject*>::iterator i = m_JointMap.find(ID);
 	if (i==m_JointMap.end())
 	{
@@ -935,6 +2023,7 @@ void Physics::SetJointAngle(int ID, float vel, float angle)
 
 void Physics::JointSlide(int ID, float force)
 {
+	PhysicsLock lock(&m_Mutex);
 	map<int,JointObject*>::iterator i = m_JointMap.find(ID);
 	if (i==m_JointMap.end())
 	{
@@ -950,6 +2039,7 @@ void Physics::JointSlide(int ID, float force)
 
 void Physics::SetJointParam(int ID, const string &Param, float Value)
 { 
+	PhysicsLock lock(&m_Mutex);
 	map<int,JointObject*>::iterator i = m_JointMap.find(ID);
 	if (i==m_JointMap.end())
 	{
@@ -993,6 +2083,7 @@ void Physics::SetJointParam(int ID, const string &Param, float Value)
 
 bool Physics::HasCollided(int Ob)
 {
+	PhysicsLock lock(&m_Mutex);
 	map<int,Object*>::iterator i = m_ObjectMap.find(Ob);
 	if (i==m_ObjectMap.end())
 	{
@@ -18,7 +18,10 @@
 #define FLUXUS_PHYSICS
 
 #include <ode/ode.h>
+#include <pthread.h>
 #include "Renderer.h"
+#include "InstancePrimitive.h"
+#include "PolyPrimitive.h"
 #include <set>
 
 ///\todo rename to Fluxus
@@ -36,9 +39,39 @@ public:
 	enum BoundingType {BOX,CYLINDER,SPHERE,MESH};
 	enum ObjectType {ACTIVE,PASSIVE};
 	
-	/// Run the simulation for one frame
+	/// Run the simulation for one frame, with a fixed timestep 
+	/// this runs as many steps as the frame time needs
     void Tick();
 	
+	/////////////////////////////////
+	///@name Timing
+	/// A step size of 0 is the old behaviour of one step per 
+	/// frame, otherwise the simulation runs in fixed steps driven 
+	/// by the renderer's frame time, up to maxsubsteps per frame. 
+	///@{
+	void SetTimestep(float step, int maxsubsteps);
+	float GetTimestep() { return m_StepSize; }
+	/// Blend transforms between the last two steps when rendering
+	void SetInterpolate(bool s) { m_Interpolate=s; }
+	/// Run the simulation in it's own thread at the fixed step rate
+	void SetThreaded(bool s);
+	bool IsThreaded() { return m_Threaded; }
+	///@}
+	
+	/////////////////////////////////
+	///@name Performance
+	///@{
+	enum BroadphaseType {HASH,SAP};
+	/// Switch the collision space, existing objects are moved over
+	void SetBroadphase(BroadphaseType type);
+	/// Threads to use for contact generation and, with new 
+	/// enough ode, solving islands. 1 does everything serially.
+	void SetThreads(int count);
+	/// Steps a throwaway world of count boxes, either in a pile 
+	/// or raining down, and returns the average step time in ms
+	float Benchmark(int count, bool rain, int steps);
+	///@}
+	
 	/// Just for visualisation of joints
    	void Render();
 	
@@ -72,6 +105,18 @@ public:
 	void SetGravity(const dVector &g);
 	void SetGlobalSurfaceParams(float slip1, float slip2, float softerp, float softcfm) 
 		{ m_Slip1=slip1; m_Slip2=slip2; m_SoftErp=softerp; m_SoftCfm=softcfm; }
+	
+	/////////////////////////////////
+	///@name Meshes
+	/// Mesh collision data is shared between all objects made 
+	/// from the same geometry.
+	///@{
+	/// Use the convex hull for active mesh objects rather than the 
+	/// triangles, much faster and more stable but loses concavities
+	void SetMeshHulls(bool s) { m_MeshHulls=s; }
+	/// Reload a mesh object's triangles from it's (deformed) pdata
+	void UpdateMesh(int ID);
+	///@}
 
 	/////////////////////////////////
 	///@name Joints
@@ -87,11 +132,57 @@ public:
 	void JointSlide(int ID, float force); 
 	///@}
 	
+	/////////////////////////////////
+	///@name Swarms
+	/// A swarm makes an active body for every instance of an 
+	/// InstancePrimitive, all sharing the same bounding shape. 
+	/// The bodies write their transforms straight into the 
+	/// instance matrices, so thousands can be simulated without 
+	/// a primitive each. Ranges are indices from start up to 
+	/// but not including end.
+	///@{
+	void MakeSwarm(int ID, float Mass, BoundingType Bound=BOX);
+	int GetSwarmSize(int ID);
+	void SwarmKick(int ID, int start, int end, dVector v);
+	void SwarmTwist(int ID, int start, int end, dVector v);
+	void SwarmAddForce(int ID, int start, int end, dVector v);
+	/// Fills result with the indices of bodies that collided in the last frame
+	void SwarmCollided(int ID, int start, int end, vector<int> &result);
+	///@}
+	
     int GetMaxObjectCount() { return m_MaxObjectCount; }
     void SetMaxObjectCount(int s) { m_MaxObjectCount=s; }
 
 	bool HasCollided(int Ob);
 	
+	/////////////////////////////////
+	///@name Collision events
+	/// Rather than polling each object, these collect a list of 
+	/// every pair of objects that touched in the last frame.
+	///@{
+	class CollisionEvent
+	{
+	public:
+		/// primitive ids, 0 for the ground plane, and the body 
+		/// index if the object is a swarm
+		int Ob1,Index1;
+		int Ob2,Index2;
+		/// the deepest contact between them
+		dVector Pos;
+		dVector Normal;
+		float Depth;
+		/// how hard they hit, from the contact forces
+		float Impulse;
+	};
+	
+	void SetCollisionEvents(bool s);
+	/// Once anything is subscribed, only events involving 
+	/// subscribed objects are kept
+	void Subscribe(int ID);
+	void Unsubscribe(int ID);
+	const vector<CollisionEvent> &GetCollisionEvents() { return m_Events; }
+	///@}
+	
 private:
 	// helpers that use ode types for convienience, and so it can be built with double support
 	void DrawLocator(dVector3 pos);
@@ -100,6 +191,44 @@ private:
 
 	enum JointType {BallJoint,HingeJoint,SliderJoint,ContactJoint,UniversalJoint,Hinge2Joint,FixedJoint,AMotorJoint};
 
+	// stored as the geom data, so contacts can be traced back
+	class GeomInfo
+	{
+	public:
+		GeomInfo() : ID(0), Index(0) {}
+		int ID;
+		int Index;
+	};
+	
+	class MeshData
+	{
+	public:
+		MeshData();
+		~MeshData();
+		unsigned int Hash;
+		int RefCount;
+		bool Cached;
+		// 3 floats per vertex, ode uses these directly
+		vector<float> Verts;
+		vector<unsigned int> Indices;
+		dTriMeshDataID TriMesh;
+		// built the first time it's needed
+		bool HullBuilt;
+		vector<dReal> HullPlanes;
+		vector<dReal> HullPoints;
+		vector<unsigned int> HullPolygons;
+	};
+	
+	// the cached mesh last made from a primitive, and the 
+	// pdata version and index size it was made from
+	class MeshSource
+	{
+	public:
+		MeshData *Mesh;
+		unsigned int Version;
+		unsigned int NumIndices;
+	};
+	
 	class Object
 	{
 	public:
@@ -109,6 +238,29 @@ private:
 		dBodyID Body;
 		dGeomID Bound;
 		Primitive *Prim;
+		MeshData *Mesh;
+		GeomInfo Info;
+		// state at the start of the last step, for interpolation
+		dReal PrevPos[3];
+		dQuaternion PrevRot;
+	};
+	
+	class Swarm
+	{
+	public:
+		Swarm();
+		~Swarm();
+		InstancePrimitive *Prim;
+		vector<dBodyID> Bodies;
+		vector<dGeomID> Bounds;
+		vector<GeomInfo> Infos;
+		// from the body centre to the instance origin
+		dVector Offset;
+		// the instance scales, not simulated but put back on the matrices
+		vector<dVector> Scales;
+		// 3 and 4 per body, for interpolation
+		vector<dReal> PrevPos;
+		vector<dReal> PrevRot;
 	};
 	
 	class JointObject
@@ -122,10 +274,39 @@ private:
 		int Ob2;
 	};
 
-	void UpdatePrimitives();
+	void UpdatePrimitives(float alpha);
+	void Advance(double delta);
+	void Step(dReal step);
+	void StorePrevious(Object *ob);
+	MeshData *GetMesh(PolyPrimitive *pp);
+	void ReleaseMesh(MeshData *mesh);
+	bool BuildHull(MeshData *mesh);
+	Swarm *FindSwarm(const string &func, int ID, int &start, int &end);
+	
+	static void *ThreadEntry(void *p);
+	void ThreadLoop();
 
 	static void NearCallback(void *data, dGeomID o1, dGeomID o2);
 	void NearCallback_i(dGeomID o1, dGeomID o2);
+	
+	void StepWorld(dReal step);
+	void AddEvent(const dContact &contact, unsigned int feedback);
+	void Collide();
+	void CollidePair(dGeomID o1, dGeomID o2, vector<dContact> &contacts);
+	void CollideShared(vector<dContact> &contacts);
+	dSpaceID CreateSpace(BroadphaseType type);
+	void AttachThreading(dWorldID world);
+	void StopWorkers();
+	
+	class WorkerArg
+	{
+	public:
+		Physics *Owner;
+		int Index;
+		int Generation;
+	};
+	static void *WorkerEntry(void *p);
+	void WorkerLoop(int index);
 
 	static bool m_ODEInited;
     dWorldID m_World;
@@ -133,10 +314,14 @@ private:
 	dGeomID m_Ground;
 
 	map<int,Object*>       m_ObjectMap;
+	map<int,Swarm*>        m_SwarmMap;
 	map<int,dGeomID>       m_GroupMap;
 	map<int,JointObject*>  m_JointMap;
+	multimap<unsigned int,MeshData*> m_MeshCache;
+	map<const PolyPrimitive*,MeshSource> m_MeshSources;
 	deque<int>             m_History;
 	set<dBodyID>		   m_CollisionRecord;
+	set<dBodyID>		   m_PendingCollisions;
 
 	Renderer *m_Renderer;
 	int m_MaxObjectCount;
@@ -149,6 +334,51 @@ private:
 	float m_Slip2;
 	float m_SoftErp;
 	float m_SoftCfm;
+	bool m_MeshHulls;
+	
+	BroadphaseType m_Broadphase;
+	
+	bool m_CollisionEvents;
+	set<int> m_Subscriptions;
+	vector<CollisionEvent> m_Events;
+	vector<CollisionEvent> m_PendingEvents;
+	// the contact forces for this step, and the range of 
+	// them belonging to each new event
+	vector<dJointFeedback> m_Feedback;
+	vector<pair<unsigned int,unsigned int> > m_EventFeedback;
+	unsigned int m_StepEvents;
+	
+	// candidate pairs from the broadphase, the serial ones 
+	// involve trimeshes, which ode can't collide concurrently
+	vector<pair<dGeomID,dGeomID> > m_Pairs;
+	vector<pair<dGeomID,dGeomID> > m_SerialPairs;
+	vector<vector<dContact> > m_ContactBuffers;
+	
+	vector<pthread_t> m_Workers;
+	vector<WorkerArg> m_WorkerArgs;
+	pthread_mutex_t m_WorkMutex;
+	pthread_cond_t m_WorkCond;
+	pthread_cond_t m_DoneCond;
+	int m_WorkGeneration;
+	int m_WorkersBusy;
+	bool m_WorkersRunning;
+	volatile int m_NextPair;
+	
+#ifdef ODE_THREADING
+	dThreadingImplementationID m_ThreadingImpl;
+	dThreadingThreadPoolID m_ThreadPool;
+#endif
+	
+	float m_StepSize;
+	int m_MaxSubSteps;
+	double m_Accumulator;
+	bool m_Interpolate;
+	
+	bool m_Threaded;
+	volatile bool m_ThreadRunning;
+	double m_LastAdvance;
+	pthread_t m_Thread;
+	pthread_mutex_t m_Mutex;
 };
 
 };
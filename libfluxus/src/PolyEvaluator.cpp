@@ -14,184 +14,198 @@
 // along with this program; if not, write to the Free Software
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
+#include <algorithm>
+#include <float.h>
+#include <math.h>
 #include "PolyEvaluator.h"
 #include "PolyPrimitive.h"
 #include "Geometry.h"
+#include "WorkerPool.h"
 
 using namespace Fluxus;
 
-PolyEvaluator::PolyEvaluator(const PolyPrimitive *prim) :
-m_Prim(prim)
-{
-	assert(m_Prim!=NULL);
-}
+// lines in a chunk for batches
+static const unsigned int EVALUATOR_LINES_CHUNK=64;
 
-PolyEvaluator::~PolyEvaluator()
+namespace Fluxus
 {
-}
-
-//////////////////////////////////////////////
 
-Evaluator::Point PolyEvaluator::ClosestPoint(const dVector &position)
+class IntersectLinesJob : public WorkerPool::Job
 {
-	return Point();
-}
-
-//////////////////////////////////////////////
-
-bool PolyEvaluator::IntersectLine(const dVector &start, const dVector &end, vector<Point> &points)
+public:
+	IntersectLinesJob(PolyEvaluator *eval) : m_Eval(eval) {}
+	virtual void Run(unsigned int start, unsigned int end) { m_Eval->IntersectChunks(start,end); }
+private:
+	PolyEvaluator *m_Eval;
+};
+
+// collects the triangles the line goes through
+class LineHits : public BVH::LineVisitor
 {
-	switch (m_Prim->GetType())
+public:
+	LineHits(const dVector &start, const dVector &end, const vector<unsigned int> &triangles, 
+	         const vector<dVector,FLX_ALLOC(dVector) > &verts, vector<PolyEvaluator::Hit> &hits) :
+	m_Start(start), m_End(end), m_Triangles(triangles), m_Verts(verts), m_Hits(hits) {}
+	
+	virtual void Visit(unsigned int item)
 	{
-		case PolyPrimitive::TRISTRIP: return IntersectTriStrip(start,end,points); break;
-		case PolyPrimitive::QUADS: return IntersectQuads(start,end,points); break;
-		case PolyPrimitive::TRILIST: return IntersectTriList(start,end,points); break;
-		case PolyPrimitive::TRIFAN: return IntersectTriFan(start,end,points); break;
-		case PolyPrimitive::POLYGON: return IntersectPolygon(start,end,points); break;
-	};
+		PolyEvaluator::Hit hit;
+		hit.T=IntersectLineTriangle(m_Start,m_End,m_Verts[m_Triangles[item*3]],
+		                            m_Verts[m_Triangles[item*3+1]],
+		                            m_Verts[m_Triangles[item*3+2]],hit.Bary);
+		if (hit.T>0)
+		{
+			hit.Triangle=item;
+			m_Hits.push_back(hit);
+		}
+	}
 	
-	return false;
-}
-
-bool PolyEvaluator::IntersectTriStrip(const dVector &start, const dVector &end, vector<Point> &points)
+private:
+	const dVector &m_Start;
+	const dVector &m_End;
+	const vector<unsigned int> &m_Triangles;
+	const vector<dVector,FLX_ALLOC(dVector) > &m_Verts;
+	vector<PolyEvaluator::Hit> &m_Hits;
+};
+
+// keeps the nearest point on the triangles seen so far
+class NearestTriangle : public BVH::NearestVisitor
 {
-	dVector bary;
-	bool found=false;
-	unsigned int i=2;
-	while(i<m_Prim->Size())
+public:
+	NearestTriangle(const dVector &point, const vector<unsigned int> &triangles, 
+	                const vector<dVector,FLX_ALLOC(dVector) > &verts) :
+	m_Dist2(FLT_MAX), m_Triangle(0), m_Point(point), m_Triangles(triangles), m_Verts(verts) {}
+	
+	virtual float Visit(unsigned int item)
 	{
-		unsigned int i1=i-2;
-		unsigned int i2=i-1;
-		unsigned int i3=i++;
-		
-        float t = IntersectLineTriangle(start,end,m_Prim->GetData<dVector>("p",i1),
-                                        m_Prim->GetData<dVector>("p",i2),
-                                        m_Prim->GetData<dVector>("p",i3),bary);
-
-		if (t>0)
+		dVector bary;
+		float d2=ClosestPointTriangle(m_Point,m_Verts[m_Triangles[item*3]],
+		                              m_Verts[m_Triangles[item*3+1]],
+		                              m_Verts[m_Triangles[item*3+2]],bary);
+		if (d2<m_Dist2)
 		{
-          points.push_back(InterpolatePData(t,bary,i1,i2,i3));
-          found=true;
+			m_Dist2=d2;
+			m_Bary=bary;
+			m_Triangle=item;
 		}
+		return m_Dist2;
 	}
+	
+	float m_Dist2;
+	dVector m_Bary;
+	unsigned int m_Triangle;
+	
+private:
+	const dVector &m_Point;
+	const vector<unsigned int> &m_Triangles;
+	const vector<dVector,FLX_ALLOC(dVector) > &m_Verts;
+};
 
-	return found;
 }
 
-bool PolyEvaluator::IntersectQuads(const dVector &start, const dVector &end, vector<Point> &points)
+PolyEvaluator::PolyEvaluator(PolyPrimitive *prim) :
+m_Prim(prim),
+m_BVH(NULL),
+m_Triangles(NULL),
+m_Verts(NULL),
+m_Starts(NULL),
+m_Ends(NULL)
 {
-	dVector bary;
-	bool found=false;
-	unsigned int i=0;
-	while(i<m_Prim->Size())
-	{
-		unsigned int i1=i++;
-		unsigned int i2=i++;
-		unsigned int i4=i++;
-   		unsigned int i3=i++;
-		
-		float t = IntersectLineTriangle(start,end,m_Prim->GetData<dVector>("p",i1),
-										m_Prim->GetData<dVector>("p",i2),
-										m_Prim->GetData<dVector>("p",i3),bary);
-        if (t>0)
-		{
-          points.push_back(InterpolatePData(t,bary,i1,i2,i3));
-          found=true;
-		}
-		else 
-        { 
-          t = IntersectLineTriangle(start,end,m_Prim->GetData<dVector>("p",i2),
-                                    m_Prim->GetData<dVector>("p",i3),
-                                    m_Prim->GetData<dVector>("p",i4),bary);
-          if (t>0)
-          {
-            points.push_back(InterpolatePData(t,bary,i2,i3,i4));
-            found=true;
-          }
-        }
-   
-	}
+	assert(m_Prim!=NULL);
+}
 
-	return found;
+PolyEvaluator::~PolyEvaluator()
+{
 }
 
-bool PolyEvaluator::IntersectTriList(const dVector &start, const dVector &end, vector<Point> &points)
-{	
-	dVector bary;
-	bool found=false;
-	unsigned int i=0;
-	while(i<m_Prim->Size())
-	{
-		unsigned int i1=i++;
-		unsigned int i2=i++;
-		unsigned int i3=i++;
-		
-		float t = IntersectLineTriangle(start,end,m_Prim->GetData<dVector>("p",i1),
-                                        m_Prim->GetData<dVector>("p",i2),
-                                        m_Prim->GetData<dVector>("p",i3),bary);
-        if (t>0)
-		{
-          points.push_back(InterpolatePData(t,bary,i1,i2,i3));
-          found=true;
-		}
-	}
+void PolyEvaluator::Update()
+{
+	m_BVH=&m_Prim->GetBVH();
+	m_Triangles=&m_Prim->GetTriangles();
+	m_Verts=m_Prim->GetDataVec<dVector>("p");
+}
 
-	return found;
+PDataContainer *PolyEvaluator::GetPData()
+{
+	return m_Prim;
 }
 
-bool PolyEvaluator::IntersectTriFan(const dVector &start, const dVector &end, vector<Point> &points)
+void PolyEvaluator::GetElement(unsigned int element, unsigned int *verts)
 {
-	return false;
+	const vector<unsigned int> &triangles=m_Prim->GetTriangles();
+	verts[0]=triangles[element*3];
+	verts[1]=triangles[element*3+1];
+	verts[2]=triangles[element*3+2];
 }
 
-bool PolyEvaluator::IntersectPolygon(const dVector &start, const dVector &end, vector<Point> &points)
+//////////////////////////////////////////////
+
+bool PolyEvaluator::ClosestPoint(const dVector &position, Hits &hits)
 {
-	return false;
+	Update();
+	NearestTriangle nearest(position,*m_Triangles,*m_Verts);
+	m_BVH->Nearest(position,FLT_MAX,nearest);
+	
+	if (nearest.m_Dist2==FLT_MAX) return false;
+	
+	hits.Add(0,sqrtf(nearest.m_Dist2),nearest.m_Triangle,nearest.m_Bary);
+	return true;
 }
 
-////////////////////////////////////////////////
+//////////////////////////////////////////////
+
+bool PolyEvaluator::IntersectLine(const dVector &start, const dVector &end, Hits &hits)
+{
+	Update();
+	unsigned int size=hits.Size();
+	FindHits(0,start,end,m_Scratch,hits);
+	return hits.Size()>size;
+}
 
-// todo - extend to arbitrary numbers of elements, and put in Evaluator
-Evaluator::Point PolyEvaluator::InterpolatePData(float t, dVector bary, unsigned int i1, unsigned int i2, unsigned int i3)
+void PolyEvaluator::FindHits(unsigned int line, const dVector &start, const dVector &end, 
+                             vector<Hit> &scratch, Hits &hits)
 {
-	Evaluator::Point point;
-    point.m_T = t;
-	vector<string> names;
-	m_Prim->GetDataNames(names);
+	scratch.clear();
+	LineHits visitor(start,end,*m_Triangles,*m_Verts,scratch);
+	m_BVH->IntersectLine(start,end,visitor);
+	
+	sort(scratch.begin(),scratch.end());
+	for (vector<Hit>::iterator i=scratch.begin(); i!=scratch.end(); ++i)
+	{
+		hits.Add(line,i->T,i->Triangle,i->Bary);
+	}
+}
 
-	for (vector<string>::iterator i=names.begin(); i!=names.end(); ++i)
+void PolyEvaluator::IntersectLines(const vector<dVector> &starts, const vector<dVector> &ends, Hits &hits)
+{
+	Update();
+	m_Starts=&starts;
+	m_Ends=&ends;
+	unsigned int count=min(starts.size(),ends.size());
+	unsigned int chunks=(count+EVALUATOR_LINES_CHUNK-1)/EVALUATOR_LINES_CHUNK;
+	if (m_ChunkHits.size()<chunks) 
 	{
-		char type=0;
-		unsigned int size=0;
-		m_Prim->GetDataInfo(*i, type, size);
-		
-		Blend *blend;
-		
-		switch(type)
-		{
-			case 'f': blend = new TypedBlend<float>('f',m_Prim->GetData<float>(*i,i1)*bary.x +
-												    m_Prim->GetData<float>(*i,i2)*bary.y +
-											   	    m_Prim->GetData<float>(*i,i3)*bary.z); break;
-			case 'v': blend = new TypedBlend<dVector>('v',m_Prim->GetData<dVector>(*i,i1)*bary.x +
-												  m_Prim->GetData<dVector>(*i,i2)*bary.y +
-												  m_Prim->GetData<dVector>(*i,i3)*bary.z); break;
-			case 'c': blend = new TypedBlend<dColour>('c',m_Prim->GetData<dColour>(*i,i1)*bary.x +
-												  m_Prim->GetData<dColour>(*i,i2)*bary.y +
-												  m_Prim->GetData<dColour>(*i,i3)*bary.z); break;
-			case 'm': blend = new TypedBlend<dMatrix>('m',m_Prim->GetData<dMatrix>(*i,i1)*bary.x +
-												  m_Prim->GetData<dMatrix>(*i,i2)*bary.y +
-												  m_Prim->GetData<dMatrix>(*i,i3)*bary.z); break;
-			default: 
-				cerr<<"unknown pdata type in PolyEvaluator::InterpolatePData: "<<type<<endl; 
-				assert(0); 
-				break;
-		};
-		
-		blend->m_Name=*i;
-		
-		point.m_Blends.push_back(blend);
+		m_ChunkHits.resize(chunks);
+		m_ChunkScratch.resize(chunks);
 	}
 	
-	return point;
-} 
+	IntersectLinesJob job(this);
+	WorkerPool::Get()->Run(job,count,EVALUATOR_LINES_CHUNK);
+	
+	for (unsigned int c=0; c<chunks; c++) hits.Append(m_ChunkHits[c]);
+}
 
+void PolyEvaluator::IntersectChunks(unsigned int start, unsigned int end)
+{
+	// we may be given several chunks at once
+	for (unsigned int c=start/EVALUATOR_LINES_CHUNK; c*EVALUATOR_LINES_CHUNK<end; c++)
+	{
+		Hits &hits=m_ChunkHits[c];
+		hits.Clear();
+		unsigned int last=min((c+1)*EVALUATOR_LINES_CHUNK,end);
+		for (unsigned int line=c*EVALUATOR_LINES_CHUNK; line<last; line++)
+		{
+			FindHits(line,(*m_Starts)[line],(*m_Ends)[line],m_ChunkScratch[c],hits);
+		}
+	}
+}
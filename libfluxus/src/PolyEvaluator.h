@@ -21,6 +21,7 @@
 #include <map>
 #include <assert.h>
 #include "Evaluator.h"
+#include "BVH.h"
 
 namespace Fluxus
 {
@@ -28,28 +29,57 @@ namespace Fluxus
 class PolyPrimitive;
 
 //////////////////////////////////////////////////
-/// The base Evaluator class. 
-/// Abstract interface for primitive evaluators
+/// Evaluates polygon primitives, using the 
+/// primitive's triangle bvh so only the triangles
+/// near the line or point are looked at. Elements
+/// are the primitive's triangles.
 class PolyEvaluator : public Evaluator
 {
 public:
-	PolyEvaluator(const PolyPrimitive *prim);
+	PolyEvaluator(PolyPrimitive *prim);
 	virtual ~PolyEvaluator();
 	
-	virtual bool IntersectLine(const dVector &start, const dVector &end, vector<Point> &points);
-	virtual Point ClosestPoint(const dVector &position);
+	virtual bool IntersectLine(const dVector &start, const dVector &end, Hits &hits);
+	virtual void IntersectLines(const vector<dVector> &starts, const vector<dVector> &ends, Hits &hits);
+	virtual bool ClosestPoint(const dVector &position, Hits &hits);
+	
+protected:
+	virtual PDataContainer *GetPData();
+	virtual void GetElement(unsigned int element, unsigned int *verts);
 	
 private:
-	const PolyPrimitive *m_Prim;
-
-	bool IntersectTriStrip(const dVector &start, const dVector &end, vector<Point> &points);
-	bool IntersectQuads(const dVector &start, const dVector &end, vector<Point> &points);
-	bool IntersectTriList(const dVector &start, const dVector &end, vector<Point> &points);
-	bool IntersectTriFan(const dVector &start, const dVector &end, vector<Point> &points);
-	bool IntersectPolygon(const dVector &start, const dVector &end, vector<Point> &points);
-
-  Point InterpolatePData(float t, dVector bary, unsigned int i1, unsigned int i2, unsigned int i3);
-
+	friend class IntersectLinesJob;
+	friend class LineHits;
+	
+	class Hit
+	{
+	public:
+		bool operator<(const Hit &other) const { return T<other.T; }
+		float T;
+		dVector Bary;
+		unsigned int Triangle;
+	};
+	
+	// finds the hits along one line, using scratch for sorting them
+	void FindHits(unsigned int line, const dVector &start, const dVector &end, 
+	              vector<Hit> &scratch, Hits &hits);
+	void IntersectChunks(unsigned int start, unsigned int end);
+	void Update();
+	
+	PolyPrimitive *m_Prim;
+	
+	// got before each query, as jobs can't ask the primitive
+	const BVH *m_BVH;
+	const vector<unsigned int> *m_Triangles;
+	const vector<dVector,FLX_ALLOC(dVector) > *m_Verts;
+	
+	// for batches of lines, each chunk of lines
+	// has its own results to be joined up after
+	const vector<dVector> *m_Starts;
+	const vector<dVector> *m_Ends;
+	vector<Hits> m_ChunkHits;
+	vector<vector<Hit> > m_ChunkScratch;
+	vector<Hit> m_Scratch;
 };
 
 }
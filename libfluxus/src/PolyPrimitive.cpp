@@ -26,9 +26,21 @@
 //#define RENDER_NORMALS
 //#define RENDER_BBOX
 
+// refitting makes the bvh looser as things move, so rebuild every so often
+static const unsigned int POLY_BVH_MAX_REFITS=64;
+
 using namespace Fluxus;
 
 PolyPrimitive::PolyPrimitive(Type t) :
+m_TopologyDirty(true),
+m_TopologyVersion(0),
+m_TopologyBuilds(0),
+m_NormalWeighting(NormalGen::WEIGHT_NONE),
+m_NormalsTopology(0),
+m_NormalsVersion(0),
+m_NormalsSmooth(false),
+m_BVHDirty(true),
+m_BVHVersion(0),
 m_IndexMode(false),
 m_Type(t)
 {
@@ -43,6 +55,15 @@ m_Type(t)
 
 PolyPrimitive::PolyPrimitive(const PolyPrimitive &other) :
 Primitive(other),
+m_TopologyDirty(true),
+m_TopologyVersion(0),
+m_TopologyBuilds(0),
+m_NormalWeighting(other.m_NormalWeighting),
+m_NormalsTopology(0),
+m_NormalsVersion(0),
+m_NormalsSmooth(false),
+m_BVHDirty(true),
+m_BVHVersion(0),
 m_IndexMode(other.m_IndexMode),
 m_IndexData(other.m_IndexData),
 m_Type(other.m_Type)
@@ -62,9 +83,8 @@ PolyPrimitive *PolyPrimitive::Clone() const
 void PolyPrimitive::Clear()
 {
 	Resize(0);
-	m_ConnectedVerts.clear();
-	m_GeometricNormals.clear();
-	m_UniqueEdges.clear();
+	m_TopologyDirty=true;
+	m_BVHDirty=true;
 }
 
 void PolyPrimitive::PDataDirty()
@@ -74,6 +94,8 @@ void PolyPrimitive::PDataDirty()
 	m_NormData=GetDataVec<dVector>("n");
 	m_ColData=GetDataVec<dColour>("c");
 	m_TexData=GetDataVec<dVector>("t");
+	m_VertPData=GetDataRaw("p");
+	m_BVHDirty=true;
 }
 
 void PolyPrimitive::AddVertex(const dVertex &Vert) 
@@ -82,10 +104,8 @@ void PolyPrimitive::AddVertex(const dVertex &Vert)
 	m_NormData->push_back(Vert.normal); 
 	m_ColData->push_back(Vert.col); 	
 	m_TexData->push_back(dVector(Vert.s, Vert.t, 0));
-	
-	m_ConnectedVerts.clear();
-	m_GeometricNormals.clear();
-	m_UniqueEdges.clear();
+	m_TopologyDirty=true;
+	m_BVHDirty=true;
 }
 
 void PolyPrimitive::Render()
@@ -238,6 +258,29 @@ void PolyPrimitive::Render()
 
 void PolyPrimitive::RecalculateNormals(bool smooth)
 {
+	unsigned int stride=GetEdgeStride();
+	if (stride>0)
+	{
+		GenerateStructuralTopology();
+		
+		// start again if the topology, settings or normals have been changed
+		PData *normals=GetDataRaw("n");
+		bool full=m_NormalsVersion!=normals->GetVersion() || smooth!=m_NormalsSmooth;
+		if (m_NormalsTopology!=m_TopologyBuilds)
+		{
+			m_NormalGen.Reset();
+			m_NormalsTopology=m_TopologyBuilds;
+		}
+		
+		m_NormalGen.UpdateFaces(*m_VertData, m_IndexMode?&m_IndexData:NULL, m_Topology, stride, m_NormalWeighting);
+		m_NormalGen.UpdateNormals(m_Topology, m_IndexMode?&m_IndexData:NULL, smooth, full, *m_NormData);
+		
+		normals->Touch();
+		m_NormalsVersion=normals->GetVersion();
+		m_NormalsSmooth=smooth;
+		return;
+	}
+	
 	GenerateTopology();
 	CalculateGeometricNormals();
 
@@ -255,7 +298,7 @@ void PolyPrimitive::RecalculateNormals(bool smooth)
 			}
 			
 			// add all the contributing normals
-			for (unsigned int i=0; i<m_IndexData.size(); i++)
+			for (unsigned int i=0; i<m_IndexData.size() && i<m_GeometricNormals.size(); i++)
 			{
 				(*m_NormData)[m_IndexData[i]]+=m_GeometricNormals[i];
 				count[m_IndexData[i]]++;
@@ -264,12 +307,12 @@ void PolyPrimitive::RecalculateNormals(bool smooth)
 			// scale back
 			for (unsigned int i=0; i<m_NormData->size(); i++)
 			{
-				(*m_NormData)[i]/=(float)count[i];
+				if (count[i]>0) (*m_NormData)[i]/=(float)count[i];
 			}
 		}
 		else
 		{
-			for (unsigned int i=0; i<m_VertData->size(); i++)
+			for (unsigned int i=0; i<m_VertData->size() && i<m_GeometricNormals.size(); i++)
 			{
 				(*m_NormData)[i]=m_GeometricNormals[i];
 			}
@@ -277,22 +320,20 @@ void PolyPrimitive::RecalculateNormals(bool smooth)
 		
 		if (smooth && !m_IndexMode)
 		{
-			// smooth the normals
-			TypedPData<dVector> *newnorms = new TypedPData<dVector>;
-			for (unsigned int i=0; i<m_VertData->size(); i++)
+			// average the normals over the verts welded into each point
+			vector<dVector> pointnormals(m_Topology.NumPoints(),dVector(0,0,0));
+			for (unsigned int i=0; i<m_Topology.NumCorners(); i++)
 			{
-				float count=1;
-				dVector n = (*m_NormData)[i];
-				for (vector<int>::iterator b=m_ConnectedVerts[i].begin(); 
-						b!=m_ConnectedVerts[i].end(); b++)
-				{
-					n+=(*m_NormData)[*b];
-					count+=1;
-				}
-				newnorms->m_Data.push_back((n/count).normalise());
+				pointnormals[m_Topology.GetPoint(i)]+=(*m_NormData)[i];
+			}
+			for (unsigned int i=0; i<m_Topology.NumCorners(); i++)
+			{
+				(*m_NormData)[i]=pointnormals[m_Topology.GetPoint(i)];
+				(*m_NormData)[i].normalise();
 			}
-			SetDataRaw("n", newnorms);
 		}
+		
+		GetDataRaw("n")->Touch();
 	}
 }
 
@@ -300,47 +341,34 @@ void PolyPrimitive::ConvertToIndexed()
 {
 	if (m_IndexMode) return;
 
-	if (m_ConnectedVerts.empty())
-	{
-		CalculateConnected();
-	}
-		
+	GenerateTopology();
+	
 	TypedPData<dVector> *NewVerts = new TypedPData<dVector>;
 	TypedPData<dVector> *NewNorms = new TypedPData<dVector>;
 	TypedPData<dColour> *NewCols = new TypedPData<dColour>;
 	TypedPData<dVector> *NewTex = new TypedPData<dVector>;
-
-	m_IndexData.clear();
-	int vert=0;
-	int index=0;
-	map<int,int> verttoindex;
-	for (vector<vector<int> >::iterator i=m_ConnectedVerts.begin();
-		 i!=m_ConnectedVerts.end(); i++)
+	
+	// take the first vert welded into each point as the new vert - 
+	// will trash non-shared normals, texture coords and colours
+	unsigned int numpoints=m_Topology.NumPoints();
+	NewVerts->m_Data.reserve(numpoints);
+	NewNorms->m_Data.reserve(numpoints);
+	NewCols->m_Data.reserve(numpoints);
+	NewTex->m_Data.reserve(numpoints);
+	for (unsigned int p=0; p<numpoints; p++)
 	{
-		if (!i->empty() && verttoindex.find(vert)==verttoindex.end())
-		{
-			// take the first connected as our new point - will trash non-shared
-			// normals, texture coords and colours
-			NewVerts->m_Data.push_back((*m_VertData)[(*i)[0]]);
-			NewNorms->m_Data.push_back((*m_NormData)[(*i)[0]]);
-			NewCols->m_Data.push_back((*m_ColData)[(*i)[0]]);
-			NewTex->m_Data.push_back((*m_TexData)[(*i)[0]]);
-			m_IndexData.push_back(index);
-			
-			// record all the verts that can point to this index
-			for (vector<int>::iterator v=i->begin(); v!=i->end(); v++)
-			{
-				verttoindex[*v]=index;
-			}
-			
-			index++;
-		}
-		else
-		{
-			m_IndexData.push_back(verttoindex[vert]);
-		}
-		
-		vert++;
+		unsigned int count=0;
+		unsigned int first=m_Topology.GetPointCorners(p,count)[0];
+		NewVerts->m_Data.push_back((*m_VertData)[first]);
+		NewNorms->m_Data.push_back((*m_NormData)[first]);
+		NewCols->m_Data.push_back((*m_ColData)[first]);
+		NewTex->m_Data.push_back((*m_TexData)[first]);
+	}
+	
+	m_IndexData.resize(m_Topology.NumCorners());
+	for (unsigned int i=0; i<m_Topology.NumCorners(); i++)
+	{
+		m_IndexData[i]=m_Topology.GetPoint(i);
 	}
 	
 	SetDataRaw("p", NewVerts);
@@ -348,67 +376,67 @@ void PolyPrimitive::ConvertToIndexed()
 	SetDataRaw("c", NewCols);
 	SetDataRaw("t", NewTex);
 		
-	m_IndexMode=true;
+	SetIndexMode(true);
+}
+
+unsigned int PolyPrimitive::GetEdgeStride() const
+{
+	///\todo - need different approach for TRIFAN
+	switch (m_Type)
+	{
+		case TRISTRIP: return 2;
+		case QUADS: return 4;
+		case TRILIST: return 3;
+		default: return 0;
+	}
 }
 
 void PolyPrimitive::GenerateTopology()
 {
-	if (m_ConnectedVerts.empty())
+	// the welding is done on positions, so everything is out of date 
+	// if they've been written to since
+	if (m_TopologyDirty || m_VertPData->GetVersion()!=m_TopologyVersion)
 	{
-		CalculateConnected();
+		m_Topology.Build(*m_VertData, m_IndexMode?&m_IndexData:NULL, GetEdgeStride());
+		m_TopologyVersion=m_VertPData->GetVersion();
+		m_TopologyDirty=false;
+		m_TopologyBuilds++;
+		m_ConnectedVerts.clear();
+		m_GeometricNormals.clear();
+		m_UniqueEdges.clear();
 	}
-	
-	if (m_GeometricNormals.empty())
+}
+
+void PolyPrimitive::GenerateStructuralTopology()
+{
+	unsigned int numcorners=m_IndexMode?m_IndexData.size():m_VertData->size();
+	if (m_TopologyDirty || m_Topology.NumCorners()!=numcorners)
 	{
-		CalculateGeometricNormals();
+		GenerateTopology();
 	}
 }
 
 void PolyPrimitive::CalculateConnected()
 { 
+	if (!m_ConnectedVerts.empty()) return;
 	
-	if (m_IndexMode)
-	{		
-		for (unsigned int i=0; i<m_IndexData.size(); i++)
-		{
-			vector<int> connected;
-			for (unsigned int b=0; b<m_IndexData.size(); b++)
-			{
-				// compare index value
-				if (i!=b && (m_IndexData[i]==m_IndexData[b] || 
-				   // compare positions
-				   ((*m_VertData)[m_IndexData[i]].feq((*m_VertData)[m_IndexData[b]]))))
-				{
-					connected.push_back(b);
-				}
-			}
-			
-			m_ConnectedVerts.push_back(connected);
-		}
-	}
-	else
+	m_ConnectedVerts.resize(m_Topology.NumCorners());
+	for (unsigned int i=0; i<m_Topology.NumCorners(); i++)
 	{
-		// cache the connected verts 
-		for (unsigned int i=0; i<m_VertData->size(); i++)
+		unsigned int count=0;
+		const unsigned int *corners=m_Topology.GetPointCorners(m_Topology.GetPoint(i),count);
+		m_ConnectedVerts[i].reserve(count-1);
+		for (unsigned int n=0; n<count; n++)
 		{
-			vector<int> connected;
-			for (unsigned int b=0; b<m_VertData->size(); b++)
-			{
-				// find all close verts
-				if (i!=b && (*m_VertData)[i].feq((*m_VertData)[b]))
-				{
-					connected.push_back(b);
-				}
-			}	
-
-			m_ConnectedVerts.push_back(connected);
+			if (corners[n]!=i) m_ConnectedVerts[i].push_back(corners[n]);
 		}
 	}
 }
 
-
 void PolyPrimitive::CalculateGeometricNormals()
 {
+	if (!m_GeometricNormals.empty()) return;
+	
 	///\todo - need different approach for TRIFAN
 	// one face 
 	if (m_Type==POLYGON && m_VertData->size()>2) 
@@ -474,89 +502,17 @@ void PolyPrimitive::CalculateGeometricNormals()
 
 void PolyPrimitive::CalculateUniqueEdges()
 {
-	if (m_UniqueEdges.empty())
-	{
-		// todo - need different approach for TRIFAN
-		int stride=0;
-		if (m_Type==TRISTRIP) stride=2;
-		if (m_Type==QUADS) stride=4;
-		if (m_Type==TRILIST) stride=3;
-		if (stride>0)
-		{		
-			set<pair<int,int> > firstpass;
-			
-			unsigned int vertcount=m_VertData->size();
-			if (m_IndexMode) vertcount=m_IndexData.size();
-			
-			// first, record all valid edges from the topology type
-			for (unsigned int i=0; i<vertcount; i+=stride)
-			{
-				for (int n=0; n<stride-1; n++)
-				{
-					firstpass.insert(pair<int,int>(n+i,n+i+1));
-				}
-				firstpass.insert(pair<int,int>(i+stride-1,i));
-			}
-
-			set<pair<int,int> > stored;
-			pair<int,int> key;
-
-			// now find all edges which share points and group them together
-			for (unsigned int i=0; i<vertcount; i+=stride)
-			{
-				for (int n=0; n<stride-1; n++)
-				{	
-					UniqueEdgesFindShared(pair<int,int>(n+i,n+i+1), firstpass, stored);
-				}	
-				UniqueEdgesFindShared(pair<int,int>(i+stride-1,i), firstpass, stored);	
-			}
-		}
-	}
-}
-
-void PolyPrimitive::UniqueEdgesFindShared(pair<int,int> edge, set<pair<int,int> > firstpass, set<pair<int,int> > &stored)
-{
-	vector<pair<int,int> > edges;
+	if (!m_UniqueEdges.empty()) return;
 	
-	if (stored.find(edge)==stored.end() && stored.find(pair<int,int>(edge.second,edge.first))==stored.end())
+	m_UniqueEdges.resize(m_Topology.NumEdges());
+	for (unsigned int e=0; e<m_Topology.NumEdges(); e++)
 	{
-		// first, store the test edge
-		edges.push_back(edge);
-		stored.insert(edge);
-		
-		//Trace::Stream<<"edge:"<<edge.first<<" "<<edge.second<<endl;
-		
-		// make all combinations of verts connected to the edge verts
-		for (vector<int>::iterator a=m_ConnectedVerts[edge.first].begin();
-			a!=m_ConnectedVerts[edge.first].end(); a++)
-		{
-			for (vector<int>::iterator b=m_ConnectedVerts[edge.second].begin();
-					b!=m_ConnectedVerts[edge.second].end(); b++)
-			{
-				//Trace::Stream<<*a<<" "<<*b<<endl;
-				pair<int, int> candidate(*a,*b);
-				if (firstpass.find(candidate)!=firstpass.end() && // if this is a real edge
-					stored.find(candidate)==stored.end() )        // and we've not stored it already
-				{
-					edges.push_back(candidate);
-					stored.insert(candidate);
-					//Trace::Stream<<"^ "<<candidate.first<<" "<<candidate.second<<endl;
-				}						
-
-				pair<int, int> rcandidate(*b,*a);
-				if (firstpass.find(rcandidate)!=firstpass.end() && // if this is a real edge
-					stored.find(rcandidate)==stored.end() )        // and we've not stored it already
-				{
-					edges.push_back(rcandidate);
-					stored.insert(rcandidate);
-					//Trace::Stream<<"^ "<<rcandidate.first<<" "<<rcandidate.second<<endl;
-				}						
-			}
-		}
-
-		if (!edges.empty())
+		unsigned int count=0;
+		const unsigned int *halfedges=m_Topology.GetEdgeHalfEdges(e,count);
+		m_UniqueEdges[e].reserve(count);
+		for (unsigned int n=0; n<count; n++)
 		{
-			m_UniqueEdges.push_back(edges);
+			m_UniqueEdges[e].push_back(pair<int,int>(halfedges[n],m_Topology.GetNext(halfedges[n])));
 		}
 	}
 }
@@ -588,9 +544,99 @@ void PolyPrimitive::ApplyTransform(bool ScaleRotOnly)
 			(*m_VertData)[i]=GetState()->Transform.transform_no_trans((*m_VertData)[i]);
 			(*m_NormData)[i]=GetState()->Transform.transform_no_trans((*m_NormData)[i]).normalise();
 		}
+		GetDataRaw("n")->Touch();
 	}
 	
+	m_VertPData->Touch();
 	GetState()->Transform.init();
 }
 
 
+
+Silhouette &PolyPrimitive::GetSilhouette()
+{
+	// the edges stay the same as the mesh deforms, only the planes are updated
+	GenerateStructuralTopology();
+	m_Silhouette.Update(m_Topology, m_TopologyBuilds, *m_VertData, 
+	                    m_IndexMode?&m_IndexData:NULL, m_VertPData->GetVersion());
+	return m_Silhouette;
+}
+
+void PolyPrimitive::GenerateBVH()
+{
+	unsigned int version=m_VertPData->GetVersion();
+	if (!m_BVHDirty && version==m_BVHVersion) return;
+	
+	if (m_BVHDirty) MakeTriangles();
+	
+	m_TriangleBoxes.resize(m_Triangles.size()/3);
+	for (unsigned int i=0; i<m_TriangleBoxes.size(); i++)
+	{
+		const dVector &a=(*m_VertData)[m_Triangles[i*3]];
+		const dVector &b=(*m_VertData)[m_Triangles[i*3+1]];
+		const dVector &c=(*m_VertData)[m_Triangles[i*3+2]];
+		dBoundingBox &box=m_TriangleBoxes[i];
+		box.min=dVector(min(a.x,min(b.x,c.x)),min(a.y,min(b.y,c.y)),min(a.z,min(b.z,c.z)));
+		box.max=dVector(max(a.x,max(b.x,c.x)),max(a.y,max(b.y,c.y)),max(a.z,max(b.z,c.z)));
+	}
+	
+	if (m_BVHDirty || m_BVH.GetRefits()>=POLY_BVH_MAX_REFITS) m_BVH.Build(m_TriangleBoxes);
+	else m_BVH.Refit(m_TriangleBoxes);
+	
+	m_BVHDirty=false;
+	m_BVHVersion=version;
+}
+
+void PolyPrimitive::MakeTriangles()
+{
+	m_Triangles.clear();
+	unsigned int numverts=m_VertData->size();
+	unsigned int numcorners=m_IndexMode?m_IndexData.size():numverts;
+	
+	// corner numbers first
+	switch (m_Type)
+	{
+		case TRISTRIP:
+			for (unsigned int i=2; i<numcorners; i++)
+			{
+				m_Triangles.push_back(i-2); m_Triangles.push_back(i-1); m_Triangles.push_back(i);
+			}
+		break;
+		case QUADS:
+			for (unsigned int i=0; i+3<numcorners; i+=4)
+			{
+				m_Triangles.push_back(i); m_Triangles.push_back(i+1); m_Triangles.push_back(i+3);
+				m_Triangles.push_back(i+1); m_Triangles.push_back(i+2); m_Triangles.push_back(i+3);
+			}
+		break;
+		case TRILIST:
+			for (unsigned int i=0; i+2<numcorners; i+=3)
+			{
+				m_Triangles.push_back(i); m_Triangles.push_back(i+1); m_Triangles.push_back(i+2);
+			}
+		break;
+		case TRIFAN:
+		case POLYGON:
+			for (unsigned int i=2; i<numcorners; i++)
+			{
+				m_Triangles.push_back(0); m_Triangles.push_back(i-1); m_Triangles.push_back(i);
+			}
+		break;
+	}
+	
+	// then look them up in the index, dropping any that are out of range
+	unsigned int count=0;
+	for (unsigned int i=0; i<m_Triangles.size(); i+=3)
+	{
+		unsigned int v[3];
+		bool valid=true;
+		for (int n=0; n<3; n++)
+		{
+			v[n]=m_IndexMode?m_IndexData[m_Triangles[i+n]]:m_Triangles[i+n];
+			if (v[n]>=numverts) valid=false;
+		}
+		if (!valid) continue;
+		for (int n=0; n<3; n++) m_Triangles[count++]=v[n];
+	}
+	m_Triangles.resize(count);
+}
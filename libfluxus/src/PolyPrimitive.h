@@ -21,6 +21,10 @@
 
 #include "Primitive.h"
 #include "PolyEvaluator.h"
+#include "PolyTopology.h"
+#include "NormalGen.h"
+#include "Silhouette.h"
+#include "BVH.h"
 
 namespace Fluxus
 {
@@ -46,6 +50,7 @@ public:
 	virtual void RecalculateNormals(bool smooth);
 	virtual void ApplyTransform(bool ScaleRotOnly=false);
 	virtual string GetTypeName() { return "PolyPrimitive"; }
+	virtual bool IsLit() { return !(m_State.Hints & HINT_UNLIT); }
 	virtual Evaluator *MakeEvaluator() { return new PolyEvaluator(this); }
 	///@}
 	
@@ -61,9 +66,14 @@ public:
 	///@name Topology functions
 	/// Functions to get topological information 
 	/// about the primitive. These are lazily computed
-	/// and stored as they can take some time.
+	/// from the welded topology, which is rebuilt when 
+	/// the vertex positions or index change.
 	///@{
 
+	/// The welded points and half edges everything 
+	/// else here is made from
+	const PolyTopology &GetTopology() { GenerateTopology(); return m_Topology; }
+
 	/// Connected verts is a list of lists of vertices 
 	/// which are coincident. If this polyprimitive is 
 	/// indexed the coincident verts are calculated by
@@ -71,22 +81,39 @@ public:
 	/// of the index is stored, otherwise it's done by 	
 	/// looking at the actual vertex positions, with a 
 	/// small allowed error, and the index is stored.
-	const vector<vector<int> > &GetConnectedVerts() { GenerateTopology(); return m_ConnectedVerts; }
+	const vector<vector<int> > &GetConnectedVerts() { GenerateTopology(); CalculateConnected(); return m_ConnectedVerts; }
 	
 	/// Unique edges is a list of coincident edges in 
 	/// the topology, formed by pairs of vert indexes, 
 	/// or index positions if the poly is indexed.
-	const vector<vector<pair<int,int> > > &GetUniqueEdges() { CalculateUniqueEdges(); return m_UniqueEdges; }
+	const vector<vector<pair<int,int> > > &GetUniqueEdges() { GenerateTopology(); CalculateUniqueEdges(); return m_UniqueEdges; }
 	
 	/// In indexed mode there is a geometric normal 
 	/// for every index
-	const vector<dVector> &GetGeometricNormals() { GenerateTopology(); return m_GeometricNormals; }
+	const vector<dVector> &GetGeometricNormals() { GenerateTopology(); CalculateGeometricNormals(); return m_GeometricNormals; }
+	
+	/// How face normals are weighted when they are 
+	/// gathered into smooth vertex normals
+	void SetNormalWeighting(NormalGen::Weighting s) { m_NormalWeighting=s; }
+	
+	/// The polygons split into triangles, as three vertex 
+	/// numbers each (already looked up in the index)
+	const vector<unsigned int> &GetTriangles() { GenerateBVH(); return m_Triangles; }
+	
+	/// A bounding volume hierarchy of the triangles, built 
+	/// when first asked for and refitted when the vertices move
+	const BVH &GetBVH() { GenerateBVH(); return m_BVH; }
+	
+	/// Edge adjacency and face planes for finding the 
+	/// silhouette edges, for shadow volumes
+	Silhouette &GetSilhouette();
 	///@}
 
 	//////////////////////////////////////////////////
 	///@name Indexed mode access
 	///@{
-	void SetIndexMode(bool s) { m_IndexMode=s; }
+	/// Also needs calling after changing the index
+	void SetIndexMode(bool s) { m_IndexMode=s; m_TopologyDirty=true; m_BVHDirty=true; }
 	bool IsIndexed() const { return m_IndexMode; }
 	vector<unsigned int> &GetIndex() { return m_IndexData; }
 	const vector<unsigned int> &GetIndexConst() const { return m_IndexData; }
@@ -102,16 +129,39 @@ protected:
 	
 	// Topology generation commands
 	void GenerateTopology();
+	// only rebuilds when the structure has changed, so
+	// deforming meshes keep the welding they started with
+	void GenerateStructuralTopology();
 	void CalculateConnected();
 	void CalculateGeometricNormals();
 	void CalculateUniqueEdges();
-	void UniqueEdgesFindShared(pair<int,int> edge, set<pair<int,int> > firstpass, set<pair<int,int> > &stored);
-	void RecalculateNormalsIndexed();
+	unsigned int GetEdgeStride() const;
+	void GenerateBVH();
+	void MakeTriangles();
+	
+	PolyTopology m_Topology;
+	bool m_TopologyDirty;
+	unsigned int m_TopologyVersion;
+	unsigned int m_TopologyBuilds;
+	
+	NormalGen m_NormalGen;
+	NormalGen::Weighting m_NormalWeighting;
+	unsigned int m_NormalsTopology;
+	unsigned int m_NormalsVersion;
+	bool m_NormalsSmooth;
+	
+	Silhouette m_Silhouette;
 	
 	vector<vector<int> > m_ConnectedVerts;
 	vector<dVector> m_GeometricNormals;
 	vector<vector<pair<int,int> > > m_UniqueEdges;
 	
+	BVH m_BVH;
+	vector<unsigned int> m_Triangles;
+	vector<dBoundingBox> m_TriangleBoxes;
+	bool m_BVHDirty;
+	unsigned int m_BVHVersion;
+	
 	bool m_IndexMode;
 	vector<unsigned int> m_IndexData;
 	
@@ -120,6 +170,7 @@ protected:
 	vector<dVector,FLX_ALLOC(dVector) > *m_NormData;
 	vector<dColour,FLX_ALLOC(dColour) > *m_ColData;
 	vector<dVector,FLX_ALLOC(dVector) > *m_TexData;
+	PData *m_VertPData;
 };
 
 };
@@ -0,0 +1,225 @@
+// Copyright (C) 2005 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include <math.h>
+#include "PolyTopology.h"
+
+using namespace Fluxus;
+
+static inline int Quantise(float v, float cell, float &frac)
+{
+	float q=v/cell;
+	// stop huge values (and nans) overflowing the int
+	if (!(q>-1e9f)) q=-1e9f;
+	if (q>1e9f) q=1e9f;
+	float f=floorf(q);
+	frac=q-f;
+	return (int)f;
+}
+
+static inline unsigned int Hash(unsigned int a, unsigned int b, unsigned int c=0)
+{
+	return (a*73856093u)^(b*19349663u)^(c*83492791u);
+}
+
+// builds a compressed row layout from the row each entry is in, so the
+// entries of row r are items[start[r]] to items[start[r+1]-1]
+static void BuildRows(const vector<unsigned int> &rows, unsigned int numrows, 
+	vector<unsigned int> &start, vector<unsigned int> &items)
+{
+	start.assign(numrows+1,0);
+	for (unsigned int i=0; i<rows.size(); i++) start[rows[i]+1]++;
+	for (unsigned int r=0; r<numrows; r++) start[r+1]+=start[r];
+	
+	items.resize(rows.size());
+	// uses start as the fill cursor, which leaves it shifted by one row
+	for (unsigned int i=0; i<rows.size(); i++) items[start[rows[i]]++]=i;
+	for (unsigned int r=numrows; r>0; r--) start[r]=start[r-1];
+	start[0]=0;
+}
+
+PolyTopology::PolyTopology() :
+m_Stride(0)
+{
+}
+
+void PolyTopology::Clear()
+{
+	m_Stride=0;
+	m_CornerPoint.clear();
+	m_PointStart.clear();
+	m_PointCorners.clear();
+	m_VertStart.clear();
+	m_VertCorners.clear();
+	m_Twin.clear();
+	m_HalfEdgeEdge.clear();
+	m_EdgeStart.clear();
+	m_EdgeHalfEdges.clear();
+}
+
+void PolyTopology::ClearTable(unsigned int size)
+{
+	unsigned int tablesize=16;
+	while (tablesize<size*2) tablesize<<=1;
+	m_Table.assign(tablesize,-1);
+	m_Chain.clear();
+}
+
+void PolyTopology::Build(const vector<dVector,FLX_ALLOC(dVector) > &verts, 
+                         const vector<unsigned int> *index, unsigned int stride, float weld)
+{
+	Clear();
+	m_Stride=stride;
+	
+	unsigned int numpoints=0;
+	if (index==NULL)
+	{
+		Weld(verts,weld,m_CornerPoint);
+		numpoints=m_PointPos.size();
+	}
+	else
+	{
+		// corners sharing an index are welded by definition
+		Weld(verts,weld,m_VertPoint);
+		numpoints=m_PointPos.size();
+		m_CornerPoint.resize(index->size());
+		for (unsigned int c=0; c<index->size(); c++)
+		{
+			unsigned int v=(*index)[c];
+			if (v<m_VertPoint.size()) m_CornerPoint[c]=m_VertPoint[v];
+			// bad indices get a point of their own
+			else m_CornerPoint[c]=numpoints++;
+		}
+		
+		// bad indices are left out
+		m_VertPoint.clear();
+		for (unsigned int c=0; c<index->size(); c++)
+		{
+			m_VertPoint.push_back((*index)[c]<verts.size()?(*index)[c]:verts.size());
+		}
+		BuildRows(m_VertPoint,verts.size()+1,m_VertStart,m_VertCorners);
+		m_VertStart.pop_back();
+	}
+	
+	BuildRows(m_CornerPoint,numpoints,m_PointStart,m_PointCorners);
+	BuildEdges();
+}
+
+void PolyTopology::Weld(const vector<dVector,FLX_ALLOC(dVector) > &verts, float weld, vector<unsigned int> &vertpoint)
+{
+	// cells are twice the weld distance, so along each axis anything close 
+	// enough is either in the same cell or the neighbour on the nearest side, 
+	// which means checking 8 cells rather than 27
+	float cell=weld*2;
+	ClearTable(verts.size());
+	unsigned int mask=m_Table.size()-1;
+	m_PointPos.clear();
+	vertpoint.resize(verts.size());
+	
+	for (unsigned int v=0; v<verts.size(); v++)
+	{
+		const dVector &pos=verts[v];
+		int cx[2],cy[2],cz[2];
+		float fx,fy,fz;
+		cx[0]=Quantise(pos.x,cell,fx);
+		cy[0]=Quantise(pos.y,cell,fy);
+		cz[0]=Quantise(pos.z,cell,fz);
+		cx[1]=fx<0.5f?cx[0]-1:cx[0]+1;
+		cy[1]=fy<0.5f?cy[0]-1:cy[0]+1;
+		cz[1]=fz<0.5f?cz[0]-1:cz[0]+1;
+		
+		int found=-1;
+		for (unsigned int n=0; n<8 && found<0; n++)
+		{
+			unsigned int slot=Hash(cx[n&1],cy[(n>>1)&1],cz[(n>>2)&1])&mask;
+			for (int p=m_Table[slot]; p>=0 && found<0; p=m_Chain[p])
+			{
+				if (m_PointPos[p].feq(pos,weld)) found=p;
+			}
+		}
+		
+		if (found<0)
+		{
+			found=m_PointPos.size();
+			m_PointPos.push_back(pos);
+			unsigned int slot=Hash(cx[0],cy[0],cz[0])&mask;
+			m_Chain.push_back(m_Table[slot]);
+			m_Table[slot]=found;
+		}
+		
+		vertpoint[v]=found;
+	}
+}
+
+void PolyTopology::BuildEdges()
+{
+	if (m_Stride<2) return;
+	unsigned int numhalfedges=(NumCorners()/m_Stride)*m_Stride;
+	if (numhalfedges==0) return;
+	
+	m_Twin.assign(numhalfedges,-1);
+	m_HalfEdgeEdge.resize(numhalfedges);
+	ClearTable(numhalfedges);
+	unsigned int mask=m_Table.size()-1;
+	m_EdgeKey.clear();
+	unsigned int numedges=0;
+	
+	// group the half edges by the pair of points they join
+	for (unsigned int h=0; h<numhalfedges; h++)
+	{
+		unsigned int a=m_CornerPoint[h];
+		unsigned int b=m_CornerPoint[GetNext(h)];
+		if (a>b) { unsigned int t=a; a=b; b=t; }
+		
+		unsigned int slot=Hash(a,b)&mask;
+		int e=m_Table[slot];
+		while (e>=0 && (m_EdgeKey[e*2]!=a || m_EdgeKey[e*2+1]!=b)) e=m_Chain[e];
+		if (e<0)
+		{
+			e=numedges++;
+			m_EdgeKey.push_back(a);
+			m_EdgeKey.push_back(b);
+			m_Chain.push_back(m_Table[slot]);
+			m_Table[slot]=e;
+		}
+		m_HalfEdgeEdge[h]=e;
+	}
+	
+	BuildRows(m_HalfEdgeEdge,numedges,m_EdgeStart,m_EdgeHalfEdges);
+	
+	// pair up half edges going opposite ways, non manifold edges 
+	// just get paired off in order
+	for (unsigned int e=0; e<numedges; e++)
+	{
+		unsigned int count=0;
+		const unsigned int *halfedges=GetEdgeHalfEdges(e,count);
+		for (unsigned int i=0; i<count; i++)
+		{
+			unsigned int h=halfedges[i];
+			for (unsigned int j=i+1; j<count && m_Twin[h]<0; j++)
+			{
+				unsigned int g=halfedges[j];
+				if (m_Twin[g]<0 && 
+					m_CornerPoint[h]==m_CornerPoint[GetNext(g)] && 
+					m_CornerPoint[GetNext(h)]==m_CornerPoint[g])
+				{
+					m_Twin[h]=g;
+					m_Twin[g]=h;
+				}
+			}
+		}
+	}
+}
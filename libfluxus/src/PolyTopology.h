@@ -0,0 +1,128 @@
+// Copyright (C) 2005 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#ifndef N_POLYTOPOLOGY
+#define N_POLYTOPOLOGY
+
+#include <vector>
+#include "dada.h"
+#include "Allocator.h"
+
+using namespace std;
+
+namespace Fluxus
+{
+
+///////////////////////////////////////////////////
+/// Connectivity for polygon primitives, built in 
+/// linear time. Corners (vertices, or index positions 
+/// in indexed mode) closer than the weld distance are 
+/// welded into shared points using a quantised spatial 
+/// hash, then the face edges are paired up into a half
+/// edge structure. 
+///
+/// Faces are runs of stride corners, and the half edge 
+/// of a corner goes from it to the next corner around 
+/// the face, so half edges share the corner numbering.
+class PolyTopology
+{
+public:
+	PolyTopology();
+	
+	/// Rebuilds everything, stride 0 means no faces
+	void Build(const vector<dVector,FLX_ALLOC(dVector) > &verts, 
+	           const vector<unsigned int> *index, unsigned int stride, 
+			   float weld=0.001);
+	void Clear();
+	
+	unsigned int NumCorners() const { return m_CornerPoint.size(); }
+	unsigned int GetStride() const { return m_Stride; }
+	
+	///////////////////////////////////////////////////
+	///@name Welded points
+	///@{
+	unsigned int NumPoints() const { return m_PointStart.empty()?0:m_PointStart.size()-1; }
+	unsigned int GetPoint(unsigned int corner) const { return m_CornerPoint[corner]; }
+	/// The corners welded into a point, in corner order
+	const unsigned int *GetPointCorners(unsigned int point, unsigned int &count) const
+	{ 
+		count=m_PointStart[point+1]-m_PointStart[point]; 
+		return &m_PointCorners[m_PointStart[point]]; 
+	}
+	///@}
+	
+	/// The corners using a vertex, only set in indexed 
+	/// mode (otherwise the corner is the vertex)
+	const unsigned int *GetVertCorners(unsigned int vert, unsigned int &count) const
+	{ 
+		count=m_VertStart[vert+1]-m_VertStart[vert]; 
+		return &m_VertCorners[m_VertStart[vert]]; 
+	}
+	unsigned int NumVerts() const { return m_VertStart.empty()?0:m_VertStart.size()-1; }
+	
+	///////////////////////////////////////////////////
+	///@name Half edges
+	///@{
+	unsigned int NumHalfEdges() const { return m_Twin.size(); }
+	unsigned int GetFace(unsigned int edge) const { return edge/m_Stride; }
+	unsigned int GetNext(unsigned int edge) const 
+	{ 
+		return edge%m_Stride==m_Stride-1?edge+1-m_Stride:edge+1; 
+	}
+	/// The half edge going the other way between the same 
+	/// points, or -1 on a boundary
+	int GetTwin(unsigned int edge) const { return m_Twin[edge]; }
+	
+	/// Edges are all the half edges between the same pair of points, 
+	/// whichever way they go - two for a closed manifold mesh
+	unsigned int NumEdges() const { return m_EdgeStart.empty()?0:m_EdgeStart.size()-1; }
+	unsigned int GetEdge(unsigned int halfedge) const { return m_HalfEdgeEdge[halfedge]; }
+	const unsigned int *GetEdgeHalfEdges(unsigned int edge, unsigned int &count) const
+	{ 
+		count=m_EdgeStart[edge+1]-m_EdgeStart[edge]; 
+		return &m_EdgeHalfEdges[m_EdgeStart[edge]]; 
+	}
+	///@}
+	
+private:
+	void Weld(const vector<dVector,FLX_ALLOC(dVector) > &verts, float weld, vector<unsigned int> &vertpoint);
+	void BuildEdges();
+	void ClearTable(unsigned int size);
+
+	unsigned int m_Stride;
+	
+	vector<unsigned int> m_CornerPoint;
+	vector<unsigned int> m_PointStart;
+	vector<unsigned int> m_PointCorners;
+	vector<unsigned int> m_VertStart;
+	vector<unsigned int> m_VertCorners;
+	
+	vector<int> m_Twin;
+	vector<unsigned int> m_HalfEdgeEdge;
+	vector<unsigned int> m_EdgeStart;
+	vector<unsigned int> m_EdgeHalfEdges;
+	
+	// scratch space, kept to save reallocating on every build
+	vector<int> m_Table;
+	vector<int> m_Chain;
+	vector<dVector> m_PointPos;
+	vector<unsigned int> m_EdgeKey;
+	vector<unsigned int> m_VertPoint;
+};
+
+}
+
+#endif
@@ -52,6 +52,10 @@ public:
 	/// Only makes sense for certain primitive types
 	virtual void RecalculateNormals(bool smooth) {}
 
+	/// Whether the gl lights shade this primitive,
+	/// which the shadow map light passes need to know
+	virtual bool IsLit()            { return false; }
+
 	///////////////////////////////////////////////////
 	///@name Primitive Interface
 	///@{
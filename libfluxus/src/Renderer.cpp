@@ -138,10 +138,14 @@ void Renderer::Render()
 		{
 			RenderStencilShadows(cam);
 		}
+		else if (CastingShadowMaps())
+		{
+			RenderShadowMaps(cam);
+		}
 		else
 		{
 			PreRender(cam);
-			m_World.Render(&m_ShadowVolumeGen,cam);
+			m_World.Render(NULL,cam);
 			m_ImmediateMode.Render(cam);
 			PostRender();
 		}
@@ -200,11 +204,11 @@ void Renderer::RenderStencilShadows(unsigned int CamIndex)
 
 	glCullFace(GL_BACK);
     glStencilOp(GL_KEEP, GL_KEEP, GL_INCR);
-	m_ShadowVolumeGen.GetVolume()->Render();
+	m_ShadowVolumeGen.Render();
 
     glCullFace(GL_FRONT);
     glStencilOp(GL_KEEP, GL_KEEP, GL_DECR);
-	m_ShadowVolumeGen.GetVolume()->Render();
+	m_ShadowVolumeGen.Render();
 
 	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
 	glDepthFunc(GL_EQUAL);
@@ -217,7 +221,8 @@ void Renderer::RenderStencilShadows(unsigned int CamIndex)
 
 	glEnable(GL_LIGHT0+m_ShadowLight);
 
-	m_World.Render(&m_ShadowVolumeGen,CamIndex);
+	// the volumes are already made
+	m_World.Render(NULL,CamIndex);
 	m_ImmediateMode.Render(CamIndex);
 	m_ImmediateMode.Clear();
 
@@ -236,6 +241,99 @@ void Renderer::RenderStencilShadows(unsigned int CamIndex)
 	PostRender();
 }
 
+bool Renderer::CastingShadowMaps()
+{
+	for (unsigned int n=0; n<m_LightVec.size() && n<(unsigned int)MAXLIGHTS; n++)
+	{
+		if (m_LightVec[n]->GetCastShadow()) return true;
+	}
+	return false;
+}
+
+void Renderer::RenderShadowMaps(unsigned int CamIndex)
+{
+	PreRender(CamIndex);
+
+	if (!m_ShadowMapGen.IsSupported())
+	{
+		m_World.Render(NULL,CamIndex);
+		m_ImmediateMode.Render(CamIndex);
+		PostRender();
+		return;
+	}
+
+	m_ShadowMapGen.SetCamera();
+
+	// the lights casting shadows are left out to start with,
+	// then added one at a time where they aren't in shadow
+	vector<Light*> casters;
+	glPushAttrib(GL_LIGHTING_BIT);
+	for (unsigned int n=0; n<m_LightVec.size() && n<(unsigned int)MAXLIGHTS; n++)
+	{
+		if (m_LightVec[n]->GetCastShadow())
+		{
+			casters.push_back(m_LightVec[n]);
+			glDisable(GL_LIGHT0+n);
+		}
+	}
+
+	m_World.Render(NULL,CamIndex);
+	m_ImmediateMode.Render(CamIndex);
+	glPopAttrib();
+
+	m_ShadowMapGen.CopyDepth();
+
+	for (vector<Light*>::iterator i=casters.begin(); i!=casters.end(); ++i)
+	{
+		unsigned int views=m_ShadowMapGen.Begin(*i);
+		if (views>0)
+		{
+			for (unsigned int v=0; v<views; v++)
+			{
+				m_ShadowMapGen.BeginView(v);
+				m_World.Render(NULL,CamIndex,SceneGraph::SHADOW_MAP);
+				m_ImmediateMode.Render(CamIndex,NULL,SceneGraph::SHADOW_MAP);
+			}
+			m_ShadowMapGen.End();
+			m_ShadowMapGen.MarkShadows();
+		}
+		else
+		{
+			// no depth maps, so nothing is in shadow
+			glClear(GL_STENCIL_BUFFER_BIT);
+		}
+
+		glPushAttrib(GL_LIGHTING_BIT|GL_FOG_BIT|GL_ENABLE_BIT|GL_COLOR_BUFFER_BIT|
+		             GL_DEPTH_BUFFER_BIT|GL_STENCIL_BUFFER_BIT|GL_POLYGON_BIT);
+		for (int n=0; n<MAXLIGHTS; n++)
+		{
+			glDisable(GL_LIGHT0+n);
+		}
+		glEnable(GL_LIGHT0+(*i)->GetIndex());
+		float black[4]={0,0,0,0};
+		glLightModelfv(GL_LIGHT_MODEL_AMBIENT,black);
+		glFogfv(GL_FOG_COLOR,black);
+
+		glEnable(GL_STENCIL_TEST);
+		glStencilFunc(GL_EQUAL,0,~0);
+		glStencilOp(GL_KEEP,GL_KEEP,GL_KEEP);
+		// wireframes move the polygon offset about, so
+		// the depth may not be exactly the same as before
+		glDepthFunc(GL_LEQUAL);
+		glDepthMask(GL_FALSE);
+		glPolygonOffset(0,0);
+		glEnable(GL_BLEND);
+
+		State::SetLightPass(true);
+		m_World.Render(NULL,CamIndex,SceneGraph::LIGHT_PASS);
+		m_ImmediateMode.Render(CamIndex,NULL,SceneGraph::LIGHT_PASS);
+		State::SetLightPass(false);
+		glPopAttrib();
+	}
+
+	PostRender();
+}
+
 void Renderer::PreRender(unsigned int CamIndex, bool PickMode)
 {
 	Camera &Cam = m_CameraVec[CamIndex];
@@ -456,7 +554,7 @@ int Renderer::Select(unsigned int CamIndex, int x, int y, int size)
 	PreRender(CamIndex,true);
 	
 	// render the scene for picking
-	m_World.Render(&m_ShadowVolumeGen,SceneGraph::SELECT);
+	m_World.Render(NULL,SceneGraph::SELECT);
 	
 	int hits=glRenderMode(GL_RENDER);
 	unsigned int *ptr=IDs, numnames;
@@ -508,7 +606,7 @@ int Renderer::SelectAll(unsigned int CamIndex, int x, int y, int size, unsigned
 	PreRender(CamIndex,true);
 
 	// render the scene for picking
-	m_World.Render(&m_ShadowVolumeGen,SceneGraph::SELECT);
+	m_World.Render(NULL,SceneGraph::SELECT);
 
 	int hits=glRenderMode(GL_RENDER);
 	unsigned int *ptr=IDs, numnames;
@@ -28,6 +28,7 @@
 #include "ImmediateMode.h"
 #include "Light.h"
 #include "TexturePainter.h"
+#include "ShadowMapGen.h"
 
 // TODO: check this works for Apple's OpenGL
 #ifndef GL_POLYGON_OFFSET_EXT
@@ -145,6 +146,10 @@ public:
 	void ShadowLight(unsigned int s)		 { m_ShadowLight=s; }
 	void DebugShadows(bool s)				 { m_ShadowVolumeGen.SetDebug(s); }
 	void ShadowLength(float s)				 { m_ShadowVolumeGen.SetLength(s); }
+	void ShadowGPU(bool s)					 { m_ShadowVolumeGen.SetGPU(s); }
+	void ShadowMapSize(unsigned int s)		 { m_ShadowMapGen.SetSize(s); }
+	void ShadowMapCascades(unsigned int s)	 { m_ShadowMapGen.SetCascades(s); }
+	void ShadowMapRange(float n, float f)	 { m_ShadowMapGen.SetRange(n,f); }
 	double GetTime()                         { return m_Time; }
 	double GetDelta()                        { return m_Delta; }
 	bool SetStereoMode(stereo_mode_t mode);
@@ -167,6 +172,8 @@ private:
 	void PostRender();
 	void RenderLights(bool camera);
 	void RenderStencilShadows(unsigned int CamIndex);
+	bool CastingShadowMaps();
+	void RenderShadowMaps(unsigned int CamIndex);
 
 	bool  m_MainRenderer;
 	bool  m_Initialised;
@@ -192,6 +199,7 @@ private:
 	vector<Camera> m_CameraVec;
 	ImmediateMode m_ImmediateMode;
 	ShadowVolumeGen m_ShadowVolumeGen;
+	ShadowMapGen m_ShadowMapGen;
 
 	// info for picking mode
 	struct SelectInfo
@@ -41,6 +41,7 @@ public:
 	virtual dBoundingBox GetBoundingBox(const dMatrix &space);
 	virtual void ApplyTransform(bool ScaleRotOnly=false);
 	virtual string GetTypeName() { return "RibbonPrimitive"; }
+	virtual bool IsLit() { return !(m_State.Hints & HINT_UNLIT); }
 	virtual Evaluator *MakeEvaluator() { return NULL; }
 	///@}
 
@@ -93,11 +93,16 @@ void SceneGraph::RenderWalk(SceneNode *node,  int depth, unsigned int cameracode
 
 	if (!(node->Prim->GetState()->Hints & HINT_FRUSTUM_CULL) || FrustumClip(node))
 	{
-		if (node->Prim->GetState()->Hints & HINT_DEPTH_SORT)
+		if ((rendermode==RENDER || rendermode==SELECT) &&
+		    node->Prim->GetState()->Hints & HINT_DEPTH_SORT)
 		{
 			// render it later, and after depth sorting
 			m_DepthSorter.Add(parent,node->Prim,node->ID);
 		}
+		else if (rendermode==SHADOW_MAP || rendermode==LIGHT_PASS)
+		{
+			RenderPass(node->Prim,rendermode);
+		}
 		else
 		{
 			glPushName(node->ID);
@@ -118,12 +123,36 @@ void SceneGraph::RenderWalk(SceneNode *node,  int depth, unsigned int cameracode
 	node->Prim->UnapplyState();
 	glPopMatrix();
 
-	if (node->Prim->GetState()->Hints & HINT_CAST_SHADOW)
+	if (shadowgen && node->Prim->GetState()->Hints & HINT_CAST_SHADOW)
 	{
 		shadowgen->Generate(node->Prim);
 	}
 }
 
+void SceneGraph::RenderPass(Primitive *prim, Mode rendermode)
+{
+	State *state=prim->GetState();
+	if (rendermode==SHADOW_MAP)
+	{
+		if (!(state->Hints & HINT_CAST_SHADOW)) return;
+	}
+	else if (rendermode==LIGHT_PASS)
+	{
+		// lights are added on top of what is there, so anything
+		// the lights don't touch, or drawn without depth, is left
+		if (!prim->IsLit() || state->Shader!=NULL || state->Hints & HINT_IGNORE_DEPTH) return;
+	}
+	else return;
+
+	// without the wireframe and other extras, which
+	// would also change the polygon offset
+	int hints=state->Hints;
+	state->Hints&=~(HINT_WIRE_STIPPLED|HINT_NORMAL|HINT_POINTS|HINT_BOUND|HINT_ORIGIN);
+	if (rendermode==LIGHT_PASS) prim->Prerender();
+	prim->Render();
+	state->Hints=hints;
+}
+
 // from Fast Extraction of Viewing Frustum Planes from the World-View-Projection Matrix
 // by Gil Gribb and Klaus Hartmann, thanks to flipcode
 void SceneGraph::GetFrustumPlanes(dPlane *planes, dMatrix m, bool normalise)
@@ -53,12 +53,18 @@ public:
 	SceneGraph();
 	~SceneGraph();
 
-	enum Mode{RENDER,SELECT};
+	/// Shadow map mode only draws the primitives which cast
+	/// shadows, and the light pass mode only the lit ones
+	enum Mode{RENDER,SELECT,SHADOW_MAP,LIGHT_PASS};
 
 	/// Traverses the graph depth first, rendering
 	/// all nodes
 	void Render(ShadowVolumeGen *shadowgen, unsigned int camera, Mode rendermode=RENDER);
 
+	/// Draws a primitive whose state is applied for the
+	/// shadow map or light pass modes, if it belongs there
+	static void RenderPass(Primitive *prim, Mode rendermode);
+
 	/// Clears the graph of all primitives
 	virtual void Clear();
 
@@ -0,0 +1,509 @@
+// Copyright (C) 2005 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include <math.h>
+#include "ShadowMapGen.h"
+#include "Trace.h"
+
+using namespace Fluxus;
+
+// the tiles are laid out in rows of 3 in the depth texture,
+// view n is at (n%TILES_X, n/TILES_X)
+static const unsigned int TILES_X = 3;
+
+// spotlights wider than this are treated as point lights
+static const float MAX_SPOT_ANGLE = 80;
+
+static const char *SHADOWMAP_VERTEX_SHADER=
+"void main()\n"
+"{\n"
+"	gl_Position=gl_Vertex;\n"
+"}\n";
+
+// finds the world position of each pixel from the depth
+// buffer, and looks it up in the depth map of the light
+static const char *SHADOWMAP_FRAGMENT_SHADER=
+"uniform sampler2DShadow ShadowMap;\n"
+"uniform sampler2D SceneDepth;\n"
+"uniform mat4 InvViewProjection;\n"
+"uniform mat4 Views[6];\n"
+"uniform vec4 Tiles[6];\n"
+"uniform vec4 Viewport;\n"
+"uniform vec4 ViewZ;\n"
+"uniform vec4 Splits;\n"
+"uniform vec3 LightPosition;\n"
+"uniform vec2 Texel;\n"
+"uniform int Mode;\n"
+"uniform int NumViews;\n"
+"void main()\n"
+"{\n"
+"	vec2 uv=(gl_FragCoord.xy-Viewport.xy)/Viewport.zw;\n"
+"	float depth=texture2D(SceneDepth,uv).r;\n"
+"	if (depth==1.0) discard;\n"
+"	vec4 p=InvViewProjection*vec4(vec3(uv,depth)*2.0-1.0,1.0);\n"
+"	p/=p.w;\n"
+"	int view=0;\n"
+"	if (Mode==1)\n"
+"	{\n"
+"		// which slice of the view we are in\n"
+"		float d=-dot(ViewZ,p);\n"
+"		view=int(dot(vec4(greaterThan(vec4(d),Splits)),vec4(1.0)));\n"
+"	}\n"
+"	else if (Mode==2)\n"
+"	{\n"
+"		// which side of the cube\n"
+"		vec3 l=p.xyz-LightPosition;\n"
+"		vec3 a=abs(l);\n"
+"		if (a.x>=a.y && a.x>=a.z) view=l.x>0.0?0:1;\n"
+"		else if (a.y>=a.z) view=l.y>0.0?2:3;\n"
+"		else view=l.z>0.0?4:5;\n"
+"	}\n"
+"	if (view>=NumViews) discard;\n"
+"	mat4 m=Views[0];\n"
+"	vec4 tile=Tiles[0];\n"
+"	for (int i=1; i<6; i++)\n"
+"	{\n"
+"		if (i==view) { m=Views[i]; tile=Tiles[i]; }\n"
+"	}\n"
+"	vec4 s=m*p;\n"
+"	if (s.w<=0.0) discard;\n"
+"	s.xyz=s.xyz/s.w*0.5+0.5;\n"
+"	// nothing outside the map to cast a shadow\n"
+"	if (any(lessThan(s.xyz,vec3(0.0))) || any(greaterThan(s.xyz,vec3(1.0)))) discard;\n"
+"	// keep the filter taps inside the tile\n"
+"	vec2 c=clamp(tile.xy+s.xy*tile.zw,tile.xy+Texel*1.5,tile.xy+tile.zw-Texel*1.5);\n"
+"	// each tap is a bilinear comparison, so this covers 3x3 texels\n"
+"	float lit=shadow2D(ShadowMap,vec3(c+vec2(-0.5,-0.5)*Texel,s.z)).r+\n"
+"	          shadow2D(ShadowMap,vec3(c+vec2( 0.5,-0.5)*Texel,s.z)).r+\n"
+"	          shadow2D(ShadowMap,vec3(c+vec2(-0.5, 0.5)*Texel,s.z)).r+\n"
+"	          shadow2D(ShadowMap,vec3(c+vec2( 0.5, 0.5)*Texel,s.z)).r;\n"
+"	if (lit>=2.0) discard;\n"
+"	gl_FragColor=vec4(0.0);\n"
+"}\n";
+
+GLSLShader *ShadowMapGen::m_Shader=NULL;
+
+static dMatrix LookAt(const dVector &eye, dVector dir)
+{
+	dir.normalise();
+	dVector up=fabs(dir.y)>0.99f?dVector(1,0,0):dVector(0,1,0);
+	dVector s=dir.cross(up);
+	s.normalise();
+	dVector u=s.cross(dir);
+	return dMatrix(s.x,s.y,s.z,-s.dot(eye),
+	               u.x,u.y,u.z,-u.dot(eye),
+	               -dir.x,-dir.y,-dir.z,dir.dot(eye),
+	               0,0,0,1);
+}
+
+static dMatrix Perspective(float fov, float n, float f)
+{
+	float c=1/tan(fov*0.5f*M_PI/180.0f);
+	return dMatrix(c,0,0,0,
+	               0,c,0,0,
+	               0,0,(f+n)/(n-f),2*f*n/(n-f),
+	               0,0,-1,0);
+}
+
+static dMatrix Ortho(float l, float r, float b, float t, float n, float f)
+{
+	return dMatrix(2/(r-l),0,0,-(r+l)/(r-l),
+	               0,2/(t-b),0,-(t+b)/(t-b),
+	               0,0,-2/(f-n),-(f+n)/(f-n),
+	               0,0,0,1);
+}
+
+ShadowMapGen::ShadowMapGen() :
+m_Size(1024),
+m_Cascades(3),
+m_Near(0.1f),
+m_Far(100),
+m_Warned(false),
+m_Mode(SINGLE),
+m_NumViews(0),
+m_BuiltSize(0),
+m_BuiltViews(0),
+m_TilesX(1),
+m_TilesY(1),
+m_Complete(false),
+m_Texture(0),
+m_FBO(0),
+m_OldFBO(0),
+m_DepthCopy(0),
+m_DepthCopyWidth(0),
+m_DepthCopyHeight(0)
+{
+	for (unsigned int n=0; n<4; n++) m_Viewport[n]=0;
+	for (unsigned int n=0; n<MAX_CASCADES; n++) m_Splits[n]=0;
+}
+
+ShadowMapGen::~ShadowMapGen()
+{
+	if (m_FBO!=0) glDeleteFramebuffersEXT(1,&m_FBO);
+	if (m_Texture!=0) glDeleteTextures(1,&m_Texture);
+	if (m_DepthCopy!=0) glDeleteTextures(1,&m_DepthCopy);
+}
+
+bool ShadowMapGen::IsSupported()
+{
+	bool supported=glewIsSupported("GL_EXT_framebuffer_object") &&
+	               GLSLShader::m_Enabled && GetShader()->IsValid();
+	// the driver didn't like the last depth texture, so give
+	// up until the size is changed
+	if (m_BuiltSize!=0 && m_BuiltSize==m_Size && !m_Complete) return false;
+	if (!supported && !m_Warned)
+	{
+		Trace::Stream<<"ShadowMapGen: shadow maps need frame buffer objects and glsl"<<endl;
+		m_Warned=true;
+	}
+	return supported;
+}
+
+void ShadowMapGen::SetSize(unsigned int s)
+{
+	if (s==0) return;
+	
+	// a whole row of maps has to fit in a texture
+	GLint maxsize=0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE,&maxsize);
+	if (maxsize>0 && s>(unsigned int)maxsize/TILES_X)
+	{
+		s=maxsize/TILES_X;
+		if (s!=m_Size) 
+		{
+			Trace::Stream<<"ShadowMapGen: shadow maps are too big for a texture, using "<<s<<endl;
+		}
+	}
+	m_Size=s;
+}
+
+void ShadowMapGen::SetCascades(unsigned int s)
+{
+	if (s<1) s=1;
+	if (s>MAX_CASCADES) s=MAX_CASCADES;
+	m_Cascades=s;
+}
+
+GLSLShader *ShadowMapGen::GetShader()
+{
+	if (m_Shader==NULL)
+	{
+		m_Shader = new GLSLShader(GLSLShaderPair(false,SHADOWMAP_VERTEX_SHADER,SHADOWMAP_FRAGMENT_SHADER));
+	}
+	return m_Shader;
+}
+
+bool ShadowMapGen::BuildTextures(unsigned int views)
+{
+	if (m_BuiltSize==m_Size && views<=m_BuiltViews) return m_Complete;
+
+	// in case the size was set before there was a context
+	SetSize(m_Size);
+
+	if (views<m_BuiltViews) views=m_BuiltViews;
+	m_TilesX=views<TILES_X?views:TILES_X;
+	m_TilesY=(views+TILES_X-1)/TILES_X;
+
+	if (m_Texture==0) glGenTextures(1,&m_Texture);
+	glBindTexture(GL_TEXTURE_2D,m_Texture);
+	glTexImage2D(GL_TEXTURE_2D,0,GL_DEPTH_COMPONENT24,m_Size*m_TilesX,m_Size*m_TilesY,0,
+	             GL_DEPTH_COMPONENT,GL_UNSIGNED_INT,NULL);
+	// linear filtering makes each comparison a bilinear one
+	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_COMPARE_MODE,GL_COMPARE_R_TO_TEXTURE);
+	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_COMPARE_FUNC,GL_LEQUAL);
+	glTexParameteri(GL_TEXTURE_2D,GL_DEPTH_TEXTURE_MODE,GL_LUMINANCE);
+	glBindTexture(GL_TEXTURE_2D,0);
+
+	GLint old=0;
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT,&old);
+	if (m_FBO==0) glGenFramebuffersEXT(1,&m_FBO);
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,m_FBO);
+	glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT,GL_DEPTH_ATTACHMENT_EXT,GL_TEXTURE_2D,m_Texture,0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	m_Complete=glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT)==GL_FRAMEBUFFER_COMPLETE_EXT;
+	if (!m_Complete)
+	{
+		Trace::Stream<<"ShadowMapGen: incomplete frame buffer for size "<<m_Size<<", shadows are off"<<endl;
+	}
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,old);
+
+	m_BuiltSize=m_Size;
+	m_BuiltViews=views;
+	return m_Complete;
+}
+
+void ShadowMapGen::SetCamera()
+{
+	dMatrix projection;
+	glGetFloatv(GL_MODELVIEW_MATRIX,m_View.arr());
+	glGetFloatv(GL_PROJECTION_MATRIX,projection.arr());
+	glGetIntegerv(GL_VIEWPORT,m_Viewport);
+	m_InvView=m_View.inverse();
+	m_InvViewProjection=(projection*m_View).inverse();
+
+	// the corners of the view in eye space
+	dMatrix invprojection=projection.inverse();
+	for (unsigned int n=0; n<4; n++)
+	{
+		float x=(n&1)?1:-1;
+		float y=(n&2)?1:-1;
+		m_NearCorners[n]=invprojection.transform_persp(dVector(x,y,-1));
+		m_FarCorners[n]=invprojection.transform_persp(dVector(x,y,1));
+	}
+}
+
+void ShadowMapGen::CopyDepth()
+{
+	int w=m_Viewport[2];
+	int h=m_Viewport[3];
+	if (m_DepthCopy==0) glGenTextures(1,&m_DepthCopy);
+	glBindTexture(GL_TEXTURE_2D,m_DepthCopy);
+	if (w!=m_DepthCopyWidth || h!=m_DepthCopyHeight)
+	{
+		glTexImage2D(GL_TEXTURE_2D,0,GL_DEPTH_COMPONENT24,w,h,0,GL_DEPTH_COMPONENT,GL_UNSIGNED_INT,NULL);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D,GL_DEPTH_TEXTURE_MODE,GL_LUMINANCE);
+		m_DepthCopyWidth=w;
+		m_DepthCopyHeight=h;
+	}
+	glCopyTexSubImage2D(GL_TEXTURE_2D,0,0,0,m_Viewport[0],m_Viewport[1],w,h);
+	glBindTexture(GL_TEXTURE_2D,0);
+}
+
+unsigned int ShadowMapGen::Begin(Light *light)
+{
+	dVector pos=light->GetPosition();
+	dVector dir=light->GetDirection();
+	pos.w=1;
+	if (light->GetCameraLock())
+	{
+		pos=m_InvView.transform(pos);
+		dir=m_InvView.transform_no_trans(dir);
+	}
+	m_LightPosition=pos;
+
+	if (light->GetType()==Light::DIRECTIONAL)
+	{
+		// the direction points towards the light
+		m_Mode=CASCADES;
+		m_NumViews=m_Cascades;
+		FitCascades(-dir);
+	}
+	else if (light->GetType()==Light::SPOT && light->GetSpotAngle()<=MAX_SPOT_ANGLE)
+	{
+		m_Mode=SINGLE;
+		m_NumViews=1;
+		m_Projections[0]=Perspective(light->GetSpotAngle()*2,m_Near,m_Far);
+		m_LightViews[0]=LookAt(pos,dir);
+	}
+	else
+	{
+		m_Mode=CUBE;
+		m_NumViews=6;
+		const dVector axes[6]={dVector(1,0,0),dVector(-1,0,0),
+		                       dVector(0,1,0),dVector(0,-1,0),
+		                       dVector(0,0,1),dVector(0,0,-1)};
+		for (unsigned int n=0; n<6; n++)
+		{
+			m_Projections[n]=Perspective(90,m_Near,m_Far);
+			m_LightViews[n]=LookAt(pos,axes[n]);
+		}
+	}
+
+	if (!BuildTextures(m_NumViews)) return 0;
+	return m_NumViews;
+}
+
+void ShadowMapGen::FitCascades(const dVector &dir)
+{
+	float n=-m_NearCorners[0].z;
+	float f=-m_FarCorners[0].z;
+	float end=f<m_Far?f:m_Far;
+	if (end<=n) end=f;
+
+	float start=n;
+	for (unsigned int c=0; c<m_Cascades; c++)
+	{
+		// between logarithmic and even splits
+		float t=(c+1)/(float)m_Cascades;
+		float split=n+(end-n)*t;
+		if (n>0) split=0.75f*n*powf(end/n,t)+0.25f*split;
+		m_Splits[c]=split;
+
+		// the corners of this slice of the view
+		dVector corners[8];
+		dVector centre(0,0,0);
+		for (unsigned int i=0; i<8; i++)
+		{
+			float d=i<4?start:split;
+			float a=(d-n)/(f-n);
+			const dVector &nc=m_NearCorners[i%4];
+			const dVector &fc=m_FarCorners[i%4];
+			corners[i]=m_InvView.transform(nc+(fc-nc)*a);
+			centre+=corners[i];
+		}
+		centre/=8;
+		centre.w=1;
+
+		// a sphere around it stays the same size as the camera turns
+		float radius=0;
+		for (unsigned int i=0; i<8; i++)
+		{
+			float d=corners[i].dist(centre);
+			if (d>radius) radius=d;
+		}
+
+		// move in whole texels, so the edges don't crawl
+		m_LightViews[c]=LookAt(dVector(0,0,0),dir);
+		dVector lc=m_LightViews[c].transform(centre);
+		float texel=radius*2/m_Size;
+		lc.x=floorf(lc.x/texel)*texel;
+		lc.y=floorf(lc.y/texel)*texel;
+
+		// and reach back towards the light for things out of view
+		m_Projections[c]=Ortho(lc.x-radius,lc.x+radius,lc.y-radius,lc.y+radius,
+		                       -(lc.z+radius)-m_Far,-(lc.z-radius));
+		start=split;
+	}
+
+	for (unsigned int c=m_Cascades; c<MAX_CASCADES; c++)
+	{
+		m_Splits[c]=m_Splits[m_Cascades-1];
+	}
+}
+
+void ShadowMapGen::BeginView(unsigned int view)
+{
+	if (view==0)
+	{
+		glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT,&m_OldFBO);
+		glPushAttrib(GL_VIEWPORT_BIT|GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT|
+		             GL_ENABLE_BIT|GL_POLYGON_BIT|GL_SCISSOR_BIT);
+		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,m_FBO);
+		glDisable(GL_SCISSOR_TEST);
+		glColorMask(GL_FALSE,GL_FALSE,GL_FALSE,GL_FALSE);
+		glEnable(GL_DEPTH_TEST);
+		glDepthFunc(GL_LEQUAL);
+		glDepthMask(GL_TRUE);
+		glViewport(0,0,m_Size*m_TilesX,m_Size*m_TilesY);
+		glClear(GL_DEPTH_BUFFER_BIT);
+		// pushes the depth back a bit, so surfaces don't shadow themselves
+		glEnable(GL_POLYGON_OFFSET_FILL);
+		glPolygonOffset(2,4);
+
+		glMatrixMode(GL_PROJECTION);
+		glPushMatrix();
+		glMatrixMode(GL_MODELVIEW);
+		glPushMatrix();
+	}
+
+	glViewport((view%TILES_X)*m_Size,(view/TILES_X)*m_Size,m_Size,m_Size);
+	glMatrixMode(GL_PROJECTION);
+	glLoadMatrixf(m_Projections[view].arr());
+	glMatrixMode(GL_MODELVIEW);
+	glLoadMatrixf(m_LightViews[view].arr());
+}
+
+void ShadowMapGen::End()
+{
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();
+	glMatrixMode(GL_MODELVIEW);
+	glPopMatrix();
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,m_OldFBO);
+	glPopAttrib();
+}
+
+void ShadowMapGen::MarkShadows()
+{
+	GLSLShader *shader=GetShader();
+	if (!shader->IsValid()) return;
+
+	glPushAttrib(GL_ENABLE_BIT|GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT|
+	             GL_STENCIL_BUFFER_BIT|GL_TEXTURE_BIT);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_CULL_FACE);
+	glDisable(GL_BLEND);
+	glDepthMask(GL_FALSE);
+	glColorMask(GL_FALSE,GL_FALSE,GL_FALSE,GL_FALSE);
+	glClear(GL_STENCIL_BUFFER_BIT);
+	glEnable(GL_STENCIL_TEST);
+	glStencilFunc(GL_ALWAYS,1,~0);
+	glStencilOp(GL_KEEP,GL_KEEP,GL_REPLACE);
+
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D,m_DepthCopy);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D,m_Texture);
+
+	vector<dMatrix> views(MAX_VIEWS);
+	vector<dVector,FLX_ALLOC(dVector) > tiles(MAX_VIEWS);
+	for (unsigned int n=0; n<m_NumViews; n++)
+	{
+		views[n]=m_Projections[n]*m_LightViews[n];
+		tiles[n]=dVector((n%TILES_X)/(float)m_TilesX,(n/TILES_X)/(float)m_TilesY,
+		                 1/(float)m_TilesX,1/(float)m_TilesY);
+	}
+
+	shader->Apply();
+	shader->SetInt("ShadowMap",0);
+	shader->SetInt("SceneDepth",1);
+	shader->SetMatrixArray("InvViewProjection",vector<dMatrix>(1,m_InvViewProjection));
+	shader->SetMatrixArray("Views",views);
+	shader->SetVectorArray("Tiles",tiles);
+	shader->SetVector("Viewport",dVector(m_Viewport[0],m_Viewport[1],m_Viewport[2],m_Viewport[3]));
+	// the row of the view matrix giving the eye depth
+	shader->SetVector("ViewZ",dVector(m_View.m[0][2],m_View.m[1][2],m_View.m[2][2],m_View.m[3][2]));
+	shader->SetVector("Splits",dVector(m_Splits[0],m_Splits[1],m_Splits[2],m_Splits[3]));
+	shader->SetVector("LightPosition",m_LightPosition,3);
+	shader->SetVector("Texel",dVector(1/(float)(m_Size*m_TilesX),1/(float)(m_Size*m_TilesY),0),2);
+	shader->SetInt("Mode",m_Mode);
+	shader->SetInt("NumViews",m_NumViews);
+
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glLoadIdentity();
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+	glLoadIdentity();
+
+	glBegin(GL_QUADS);
+	glVertex3f(-1,-1,0);
+	glVertex3f(1,-1,0);
+	glVertex3f(1,1,0);
+	glVertex3f(-1,1,0);
+	glEnd();
+
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();
+	glMatrixMode(GL_MODELVIEW);
+	glPopMatrix();
+
+	GLSLShader::Unapply();
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D,0);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D,0);
+	glPopAttrib();
+}
@@ -0,0 +1,129 @@
+// Copyright (C) 2005 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#ifndef N_SHADOWMAPGEN
+#define N_SHADOWMAPGEN
+
+#include "dada.h"
+#include "Light.h"
+#include "GLSLShader.h"
+
+namespace Fluxus
+{
+
+///////////////////////////////////////////////////
+/// Shadows from depth maps rendered from the lights,
+/// which cost the same however much geometry there
+/// is, and work for any number of lights. Directional
+/// lights get a cascade of maps covering slices of
+/// the view, point lights (and wide spotlights) one
+/// for each side of a cube, all as tiles of a single
+/// depth texture. The renderer draws the maps for a
+/// light, then the pixels in its shadow are marked
+/// in the stencil buffer for the pass adding it in.
+class ShadowMapGen
+{
+public:
+	ShadowMapGen();
+	~ShadowMapGen();
+
+	/// Needs frame buffer objects and glsl, and a depth
+	/// texture the driver will render to
+	bool IsSupported();
+
+	/// The size of each depth map, which is made smaller
+	/// if the maps won't fit in a texture
+	void SetSize(unsigned int s);
+	/// How many slices of the view directional lights are split into
+	void SetCascades(unsigned int s);
+	/// The depth range of point and spotlights, the far
+	/// one is also how far away from the camera the shadows
+	/// of directional lights reach
+	void SetRange(float n, float f) { m_Near=n; m_Far=f; }
+
+	/// Reads the camera from the current gl matrices and viewport
+	void SetCamera();
+	/// Keeps a copy of the depth buffer for finding the shadows
+	void CopyDepth();
+
+	///////////////////////////////////////////////////
+	///@name Depth maps
+	///@{
+	/// Sets up the views of the light, returns the
+	/// number of depth maps to render, or 0 if they
+	/// can't be rendered (End isn't needed then)
+	unsigned int Begin(Light *light);
+	/// Sets up gl to render one of the depth maps
+	void BeginView(unsigned int view);
+	/// Back to rendering from the camera
+	void End();
+	///@}
+
+	/// Marks the pixels in the shadow of the light
+	/// in the stencil buffer, with a one
+	void MarkShadows();
+
+	static const unsigned int MAX_VIEWS = 6;
+	static const unsigned int MAX_CASCADES = 4;
+
+private:
+	enum Mode {SINGLE,CASCADES,CUBE};
+
+	bool BuildTextures(unsigned int views);
+	void FitCascades(const dVector &dir);
+	GLSLShader *GetShader();
+
+	unsigned int m_Size;
+	unsigned int m_Cascades;
+	float m_Near;
+	float m_Far;
+	bool m_Warned;
+
+	// the camera
+	dMatrix m_View;
+	dMatrix m_InvView;
+	dMatrix m_InvViewProjection;
+	dVector m_NearCorners[4];
+	dVector m_FarCorners[4];
+	int m_Viewport[4];
+
+	// the light
+	Mode m_Mode;
+	unsigned int m_NumViews;
+	dVector m_LightPosition;
+	dMatrix m_Projections[MAX_VIEWS];
+	dMatrix m_LightViews[MAX_VIEWS];
+	float m_Splits[MAX_CASCADES];
+
+	// the depth texture only grows to the number of maps used
+	unsigned int m_BuiltSize;
+	unsigned int m_BuiltViews;
+	unsigned int m_TilesX;
+	unsigned int m_TilesY;
+	bool m_Complete;
+	GLuint m_Texture;
+	GLuint m_FBO;
+	GLint m_OldFBO;
+	GLuint m_DepthCopy;
+	int m_DepthCopyWidth;
+	int m_DepthCopyHeight;
+
+	static GLSLShader *m_Shader;
+};
+
+}
+
+#endif
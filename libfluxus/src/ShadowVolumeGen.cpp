@@ -16,14 +16,36 @@
 
 #include <algorithm>
 #include "ShadowVolumeGen.h"
+#include "GLSLShader.h"
 
 using namespace Fluxus;
 
+// extrudes the edge quads of faces turned towards the light, see Silhouette
+static const char *SHADOW_VERTEX_SHADER=
+"uniform vec3 LightPosition;\n"
+"uniform float Length;\n"
+"void main()\n"
+"{\n"
+"	vec4 p=gl_Vertex;\n"
+"	vec4 plane=gl_MultiTexCoord0;\n"
+"	if (dot(plane.xyz,LightPosition)>=plane.w) p.xyz+=(p.xyz-LightPosition)*Length;\n"
+"	gl_Position=gl_ModelViewProjectionMatrix*p;\n"
+"}\n";
+
+static const char *SHADOW_FRAGMENT_SHADER=
+"void main()\n"
+"{\n"
+"	gl_FragColor=vec4(0.0);\n"
+"}\n";
+
+GLSLShader *ShadowVolumeGen::m_Shader=NULL;
+
 ShadowVolumeGen::ShadowVolumeGen() :
 m_ShadowVolume(PolyPrimitive::QUADS),
 m_LightPosition(5,5,0),
 m_Length(10),
-m_Debug(false)
+m_Debug(false),
+m_GPU(false)
 {
 }
 
@@ -51,7 +73,7 @@ void ShadowVolumeGen::Generate(Primitive *prim)
 void ShadowVolumeGen::Clear()
 { 
 	m_ShadowVolume.Clear();
-	
+	m_Casters.clear();
 }
 
 PolyPrimitive *ShadowVolumeGen::GetVolume() 
@@ -60,139 +82,98 @@ PolyPrimitive *ShadowVolumeGen::GetVolume()
 }
 
 void ShadowVolumeGen::PolyGen(PolyPrimitive *src)
-{	
-	TypedPData<dVector> *points = dynamic_cast<TypedPData<dVector>* >(src->GetDataRaw("p"));
+{
+	if (src->GetType()!=PolyPrimitive::TRISTRIP && 
+	    src->GetType()!=PolyPrimitive::QUADS &&
+	    src->GetType()!=PolyPrimitive::TRILIST) return;
+
+	dMatrix &transform = src->GetState()->Transform;
+	Silhouette &silhouette = src->GetSilhouette();
 	
-	///\todo using geometric normals, as we need them to be non smoothed
-	/// to tell the difference between faces, but this doesn't update with
-	/// n (from things like skinning and user deformation). recalc-normals
-	/// is ok though as it regenerates them... not sure what the answer is.
-	const vector<dVector> &normals = src->GetGeometricNormals();
-	const vector<vector<int> > &connected=src->GetConnectedVerts();
+	// the vertex shader does the rest
+	if (m_GPU && !m_Debug && GetShader()->IsValid())
+	{
+		m_Casters.push_back(pair<PolyPrimitive*,dMatrix>(src,transform));
+		return;
+	}
 	
-	dMatrix &transform = src->GetState()->Transform;
+	// find the edges with the light in object space, rather 
+	// than moving all the points and normals into the world
+	m_Edges.clear();
+	silhouette.Find(transform.inverse().transform(m_LightPosition),m_Edges);
+	if (m_Edges.empty()) return;
 	
-	int stride=0;
-	if (src->GetType()==PolyPrimitive::TRISTRIP) stride=2;
-	if (src->GetType()==PolyPrimitive::QUADS) stride=4;
-	if (src->GetType()==PolyPrimitive::TRILIST) stride=3;
-	if (stride>0)
+	const vector<dVector,FLX_ALLOC(dVector) > &points = *src->GetDataVec<dVector>("p");
+	
+	// write the quads straight into the volume
+	unsigned int start=m_ShadowVolume.Size();
+	m_ShadowVolume.Resize(start+m_Edges.size()*2);
+	vector<dVector,FLX_ALLOC(dVector) > &volume = *m_ShadowVolume.GetDataVec<dVector>("p");
+	dVector *v=&volume[start];
+	for (unsigned int i=0; i<m_Edges.size(); i+=2)
 	{
-		SharedEdgeContainer edges = src->GetUniqueEdges();
-		vector<pair<dVector,dVector> > silhouette;
-			
-		if (src->IsIndexed())
-		{
-			vector<unsigned int> index = src->GetIndex();
-			// loop over all the edges
-			for (SharedEdgeContainer::iterator i=edges.begin(); i!=edges.end(); ++i)
-			{
-				EdgeContainer sharededges = *i;
-
-				dVector lightdir = transform.transform(points->m_Data[index[sharededges.begin()->first]])-m_LightPosition;
-				lightdir.normalise();
-
-				if (sharededges.size()==2)
-				{
-					bool backface=false;
-					bool frontface=false;
-
-					EdgeContainer::iterator frontedge;
-
-					// loop over the edges shared by this one
-					for (EdgeContainer::iterator edge=sharededges.begin(); edge!=sharededges.end(); ++edge)
-					{			
-						// only check the first vert, as they should have 
-						// the same geometric normal if the poly is planar..
-						if (lightdir.dot(transform.transform_no_trans(normals[edge->first]))>0) 
-						{
-							frontedge=edge;
-							frontface=true;
-						}
-						else backface=true;
-					}
-
-					// if we contain both front and back facing normals (from the light's pov) 
-					if (backface && frontface) 
-					{			
-						silhouette.push_back(pair<dVector,dVector>(transform.transform(points->m_Data[index[frontedge->first]]),
-					                                    		   transform.transform(points->m_Data[index[frontedge->second]])));
-					}
-				}
-			}
-		}
-		else
-		{
-			// loop over all the edges
-			for (SharedEdgeContainer::iterator i=edges.begin(); i!=edges.end(); ++i)
-			{
-				EdgeContainer sharededges = *i;
-
-				dVector lightdir = transform.transform(points->m_Data[sharededges.begin()->first])-m_LightPosition;
-				lightdir.normalise();
-
-
-				if (sharededges.size()==2)
-				{
-					bool backface=false;
-					bool frontface=false;
-
-					EdgeContainer::iterator frontedge;
-
-					// loop over the edges shared by this one
-					for (EdgeContainer::iterator edge=sharededges.begin(); edge!=sharededges.end(); ++edge)
-					{			
-						// only check the first vert, as they should have 
-						// the same geometric normal if the poly is planar..
-						if (lightdir.dot(transform.transform_no_trans(normals[edge->first]))>0) 
-						{
-							frontedge=edge;
-							frontface=true;
-						}
-						else backface=true;
-					}
-
-					// if we contain both front and back facing normals (from the light's pov) 
-					if (backface && frontface) 
-					{			
-						silhouette.push_back(pair<dVector,dVector>(transform.transform(points->m_Data[frontedge->first]),
-					                                    		   transform.transform(points->m_Data[frontedge->second])));
-					}
-				}
-			}
-		}
+		dVector edgestart=transform.transform(points[m_Edges[i]]);
+		dVector edgeend=transform.transform(points[m_Edges[i+1]]);
+		if (m_Debug) DrawEdge(edgestart,edgeend);
 		
-		for (vector<pair<dVector,dVector> >::iterator i=silhouette.begin();
-		     i!=silhouette.end(); i++)
-		{
-			AddEdge(i->first,i->second);
-		}
+		*v++=edgestart;
+		*v++=edgeend;
+		*v++=edgeend+(edgeend-m_LightPosition)*m_Length;
+		*v++=edgestart+(edgestart-m_LightPosition)*m_Length;
 	}
 }
 
-void ShadowVolumeGen::AddEdge(dVector start, dVector end)
+void ShadowVolumeGen::DrawEdge(dVector start, dVector end)
+{
+	glDisable(GL_LIGHTING);
+	glLineWidth(3);
+	glBegin(GL_LINES);					
+		glColor3f(1,0,0);
+		glVertex3fv(start.arr());
+		glColor3f(0,0,1);
+		glVertex3fv(end.arr());
+	glEnd();
+	glEnable(GL_LIGHTING);
+}
+
+GLSLShader *ShadowVolumeGen::GetShader()
 {
-	if (m_Debug)
+	if (m_Shader==NULL)
 	{
-		glDisable(GL_LIGHTING);
-		glLineWidth(3);
-		glBegin(GL_LINES);					
-			glColor3f(1,0,0);
-			glVertex3fv(start.arr());
-			glColor3f(0,0,1);
-			glVertex3fv(end.arr());
-		glEnd();
-		glEnable(GL_LIGHTING);
+		m_Shader = new GLSLShader(GLSLShaderPair(false,SHADOW_VERTEX_SHADER,SHADOW_FRAGMENT_SHADER));
 	}
+	return m_Shader;
+}
 
-	m_ShadowVolume.AddVertex(dVertex(start,dVector(0,0,0),0,0));
-	m_ShadowVolume.AddVertex(dVertex(end,dVector(0,0,0),0,0));
-
-	dVector proj = end-m_LightPosition;
-	m_ShadowVolume.AddVertex(dVertex(end+proj*m_Length,dVector(0,0,0),0,0));
-
-	proj = start-m_LightPosition;
-	m_ShadowVolume.AddVertex(dVertex(start+proj*m_Length,dVector(0,0,0),0,0));
+void ShadowVolumeGen::Render()
+{
+	m_ShadowVolume.Render();
+	if (m_Casters.empty()) return;
+	
+	glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	GetShader()->Apply();
+	m_Shader->SetFloat("Length",m_Length);
+	
+	for (vector<pair<PolyPrimitive*,dMatrix> >::iterator i=m_Casters.begin(); i!=m_Casters.end(); ++i)
+	{
+		Silhouette &silhouette = i->first->GetSilhouette();
+		const vector<dVector> &verts = silhouette.GetExtrusionVerts();
+		if (verts.empty()) continue;
+		const vector<dVector> &planes = silhouette.GetExtrusionPlanes();
+		
+		m_Shader->SetVector("LightPosition",i->second.inverse().transform(m_LightPosition),3);
+		glPushMatrix();
+		glMultMatrixf(i->second.arr());
+		glVertexPointer(3,GL_FLOAT,sizeof(dVector),(void*)(&verts[0].x));
+		glTexCoordPointer(4,GL_FLOAT,sizeof(dVector),(void*)(&planes[0].x));
+		glDrawArrays(GL_QUADS,0,verts.size());
+		glPopMatrix();
+	}
+	
+	GLSLShader::Unapply();
+	glPopClientAttrib();
 }
 
 ///\todo shadow volumes for nurbs
@@ -18,8 +18,9 @@
 // Generates a shadow volume poly primitive for the supplied 
 // primitives and light position
 
-// Can we accelerate the process by caching as much as possible, and 
-// changing only when light positions/primitive transforms/deform?
+// The edge adjacency and face planes are cached by each polygon 
+// primitive (see Silhouette), so only deforming meshes pay for more 
+// than the facing test. Volumes can also be extruded on the gpu.
 
 #ifndef N_SHADOWGEN
 #define N_SHADOWGEN
@@ -31,6 +32,8 @@
 namespace Fluxus
 {
 
+class GLSLShader;
+
 /////////////////////////////////////
 /// Generates shadow volumes from 
 /// extruding light silhouette edges. These 
@@ -56,9 +59,13 @@ public:
 	/// primitive
 	void Generate(Primitive *prim);
 	
-	/// Gets the volume generated so far
+	/// Gets the volume generated so far on the cpu
 	PolyPrimitive *GetVolume();
 	
+	/// Renders the volume, including the casters 
+	/// extruded on the gpu
+	void Render();
+	
 	/// Sets the length to extrude the volume by, in world space
 	void SetLength(float s) { m_Length=s; }
 
@@ -66,6 +73,11 @@ public:
 	/// silhouette edge artifacts
 	void SetExpand(float s) { m_Expand=s; }
 	
+	/// Extrude polygon primitive volumes in a vertex shader 
+	/// rather than finding the silhouette edges on the cpu. 
+	/// Falls back to the cpu without shaders, or in debug mode.
+	void SetGPU(bool s) { m_GPU=s; }
+	
 	///@name Accessors for debug mode
 	/// When in debug mode, the silhouette edges are drawn, 
 	/// indicating direction by colour gradient
@@ -76,21 +88,21 @@ public:
 	
 private:
 
-	typedef pair<int,int> EdgeType;
-	typedef vector<EdgeType> EdgeContainer;
-	typedef vector<EdgeContainer> SharedEdgeContainer;
-
 	void PolyGen(PolyPrimitive *src);
 	void NURBSGen(NURBSPrimitive *src);
-	
-	void AddEdge(dVector start, dVector end);
-	int FindNextEdge(unsigned int index, vector<pair<dVector,dVector> > &silhouette, bool &flip);
+	void DrawEdge(dVector start, dVector end);
+	static GLSLShader *GetShader();
 
 	PolyPrimitive m_ShadowVolume;
 	dVector m_LightPosition;
 	float m_Length;
 	float m_Expand;
 	bool m_Debug;
+	bool m_GPU;
+	
+	vector<unsigned int> m_Edges;
+	vector<pair<PolyPrimitive*,dMatrix> > m_Casters;
+	static GLSLShader *m_Shader;
 };
 
 };
@@ -0,0 +1,169 @@
+// Copyright (C) 2005 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include "Silhouette.h"
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+using namespace Fluxus;
+
+Silhouette::Silhouette() :
+m_Build(0),
+m_Version(0),
+m_ExtrusionDirty(true),
+m_Verts(NULL),
+m_Stride(0),
+m_NumFaces(0)
+{
+}
+
+void Silhouette::Update(const PolyTopology &topology, unsigned int build,
+                        const vector<dVector,FLX_ALLOC(dVector) > &verts,
+                        const vector<unsigned int> *index, unsigned int version)
+{
+	m_Verts=&verts;
+	bool rebuilt=false;
+	if (build!=m_Build)
+	{
+		BuildEdges(topology,index);
+		m_Build=build;
+		rebuilt=true;
+	}
+
+	if (rebuilt || version!=m_Version)
+	{
+		BuildPlanes(verts,index);
+		m_Version=version;
+		m_ExtrusionDirty=true;
+	}
+}
+
+void Silhouette::BuildEdges(const PolyTopology &topology, const vector<unsigned int> *index)
+{
+	m_EdgeVerts.clear();
+	m_EdgeFaces.clear();
+	m_Stride=topology.GetStride();
+	if (m_Stride==0) return;
+
+	for (unsigned int e=0; e<topology.NumEdges(); e++)
+	{
+		unsigned int count=0;
+		const unsigned int *halfedges=topology.GetEdgeHalfEdges(e,count);
+		if (count!=2) continue;
+
+		for (unsigned int n=0; n<2; n++)
+		{
+			unsigned int start=halfedges[n];
+			unsigned int end=topology.GetNext(start);
+			m_EdgeVerts.push_back(index?(*index)[start]:start);
+			m_EdgeVerts.push_back(index?(*index)[end]:end);
+			m_EdgeFaces.push_back(topology.GetFace(start));
+		}
+	}
+}
+
+void Silhouette::BuildPlanes(const vector<dVector,FLX_ALLOC(dVector) > &verts, const vector<unsigned int> *index)
+{
+	unsigned int corners=index?index->size():verts.size();
+	m_NumFaces=m_Stride?(corners+m_Stride-1)/m_Stride:0;
+	// rounded up for the sse loop
+	unsigned int padded=(m_NumFaces+3)&~3;
+	m_PlaneX.resize(padded);
+	m_PlaneY.resize(padded);
+	m_PlaneZ.resize(padded);
+	m_PlaneD.resize(padded);
+	m_Away.resize(padded);
+
+	// faces use their first three corners, like the normals
+	for (unsigned int f=0; f<padded; f++)
+	{
+		unsigned int c=f*m_Stride;
+		if (f>=m_NumFaces || c+2>=corners)
+		{
+			m_PlaneX[f]=m_PlaneY[f]=m_PlaneZ[f]=m_PlaneD[f]=0;
+			continue;
+		}
+
+		const dVector &a=verts[index?(*index)[c]:c];
+		const dVector &b=verts[index?(*index)[c+1]:c+1];
+		const dVector &d=verts[index?(*index)[c+2]:c+2];
+		// doesn't need normalising, only the side matters
+		dVector n=(a-b).cross(b-d);
+		m_PlaneX[f]=n.x;
+		m_PlaneY[f]=n.y;
+		m_PlaneZ[f]=n.z;
+		m_PlaneD[f]=n.dot(a);
+	}
+}
+
+void Silhouette::Find(const dVector &light, vector<unsigned int> &edges)
+{
+	// which faces are turned away from the light
+	unsigned int padded=m_Away.size();
+#ifdef __SSE__
+	__m128 lx=_mm_set1_ps(light.x);
+	__m128 ly=_mm_set1_ps(light.y);
+	__m128 lz=_mm_set1_ps(light.z);
+	for (unsigned int f=0; f<padded; f+=4)
+	{
+		__m128 s=_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&m_PlaneX[f]),lx),
+		                               _mm_mul_ps(_mm_loadu_ps(&m_PlaneY[f]),ly)),
+		                    _mm_mul_ps(_mm_loadu_ps(&m_PlaneZ[f]),lz));
+		int away=_mm_movemask_ps(_mm_cmplt_ps(s,_mm_loadu_ps(&m_PlaneD[f])));
+		m_Away[f]=away&1;
+		m_Away[f+1]=(away>>1)&1;
+		m_Away[f+2]=(away>>2)&1;
+		m_Away[f+3]=(away>>3)&1;
+	}
+#else
+	for (unsigned int f=0; f<padded; f++)
+	{
+		m_Away[f]=m_PlaneX[f]*light.x+m_PlaneY[f]*light.y+m_PlaneZ[f]*light.z<m_PlaneD[f];
+	}
+#endif
+
+	// edges where the faces disagree
+	const unsigned int *faces=m_EdgeFaces.empty()?NULL:&m_EdgeFaces[0];
+	for (unsigned int e=0; e<NumEdges(); e++)
+	{
+		unsigned char away=m_Away[faces[e*2]];
+		if (away!=m_Away[faces[e*2+1]])
+		{
+			// take the half edge of the face turned away
+			const unsigned int *v=&m_EdgeVerts[e*4+(away?0:2)];
+			edges.push_back(v[0]);
+			edges.push_back(v[1]);
+		}
+	}
+}
+
+void Silhouette::UpdateExtrusion()
+{
+	if (!m_ExtrusionDirty || m_Verts==NULL) return;
+
+	m_ExtrusionVerts.resize(m_EdgeVerts.size());
+	m_ExtrusionPlanes.resize(m_EdgeVerts.size());
+	for (unsigned int i=0; i<m_EdgeVerts.size(); i++)
+	{
+		unsigned int f=m_EdgeFaces[i/2];
+		m_ExtrusionVerts[i]=(*m_Verts)[m_EdgeVerts[i]];
+		m_ExtrusionPlanes[i]=dVector(m_PlaneX[f],m_PlaneY[f],m_PlaneZ[f]);
+		m_ExtrusionPlanes[i].w=m_PlaneD[f];
+	}
+	m_ExtrusionDirty=false;
+}
@@ -0,0 +1,100 @@
+// Copyright (C) 2005 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#ifndef N_SILHOUETTE
+#define N_SILHOUETTE
+
+#include <vector>
+#include "dada.h"
+#include "Allocator.h"
+#include "PolyTopology.h"
+
+using namespace std;
+
+namespace Fluxus
+{
+
+///////////////////////////////////////////////////
+/// Finds the silhouette edges of a polygon primitive
+/// as seen from a point light, for shadow volumes.
+/// The edges with exactly two faces are kept in flat
+/// arrays, only rebuilt when the topology is, and
+/// the face planes are only redone when the vertices
+/// move, so a still mesh just needs the facing test.
+class Silhouette
+{
+public:
+	Silhouette();
+
+	/// Brings everything up to date with the primitive,
+	/// build is the topology's build count and version
+	/// the version of the vertex positions
+	void Update(const PolyTopology &topology, unsigned int build,
+	            const vector<dVector,FLX_ALLOC(dVector) > &verts,
+	            const vector<unsigned int> *index, unsigned int version);
+
+	/// Adds the edges between faces turned towards and away
+	/// from the light (in object space) as pairs of vertex
+	/// numbers, going the way of the face turned away
+	void Find(const dVector &light, vector<unsigned int> &edges);
+
+	unsigned int NumEdges() const { return m_EdgeFaces.size()/2; }
+
+	///////////////////////////////////////////////////
+	///@name Extrusion mesh
+	/// A degenerate quad for every edge, made of the edge
+	/// from each of its faces, with the plane of the face
+	/// at each vertex. Pushing the vertices whose face is
+	/// turned towards the light away from it only stretches
+	/// the quads on the silhouette, so this can be done in
+	/// a vertex shader without finding the edges.
+	///@{
+	const vector<dVector> &GetExtrusionVerts() { UpdateExtrusion(); return m_ExtrusionVerts; }
+	const vector<dVector> &GetExtrusionPlanes() { UpdateExtrusion(); return m_ExtrusionPlanes; }
+	///@}
+
+private:
+	void BuildEdges(const PolyTopology &topology, const vector<unsigned int> *index);
+	void BuildPlanes(const vector<dVector,FLX_ALLOC(dVector) > &verts, const vector<unsigned int> *index);
+	void UpdateExtrusion();
+
+	unsigned int m_Build;
+	unsigned int m_Version;
+	bool m_ExtrusionDirty;
+	const vector<dVector,FLX_ALLOC(dVector) > *m_Verts;
+
+	// the half edge from each face as two vertex
+	// numbers, and the two faces, for each edge
+	vector<unsigned int> m_EdgeVerts;
+	vector<unsigned int> m_EdgeFaces;
+
+	// face planes, as separate arrays padded
+	// to a multiple of four for the facing test
+	unsigned int m_Stride;
+	unsigned int m_NumFaces;
+	vector<float> m_PlaneX;
+	vector<float> m_PlaneY;
+	vector<float> m_PlaneZ;
+	vector<float> m_PlaneD;
+	vector<unsigned char> m_Away;
+
+	vector<dVector> m_ExtrusionVerts;
+	vector<dVector> m_ExtrusionPlanes;
+};
+
+}
+
+#endif
@@ -15,13 +15,46 @@
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
 #include <stdio.h>
+#include <string.h>
+#include <map>
 #include "SkinningPrimFunc.h"
 #include "Primitive.h"
 #include "SceneGraph.h"
+#include "GLSLShader.h"
+#include "WorkerPool.h"
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
 
 using namespace Fluxus;
 
-SkinningPrimFunc::SkinningPrimFunc()
+// bones kept per vertex
+static const unsigned int SKIN_MAX_INFLUENCES=4;
+// below this it's not worth splitting the work
+static const unsigned int SKIN_CHUNK=2048;
+
+namespace Fluxus
+{
+
+class SkinningJob : public WorkerPool::Job
+{
+public:
+	SkinningJob(SkinningPrimFunc *func) : m_Func(func) {}
+	virtual void Run(unsigned int start, unsigned int end) { m_Func->Skin(start,end); }
+private:
+	SkinningPrimFunc *m_Func;
+};
+
+}
+
+SkinningPrimFunc::SkinningPrimFunc() :
+m_Bones(NULL),
+m_Weights(NULL),
+m_PRef(NULL),
+m_NRef(NULL),
+m_P(NULL),
+m_N(NULL)
 {
 }
 
@@ -34,40 +67,52 @@ void SkinningPrimFunc::Run(Primitive &prim, const SceneGraph &world)
 	int rootid = GetArg<int>("skeleton-root",0);
 	int bindposerootid = GetArg<int>("bindpose-root",0);
 	bool skinnormals = GetArg<int>("skin-normals",0);
+	bool gpu = GetArg<int>("gpu",0);
 	vector<dVector, FLX_ALLOC(dVector) > *p = prim.GetDataVec<dVector>("p");
 	vector<dVector, FLX_ALLOC(dVector) > *pref = prim.GetDataVec<dVector>("pref");
 	vector<dVector, FLX_ALLOC(dVector) > *n = NULL;
 	vector<dVector, FLX_ALLOC(dVector) > *nref = NULL;
 
-	if (!pref)
+	if (gpu)
 	{
-		///\todo sort out a proper error messaging thing
-		Trace::Stream<<"SkinningPrimFunc::Run: aborting: primitive needs a pref (copy of p)"<<endl;
-		return;
+		if (prim.GetState()->Shader==NULL)
+		{
+			Trace::Stream<<"SkinningPrimFunc::Run: aborting: gpu skinning needs a shader on the primitive"<<endl;
+			return;
+		}
 	}
-
-	if (skinnormals)
+	else 
 	{
-		n = prim.GetDataVec<dVector>("n");
-		nref = prim.GetDataVec<dVector>("nref");
-		if (!nref)
+		if (!pref)
 		{
-			Trace::Stream<<"SkinningPrimFunc::Run: aborting: primitive needs an nref (copy of n)"<<endl;
+			///\todo sort out a proper error messaging thing
+			Trace::Stream<<"SkinningPrimFunc::Run: aborting: primitive needs a pref (copy of p)"<<endl;
 			return;
 		}
+
+		if (skinnormals)
+		{
+			n = prim.GetDataVec<dVector>("n");
+			nref = prim.GetDataVec<dVector>("nref");
+			if (!nref)
+			{
+				Trace::Stream<<"SkinningPrimFunc::Run: aborting: primitive needs an nref (copy of n)"<<endl;
+				return;
+			}
+		}
 	}
 
 	const SceneNode *root = static_cast<const SceneNode *>(world.FindNode(rootid));
 	if (!root)
 	{
-		Trace::Stream<<"GenSkinWeightsPrimFunc::Run: couldn't find skeleton root node "<<rootid<<endl;
+		Trace::Stream<<"SkinningPrimFunc::Run: couldn't find skeleton root node "<<rootid<<endl;
 		return;
 	}
 
 	const SceneNode *bindposeroot = static_cast<const SceneNode *>(world.FindNode(bindposerootid));
-	if (!root)
+	if (!bindposeroot)
 	{
-		Trace::Stream<<"GenSkinWeightsPrimFunc::Run: couldn't find bindopose skeleton root node "<<bindposerootid<<endl;
+		Trace::Stream<<"SkinningPrimFunc::Run: couldn't find bindpose skeleton root node "<<bindposerootid<<endl;
 		return;
 	}
 
@@ -84,17 +129,58 @@ void SkinningPrimFunc::Run(Primitive &prim, const SceneGraph &world)
 		return;
 	}
 
+	if (prim.Size()==0 || !PackWeights(prim,skeleton.size())) return;
+
+	// the bind pose rarely moves, so only invert the bones that have
+	vector<dMatrix> bindpose;
+	GlobalTransforms(world,bindposeskeleton,bindpose);
+	m_BindPose.resize(bindpose.size());
+	m_BindInverse.resize(bindpose.size());
+	for (unsigned int i=0; i<bindpose.size(); i++)
+	{
+		if (memcmp(bindpose[i].arr(),m_BindPose[i].arr(),sizeof(float)*16)!=0)
+		{
+			m_BindPose[i]=bindpose[i];
+			m_BindInverse[i]=bindpose[i].inverse();
+		}
+	}
+
 	// make a vector of all the transforms
-	vector<dMatrix> transforms;
-	for (unsigned int i=0; i<skeleton.size(); i++)
+	GlobalTransforms(world,skeleton,m_Transforms);
+	for (unsigned int i=0; i<m_Transforms.size(); i++)
 	{
-		transforms.push_back(world.GetGlobalTransform(skeleton[i])*
-							 world.GetGlobalTransform(bindposeskeleton[i]).inverse());
+		m_Transforms[i]*=m_BindInverse[i];
 	}
 
+	if (gpu)
+	{
+		GLSLShader *shader=prim.GetState()->Shader;
+		shader->Apply();
+		shader->SetMatrixArray("SkinMatrices",m_Transforms);
+		GLSLShader::Unapply();
+		return;
+	}
+
+	m_Bones=&(*prim.GetDataVec<dColour>("skin_bones"))[0];
+	m_Weights=&(*prim.GetDataVec<dColour>("skin_weights"))[0];
+	m_PRef=&(*pref)[0];
+	m_P=&(*p)[0];
+	m_NRef=skinnormals?&(*nref)[0]:NULL;
+	m_N=skinnormals?&(*n)[0]:NULL;
+
+	SkinningJob job(this);
+	WorkerPool::Get()->Run(job,prim.Size(),SKIN_CHUNK);
+	
+	prim.GetDataRaw("p")->Touch();
+	if (skinnormals) prim.GetDataRaw("n")->Touch();
+}
+
+bool SkinningPrimFunc::PackWeights(Primitive &prim, unsigned int numbones)
+{
 	// get pointers to all the weights
 	vector<vector<float, FLX_ALLOC(float) >*> weights;
-	for (unsigned int bone=0; bone<skeleton.size(); bone++)
+	unsigned int latest=0;
+	for (unsigned int bone=0; bone<numbones; bone++)
 	{
 		char wname[256];
 		snprintf(wname,256,"w%d",bone);
@@ -102,26 +188,146 @@ void SkinningPrimFunc::Run(Primitive &prim, const SceneGraph &world)
 		if (w==NULL)
 		{
 			Trace::Stream<<"SkinningPrimFunc::Run: can't find weights, aborting"<<endl;
-			return;
+			return false;
 		}
 		weights.push_back(w);
+		unsigned int version=prim.GetDataRaw(wname)->GetVersion();
+		if (version>latest) latest=version;
+	}
+
+	PData *bonedata=prim.GetDataRaw("skin_bones");
+	PData *weightdata=prim.GetDataRaw("skin_weights");
+	if (bonedata==NULL) 
+	{
+		prim.AddData("skin_bones",new TypedPData<dColour>(prim.Size()));
+		bonedata=prim.GetDataRaw("skin_bones");
+	}
+	else if (weightdata!=NULL && bonedata->Size()==prim.Size() && weightdata->Size()==prim.Size() &&
+			 bonedata->GetVersion()>latest && weightdata->GetVersion()>latest)
+	{
+		// still up to date
+		return true;
+	}
+	if (weightdata==NULL) 
+	{
+		prim.AddData("skin_weights",new TypedPData<dColour>(prim.Size()));
+		weightdata=prim.GetDataRaw("skin_weights");
 	}
+	bonedata->Resize(prim.Size());
+	weightdata->Resize(prim.Size());
 
+	vector<dColour, FLX_ALLOC(dColour) > *bones = prim.GetDataVec<dColour>("skin_bones");
+	vector<dColour, FLX_ALLOC(dColour) > *packed = prim.GetDataVec<dColour>("skin_weights");
 	for (unsigned int i=0; i<prim.Size(); i++)
 	{
-		dMatrix mat;
-		mat.zero();
-		for	(unsigned int bone=0; bone<skeleton.size(); bone++)
+		// keep the strongest, sorted by weight
+		float w[SKIN_MAX_INFLUENCES]={0,0,0,0};
+		float b[SKIN_MAX_INFLUENCES]={0,0,0,0};
+		float total=0;
+		for (unsigned int bone=0; bone<numbones; bone++)
 		{
-			mat+=(transforms[bone]*(*weights[bone])[i]);
+			float weight=(*weights[bone])[i];
+			total+=weight;
+			if (weight<=w[SKIN_MAX_INFLUENCES-1]) continue;
+			int k=SKIN_MAX_INFLUENCES-1;
+			while (k>0 && w[k-1]<weight)
+			{
+				w[k]=w[k-1];
+				b[k]=b[k-1];
+				k--;
+			}
+			w[k]=weight;
+			b[k]=bone;
 		}
 
-		(*p)[i]=mat.transform((*pref)[i]);
+		// scale them back up to what the full set added up to
+		float sum=w[0]+w[1]+w[2]+w[3];
+		float scale=sum>0?total/sum:0;
+		(*bones)[i]=dColour(b[0],b[1],b[2],b[3]);
+		(*packed)[i]=dColour(w[0]*scale,w[1]*scale,w[2]*scale,w[3]*scale);
+	}
+	bonedata->Touch();
+	weightdata->Touch();
+	return true;
+}
 
-		if (skinnormals)
+void SkinningPrimFunc::GlobalTransforms(const SceneGraph &world, const vector<const SceneNode*> &nodes, 
+                                        vector<dMatrix> &result)
+{
+	// nodes come parents first, so build on the parent's 
+	// transform rather than walking up the tree for each 
+	// (same rules as SceneGraph::GetGlobalTransform)
+	map<const Node*,unsigned int> index;
+	result.resize(nodes.size());
+	for (unsigned int i=0; i<nodes.size(); i++)
+	{
+		const SceneNode *node=nodes[i];
+		index[node]=i;
+		
+		map<const Node*,unsigned int>::iterator parent=index.find(node->Parent);
+		dMatrix mat;
+		if (parent!=index.end()) mat=result[parent->second];
+		else if (node->Parent!=NULL) mat=world.GetGlobalTransform(static_cast<const SceneNode*>(node->Parent));
+
+		if (node->Prim)
 		{
-			(*n)[i]=mat.transform_no_trans((*nref)[i]);
+			if (node->Prim->GetState()->Hints & HINT_LAZY_PARENT) mat.init();
+			mat*=node->Prim->GetState()->Transform;
 		}
+		result[i]=mat;
 	}
 }
 
+void SkinningPrimFunc::Skin(unsigned int start, unsigned int end)
+{
+	const dMatrix *transforms=&m_Transforms[0];
+	float numbones=m_Transforms.size();
+	
+	for (unsigned int i=start; i<end; i++)
+	{
+		const float *bones=&m_Bones[i].r;
+		const float *weights=&m_Weights[i].r;
+
+#ifdef __SSE__
+		// blend the bone matrices a row at a time
+		__m128 r0=_mm_setzero_ps(), r1=_mm_setzero_ps(), r2=_mm_setzero_ps(), r3=_mm_setzero_ps();
+		for (unsigned int k=0; k<SKIN_MAX_INFLUENCES; k++)
+		{
+			if (weights[k]==0) break;
+			if (bones[k]>=numbones) continue;
+			const float *m=transforms[(unsigned int)bones[k]].m[0];
+			__m128 w=_mm_set1_ps(weights[k]);
+			r0=_mm_add_ps(r0,_mm_mul_ps(_mm_loadu_ps(m),w));
+			r1=_mm_add_ps(r1,_mm_mul_ps(_mm_loadu_ps(m+4),w));
+			r2=_mm_add_ps(r2,_mm_mul_ps(_mm_loadu_ps(m+8),w));
+			r3=_mm_add_ps(r3,_mm_mul_ps(_mm_loadu_ps(m+12),w));
+		}
+		
+		const dVector &pr=m_PRef[i];
+		__m128 t=_mm_add_ps(_mm_add_ps(_mm_mul_ps(r0,_mm_set1_ps(pr.x)),_mm_mul_ps(r1,_mm_set1_ps(pr.y))),
+		                    _mm_add_ps(_mm_mul_ps(r2,_mm_set1_ps(pr.z)),_mm_mul_ps(r3,_mm_set1_ps(pr.w))));
+		_mm_storeu_ps(m_P[i].arr(),t);
+		
+		if (m_N)
+		{
+			const dVector &nr=m_NRef[i];
+			t=_mm_add_ps(_mm_add_ps(_mm_mul_ps(r0,_mm_set1_ps(nr.x)),_mm_mul_ps(r1,_mm_set1_ps(nr.y))),
+			             _mm_mul_ps(r2,_mm_set1_ps(nr.z)));
+			_mm_storeu_ps(m_N[i].arr(),t);
+			m_N[i].w=nr.w;
+		}
+#else
+		dMatrix mat;
+		mat.zero();
+		for (unsigned int k=0; k<SKIN_MAX_INFLUENCES; k++)
+		{
+			if (weights[k]==0) break;
+			if (bones[k]>=numbones) continue;
+			mat+=transforms[(unsigned int)bones[k]]*weights[k];
+		}
+		
+		m_P[i]=mat.transform(m_PRef[i]);
+		if (m_N) m_N[i]=mat.transform_no_trans(m_NRef[i]);
+#endif
+	}
+}
@@ -27,7 +27,15 @@ namespace Fluxus
 {
 
 //////////////////////////////////////////////////
-/// A primitive function for debugging skin weights
+/// Deforms a primitive to follow a skeleton. The 
+/// per bone weights ("w0".."wn") are packed the first
+/// time into the 4 strongest bones per vertex, kept 
+/// in "skin_bones" and "skin_weights" pdata, and 
+/// remade if the weights change. The vertices are 
+/// split between threads. With "gpu" set the bone 
+/// matrices are sent to the primitive's shader as 
+/// "SkinMatrices" instead, for skinning in the 
+/// vertex shader using the packed pdata.
 class SkinningPrimFunc : public PrimitiveFunction
 {
 public:
@@ -37,7 +45,25 @@ public:
 	virtual void Run(Primitive &prim, const SceneGraph &world);
 
 private:
+	friend class SkinningJob;
 	
+	bool PackWeights(Primitive &prim, unsigned int numbones);
+	void GlobalTransforms(const SceneGraph &world, const vector<const SceneNode*> &nodes, 
+	                      vector<dMatrix> &result);
+	void Skin(unsigned int start, unsigned int end);
+	
+	// the bind pose, so we only invert when it moves
+	vector<dMatrix> m_BindPose;
+	vector<dMatrix> m_BindInverse;
+	
+	// for the jobs
+	vector<dMatrix> m_Transforms;
+	const dColour *m_Bones;
+	const dColour *m_Weights;
+	const dVector *m_PRef;
+	const dVector *m_NRef;
+	dVector *m_P;
+	dVector *m_N;
 };
 
 
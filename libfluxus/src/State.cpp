@@ -21,6 +21,8 @@
 
 using namespace Fluxus;
 
+bool State::m_LightPass=false;
+
 State::State() :
 Colour(1,1,1),
 Shinyness(1.0f),
@@ -104,13 +106,19 @@ void State::Apply()
 	if (WireOpacity != 1.0f) WireColour.a=WireOpacity;
 	glColor4f(Colour.r,Colour.g,Colour.b,Colour.a);
 	glMaterialfv(GL_FRONT_AND_BACK,GL_AMBIENT,Ambient.arr());
-	glMaterialfv(GL_FRONT_AND_BACK,GL_EMISSION,Emissive.arr());
+	if (m_LightPass)
+	{
+		dColour black(0,0,0,Emissive.a);
+		glMaterialfv(GL_FRONT_AND_BACK,GL_EMISSION,black.arr());
+	}
+	else glMaterialfv(GL_FRONT_AND_BACK,GL_EMISSION,Emissive.arr());
 	glMaterialfv(GL_FRONT_AND_BACK,GL_DIFFUSE,Colour.arr());
 	glMaterialfv(GL_FRONT_AND_BACK,GL_SPECULAR,Specular.arr());
 	glMaterialfv(GL_FRONT_AND_BACK,GL_SHININESS,&Shinyness);
 	glLineWidth(LineWidth);
 	glPointSize(PointWidth);
-	glBlendFunc(SourceBlend,DestinationBlend);
+	if (m_LightPass) glBlendFunc(GL_SRC_ALPHA,GL_ONE);
+	else glBlendFunc(SourceBlend,DestinationBlend);
 
 	if (Cull) glEnable(GL_CULL_FACE);
 	else glDisable(GL_CULL_FACE);
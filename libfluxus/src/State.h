@@ -71,6 +71,10 @@ public:
 	void Apply();
 	void Unapply();
 	void Spew();
+	
+	/// When lights are added up in extra passes everything
+	/// blends additively, and emissive colour is left out
+	static void SetLightPass(bool s) { m_LightPass=s; }
 
 	dColour Colour;
 	dColour Specular;
@@ -98,6 +102,9 @@ public:
 	bool Cull;
 
 	PixelPrimitive *Target;
+	
+private:
+	static bool m_LightPass;
 };
 
 };
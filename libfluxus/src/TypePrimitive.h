@@ -39,6 +39,7 @@ public:
 	virtual TypePrimitive* Clone() const;
 	virtual void Render();
 	virtual string GetTypeName() { return "TypePrimitive"; }
+	virtual bool IsLit() { return !(m_State.Hints & HINT_UNLIT); }
 	virtual Evaluator *MakeEvaluator() { return NULL; }
 	virtual void PDataDirty() {}
 	virtual dBoundingBox GetBoundingBox(const dMatrix&) { return dBoundingBox(); }
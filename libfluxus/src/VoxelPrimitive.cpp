@@ -14,32 +14,111 @@
 // along with this program; if not, write to the Free Software
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
+#include <math.h>
 #include "Renderer.h"
 #include "VoxelPrimitive.h"
 #include "BlobbyPrimitive.h"
+#include "GLSLShader.h"
 #include "State.h"
 
 using namespace Fluxus;
 
-VoxelPrimitive::VoxelPrimitive(unsigned int w, unsigned int h, unsigned int d)
+// the size of the blocks empty space is skipped in
+static const unsigned int VOXEL_BLOCK_SIZE=8;
+
+static const char *VOXEL_VERTEX_SHADER=
+"uniform float Scale;\n"
+"varying vec3 VoxelPos;\n"
+"void main()\n"
+"{\n"
+"	VoxelPos=gl_Vertex.xyz*Scale+0.5;\n"
+"	gl_Position=ftransform();\n"
+"}\n";
+
+static const char *VOXEL_FRAGMENT_SHADER=
+"uniform sampler3D Volume;\n"
+"uniform sampler3D Blocks;\n"
+"uniform vec3 Dims;\n"
+"uniform vec3 BlockDims;\n"
+"uniform float BlockSize;\n"
+"uniform vec3 Eye;\n"
+"varying vec3 VoxelPos;\n"
+"const float StepSize=0.5;\n"
+"void main()\n"
+"{\n"
+"	vec3 dir=normalize(VoxelPos-Eye);\n"
+"	vec3 inv=1.0/(dir+vec3(equal(dir,vec3(0.0)))*0.000001);\n"
+"	// where the ray is inside the volume\n"
+"	vec3 t0=-Eye*inv;\n"
+"	vec3 t1=(Dims-Eye)*inv;\n"
+"	vec3 tmin=min(t0,t1);\n"
+"	vec3 tmax=max(t0,t1);\n"
+"	float t=max(max(tmin.x,tmin.y),max(tmin.z,0.0));\n"
+"	float end=min(min(tmax.x,tmax.y),tmax.z);\n"
+"	float start=t;\n"
+"	vec4 acc=vec4(0.0);\n"
+"	for (int i=0; i<4096 && t<end; i++)\n"
+"	{\n"
+"		vec3 p=Eye+dir*t;\n"
+"		if (texture3D(Blocks,p/(BlockSize*BlockDims)).r==0.0)\n"
+"		{\n"
+"			// jump to the first step past where the ray leaves this block,\n"
+"			// staying on the same steps so skipping doesn't change the result\n"
+"			vec3 exit=(floor(p/BlockSize)+step(0.0,dir))*BlockSize;\n"
+"			vec3 te=(exit-Eye)*inv;\n"
+"			float leave=max(min(min(te.x,te.y),te.z),t)+0.001;\n"
+"			t=start+ceil((leave-start)/StepSize)*StepSize;\n"
+"			continue;\n"
+"		}\n"
+"		vec4 c=texture3D(Volume,p/Dims);\n"
+"		// alpha is per voxel, so correct it for the step length\n"
+"		float a=1.0-pow(1.0-clamp(c.a,0.0,1.0),StepSize);\n"
+"		acc.rgb+=(1.0-acc.a)*a*c.rgb;\n"
+"		acc.a+=(1.0-acc.a)*a;\n"
+"		if (acc.a>0.99) break;\n"
+"		t+=StepSize;\n"
+"	}\n"
+"	gl_FragColor=acc;\n"
+"}\n";
+
+GLSLShader *VoxelPrimitive::m_Shader=NULL;
+
+VoxelPrimitive::VoxelPrimitive(unsigned int w, unsigned int h, unsigned int d) :
+m_Width(w),
+m_Height(h),
+m_Depth(d),
+m_RenderMode(RENDER_SPRITES),
+m_Texture(0),
+m_BlockTexture(0),
+m_Dirty(false),
+m_KnownVersion(0)
 {
 	AddData("c",new TypedPData<dColour>(w*h*d));
 	AddData("g",new TypedPData<dColour>(w*h*d));
-	m_Width=w;
-	m_Height=h;
-	m_Depth=d;
 	// direct access for speed
 	PDataDirty();
+	ChangedAll();
 }
 
 VoxelPrimitive::VoxelPrimitive(const VoxelPrimitive &other) :
-Primitive(other)
+Primitive(other),
+m_Width(other.m_Width),
+m_Height(other.m_Height),
+m_Depth(other.m_Depth),
+m_RenderMode(other.m_RenderMode),
+m_Texture(0),
+m_BlockTexture(0),
+m_Dirty(false),
+m_KnownVersion(0)
 {
 	PDataDirty();
+	ChangedAll();
 }
 
 VoxelPrimitive::~VoxelPrimitive()
 {
+	if (m_Texture!=0) glDeleteTextures(1,(GLuint*)&m_Texture);
+	if (m_BlockTexture!=0) glDeleteTextures(1,(GLuint*)&m_BlockTexture);
 }
 
 VoxelPrimitive* VoxelPrimitive::Clone() const
@@ -74,6 +153,43 @@ dColour VoxelPrimitive::SafeRef(unsigned int x, unsigned int y, unsigned int z)
 	return dColour(0,0,0);
 }
 
+bool VoxelPrimitive::VoxelRange(const dVector &min, const dVector &max, unsigned int *lo, unsigned int *hi)
+{
+	// voxel positions are their index over the width
+	float lower[3] = { min.x*m_Width, min.y*m_Width, min.z*m_Width };
+	float upper[3] = { max.x*m_Width, max.y*m_Width, max.z*m_Width };
+	unsigned int size[3] = { m_Width, m_Height, m_Depth };
+	for (int a=0; a<3; a++)
+	{
+		if (upper[a]<0 || lower[a]>size[a]-1 || lower[a]>upper[a]) return false;
+		lo[a]=lower[a]<0?0:(unsigned int)floor(lower[a]);
+		hi[a]=upper[a]>size[a]-1?size[a]-1:(unsigned int)ceil(upper[a]);
+	}
+	return true;
+}
+
+void VoxelPrimitive::Changed(const unsigned int *lo, const unsigned int *hi)
+{
+	for (int a=0; a<3; a++)
+	{
+		if (!m_Dirty || lo[a]<m_DirtyMin[a]) m_DirtyMin[a]=lo[a];
+		if (!m_Dirty || hi[a]>m_DirtyMax[a]) m_DirtyMax[a]=hi[a];
+	}
+	m_Dirty=true;
+	
+	// so we can tell our changes from other writes to the pdata
+	PData *col=GetDataRaw("c");
+	col->Touch();
+	m_KnownVersion=col->GetVersion();
+}
+
+void VoxelPrimitive::ChangedAll()
+{
+	unsigned int lo[3] = { 0, 0, 0 };
+	unsigned int hi[3] = { m_Width-1, m_Height-1, m_Depth-1 };
+	Changed(lo,hi);
+}
+
 void VoxelPrimitive::CalcGradient()
 {
 	for (unsigned int x=0; x<m_Width; x++)
@@ -92,42 +208,77 @@ void VoxelPrimitive::CalcGradient()
 
 void VoxelPrimitive::SphereInfluence(const dVector &pos, const dColour &col, float pow)
 {
+	// this reaches every voxel
 	for (unsigned int i=0; i<m_Width*m_Height*m_Depth; i++)
 	{
 		(*m_ColData)[i]+=col*powf(1/Position(i).dist(pos),pow);
 	}
+	ChangedAll();
 }
 
 void VoxelPrimitive::SphereSolid(const dVector &pos, const dColour &col, float radius)
 {
-	for (unsigned int i=0; i<m_Width*m_Height*m_Depth; i++)
+	unsigned int lo[3],hi[3];
+	if (!VoxelRange(pos-dVector(radius,radius,radius),pos+dVector(radius,radius,radius),lo,hi)) return;
+	
+	for (unsigned int z=lo[2]; z<=hi[2]; z++)
 	{
-		if (Position(i).dist(pos)<radius) (*m_ColData)[i]=col;
+		for (unsigned int y=lo[1]; y<=hi[1]; y++)
+		{
+			for (unsigned int x=lo[0]; x<=hi[0]; x++)
+			{
+				unsigned int i=Index(x,y,z);
+				if (Position(i).dist(pos)<radius) (*m_ColData)[i]=col;
+			}
+		}
 	}
+	Changed(lo,hi);
 }
 
 void VoxelPrimitive::BoxSolid(const dVector &topleft, const dVector &botright, const dColour &col)
 {
-	for (unsigned int i=0; i<m_Width*m_Height*m_Depth; i++)
+	unsigned int lo[3],hi[3];
+	if (!VoxelRange(topleft,botright,lo,hi)) return;
+	
+	for (unsigned int z=lo[2]; z<=hi[2]; z++)
 	{
-		dVector pos=Position(i);
-		if (pos>topleft && pos<botright) (*m_ColData)[i]=col;
+		for (unsigned int y=lo[1]; y<=hi[1]; y++)
+		{
+			for (unsigned int x=lo[0]; x<=hi[0]; x++)
+			{
+				unsigned int i=Index(x,y,z);
+				dVector pos=Position(i);
+				if (pos>topleft && pos<botright) (*m_ColData)[i]=col;
+			}
+		}
 	}
+	Changed(lo,hi);
 }
 
 void VoxelPrimitive::Threshold(float value)
 {
+	// only the voxels that actually change need uploading
+	unsigned int lo[3] = { m_Width, m_Height, m_Depth };
+	unsigned int hi[3] = { 0, 0, 0 };
+	bool changed=false;
+	
 	for (unsigned int i=0; i<m_Width*m_Height*m_Depth; i++)
 	{
-		if ((*m_ColData)[i].mag()<value)
-		{
-			(*m_ColData)[i]=dColour(0,0,0,0);
-		}
-		else
+		dColour &c=(*m_ColData)[i];
+		dColour n=c.mag()<value?dColour(0,0,0,0):dColour(1,1,1,1);
+		if (c.r!=n.r || c.g!=n.g || c.b!=n.b || c.a!=n.a)
 		{
-			(*m_ColData)[i]=dColour(1,1,1,1);
+			c=n;
+			unsigned int p[3] = { i%m_Width, (i/m_Width)%m_Height, i/(m_Width*m_Height) };
+			for (int a=0; a<3; a++)
+			{
+				if (p[a]<lo[a]) lo[a]=p[a];
+				if (p[a]>hi[a]) hi[a]=p[a];
+			}
+			changed=true;
 		}
 	}
+	if (changed) Changed(lo,hi);
 }
 
 void VoxelPrimitive::PointLight(dVector lightpos, dColour col)
@@ -139,9 +290,16 @@ void VoxelPrimitive::PointLight(dVector lightpos, dColour col)
 		if (lambert>0) (*m_ColData)[i]+=col*lambert;
 		else (*m_ColData)[i]*=0.1; // ambient...
 	}	
+	ChangedAll();
 }
-	
+
 void VoxelPrimitive::Render()
+{
+	if (m_RenderMode==RENDER_RAYMARCH && GLSLShader::m_Enabled) RenderRaymarch();
+	else RenderSprites();
+}
+
+void VoxelPrimitive::RenderSprites()
 {
 	glDisable(GL_LIGHTING);
 
@@ -178,54 +336,203 @@ void VoxelPrimitive::Render()
 	glEnable(GL_LIGHTING);
 }
 
+
+void VoxelPrimitive::Upload()
+{
+	// pdata written to from outside, we don't know where
+	if (GetDataRaw("c")->GetVersion()!=m_KnownVersion) ChangedAll();
+	
+	unsigned int size[3] = { m_Width, m_Height, m_Depth };
+	bool create=m_Texture==0;
+	if (create)
+	{
+		for (int a=0; a<3; a++) m_BlockDims[a]=(size[a]+VOXEL_BLOCK_SIZE-1)/VOXEL_BLOCK_SIZE;
+		m_Blocks.assign(m_BlockDims[0]*m_BlockDims[1]*m_BlockDims[2],0);
+		
+		glGenTextures(1,(GLuint*)&m_Texture);
+		glBindTexture(GL_TEXTURE_3D,m_Texture);
+		glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_WRAP_R,GL_CLAMP_TO_EDGE);
+		glTexImage3D(GL_TEXTURE_3D,0,GL_RGBA,m_Width,m_Height,m_Depth,0,GL_RGBA,GL_FLOAT,NULL);
+		
+		glGenTextures(1,(GLuint*)&m_BlockTexture);
+		glBindTexture(GL_TEXTURE_3D,m_BlockTexture);
+		glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_MIN_FILTER,GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_WRAP_R,GL_CLAMP_TO_EDGE);
+		glTexImage3D(GL_TEXTURE_3D,0,GL_LUMINANCE8,m_BlockDims[0],m_BlockDims[1],m_BlockDims[2],
+		             0,GL_LUMINANCE,GL_UNSIGNED_BYTE,NULL);
+		ChangedAll();
+	}
+	
+	if (!m_Dirty) return;
+	m_Dirty=false;
+	
+	glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+	
+	// just the changed part of the grid
+	glBindTexture(GL_TEXTURE_3D,m_Texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT,4);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH,m_Width);
+	glPixelStorei(GL_UNPACK_IMAGE_HEIGHT,m_Height);
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS,m_DirtyMin[0]);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS,m_DirtyMin[1]);
+	glPixelStorei(GL_UNPACK_SKIP_IMAGES,m_DirtyMin[2]);
+	glTexSubImage3D(GL_TEXTURE_3D,0,m_DirtyMin[0],m_DirtyMin[1],m_DirtyMin[2],
+	                m_DirtyMax[0]-m_DirtyMin[0]+1,m_DirtyMax[1]-m_DirtyMin[1]+1,m_DirtyMax[2]-m_DirtyMin[2]+1,
+	                GL_RGBA,GL_FLOAT,&(*m_ColData)[0]);
+	
+	// remake the blocks touching it - each block includes a voxel 
+	// border, as the filtering reaches into the next block
+	unsigned int blo[3],bhi[3];
+	for (int a=0; a<3; a++)
+	{
+		blo[a]=m_DirtyMin[a]>0?(m_DirtyMin[a]-1)/VOXEL_BLOCK_SIZE:0;
+		bhi[a]=(m_DirtyMax[a]+1)/VOXEL_BLOCK_SIZE;
+		if (bhi[a]>=m_BlockDims[a]) bhi[a]=m_BlockDims[a]-1;
+	}
+	
+	for (unsigned int bz=blo[2]; bz<=bhi[2]; bz++)
+	{
+		for (unsigned int by=blo[1]; by<=bhi[1]; by++)
+		{
+			for (unsigned int bx=blo[0]; bx<=bhi[0]; bx++)
+			{
+				unsigned int b[3] = { bx, by, bz };
+				unsigned int lo[3],hi[3];
+				for (int a=0; a<3; a++)
+				{
+					lo[a]=b[a]*VOXEL_BLOCK_SIZE;
+					lo[a]=lo[a]>0?lo[a]-1:0;
+					hi[a]=(b[a]+1)*VOXEL_BLOCK_SIZE;
+					if (hi[a]>size[a]-1) hi[a]=size[a]-1;
+				}
+				
+				unsigned char occupied=0;
+				for (unsigned int z=lo[2]; z<=hi[2] && !occupied; z++)
+				{
+					for (unsigned int y=lo[1]; y<=hi[1] && !occupied; y++)
+					{
+						for (unsigned int x=lo[0]; x<=hi[0]; x++)
+						{
+							if ((*m_ColData)[Index(x,y,z)].a>0.001) 
+							{
+								occupied=255;
+								break;
+							}
+						}
+					}
+				}
+				m_Blocks[bx+by*m_BlockDims[0]+bz*m_BlockDims[0]*m_BlockDims[1]]=occupied;
+			}
+		}
+	}
+	
+	glBindTexture(GL_TEXTURE_3D,m_BlockTexture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT,1);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH,m_BlockDims[0]);
+	glPixelStorei(GL_UNPACK_IMAGE_HEIGHT,m_BlockDims[1]);
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS,blo[0]);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS,blo[1]);
+	glPixelStorei(GL_UNPACK_SKIP_IMAGES,blo[2]);
+	glTexSubImage3D(GL_TEXTURE_3D,0,blo[0],blo[1],blo[2],
+	                bhi[0]-blo[0]+1,bhi[1]-blo[1]+1,bhi[2]-blo[2]+1,
+	                GL_LUMINANCE,GL_UNSIGNED_BYTE,&m_Blocks[0]);
+	
+	glPopClientAttrib();
+	glBindTexture(GL_TEXTURE_3D,0);
+}
+
+void VoxelPrimitive::RenderRaymarch()
+{
+	if (m_Shader==NULL)
+	{
+		m_Shader = new GLSLShader(GLSLShaderPair(false,VOXEL_VERTEX_SHADER,VOXEL_FRAGMENT_SHADER));
+	}
+	if (!m_Shader->IsValid()) 
+	{
+		RenderSprites();
+		return;
+	}
+	
+	Upload();
+	
+	// the camera in voxel space
+	dMatrix modelview;
+	glGetFloatv(GL_MODELVIEW_MATRIX,modelview.arr());
+	dVector eye=modelview.inverse().transform(dVector(0,0,0))*m_Width+dVector(0.5,0.5,0.5);
+	
+	glPushAttrib(GL_ENABLE_BIT|GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT|GL_POLYGON_BIT|GL_TEXTURE_BIT);
+	glDisable(GL_LIGHTING);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE,GL_ONE_MINUS_SRC_ALPHA);
+	glDepthMask(false);
+	// draw the back of the box, so it still works from inside
+	glEnable(GL_CULL_FACE);
+	glFrontFace(GL_CCW);
+	glCullFace(GL_FRONT);
+	
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_3D,m_BlockTexture);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_3D,m_Texture);
+	
+	m_Shader->Apply();
+	m_Shader->SetInt("Volume",0);
+	m_Shader->SetInt("Blocks",1);
+	m_Shader->SetFloat("Scale",m_Width);
+	m_Shader->SetVector("Dims",dVector(m_Width,m_Height,m_Depth),3);
+	m_Shader->SetVector("BlockDims",dVector(m_BlockDims[0],m_BlockDims[1],m_BlockDims[2]),3);
+	m_Shader->SetFloat("BlockSize",VOXEL_BLOCK_SIZE);
+	m_Shader->SetVector("Eye",eye,3);
+	
+	// the box around the voxel centres
+	dVector min=dVector(-0.5,-0.5,-0.5)/m_Width;
+	dVector max=dVector(m_Width-0.5,m_Height-0.5,m_Depth-0.5)/m_Width;
+	glBegin(GL_QUADS);
+	glVertex3f(min.x,min.y,min.z); glVertex3f(min.x,max.y,min.z); glVertex3f(max.x,max.y,min.z); glVertex3f(max.x,min.y,min.z);
+	glVertex3f(min.x,min.y,max.z); glVertex3f(max.x,min.y,max.z); glVertex3f(max.x,max.y,max.z); glVertex3f(min.x,max.y,max.z);
+	glVertex3f(min.x,min.y,min.z); glVertex3f(min.x,min.y,max.z); glVertex3f(min.x,max.y,max.z); glVertex3f(min.x,max.y,min.z);
+	glVertex3f(max.x,min.y,min.z); glVertex3f(max.x,max.y,min.z); glVertex3f(max.x,max.y,max.z); glVertex3f(max.x,min.y,max.z);
+	glVertex3f(min.x,min.y,min.z); glVertex3f(max.x,min.y,min.z); glVertex3f(max.x,min.y,max.z); glVertex3f(min.x,min.y,max.z);
+	glVertex3f(min.x,max.y,min.z); glVertex3f(min.x,max.y,max.z); glVertex3f(max.x,max.y,max.z); glVertex3f(max.x,max.y,min.z);
+	glEnd();
+	
+	// put back the state's shader
+	if (m_State.Shader!=NULL) m_State.Shader->Apply();
+	else GLSLShader::Unapply();
+	
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_3D,0);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_3D,0);
+	glPopAttrib();
+}
+
 BlobbyPrimitive *VoxelPrimitive::ConvertToBlobby()
 {
 	BlobbyPrimitive *blob = new BlobbyPrimitive(m_Width, m_Height, m_Depth, dVector(1,1,1));
 
-    // cell corners
-    // 0 = 0 1 0
-    // 1 = 0 1 1
-    // 2 = 0 0 1
-    // 3 = 0 0 0
-
-    // 4 = 1 1 0
-    // 5 = 1 1 1
-    // 6 = 1 0 1
-    // 7 = 1 0 0
-
-    unsigned int pos=0;
-    for (unsigned int x=0; x<m_Width; x++)
-    {
-        for (unsigned int y=0; y<m_Height; y++)
-        {
-            for (unsigned int z=0; z<m_Depth; z++)
-            {
-                BlobbyPrimitive::Cell &cell = blob->GetVoxels()[pos];
-
-                cell.val[0]=SafeRef(x,y+1,z).mag();
-                cell.val[1]=SafeRef(x,y+1,z+1).mag();
-                cell.val[2]=SafeRef(x,y,z+1).mag();
-                cell.val[3]=SafeRef(x,y,z).mag();
-
-                cell.val[4]=SafeRef(x+1,y+1,z).mag();
-                cell.val[5]=SafeRef(x+1,y+1,z+1).mag();
-                cell.val[6]=SafeRef(x+1,y,z+1).mag();
-                cell.val[7]=SafeRef(x+1,y,z).mag();
-
-                cell.col[0]=SafeRef(x,y+1,z);
-                cell.col[1]=SafeRef(x,y+1,z+1);
-                cell.col[2]=SafeRef(x,y,z+1);
-                cell.col[3]=SafeRef(x,y,z);
-
-                cell.col[4]=SafeRef(x+1,y+1,z);
-                cell.col[5]=SafeRef(x+1,y+1,z+1);
-                cell.col[6]=SafeRef(x+1,y,z+1);
-                cell.col[7]=SafeRef(x+1,y,z);
-
-                pos++;
-            }
-        }
-    }
+	// the lattice has a point at each cell corner
+	vector<float> &field = blob->GetField();
+	vector<dColour> &colours = blob->GetFieldColours();
+	for (unsigned int x=0; x<=m_Width; x++)
+	{
+		for (unsigned int y=0; y<=m_Height; y++)
+		{
+			for (unsigned int z=0; z<=m_Depth; z++)
+			{
+				unsigned int i = blob->LatticeIndex(x,y,z);
+				colours[i]=SafeRef(x,y,z);
+				field[i]=colours[i].mag();
+			}
+		}
+	}
 
     // stop the influences overwriting these values...
     blob->LockVoxels();
@@ -23,11 +23,20 @@ namespace Fluxus
 {
 
 class BlobbyPrimitive;
+class GLSLShader;
 
 //////////////////////////////////////////////////////
+/// A dense grid of coloured voxels. These are either 
+/// drawn as camera facing sprites, or uploaded to a 3D
+/// texture and ray marched in a shader - in which case
+/// only the parts of the grid changed since the last
+/// frame are sent, and blocks of empty voxels are 
+/// skipped over.
 class VoxelPrimitive : public Primitive
 {
 public:
+	enum RenderMode {RENDER_SPRITES, RENDER_RAYMARCH};
+
 	VoxelPrimitive(unsigned int w, unsigned int h, unsigned int d);
 	VoxelPrimitive(const VoxelPrimitive &other);
 	virtual ~VoxelPrimitive();
@@ -58,12 +67,25 @@ public:
 	BlobbyPrimitive *ConvertToBlobby();
 	///@}
 	
+	/// Ray marching needs GLSL, and falls back to sprites
+	void SetRenderMode(RenderMode s) { m_RenderMode=s; }
+	
 protected:
 
 	virtual void PDataDirty();
 	unsigned int Index(unsigned int x, unsigned int y, unsigned int z);
 	dVector Position(unsigned int index);
 	dColour SafeRef(unsigned int x, unsigned int y, unsigned int z);
+	
+	// the voxels inside a box in primitive space, returns false if there are none
+	bool VoxelRange(const dVector &min, const dVector &max, unsigned int *lo, unsigned int *hi);
+	// records the voxels (inclusive) written to by the voxel operations
+	void Changed(const unsigned int *lo, const unsigned int *hi);
+	void ChangedAll();
+	
+	void RenderSprites();
+	void RenderRaymarch();
+	void Upload();
 
 private:
 
@@ -72,6 +94,20 @@ private:
 	unsigned int m_Width;
 	unsigned int m_Height;
 	unsigned int m_Depth;
+	
+	RenderMode m_RenderMode;
+	unsigned int m_Texture;
+	unsigned int m_BlockTexture;
+	// the highest alpha in each block, for skipping empty space
+	vector<unsigned char> m_Blocks;
+	unsigned int m_BlockDims[3];
+	// what needs uploading
+	bool m_Dirty;
+	unsigned int m_DirtyMin[3];
+	unsigned int m_DirtyMax[3];
+	unsigned int m_KnownVersion;
+	
+	static GLSLShader *m_Shader;
 };
 
 }
@@ -0,0 +1,168 @@
+// Copyright (C) 2005 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include <unistd.h>
+#include "Trace.h"
+#include "WorkerPool.h"
+
+using namespace Fluxus;
+
+WorkerPool *WorkerPool::m_Singleton=NULL;
+
+WorkerPool::WorkerPool() :
+m_Threads(1),
+m_Running(false),
+m_Generation(0),
+m_StartGeneration(0),
+m_Busy(0),
+m_Job(NULL),
+m_Count(0),
+m_Chunk(1),
+m_Next(0)
+{
+	pthread_mutex_init(&m_RunMutex,NULL);
+	pthread_mutex_init(&m_Mutex,NULL);
+	pthread_cond_init(&m_WorkCond,NULL);
+	pthread_cond_init(&m_DoneCond,NULL);
+	
+	long cpus=sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus>1) m_Threads=cpus;
+}
+
+WorkerPool::~WorkerPool()
+{
+	StopWorkers();
+	pthread_cond_destroy(&m_DoneCond);
+	pthread_cond_destroy(&m_WorkCond);
+	pthread_mutex_destroy(&m_Mutex);
+	pthread_mutex_destroy(&m_RunMutex);
+}
+
+void WorkerPool::SetThreads(unsigned int count)
+{
+	pthread_mutex_lock(&m_RunMutex);
+	StopWorkers();
+	m_Threads=count<1?1:count;
+	pthread_mutex_unlock(&m_RunMutex);
+}
+
+void WorkerPool::StartWorkers()
+{
+	// the calling thread is the first one
+	m_Running=true;
+	m_StartGeneration=m_Generation;
+	for (unsigned int i=1; i<m_Threads; i++)
+	{
+		pthread_t thread;
+		if (pthread_create(&thread,NULL,WorkerEntry,this)!=0)
+		{
+			Trace::Stream<<"WorkerPool::StartWorkers : could only start "<<i-1<<" workers"<<endl;
+			break;
+		}
+		m_Workers.push_back(thread);
+	}
+}
+
+void WorkerPool::StopWorkers()
+{
+	if (m_Workers.empty()) return;
+	
+	pthread_mutex_lock(&m_Mutex);
+	m_Running=false;
+	pthread_cond_broadcast(&m_WorkCond);
+	pthread_mutex_unlock(&m_Mutex);
+	
+	for (unsigned int i=0; i<m_Workers.size(); i++)
+	{
+		pthread_join(m_Workers[i],NULL);
+	}
+	m_Workers.clear();
+}
+
+void WorkerPool::Run(Job &job, unsigned int count, unsigned int chunk)
+{
+	if (chunk<1) chunk=1;
+	
+	// not worth waking anyone up for
+	if (m_Threads<2 || count<=chunk)
+	{
+		job.Run(0,count);
+		return;
+	}
+	
+	pthread_mutex_lock(&m_RunMutex);
+	if (m_Workers.empty()) StartWorkers();
+	
+	pthread_mutex_lock(&m_Mutex);
+	m_Job=&job;
+	m_Count=count;
+	m_Chunk=chunk;
+	m_Next=0;
+	m_Busy=m_Workers.size();
+	m_Generation++;
+	pthread_cond_broadcast(&m_WorkCond);
+	pthread_mutex_unlock(&m_Mutex);
+	
+	DoChunks();
+	
+	pthread_mutex_lock(&m_Mutex);
+	while (m_Busy>0) pthread_cond_wait(&m_DoneCond,&m_Mutex);
+	m_Job=NULL;
+	pthread_mutex_unlock(&m_Mutex);
+	pthread_mutex_unlock(&m_RunMutex);
+}
+
+void WorkerPool::DoChunks()
+{
+	while (true)
+	{
+		unsigned int start=__sync_fetch_and_add(&m_Next,m_Chunk);
+		if (start>=m_Count) break;
+		unsigned int end=start+m_Chunk;
+		if (end>m_Count) end=m_Count;
+		m_Job->Run(start,end);
+	}
+}
+
+void *WorkerPool::WorkerEntry(void *p)
+{
+	((WorkerPool*)p)->WorkerLoop();
+	return NULL;
+}
+
+void WorkerPool::WorkerLoop()
+{
+	// not m_Generation, which may have moved on before we got here
+	int generation=m_StartGeneration;
+	pthread_mutex_lock(&m_Mutex);
+	while (true)
+	{
+		while (m_Running && m_Generation==generation) 
+		{
+			pthread_cond_wait(&m_WorkCond,&m_Mutex);
+		}
+		if (!m_Running) break;
+		generation=m_Generation;
+		pthread_mutex_unlock(&m_Mutex);
+		
+		DoChunks();
+		
+		pthread_mutex_lock(&m_Mutex);
+		m_Busy--;
+		if (m_Busy==0) pthread_cond_signal(&m_DoneCond);
+	}
+	pthread_mutex_unlock(&m_Mutex);
+}
@@ -0,0 +1,96 @@
+// Copyright (C) 2005 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#ifndef N_WORKERPOOL
+#define N_WORKERPOOL
+
+#include <vector>
+#include <pthread.h>
+
+using namespace std;
+
+namespace Fluxus
+{
+
+///////////////////////////////////////////////////
+/// A pool of threads for splitting loops over big 
+/// arrays between cpus. The calling thread takes 
+/// chunks too, and Run only returns once the whole
+/// loop is done, so jobs can use the caller's data.
+/// Jobs must not call Run themselves.
+class WorkerPool
+{
+public:
+	class Job
+	{
+	public:
+		virtual ~Job() {}
+		/// Does items [start,end), called from several threads at once
+		virtual void Run(unsigned int start, unsigned int end)=0;
+	};
+	
+	static WorkerPool *Get()
+	{
+		if (m_Singleton==NULL) m_Singleton=new WorkerPool;
+		return m_Singleton;
+	}
+	
+	static void Shutdown()
+	{
+		if (m_Singleton!=NULL) delete m_Singleton;
+		m_Singleton=NULL;
+	}
+	
+	/// Defaults to the number of cpus
+	void SetThreads(unsigned int count);
+	unsigned int GetThreads() const { return m_Threads; }
+	
+	/// Runs the job over count items, in chunks of the given size
+	void Run(Job &job, unsigned int count, unsigned int chunk=1024);
+
+private:
+	WorkerPool();
+	~WorkerPool();
+	
+	void StartWorkers();
+	void StopWorkers();
+	void DoChunks();
+	static void *WorkerEntry(void *p);
+	void WorkerLoop();
+	
+	static WorkerPool *m_Singleton;
+	
+	unsigned int m_Threads;
+	vector<pthread_t> m_Workers;
+	bool m_Running;
+	
+	pthread_mutex_t m_RunMutex;
+	pthread_mutex_t m_Mutex;
+	pthread_cond_t m_WorkCond;
+	pthread_cond_t m_DoneCond;
+	int m_Generation;
+	int m_StartGeneration;
+	int m_Busy;
+	
+	Job *m_Job;
+	unsigned int m_Count;
+	unsigned int m_Chunk;
+	volatile unsigned int m_Next;
+};
+
+}
+
+#endif
@@ -872,8 +872,16 @@ public:
 		temp.m[3][1] = m[0][1]*m[2][2]*m[3][0] - m[0][2]*m[2][1]*m[3][0] + m[0][2]*m[2][0]*m[3][1] - m[0][0]*m[2][2]*m[3][1] - m[0][1]*m[2][0]*m[3][2] + m[0][0]*m[2][1]*m[3][2];
 		temp.m[3][2] = m[0][2]*m[1][1]*m[3][0] - m[0][1]*m[1][2]*m[3][0] - m[0][2]*m[1][0]*m[3][1] + m[0][0]*m[1][2]*m[3][1] + m[0][1]*m[1][0]*m[3][2] - m[0][0]*m[1][1]*m[3][2];
 		temp.m[3][3] = m[0][1]*m[1][2]*m[2][0] - m[0][2]*m[1][1]*m[2][0] + m[0][2]*m[1][0]*m[2][1] - m[0][0]*m[1][2]*m[2][1] - m[0][1]*m[1][0]*m[2][2] + m[0][0]*m[1][1]*m[2][2];
-	   float scale=1/temp.determinant();
-	   temp.scale(scale,scale,scale);
+	   // the adjugate over the determinant, all of it,
+	   // not just the rotation part
+	   float scale=1/determinant();
+	   for (int i=0; i<4; i++)
+	   {
+	       for (int j=0; j<4; j++)
+	       {
+	           temp.m[i][j]*=scale;
+	       }
+	   }
 	   return temp;
 	}
 
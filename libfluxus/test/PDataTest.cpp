@@ -0,0 +1,66 @@
+// Copyright (C) 2005 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+// Checks the pdata operators let the caches built from an array
+// know they have changed it, run with "scons check"
+
+#include <iostream>
+#include "PolyPrimitive.h"
+
+using namespace std;
+using namespace Fluxus;
+
+static unsigned int Check(const string &name, bool ok)
+{
+	cerr<<name<<"\t"<<(ok?"ok":"FAILED")<<endl;
+	return ok?0:1;
+}
+
+int main()
+{
+	unsigned int failures=0;
+
+	// a single triangle facing +z
+	PolyPrimitive prim(PolyPrimitive::TRILIST);
+	prim.Resize(3);
+	vector<dVector,FLX_ALLOC(dVector) > *p=prim.GetDataVec<dVector>("p");
+	(*p)[0]=dVector(0,0,0);
+	(*p)[1]=dVector(1,0,0);
+	(*p)[2]=dVector(0,1,0);
+	prim.GetDataRaw("p")->Touch();
+	prim.RecalculateNormals(true);
+
+	vector<dVector,FLX_ALLOC(dVector) > *n=prim.GetDataVec<dVector>("n");
+	failures+=Check("normals before",(*n)[0].z>0.99);
+
+	// (pdata-op "*" "p" (vector 1 -1 1)) flips it over
+	unsigned int version=prim.GetDataRaw("p")->GetVersion();
+	prim.DataOp("*","p",dVector(1,-1,1));
+	failures+=Check("op touches p",prim.GetDataRaw("p")->GetVersion()!=version);
+
+	prim.RecalculateNormals(true);
+	n=prim.GetDataVec<dVector>("n");
+	failures+=Check("normals after op",(*n)[0].z<-0.99);
+
+	// the same for the float operators
+	version=prim.GetDataRaw("p")->GetVersion();
+	prim.DataOp("+","p",1.0f);
+	failures+=Check("float op touches p",prim.GetDataRaw("p")->GetVersion()!=version);
+	failures+=Check("float op result",(*p)[1].x>1.99 && (*p)[1].x<2.01);
+
+	cerr<<failures<<" failures"<<endl;
+	return failures>0?1:0;
+}
@@ -0,0 +1,480 @@
+// Copyright (C) 2005 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include <cstring>
+#include <math.h>
+#include "AudioAnalyser.h"
+
+// compression used for the spectral flux, so quiet parts still register
+static const float FLUX_COMPRESSION = 100.0f;
+// minimum flux for an onset, stops noise triggering them in silence
+static const float ONSET_FLOOR = 0.01f;
+// shortest time between onsets in seconds
+static const float ONSET_MIN_INTERVAL = 0.05f;
+// time over which the flux is averaged for the onset threshold
+static const float FLUX_MEAN_TIME = 0.5f;
+// seconds of onset history used for the tempo estimate
+static const float TEMPO_HISTORY_TIME = 6.0f;
+static const float TEMPO_MIN_BPM = 60.0f;
+static const float TEMPO_MAX_BPM = 200.0f;
+// how far the beat phase is pulled towards each onset
+static const float BEAT_PHASE_GAIN = 0.2f;
+static const int TRIPLE_DIRTY = 4;
+
+static int AtomicExchange(volatile int *p, int v)
+{
+	int old;
+	do old=*p;
+	while (!__sync_bool_compare_and_swap(p,old,v));
+	return old;
+}
+
+FFT::FFT(int length) :
+m_FFTLength(length),
+#ifndef __FFTWFLOAT__
+m_In(new double[length]),
+#else
+m_In(new float[length]),
+#endif
+
+#ifndef __FFTWFLOAT__
+m_Spectrum(new fftw_complex[length])
+{
+	m_Plan = fftw_plan_dft_r2c_1d(m_FFTLength, m_In, m_Spectrum, FFTW_ESTIMATE);
+#else
+m_Spectrum(new fftwf_complex[length])
+{
+	m_Plan = fftwf_plan_dft_r2c_1d(m_FFTLength, m_In, m_Spectrum, FFTW_ESTIMATE);
+#endif
+
+	m_Window = new float[m_FFTLength];
+	float sum=0;
+	for (unsigned int i=0; i<m_FFTLength; i++)
+	{
+		m_Window[i]=0.5f-0.5f*cos(2.0f*M_PI*i/(float)m_FFTLength);
+		sum+=m_Window[i];
+	}
+	m_Scale=2.0f/sum;
+}
+
+FFT::~FFT()
+{
+	delete[] m_In;
+	delete[] m_Spectrum;
+	delete[] m_Window;
+#ifndef __FFTWFLOAT__
+	fftw_destroy_plan(m_Plan);
+#else
+	fftwf_destroy_plan(m_Plan);
+#endif
+}
+
+void FFT::Impulse2Freq(float *imp, float *out)
+{
+	unsigned int i;
+
+	for (i=0; i<m_FFTLength; i++)
+	{
+		m_In[i] = imp[i]*m_Window[i];
+	}
+
+#ifndef __FFTWFLOAT__
+	fftw_execute(m_Plan);
+#else
+	fftwf_execute(m_Plan);
+#endif
+
+	for (i=0; i<GetNumBins(); i++)
+	{
+		out[i] = sqrt(m_Spectrum[i][0]*m_Spectrum[i][0]+
+		              m_Spectrum[i][1]*m_Spectrum[i][1])*m_Scale;
+	}
+}
+
+///////////////////////////////////////////////////////////////
+
+AudioFrame::AudioFrame() :
+Audio(NULL),
+AudioSize(0),
+Spectrum(NULL),
+LogSpectrum(NULL),
+SpectrumSize(0),
+Bands(NULL),
+Envelopes(NULL),
+NumBands(0),
+RMS(0),
+Peak(0),
+Flux(0),
+Tempo(0),
+BeatPhase(0),
+Onsets(0),
+Beats(0)
+{
+}
+
+AudioFrame::~AudioFrame()
+{
+	delete[] Audio;
+	delete[] Spectrum;
+	delete[] LogSpectrum;
+	delete[] Bands;
+	delete[] Envelopes;
+}
+
+void AudioFrame::Init(unsigned int spectrumsize, unsigned int audiosize)
+{
+	AudioSize=audiosize;
+	Audio = new float[AudioSize];
+	SpectrumSize=spectrumsize;
+	Spectrum = new float[SpectrumSize];
+	LogSpectrum = new float[SpectrumSize];
+	Bands = new float[AUDIO_MAX_BANDS];
+	Envelopes = new float[AUDIO_MAX_BANDS];
+	Clear();
+}
+
+void AudioFrame::Clear()
+{
+	memset(Audio,0,AudioSize*sizeof(float));
+	memset(Spectrum,0,SpectrumSize*sizeof(float));
+	memset(LogSpectrum,0,SpectrumSize*sizeof(float));
+	memset(Bands,0,AUDIO_MAX_BANDS*sizeof(float));
+	memset(Envelopes,0,AUDIO_MAX_BANDS*sizeof(float));
+	NumBands=0;
+	RMS=Peak=Flux=Tempo=BeatPhase=0;
+	Onsets=Beats=0;
+}
+
+///////////////////////////////////////////////////////////////
+
+AudioAnalyser::AudioAnalyser(unsigned int fftlength, unsigned int samplerate, unsigned int averages) :
+m_FFT(fftlength),
+m_FFTLength(fftlength),
+m_HopSize(fftlength/4),
+m_SampleRate(samplerate),
+m_InputPos(0),
+m_SinceHop(0),
+m_Averages(averages),
+m_AveragePos(0),
+m_NumBands(16),
+m_Attack(0.01),
+m_Release(0.2),
+m_OnsetThreshold(1.5),
+m_FluxMean(0),
+m_SinceOnset(0),
+m_Onsets(0),
+m_HistoryPos(0),
+m_SinceTempo(0),
+m_Period(0),
+m_Phase(0),
+m_Beats(0),
+m_Back(0),
+m_Front(1),
+m_Middle(2)
+{
+	if (m_HopSize<1) m_HopSize=1;
+	m_HopRate=m_SampleRate/(float)m_HopSize;
+
+	m_Input = new float[m_FFTLength];
+	m_Block = new float[m_FFTLength];
+	memset(m_Input,0,m_FFTLength*sizeof(float));
+
+	unsigned int bins=m_FFT.GetNumBins();
+	m_Magnitudes = new float[bins];
+	m_PrevLog = new float[bins];
+	memset(m_PrevLog,0,bins*sizeof(float));
+
+	if (m_Averages<1) m_Averages=1;
+	m_AverageHistory = new float[m_Averages*bins];
+	m_AverageSum = new float[bins];
+	memset(m_AverageHistory,0,m_Averages*bins*sizeof(float));
+	memset(m_AverageSum,0,bins*sizeof(float));
+	m_Envelopes = new float[AUDIO_MAX_BANDS];
+	memset(m_Envelopes,0,AUDIO_MAX_BANDS*sizeof(float));
+
+	m_Flux[0]=m_Flux[1]=0;
+
+	m_HistorySize=(unsigned int)(TEMPO_HISTORY_TIME*m_HopRate);
+	m_History = new float[m_HistorySize];
+	memset(m_History,0,m_HistorySize*sizeof(float));
+
+	m_MinLag=(int)(m_HopRate*60.0f/TEMPO_MAX_BPM);
+	m_MaxLag=(int)(m_HopRate*60.0f/TEMPO_MIN_BPM)+1;
+	if (m_MinLag<2) m_MinLag=2;
+	if (m_MaxLag>(int)m_HistorySize/2) m_MaxLag=m_HistorySize/2;
+	m_Correlation = new float[m_MaxLag+2];
+
+	for (int n=0; n<3; n++) m_Frames[n].Init(bins,m_FFTLength);
+}
+
+AudioAnalyser::~AudioAnalyser()
+{
+	delete[] m_Input;
+	delete[] m_Block;
+	delete[] m_Magnitudes;
+	delete[] m_PrevLog;
+	delete[] m_AverageHistory;
+	delete[] m_AverageSum;
+	delete[] m_Envelopes;
+	delete[] m_History;
+	delete[] m_Correlation;
+}
+
+void AudioAnalyser::SetNumBands(unsigned int s)
+{
+	if (s<1) s=1;
+	if (s>AUDIO_MAX_BANDS) s=AUDIO_MAX_BANDS;
+	m_NumBands=s;
+}
+
+void AudioAnalyser::SetEnvelope(float attack, float release)
+{
+	if (attack<0) attack=0;
+	if (release<0) release=0;
+	m_Attack=attack;
+	m_Release=release;
+}
+
+void AudioAnalyser::CopySettings(const AudioAnalyser &other)
+{
+	m_NumBands=other.m_NumBands;
+	m_Attack=other.m_Attack;
+	m_Release=other.m_Release;
+	m_OnsetThreshold=other.m_OnsetThreshold;
+}
+
+void AudioAnalyser::Write(const float *samples, unsigned int count)
+{
+	for (unsigned int n=0; n<count; n++)
+	{
+		m_Input[m_InputPos++]=samples[n];
+		if (m_InputPos>=m_FFTLength) m_InputPos=0;
+		if (++m_SinceHop>=m_HopSize)
+		{
+			m_SinceHop=0;
+			Analyse();
+		}
+	}
+}
+
+const AudioFrame *AudioAnalyser::Read()
+{
+	if (m_Middle&TRIPLE_DIRTY)
+	{
+		m_Front=AtomicExchange(&m_Middle,m_Front)&~TRIPLE_DIRTY;
+	}
+	return &m_Frames[m_Front];
+}
+
+void AudioAnalyser::Publish()
+{
+	m_Back=AtomicExchange(&m_Middle,m_Back|TRIPLE_DIRTY)&~TRIPLE_DIRTY;
+}
+
+void AudioAnalyser::Analyse()
+{
+	AudioFrame *frame=&m_Frames[m_Back];
+
+	// unwrap the input ring, oldest sample first
+	unsigned int tail=m_FFTLength-m_InputPos;
+	memcpy(m_Block,m_Input+m_InputPos,tail*sizeof(float));
+	memcpy(m_Block+tail,m_Input,m_InputPos*sizeof(float));
+	memcpy(frame->Audio,m_Block,m_FFTLength*sizeof(float));
+
+	float sum=0,peak=0;
+	for (unsigned int i=0; i<m_FFTLength; i++)
+	{
+		sum+=m_Block[i]*m_Block[i];
+		float a=fabs(m_Block[i]);
+		if (a>peak) peak=a;
+	}
+	frame->RMS=sqrt(sum/m_FFTLength);
+	frame->Peak=peak;
+
+	m_FFT.Impulse2Freq(m_Block,m_Magnitudes);
+
+	// the flux comes from the unaveraged spectrum, so onsets stay sharp
+	float flux=0;
+	float *history=m_AverageHistory+m_AveragePos*frame->SpectrumSize;
+	for (unsigned int i=0; i<frame->SpectrumSize; i++)
+	{
+		float mag=m_Magnitudes[i];
+		float c=log(1.0f+FLUX_COMPRESSION*mag);
+		if (c>m_PrevLog[i]) flux+=c-m_PrevLog[i];
+		m_PrevLog[i]=c;
+
+		if (m_Averages>1)
+		{
+			m_AverageSum[i]+=mag-history[i];
+			history[i]=mag;
+			mag=m_AverageSum[i]/m_Averages;
+			if (mag<0) mag=0;
+		}
+		frame->Spectrum[i]=mag;
+		frame->LogSpectrum[i]=20.0f*log10(mag>1e-6f?mag:1e-6f);
+	}
+	flux/=frame->SpectrumSize;
+	if (++m_AveragePos>=m_Averages) m_AveragePos=0;
+
+	// bands, spaced the same as the old gh harmonics, scaled up to
+	// roughly the size of the old unnormalised values
+	unsigned int numbands=m_NumBands;
+	float useful=frame->SpectrumSize;
+	float attack=m_Attack>0?1-exp(-1/(m_Attack*m_HopRate)):1;
+	float release=m_Release>0?1-exp(-1/(m_Release*m_HopRate)):1;
+	for (unsigned int n=0; n<numbands; n++)
+	{
+		float f=n/(float)numbands;
+		float t=(n+1)/(float)numbands;
+		unsigned int from=(unsigned int)(f*f*useful);
+		unsigned int to=(unsigned int)(t*t*useful);
+		if (to>=frame->SpectrumSize) to=frame->SpectrumSize-1;
+
+		float value=0;
+		for (unsigned int i=from; i<=to; i++)
+		{
+			value+=frame->Spectrum[i];
+		}
+		value*=m_FFTLength/2;
+		frame->Bands[n]=value;
+
+		float &env=m_Envelopes[n];
+		env+=(value-env)*(value>env?attack:release);
+		frame->Envelopes[n]=env;
+	}
+	frame->NumBands=numbands;
+
+	DetectOnset(frame,flux);
+	Publish();
+}
+
+void AudioAnalyser::DetectOnset(AudioFrame *frame, float flux)
+{
+	// peak pick the flux against a running mean - the peak is the
+	// previous hop, so onsets are reported one hop late
+	float meancoef=1-exp(-1/(FLUX_MEAN_TIME*m_HopRate));
+	float threshold=m_FluxMean*m_OnsetThreshold+ONSET_FLOOR;
+	bool onset=false;
+	m_SinceOnset++;
+	if (m_Flux[0]>threshold && m_Flux[0]>m_Flux[1] && m_Flux[0]>=flux &&
+		m_SinceOnset>=ONSET_MIN_INTERVAL*m_HopRate)
+	{
+		onset=true;
+		m_SinceOnset=0;
+		m_Onsets++;
+	}
+
+	// the onset strength envelope for the tempo estimate
+	float strength=flux-m_FluxMean;
+	m_History[m_HistoryPos++]=strength>0?strength:0;
+	if (m_HistoryPos>=m_HistorySize) m_HistoryPos=0;
+
+	m_FluxMean+=(flux-m_FluxMean)*meancoef;
+	m_Flux[1]=m_Flux[0];
+	m_Flux[0]=flux;
+
+	frame->Flux=flux;
+	frame->Onsets=m_Onsets;
+	TrackBeat(frame,onset);
+}
+
+void AudioAnalyser::TrackBeat(AudioFrame *frame, bool onset)
+{
+	// refresh the tempo twice a second
+	if (++m_SinceTempo>=m_HopRate/2 && m_MinLag<m_MaxLag)
+	{
+		m_SinceTempo=0;
+		EstimateTempo();
+	}
+
+	if (m_Period>0)
+	{
+		m_Phase+=1/m_Period;
+		if (m_Phase>=1)
+		{
+			m_Phase-=1;
+			m_Beats++;
+		}
+
+		if (onset)
+		{
+			// pull the phase towards the onsets, harder for the ones
+			// near a beat so off beat notes don't drag it around
+			float error=m_Phase-1/m_Period;
+			error-=floor(error+0.5f);
+			float gain=fabs(error)<0.25f?BEAT_PHASE_GAIN:BEAT_PHASE_GAIN*0.25f;
+			m_Phase-=error*gain;
+		}
+
+		frame->Tempo=60.0f*m_HopRate/m_Period;
+		frame->BeatPhase=m_Phase<0?0:m_Phase;
+	}
+	else
+	{
+		frame->Tempo=0;
+		frame->BeatPhase=0;
+	}
+	frame->Beats=m_Beats;
+}
+
+void AudioAnalyser::EstimateTempo()
+{
+	// autocorrelate the onset envelope over the lags in tempo range,
+	// weighted towards 120bpm to favour the usual metrical level
+	int minlag=m_MinLag,maxlag=m_MaxLag;
+	float *acf=m_Correlation;
+	int best=0;
+	float bestscore=0;
+	for (int lag=minlag-1; lag<=maxlag+1; lag++)
+	{
+		float sum=0;
+		for (unsigned int i=lag; i<m_HistorySize; i++)
+		{
+			unsigned int a=(m_HistoryPos+i)%m_HistorySize;
+			unsigned int b=(m_HistoryPos+i-lag)%m_HistorySize;
+			sum+=m_History[a]*m_History[b];
+		}
+		acf[lag]=sum/(m_HistorySize-lag);
+		if (lag<minlag || lag>maxlag) continue;
+
+		float octaves=log2(60.0f*m_HopRate/lag/120.0f);
+		float score=acf[lag]*exp(-0.5f*octaves*octaves);
+		if (score>bestscore)
+		{
+			bestscore=score;
+			best=lag;
+		}
+	}
+
+	if (best==0) return;
+
+	// parabolic interpolation for a sub-hop period
+	float period=best;
+	float a=acf[best-1],b=acf[best],c=acf[best+1];
+	if (a-2*b+c<0) period+=0.5f*(a-c)/(a-2*b+c);
+
+	// stick with the current tempo unless the new one is clearly better
+	if (m_Period>0 && fabs(period-m_Period)>m_Period*0.05f)
+	{
+		int current=(int)(m_Period+0.5f);
+		if (current>=minlag && current<=maxlag && acf[current]*1.1f>acf[best]) return;
+	}
+	else if (m_Period>0)
+	{
+		period=m_Period*0.8f+period*0.2f;
+	}
+	m_Period=period;
+}
@@ -0,0 +1,162 @@
+// Copyright (C) 2005 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+//#define __FFTWFLOAT__
+#include <fftw3.h>
+
+#ifndef AUDIO_ANALYSER
+#define AUDIO_ANALYSER
+
+static const unsigned int AUDIO_MAX_BANDS = 1024;
+
+class FFT
+{
+public:
+    FFT(int length);
+    ~FFT();
+	// hann windows the block and returns the magnitudes of the
+	// length/2+1 bins, scaled so a full scale sine reads 1
+	void Impulse2Freq(float *imp, float *out);
+	unsigned int GetNumBins() { return m_FFTLength/2+1; }
+private:
+#ifndef __FFTWFLOAT__
+	fftw_plan m_Plan;
+	unsigned int m_FFTLength;
+	double *m_In;
+	fftw_complex *m_Spectrum;
+#else
+	fftwf_plan m_Plan;
+	unsigned int m_FFTLength;
+	float *m_In;
+	fftwf_complex *m_Spectrum;
+#endif
+	float *m_Window;
+	float m_Scale;
+};
+
+// one analysis result, everything the render thread gets to see
+class AudioFrame
+{
+public:
+	AudioFrame();
+	~AudioFrame();
+	void Init(unsigned int spectrumsize, unsigned int audiosize);
+	void Clear();
+
+	// the raw block the analysis was done on
+	float *Audio;
+	unsigned int AudioSize;
+	float *Spectrum;
+	float *LogSpectrum;
+	unsigned int SpectrumSize;
+	float *Bands;
+	float *Envelopes;
+	unsigned int NumBands;
+	float RMS;
+	float Peak;
+	float Flux;
+	float Tempo;
+	float BeatPhase;
+	// counters, so onsets and beats between frames aren't lost
+	unsigned int Onsets;
+	unsigned int Beats;
+};
+
+///////////////////////////////////////////////////////////////
+// Runs on the analysis thread - collects incoming samples and 
+// does an analysis every hop (a quarter of the fft length), then
+// hands the result to the render thread via a triple buffer,
+// so neither side ever waits for the other. The spectrum can be
+// averaged over a number of hops to steady it.
+
+class AudioAnalyser
+{
+public:
+	AudioAnalyser(unsigned int fftlength, unsigned int samplerate, unsigned int averages=1);
+	~AudioAnalyser();
+
+	// analysis side
+	void Write(const float *samples, unsigned int count);
+
+	// render side, the latest complete frame (valid until the next call)
+	const AudioFrame *Read();
+
+	void SetNumBands(unsigned int s);
+	void SetEnvelope(float attack, float release);
+	void SetOnsetThreshold(float s) { m_OnsetThreshold=s; }
+	void CopySettings(const AudioAnalyser &other);
+	unsigned int GetNumBands() const { return m_NumBands; }
+	float GetAttack() const { return m_Attack; }
+	float GetRelease() const { return m_Release; }
+	float GetOnsetThreshold() const { return m_OnsetThreshold; }
+	unsigned int GetHopSize() { return m_HopSize; }
+
+private:
+	void Analyse();
+	void DetectOnset(AudioFrame *frame, float flux);
+	void TrackBeat(AudioFrame *frame, bool onset);
+	void EstimateTempo();
+	void Publish();
+
+	FFT m_FFT;
+	unsigned int m_FFTLength;
+	unsigned int m_HopSize;
+	unsigned int m_SampleRate;
+	float m_HopRate;
+
+	float *m_Input;
+	unsigned int m_InputPos;
+	unsigned int m_SinceHop;
+	float *m_Block;
+	float *m_Magnitudes;
+	float *m_PrevLog;
+
+	unsigned int m_Averages;
+	unsigned int m_AveragePos;
+	float *m_AverageHistory;
+	float *m_AverageSum;
+	float *m_Envelopes;
+
+	volatile unsigned int m_NumBands;
+	volatile float m_Attack;
+	volatile float m_Release;
+	volatile float m_OnsetThreshold;
+
+	// onset detection
+	float m_FluxMean;
+	float m_Flux[2];
+	unsigned int m_SinceOnset;
+	unsigned int m_Onsets;
+
+	// tempo and beat tracking
+	float *m_History;
+	unsigned int m_HistorySize;
+	unsigned int m_HistoryPos;
+	unsigned int m_SinceTempo;
+	float *m_Correlation;
+	int m_MinLag;
+	int m_MaxLag;
+	float m_Period;
+	float m_Phase;
+	unsigned int m_Beats;
+
+	AudioFrame m_Frames[3];
+	int m_Back;
+	int m_Front;
+	volatile int m_Middle;
+};
+
+#endif
@@ -17,98 +17,57 @@
 #include <cstring>
 #include <limits.h>
 #include <iostream>
-#include <sndfile.h>
+#include <sys/time.h>
 #include "AudioCollector.h"
 #include "JackClient.h"
 
-static const int MAX_FFT_LENGTH = 4096;
-
-FFT::FFT(int length) :
-m_FFTLength(length),
-#ifndef __FFTWFLOAT__
-m_In(new double[length]),
-#else
-m_In(new float[length]),
-#endif
-
-#ifndef __FFTWFLOAT__
-m_Spectrum(new fftw_complex[length])
-{
-	m_Plan = fftw_plan_dft_r2c_1d(m_FFTLength, m_In, m_Spectrum, FFTW_ESTIMATE);
-}
-#else
-m_Spectrum(new fftwf_complex[length])
-{
-	m_Plan = fftwf_plan_dft_r2c_1d(m_FFTLength, m_In, m_Spectrum, FFTW_ESTIMATE);
-}
-#endif
-
-FFT::~FFT()
-{
-	delete[] m_In;
-#ifndef __FFTWFLOAT__
-	fftw_destroy_plan(m_Plan);
-#else
-	fftwf_destroy_plan(m_Plan);
-#endif
-}
-
-void FFT::Impulse2Freq(float *imp, float *out)
-{
-  unsigned int i;
-
-  for (i=0; i<m_FFTLength; i++)
-  {
-    m_In[i] = imp[i];
-  }
-
-#ifndef __FFTWFLOAT__
-  fftw_execute(m_Plan);
-#else
-  fftwf_execute(m_Plan);
-#endif
-
-  for (i=0; i<m_FFTLength; i++)
-  {
-    out[i] = m_Spectrum[i][0];
-  }
-}
-
-///////////////////////////////////////////////////////////////////////////////////////////////////////////
+// how long the analysis thread sleeps if it misses a wakeup
+static const long ANALYSIS_WAIT_NS = 10000000;
 
 AudioCollector::AudioCollector(const string &port, int BufferLength, unsigned int Samplerate, int FFTBuffers) :
 m_Gain(1),
 m_SmoothingBias(0.8),
-m_FFT(BufferLength),
+m_Analyser(BufferLength,Samplerate,FFTBuffers),
+m_Ring(BufferLength*8>(int)Samplerate?BufferLength*8:Samplerate),
+m_Running(false),
+m_Overruns(0),
+m_Offline(NULL),
+m_WasProcessing(false),
+m_Frame(NULL),
+m_Onsets(0),
+m_Beats(0),
+m_Onset(false),
+m_Beat(false),
 m_FFTBuffers(FFTBuffers),
 m_JackBuffer(NULL),
 m_OSSBuffer(NULL),
 m_OneOverSHRT_MAX(1/(float)SHRT_MAX),
 m_Processing(false),
-m_ProcessPos(0),
+m_ProcessTime(0),
 m_NumBars(16)
 {
 	m_BufferLength = BufferLength;
 	m_Samplerate = Samplerate;
 	m_BufferTime = m_BufferLength/(float)m_Samplerate;
 	
-	m_Buffer = new float[BufferLength];
-	memset(m_Buffer,0,BufferLength*sizeof(float));
-	
-	m_FFTBuffer = new float[BufferLength*m_FFTBuffers];
-	memset(m_FFTBuffer,0,BufferLength*sizeof(float));
-	
 	m_JackBuffer = new float[BufferLength];
 	memset(m_JackBuffer,0,BufferLength*sizeof(float));
 	
-	m_AudioBuffer = new float[BufferLength];
-	memset(m_AudioBuffer,0,BufferLength*sizeof(float));
-	
 	m_FFTOutput = new float[m_NumBars];
 	for (unsigned int n=0; n<m_NumBars; n++) m_FFTOutput[n]=0;
+	m_Frame = m_Analyser.Read();
+	m_OfflineFrame.Init(m_Frame->SpectrumSize,m_Frame->AudioSize);
 	
 	m_Mutex = new pthread_mutex_t;
 	pthread_mutex_init(m_Mutex,NULL);
+	pthread_cond_init(&m_Ready,NULL);
+	
+	m_Running=true;
+	if (pthread_create(&m_Thread,NULL,AnalysisThread,(void*)this))
+	{
+		cerr<<"Could not start the audio analysis thread"<<endl;
+		m_Running=false;
+	}
 	
 	JackClient *Jack = JackClient::Get();
 	Jack->SetCallback(AudioCallback,(void*)this);
@@ -128,6 +87,21 @@ m_NumBars(16)
 AudioCollector::~AudioCollector()
 {
 	JackClient::Get()->Detach();
+	
+	if (m_Running)
+	{
+		pthread_mutex_lock(m_Mutex);
+		m_Running=false;
+		pthread_cond_signal(&m_Ready);
+		pthread_mutex_unlock(m_Mutex);
+		pthread_join(m_Thread,NULL);
+	}
+	pthread_cond_destroy(&m_Ready);
+	pthread_mutex_destroy(m_Mutex);
+	delete m_Mutex;
+	delete m_Offline;
+	delete[] m_JackBuffer;
+	delete[] m_FFTOutput;
 }
 
 bool AudioCollector::IsConnected()
@@ -140,112 +114,115 @@ float AudioCollector::GetHarmonic(int h)
 	return  m_FFTOutput[h%m_NumBars];
 }
 
+float AudioCollector::GetEnvelope(int h)
+{
+	if (m_Frame->NumBands==0) return 0;
+	return m_Frame->Envelopes[h%m_Frame->NumBands]*m_Gain;
+}
+
+void AudioCollector::SetEnvelope(float attack, float release)
+{
+	m_Analyser.SetEnvelope(attack,release);
+}
+
+void AudioCollector::SetOnsetThreshold(float s)
+{
+	m_Analyser.SetOnsetThreshold(s);
+}
+
+float AudioCollector::GetProcessProgress()
+{
+	if (m_Offline==NULL) return 0;
+	return m_Offline->GetProgress();
+}
+
 float *AudioCollector::GetFFT()
 {
 	if (m_Processing)
 	{
-		if (m_ProcessPos+m_BufferLength<m_ProcessLength)
+		switch (m_Offline->GetState())
 		{
-			m_FFT.Impulse2Freq(m_ProcessBuffer+m_ProcessPos,m_FFTBuffer);
-			memcpy((void*)m_AudioBuffer,(void*)(m_ProcessBuffer+m_ProcessPos),m_BufferLength*sizeof(float));
-			m_ProcessPos+=m_BufferLength;
+			case OfflineAnalysis::LOADING:
+				// the clock waits for the analysis, so the frames 
+				// still line up with the audio from the start
+			break;
+			
+			case OfflineAnalysis::READY:
+				if (m_ProcessTime<m_Offline->GetLength())
+				{
+					m_Offline->Get(m_ProcessTime,&m_OfflineFrame);
+					m_ProcessTime+=m_BufferTime;
+				}
+				else
+				{
+					cerr<<"Finished processing audio file..."<<endl;
+					m_Processing=false;
+				}
+			break;
+			
+			case OfflineAnalysis::FAILED:
+				m_Processing=false;
+			break;
 		}
-		else
+		
+		if (!m_Processing)
 		{
-			cerr<<"Finished processing audio file..."<<endl;
 			// finished, so clean up...
-			delete[] m_ProcessBuffer;
-			m_ProcessPos=0;
-			m_Processing=false;
+			delete m_Offline;
+			m_Offline=NULL;
+			m_ProcessTime=0;
 		}
 	}
-	else
-	{
-		pthread_mutex_lock(m_Mutex);
-		memcpy((void*)m_AudioBuffer,(void*)m_Buffer,m_BufferLength*sizeof(float));
-		pthread_mutex_unlock(m_Mutex);
 
-		m_FFT.Impulse2Freq(m_AudioBuffer,m_FFTBuffer);
+	// the only thing shared with the analysis thread
+	m_Frame=m_Processing?&m_OfflineFrame:m_Analyser.Read();
+	
+	// onsets and beats are counted on the analysis side, so we catch
+	// any that happened since the last frame
+	if (m_Processing!=m_WasProcessing)
+	{
+		m_WasProcessing=m_Processing;
+		m_Onsets=m_Frame->Onsets;
+		m_Beats=m_Frame->Beats;
 	}
+	m_Onset=m_Frame->Onsets!=m_Onsets;
+	m_Beat=m_Frame->Beats!=m_Beats;
+	m_Onsets=m_Frame->Onsets;
+	m_Beats=m_Frame->Beats;
 
-    // seem to only have stuff in the lower half - something to do with nyquist?
-    float UsefulArea = m_BufferLength/2;
-
-	for (unsigned int n=0; n<m_NumBars; n++)
+	unsigned int bands=m_NumBars<m_Frame->NumBands?m_NumBars:m_Frame->NumBands;
+	for (unsigned int n=0; n<bands; n++)
 	{
-		float Value = 0;
-        
-        float f = n/(float)m_NumBars;
-        float t = (n+1)/(float)m_NumBars;
-        f*=f;
-        t*=t;
-        unsigned from = f*UsefulArea;
-        unsigned to = t*UsefulArea;
-
-		for (unsigned int i=from; i<=to; i++)
-		{
-            if (i<m_BufferLength)
-            {                
-                Value += m_FFTBuffer[i];
-            }
-		}
-
-        if (Value<0) Value=-Value;
-		Value*=m_Gain;
+		float Value=m_Frame->Bands[n]*m_Gain;
 		m_FFTOutput[n]=((m_FFTOutput[n]*m_SmoothingBias)+Value*(1-m_SmoothingBias));
 	}
 
 	return m_FFTOutput;
 }
 
- 
 void AudioCollector::Process(const string &filename)
 {
 	if (m_Processing) return;
 
-	SF_INFO info;
-	info.format=0;
-
-	SNDFILE* file = sf_open (filename.c_str(), SFM_READ, &info) ;
-	if (!file)
-	{
-		cerr<<"Error opening ["<<filename<<"] : "<<sf_strerror(file)<<endl;
-		return;
-	}
-
-	m_ProcessBuffer = new float[info.frames];
-	memset((void*)m_ProcessBuffer,0,info.frames*sizeof(float));
-	m_ProcessLength=info.frames;
-
-	// mix down to mono if need be
-	if (info.channels>1)
-	{
-		float *Buffer = new float[info.frames*info.channels];
-		sf_readf_float(file,Buffer,info.frames*info.channels);
-		int from=0;
-		for (int n=0; n<info.frames; n++)
-		{
-			for (int c=0; c<info.channels; c++)
-			{
-				m_ProcessBuffer[n]=(m_ProcessBuffer[n]+Buffer[from++])/2.0f;
-			}
-		}
-	}
-	else
-	{
-		sf_readf_float(file, m_ProcessBuffer, info.frames);
-	}
-	sf_close(file);
-
+	// the analysis runs in the background, and is cached next to the file
+	m_Offline = new OfflineAnalysis(filename,m_BufferLength,m_FFTBuffers,m_Analyser);
+	m_OfflineFrame.Clear();
 	m_Processing=true;
-	m_ProcessPos=0;
+	m_ProcessTime=0;
 }
 
 void AudioCollector::AudioCallback_i(unsigned int Size)
 {
-	if (Size<=m_BufferLength && !pthread_mutex_trylock(m_Mutex))
+	if (Size>m_BufferLength) return;
+	
+	// never block here - if the analysis has fallen a second behind 
+	// we drop the block, but count it so it gets reported
+	if (!m_Ring.Write(m_JackBuffer,Size)) m_Overruns+=Size;
+	
+	// if we can't get the lock the thread is awake anyway
+	if (!pthread_mutex_trylock(m_Mutex))
 	{
-		memcpy((void*)m_Buffer,(void*)m_JackBuffer,m_BufferLength*sizeof(float));
+		pthread_cond_signal(&m_Ready);
 		pthread_mutex_unlock(m_Mutex);
 	}
 }
@@ -254,3 +231,52 @@ void AudioCollector::AudioCallback(void *Context, unsigned int Size)
 {
 	((AudioCollector*)Context)->AudioCallback_i(Size);
 }
+
+void *AudioCollector::AnalysisThread(void *Context)
+{
+	((AudioCollector*)Context)->AnalysisThread_i();
+	return NULL;
+}
+
+void AudioCollector::AnalysisThread_i()
+{
+	float *Block = new float[m_BufferLength];
+	unsigned int Reported=0;
+	
+	pthread_mutex_lock(m_Mutex);
+	while (m_Running)
+	{
+		if (m_Ring.ReadSpace()==0)
+		{
+			timeval now;
+			gettimeofday(&now,NULL);
+			timespec until;
+			until.tv_sec=now.tv_sec;
+			until.tv_nsec=now.tv_usec*1000+ANALYSIS_WAIT_NS;
+			if (until.tv_nsec>=1000000000) 
+			{
+				until.tv_sec++;
+				until.tv_nsec-=1000000000;
+			}
+			pthread_cond_timedwait(&m_Ready,m_Mutex,&until);
+			continue;
+		}
+		pthread_mutex_unlock(m_Mutex);
+		
+		unsigned int Count;
+		while ((Count=m_Ring.Read(Block,m_BufferLength))>0)
+		{
+			m_Analyser.Write(Block,Count);
+		}
+		
+		if (m_Overruns!=Reported)
+		{
+			cerr<<"Audio analysis fell behind, dropped "<<m_Overruns-Reported<<" samples"<<endl;
+			Reported=m_Overruns;
+		}
+		
+		pthread_mutex_lock(m_Mutex);
+	}
+	pthread_mutex_unlock(m_Mutex);
+	delete[] Block;
+}
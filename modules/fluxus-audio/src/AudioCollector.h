@@ -14,36 +14,17 @@
 // along with this program; if not, write to the Free Software
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
-//#define __FFTWFLOAT__
-#include <fftw3.h>
 #include <pthread.h>
 #include <string>
+#include "AudioAnalyser.h"
+#include "SampleRing.h"
+#include "OfflineAnalysis.h"
 
 #ifndef AUDIO_COLLECTOR
 #define AUDIO_COLLECTOR
 
 using namespace std;
 
-class FFT
-{
-public:
-    FFT(int length);
-    ~FFT();
-	void Impulse2Freq(float *imp, float *out);
-private:
-#ifndef __FFTWFLOAT__
-	fftw_plan m_Plan;
-	unsigned int m_FFTLength;
-	double *m_In;
-	fftw_complex *m_Spectrum;
-#else
-	fftwf_plan m_Plan;
-	unsigned int m_FFTLength;
-	float *m_In;
-	fftwf_complex *m_Spectrum;
-#endif
-};
-
 class AudioCollector
 {
 public:
@@ -51,21 +32,33 @@ public:
 	~AudioCollector();
 
 	float *GetFFT();
-	float *GetAudioBuffer() { return m_AudioBuffer; }
-	int GetAudioBufferLength() { return m_BufferLength; }
+	const AudioFrame *GetFrame() { return m_Frame; }
+	float *GetAudioBuffer() { return m_Frame->Audio; }
+	int GetAudioBufferLength() { return m_Frame->AudioSize; }
 	float GetHarmonic(int h);
+	float GetEnvelope(int h);
+	bool  IsOnset() { return m_Onset; }
+	bool  IsBeat() { return m_Beat; }
+	void  SetEnvelope(float attack, float release);
+	void  SetOnsetThreshold(float s);
 	bool  IsConnected();
 	void  SetGain(float s) { m_Gain=s; }
 	float  GetGain() { return m_Gain; }
 	void  SetSmoothingBias(float s) { if (s<2 && s>0) m_SmoothingBias=s; }
 	void  Process(const string &filename);
 	bool  IsProcessing() { return m_Processing; }
+	// time in the file being processed, and how far its analysis has got
+	double GetProcessTime() { return m_ProcessTime; }
+	void  SetProcessTime(double s) { m_ProcessTime=s; }
+	float GetProcessProgress();
 	float BufferTime() { return m_BufferTime; }
 
 	void SetNumBars(unsigned int s)
 	{
 		if (s < 1) s = 1;
+		if (s > AUDIO_MAX_BANDS) s = AUDIO_MAX_BANDS;
 		m_NumBars = s;
+		m_Analyser.SetNumBands(s);
 		delete[] m_FFTOutput;
 		m_FFTOutput = new float[s];
 		memset(m_FFTOutput, 0, sizeof(float) * s);
@@ -77,17 +70,31 @@ private:
 
     void AudioCallback_i(unsigned int);
 	static void AudioCallback(void *, unsigned int);
+	void AnalysisThread_i();
+	static void *AnalysisThread(void *);
 
 	float m_Gain;
 	float m_SmoothingBias;
 	unsigned int m_Samplerate;
 	float m_BufferTime;
 	unsigned int m_BufferLength;
-	FFT m_FFT;
+	AudioAnalyser m_Analyser;
+	// the jack thread only writes to the ring, and the analysis 
+	// thread only publishes frames, so nothing waits on a lock
+	SampleRing m_Ring;
+	volatile bool m_Running;
+	volatile unsigned int m_Overruns;
+	pthread_t m_Thread;
+	pthread_cond_t m_Ready;
+	OfflineAnalysis *m_Offline;
+	AudioFrame m_OfflineFrame;
+	bool m_WasProcessing;
+	const AudioFrame *m_Frame;
+	unsigned int m_Onsets;
+	unsigned int m_Beats;
+	bool m_Onset;
+	bool m_Beat;
 	pthread_mutex_t* m_Mutex;
-	float *m_Buffer;
-	float *m_AudioBuffer;
-	float *m_FFTBuffer;
 	float *m_FFTOutput;
 	int    m_FFTBuffers;
 	int    m_InputPort;
@@ -98,9 +105,7 @@ private:
 	short *m_OSSBuffer;
 	float  m_OneOverSHRT_MAX;
 	bool   m_Processing;
-	float *m_ProcessBuffer;
-	unsigned int m_ProcessPos;
-	unsigned int m_ProcessLength;
+	double m_ProcessTime;
     unsigned int m_NumBars;
 };
 
@@ -14,6 +14,7 @@
 // along with this program; if not, write to the Free Software
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
+#include <math.h>
 #include <escheme.h>
 #include "AudioCollector.h"
 
@@ -76,13 +77,14 @@ AudioCollector *Audio = NULL;
 // EndSectionDoc
 
 // StartFunctionDoc-en
-// start-audio jackport-string buffersize-number samplerate-number
+// start-audio jackport-string buffersize-number samplerate-number [averages-number]
 // Returns: void
 // Description:
 // Starts up the audio with the specified settings, you'll need to call this first, or put it into 
 // $HOME/.fluxus.scm to call it automatically at startup. Make the jack port name an empty 
 // string and it won't try to connect to anything for you. You can use qjackctrl or equivelent to 
-// do the connection manually. Fluxus reads a single mono source.
+// do the connection manually. Fluxus reads a single mono source. The optional averages 
+// number (1 or more) steadies the spectrum by averaging it over that many analysis hops.
 // Example:
 // (start-audio "alsa_pcm:capture_1" 1024 44100)
 // EndFunctionDoc
@@ -122,11 +124,16 @@ Scheme_Object *start_audio(int argc, Scheme_Object **argv)
 	if (!SCHEME_CHAR_STRINGP(argv[0])) scheme_wrong_type("start-audio", "string", 0, argc, argv);
 	if (!SCHEME_NUMBERP(argv[1])) scheme_wrong_type("start-audio", "number", 1, argc, argv);
 	if (!SCHEME_NUMBERP(argv[2])) scheme_wrong_type("start-audio", "number", 2, argc, argv);
+	if (argc>3 && (!SCHEME_NUMBERP(argv[3]) || scheme_real_to_double(argv[3])<1))
+	{
+		scheme_wrong_type("start-audio", "number 1 or more", 3, argc, argv);
+	}
 	
 	if (Audio==NULL)
 	{
 		char *name = scheme_utf8_encode_to_buffer(SCHEME_CHAR_STR_VAL(argv[0]),SCHEME_CHAR_STRLEN_VAL(argv[0]),NULL,0);
-		Audio = new AudioCollector(name,(unsigned int)scheme_real_to_double(argv[1]),(int)scheme_real_to_double(argv[2]));
+		int averages = argc>3 ? (int)scheme_real_to_double(argv[3]) : 1;
+		Audio = new AudioCollector(name,(unsigned int)scheme_real_to_double(argv[1]),(int)scheme_real_to_double(argv[2]),averages);
 	}
 	
 	MZ_GC_UNREG(); 
@@ -269,7 +276,6 @@ Scheme_Object *get_audio(int argc, Scheme_Object **argv)
 
 	if (Audio != NULL)
 	{
-		/* TODO: make it work with (process) */
 		int size = Audio->GetAudioBufferLength();
 		float *src = Audio->GetAudioBuffer();
 		float gain = Audio->GetGain();
@@ -337,7 +343,10 @@ Scheme_Object *gain(int argc, Scheme_Object **argv)
 // This command temporarally disables the realtime reading of the input audio stream and reads a 
 // wav file instead. For use with the framedump command to process audio offline to make music 
 // videos. The advantage of this is that it locks the framerate so the right amount of audio gets
-// read for each frame - making syncing of the frames and audio files possible.
+// read for each frame - making syncing of the frames and audio files possible. The whole file is 
+// analysed in the background first, and the results are saved next to it (as wavfile.fxa) so the 
+// next time it starts straight away. The audio clock waits until the analysis is ready, see 
+// process-progress.
 // Example:
 // (process "somemusic.wav") ; read a precorded audio file
 // EndFunctionDoc
@@ -384,6 +393,70 @@ Scheme_Object *process(int argc, Scheme_Object **argv)
     return scheme_void;
 }
 
+// StartFunctionDoc-en
+// process-progress
+// Returns: progress-number
+// Description:
+// Returns how far through analysing the file given to process we are, from 0 to 1.
+// Example:
+// (process "somemusic.wav")
+// (every-frame
+//     (when (< (process-progress) 1)
+//         (display (process-progress)) (newline)))
+// EndFunctionDoc
+
+Scheme_Object *process_progress(int argc, Scheme_Object **argv)
+{
+	if (Audio!=NULL)
+	{
+		return scheme_make_double(Audio->GetProcessProgress());
+	}
+	return scheme_make_double(0);
+}
+
+// StartFunctionDoc-en
+// process-time
+// Returns: seconds-number
+// Description:
+// Returns the current time in seconds in the file given to process. The audio features 
+// are looked up by this time, which moves on by one buffer's worth each frame.
+// Example:
+// (every-frame (display (process-time)) (newline))
+// EndFunctionDoc
+
+Scheme_Object *process_time(int argc, Scheme_Object **argv)
+{
+	if (Audio!=NULL)
+	{
+		return scheme_make_double(Audio->GetProcessTime());
+	}
+	return scheme_make_double(0);
+}
+
+// StartFunctionDoc-en
+// process-seek seconds-number
+// Returns: void
+// Description:
+// Jumps to a time in the file given to process, for rendering part of a video.
+// Example:
+// (process "somemusic.wav")
+// (process-seek 60) ; start a minute in
+// EndFunctionDoc
+
+Scheme_Object *process_seek(int argc, Scheme_Object **argv)
+{
+	MZ_GC_DECL_REG(1);
+	MZ_GC_VAR_IN_REG(0, argv);
+	MZ_GC_REG();
+	if (!SCHEME_NUMBERP(argv[0])) scheme_wrong_type("process-seek", "number", 0, argc, argv);
+	if (Audio!=NULL)
+	{
+		Audio->SetProcessTime(scheme_real_to_double(argv[0]));
+	}
+	MZ_GC_UNREG();
+	return scheme_void;
+}
+
 // StartFunctionDoc-en
 // smoothing-bias value-number
 // Returns: void
@@ -534,6 +607,310 @@ Scheme_Object *get_num_frequency_bins(int argc, Scheme_Object **argv)
 	return scheme_make_integer_value(bars);
 }
 
+// StartFunctionDoc-en
+// gs
+// Returns: spectrum-vector
+// Description:
+// Returns the magnitude spectrum of the incoming audio, from 0 up to half the samplerate. 
+// There is one value per fft bin, so the size depends on the buffersize given to 
+// start-audio. Scaled by the gain.
+// Example:
+// (clear)
+// (define bars (build-list 64 (lambda (i) (with-state (translate (vector i 0 0)) (build-cube)))))
+// (every-frame
+//     (let ([s (gs)])
+//         (for-each
+//             (lambda (b i)
+//                 (with-primitive b
+//                     (identity)
+//                     (translate (vector i 0 0))
+//                     (scale (vector 1 (+ 0.1 (* 10 (vector-ref s i))) 1))))
+//             bars (build-list 64 (lambda (i) i)))))
+// EndFunctionDoc
+
+Scheme_Object *get_spectrum(int argc, Scheme_Object **argv)
+{
+	Scheme_Object *ret = NULL;
+	Scheme_Object *tmp = NULL;
+	MZ_GC_DECL_REG(2);
+	MZ_GC_VAR_IN_REG(0, ret);
+	MZ_GC_VAR_IN_REG(1, tmp);
+	MZ_GC_REG();
+
+	if (Audio != NULL)
+	{
+		const AudioFrame *frame = Audio->GetFrame();
+		float gain = Audio->GetGain();
+		ret = scheme_make_vector(frame->SpectrumSize, scheme_void);
+		for (unsigned int n = 0; n < frame->SpectrumSize; n++)
+		{
+			tmp = scheme_make_double(gain * frame->Spectrum[n]);
+			SCHEME_VEC_ELS(ret)[n] = tmp;
+		}
+	}
+	else
+	{
+		ret = scheme_make_vector(0, scheme_void);
+	}
+
+	MZ_GC_UNREG();
+	return ret;
+}
+
+// StartFunctionDoc-en
+// gs-db
+// Returns: spectrum-vector
+// Description:
+// The same as gs, but in decibels, where 0 is a full scale sine wave. A log spectrum 
+// shows the quieter high frequencies much better than gs does.
+// Example:
+// (every-frame (display (vector-ref (gs-db) 10)))
+// EndFunctionDoc
+
+Scheme_Object *get_spectrum_db(int argc, Scheme_Object **argv)
+{
+	Scheme_Object *ret = NULL;
+	Scheme_Object *tmp = NULL;
+	MZ_GC_DECL_REG(2);
+	MZ_GC_VAR_IN_REG(0, ret);
+	MZ_GC_VAR_IN_REG(1, tmp);
+	MZ_GC_REG();
+
+	if (Audio != NULL)
+	{
+		const AudioFrame *frame = Audio->GetFrame();
+		float gain = Audio->GetGain();
+		float offset = gain>0 ? 20*log10(gain) : 0;
+		ret = scheme_make_vector(frame->SpectrumSize, scheme_void);
+		for (unsigned int n = 0; n < frame->SpectrumSize; n++)
+		{
+			tmp = scheme_make_double(frame->LogSpectrum[n] + offset);
+			SCHEME_VEC_ELS(ret)[n] = tmp;
+		}
+	}
+	else
+	{
+		ret = scheme_make_vector(0, scheme_void);
+	}
+
+	MZ_GC_UNREG();
+	return ret;
+}
+
+// StartFunctionDoc-en
+// ge harmonic-number
+// Returns: envelope-real
+// Description:
+// Like gh, but follows each band with an envelope which rises quickly and falls slowly,
+// set with audio-envelope. Good for things which should jump with the sound and then 
+// settle back down. The harmonic number wraps around the same way as gh.
+// Example:
+// (every-frame
+//     (with-state
+//         (scale (+ 1 (ge 0)))
+//         (draw-sphere)))
+// EndFunctionDoc
+
+Scheme_Object *get_envelope(int argc, Scheme_Object **argv)
+{
+	MZ_GC_DECL_REG(1);
+	MZ_GC_VAR_IN_REG(0, argv);
+	MZ_GC_REG();
+	if (!SCHEME_NUMBERP(argv[0])) scheme_wrong_type("ge", "number", 0, argc, argv);
+	if (Audio!=NULL)
+	{
+		MZ_GC_UNREG();
+		return scheme_make_double(Audio->GetEnvelope((int)scheme_real_to_double(argv[0])));
+	}
+	MZ_GC_UNREG();
+	return scheme_make_double(0);
+}
+
+// StartFunctionDoc-en
+// audio-envelope attack-seconds release-seconds
+// Returns: void
+// Description:
+// Sets how quickly the band envelopes read by ge rise and fall. Defaults to 0.01 and 0.2.
+// Example:
+// (audio-envelope 0 1) ; jump up, slowly fall
+// EndFunctionDoc
+
+Scheme_Object *audio_envelope(int argc, Scheme_Object **argv)
+{
+	MZ_GC_DECL_REG(1);
+	MZ_GC_VAR_IN_REG(0, argv);
+	MZ_GC_REG();
+	if (!SCHEME_NUMBERP(argv[0])) scheme_wrong_type("audio-envelope", "number", 0, argc, argv);
+	if (!SCHEME_NUMBERP(argv[1])) scheme_wrong_type("audio-envelope", "number", 1, argc, argv);
+	if (Audio!=NULL)
+	{
+		Audio->SetEnvelope(scheme_real_to_double(argv[0]),scheme_real_to_double(argv[1]));
+	}
+	MZ_GC_UNREG();
+	return scheme_void;
+}
+
+// StartFunctionDoc-en
+// grms
+// Returns: level-real
+// Description:
+// Returns the rms level of the incoming audio, a good measure of how loud it is.
+// Scaled by the gain.
+// Example:
+// (every-frame (with-state (scale (+ 1 (* 10 (grms)))) (draw-cube)))
+// EndFunctionDoc
+
+Scheme_Object *get_rms(int argc, Scheme_Object **argv)
+{
+	if (Audio!=NULL)
+	{
+		return scheme_make_double(Audio->GetFrame()->RMS*Audio->GetGain());
+	}
+	return scheme_make_double(0);
+}
+
+// StartFunctionDoc-en
+// gpeak
+// Returns: level-real
+// Description:
+// Returns the peak level of the incoming audio. Scaled by the gain.
+// Example:
+// (every-frame (when (> (gpeak) 0.9) (display "too loud!") (newline)))
+// EndFunctionDoc
+
+Scheme_Object *get_peak(int argc, Scheme_Object **argv)
+{
+	if (Audio!=NULL)
+	{
+		return scheme_make_double(Audio->GetFrame()->Peak*Audio->GetGain());
+	}
+	return scheme_make_double(0);
+}
+
+// StartFunctionDoc-en
+// gonset
+// Returns: boolean
+// Description:
+// Returns true if an onset - the start of a note or drum hit - was detected since 
+// the last frame. Onsets are found on the audio side, so none are missed if the 
+// framerate is low.
+// Example:
+// (every-frame
+//     (when (gonset)
+//         (with-state
+//             (translate (vmul (crndvec) 5))
+//             (build-cube))))
+// EndFunctionDoc
+
+Scheme_Object *get_onset(int argc, Scheme_Object **argv)
+{
+	if (Audio!=NULL && Audio->IsOnset()) return scheme_true;
+	return scheme_false;
+}
+
+// StartFunctionDoc-en
+// gflux
+// Returns: flux-real
+// Description:
+// Returns the spectral flux, how much the sound is changing, which is what gonset 
+// uses to find onsets.
+// Example:
+// (every-frame (with-state (scale (+ 1 (* 20 (gflux)))) (draw-cube)))
+// EndFunctionDoc
+
+Scheme_Object *get_flux(int argc, Scheme_Object **argv)
+{
+	if (Audio!=NULL)
+	{
+		return scheme_make_double(Audio->GetFrame()->Flux);
+	}
+	return scheme_make_double(0);
+}
+
+// StartFunctionDoc-en
+// onset-threshold value-number
+// Returns: void
+// Description:
+// Sets how far above the average spectral flux it needs to go to count as an onset. 
+// Lower values find more onsets. Defaults to 1.5.
+// Example:
+// (onset-threshold 3) ; only the big hits
+// EndFunctionDoc
+
+Scheme_Object *onset_threshold(int argc, Scheme_Object **argv)
+{
+	MZ_GC_DECL_REG(1);
+	MZ_GC_VAR_IN_REG(0, argv);
+	MZ_GC_REG();
+	if (!SCHEME_NUMBERP(argv[0])) scheme_wrong_type("onset-threshold", "number", 0, argc, argv);
+	if (Audio!=NULL)
+	{
+		Audio->SetOnsetThreshold(scheme_real_to_double(argv[0]));
+	}
+	MZ_GC_UNREG();
+	return scheme_void;
+}
+
+// StartFunctionDoc-en
+// gbeat
+// Returns: boolean
+// Description:
+// Returns true if a beat happened since the last frame. The beat is tracked from the 
+// onsets, and keeps going through quiet parts at the estimated tempo.
+// Example:
+// (every-frame
+//     (when (gbeat)
+//         (colour (rndvec)))
+//     (draw-cube))
+// EndFunctionDoc
+
+Scheme_Object *get_beat(int argc, Scheme_Object **argv)
+{
+	if (Audio!=NULL && Audio->IsBeat()) return scheme_true;
+	return scheme_false;
+}
+
+// StartFunctionDoc-en
+// gbpm
+// Returns: tempo-real
+// Description:
+// Returns the estimated tempo in beats per minute, between 60 and 200, or 0 if it 
+// hasn't found one yet.
+// Example:
+// (every-frame (display (gbpm)) (newline))
+// EndFunctionDoc
+
+Scheme_Object *get_bpm(int argc, Scheme_Object **argv)
+{
+	if (Audio!=NULL)
+	{
+		return scheme_make_double(Audio->GetFrame()->Tempo);
+	}
+	return scheme_make_double(0);
+}
+
+// StartFunctionDoc-en
+// gbeat-phase
+// Returns: phase-real
+// Description:
+// Returns how far through the current beat we are, from 0 on the beat up to 1 at the
+// next one. Use this for smooth movement locked to the music.
+// Example:
+// (every-frame
+//     (with-state
+//         (rotate (vector 0 (* 360 (gbeat-phase)) 0))
+//         (draw-cube)))
+// EndFunctionDoc
+
+Scheme_Object *get_beat_phase(int argc, Scheme_Object **argv)
+{
+	if (Audio!=NULL)
+	{
+		return scheme_make_double(Audio->GetFrame()->BeatPhase);
+	}
+	return scheme_make_double(0);
+}
+
 /////////////////////
 
 #ifdef STATIC_LINK
@@ -550,15 +927,30 @@ Scheme_Object *scheme_reload(Scheme_Env *env)
 	// add all the modules from this extension
 	menv=scheme_primitive_module(scheme_intern_symbol("fluxus-audio"), env);
 
-	scheme_add_global("start-audio", scheme_make_prim_w_arity(start_audio, "start-audio", 3, 3), menv);
+	scheme_add_global("start-audio", scheme_make_prim_w_arity(start_audio, "start-audio", 3, 4), menv);
 	scheme_add_global("gh", scheme_make_prim_w_arity(get_harmonic, "gh", 1, 1), menv);
 	scheme_add_global("ga", scheme_make_prim_w_arity(get_audio, "ga", 0, 0), menv);
 	scheme_add_global("gain", scheme_make_prim_w_arity(gain, "gain", 1, 1), menv);
 	scheme_add_global("process", scheme_make_prim_w_arity(process, "process", 1, 1), menv);
+	scheme_add_global("process-progress", scheme_make_prim_w_arity(process_progress, "process-progress", 0, 0), menv);
+	scheme_add_global("process-time", scheme_make_prim_w_arity(process_time, "process-time", 0, 0), menv);
+	scheme_add_global("process-seek", scheme_make_prim_w_arity(process_seek, "process-seek", 1, 1), menv);
 	scheme_add_global("smoothing-bias", scheme_make_prim_w_arity(smoothing_bias, "smoothing-bias", 1, 1), menv);
 	scheme_add_global("update-audio", scheme_make_prim_w_arity(update_audio, "update-audio", 0, 0), menv);
 	scheme_add_global("set-num-frequency-bins", scheme_make_prim_w_arity(set_num_frequency_bins, "set-num-frequency-bins", 1, 1), menv);
 	scheme_add_global("get-num-frequency-bins", scheme_make_prim_w_arity(get_num_frequency_bins, "get-num-frequency-bins", 0, 0), menv);
+	scheme_add_global("gs", scheme_make_prim_w_arity(get_spectrum, "gs", 0, 0), menv);
+	scheme_add_global("gs-db", scheme_make_prim_w_arity(get_spectrum_db, "gs-db", 0, 0), menv);
+	scheme_add_global("ge", scheme_make_prim_w_arity(get_envelope, "ge", 1, 1), menv);
+	scheme_add_global("audio-envelope", scheme_make_prim_w_arity(audio_envelope, "audio-envelope", 2, 2), menv);
+	scheme_add_global("grms", scheme_make_prim_w_arity(get_rms, "grms", 0, 0), menv);
+	scheme_add_global("gpeak", scheme_make_prim_w_arity(get_peak, "gpeak", 0, 0), menv);
+	scheme_add_global("gonset", scheme_make_prim_w_arity(get_onset, "gonset", 0, 0), menv);
+	scheme_add_global("gflux", scheme_make_prim_w_arity(get_flux, "gflux", 0, 0), menv);
+	scheme_add_global("onset-threshold", scheme_make_prim_w_arity(onset_threshold, "onset-threshold", 1, 1), menv);
+	scheme_add_global("gbeat", scheme_make_prim_w_arity(get_beat, "gbeat", 0, 0), menv);
+	scheme_add_global("gbpm", scheme_make_prim_w_arity(get_bpm, "gbpm", 0, 0), menv);
+	scheme_add_global("gbeat-phase", scheme_make_prim_w_arity(get_beat_phase, "gbeat-phase", 0, 0), menv);
 
 	scheme_finish_primitive_module(menv);
 	MZ_GC_UNREG();
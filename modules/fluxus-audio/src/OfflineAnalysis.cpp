@@ -0,0 +1,310 @@
+// Copyright (C) 2005 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <math.h>
+#include <sndfile.h>
+#include "OfflineAnalysis.h"
+
+// bump this if the analysis changes, so old caches get ignored
+static const unsigned int CACHE_VERSION = 1;
+static const char CACHE_MAGIC[4] = {'F','X','A','A'};
+static const unsigned int RECORD_SCALARS = 7;
+
+OfflineAnalysis::OfflineAnalysis(const string &filename, unsigned int fftlength, 
+	unsigned int averages, const AudioAnalyser &settings) :
+m_Filename(filename),
+m_FFTLength(fftlength),
+m_Averages(averages),
+m_NumBands(settings.GetNumBands()),
+m_Attack(settings.GetAttack()),
+m_Release(settings.GetRelease()),
+m_OnsetThreshold(settings.GetOnsetThreshold()),
+m_SampleRate(0),
+m_HopSize(0),
+m_Length(0),
+m_RecordSize(m_NumBands*2+RECORD_SCALARS),
+m_NumRecords(0),
+m_FFT(fftlength),
+m_State(LOADING),
+m_Progress(0),
+m_Cancel(false),
+m_Started(false)
+{
+	m_Block = new float[m_FFTLength];
+	if (pthread_create(&m_Thread,NULL,Run,(void*)this))
+	{
+		cerr<<"Could not start the analysis thread for "<<m_Filename<<endl;
+		m_State=FAILED;
+	}
+	else
+	{
+		m_Started=true;
+	}
+}
+
+OfflineAnalysis::~OfflineAnalysis()
+{
+	if (m_Started)
+	{
+		m_Cancel=true;
+		pthread_join(m_Thread,NULL);
+	}
+	delete[] m_Block;
+}
+
+void *OfflineAnalysis::Run(void *context)
+{
+	((OfflineAnalysis*)context)->Run_i();
+	return NULL;
+}
+
+void OfflineAnalysis::Run_i()
+{
+	if (!Decode()) 
+	{
+		m_Progress=1;
+		m_State=FAILED;
+		return;
+	}
+	
+	unsigned long long hash=Hash();
+	if (LoadCache(hash))
+	{
+		cerr<<"Loaded cached analysis for "<<m_Filename<<endl;
+	}
+	else
+	{
+		Analyse();
+		if (m_Cancel) 
+		{
+			m_State=FAILED;
+			return;
+		}
+		SaveCache(hash);
+	}
+	
+	m_Progress=1;
+	__sync_synchronize();
+	m_State=READY;
+}
+
+bool OfflineAnalysis::Decode()
+{
+	SF_INFO info;
+	memset(&info,0,sizeof(info));
+	SNDFILE* file = sf_open(m_Filename.c_str(), SFM_READ, &info);
+	if (!file)
+	{
+		cerr<<"Error opening ["<<m_Filename<<"] : "<<sf_strerror(file)<<endl;
+		return false;
+	}
+
+	m_SampleRate=info.samplerate;
+	m_HopSize=m_FFTLength/4>0?m_FFTLength/4:1;
+	m_Samples.clear();
+	
+	// some formats only estimate the length, so we keep what we actually read
+	sf_count_t frames=0;
+	if (info.frames>0 && info.channels>0)
+	{
+		// mix down to mono if need be
+		if (info.channels>1)
+		{
+			float *Buffer = new float[info.frames*info.channels];
+			frames=sf_readf_float(file,Buffer,info.frames);
+			if (frames>0) m_Samples.resize(frames);
+			unsigned int from=0;
+			for (unsigned int n=0; n<m_Samples.size(); n++)
+			{
+				float sum=0;
+				for (int c=0; c<info.channels; c++) sum+=Buffer[from++];
+				m_Samples[n]=sum/info.channels;
+			}
+			delete[] Buffer;
+		}
+		else
+		{
+			m_Samples.resize(info.frames);
+			frames=sf_readf_float(file,&m_Samples[0],info.frames);
+			m_Samples.resize(frames>0?frames:0);
+		}
+	}
+	sf_close(file);
+	
+	if (m_Samples.empty() || m_SampleRate<=0)
+	{
+		cerr<<"No audio could be read from ["<<m_Filename<<"]"<<endl;
+		return false;
+	}
+	
+	m_Length=m_Samples.size()/(double)m_SampleRate;
+	return true;
+}
+
+void OfflineAnalysis::Analyse()
+{
+	AudioAnalyser analyser(m_FFTLength,m_SampleRate,m_Averages);
+	analyser.SetNumBands(m_NumBands);
+	analyser.SetEnvelope(m_Attack,m_Release);
+	analyser.SetOnsetThreshold(m_OnsetThreshold);
+	
+	m_NumRecords=m_Samples.size()/m_HopSize;
+	m_Records.resize(m_NumRecords*m_RecordSize);
+	
+	// one hop in, one analysis out - read back straight away as 
+	// we're on the same thread as the writer
+	for (unsigned int r=0; r<m_NumRecords && !m_Cancel; r++)
+	{
+		analyser.Write(&m_Samples[r*m_HopSize],m_HopSize);
+		const AudioFrame *frame=analyser.Read();
+		
+		float *record=&m_Records[r*m_RecordSize];
+		memcpy(record,frame->Bands,m_NumBands*sizeof(float));
+		memcpy(record+m_NumBands,frame->Envelopes,m_NumBands*sizeof(float));
+		float *scalars=record+m_NumBands*2;
+		scalars[0]=frame->RMS;
+		scalars[1]=frame->Peak;
+		scalars[2]=frame->Flux;
+		scalars[3]=frame->Tempo;
+		scalars[4]=frame->BeatPhase;
+		scalars[5]=frame->Onsets;
+		scalars[6]=frame->Beats;
+		
+		if ((r&1023)==0) m_Progress=r/(float)m_NumRecords;
+	}
+}
+
+unsigned long long OfflineAnalysis::Hash()
+{
+	// fnv-1a over the samples and everything that changes the result
+	unsigned long long hash=14695981039346656037ULL;
+	
+	unsigned int params[] = { CACHE_VERSION, m_SampleRate, m_FFTLength, m_Averages, m_NumBands };
+	float settings[] = { m_Attack, m_Release, m_OnsetThreshold };
+	
+	const unsigned char *data;
+	if (!m_Samples.empty())
+	{
+		data=(const unsigned char*)&m_Samples[0];
+		unsigned int size=m_Samples.size()*sizeof(float);
+		for (unsigned int i=0; i<size; i++) hash=(hash^data[i])*1099511628211ULL;
+	}
+	data=(const unsigned char*)params;
+	for (unsigned int i=0; i<sizeof(params); i++) hash=(hash^data[i])*1099511628211ULL;
+	data=(const unsigned char*)settings;
+	for (unsigned int i=0; i<sizeof(settings); i++) hash=(hash^data[i])*1099511628211ULL;
+	return hash;
+}
+
+bool OfflineAnalysis::LoadCache(unsigned long long hash)
+{
+	FILE *file=fopen((m_Filename+".fxa").c_str(),"rb");
+	if (!file) return false;
+	
+	char magic[4];
+	unsigned long long filehash=0;
+	unsigned int recordsize=0,numrecords=0;
+	bool ok=fread(magic,1,4,file)==4 && !memcmp(magic,CACHE_MAGIC,4) &&
+	        fread(&filehash,sizeof(filehash),1,file)==1 && filehash==hash &&
+	        fread(&recordsize,sizeof(recordsize),1,file)==1 && recordsize==m_RecordSize &&
+	        fread(&numrecords,sizeof(numrecords),1,file)==1;
+	
+	if (ok)
+	{
+		m_Records.resize(numrecords*m_RecordSize);
+		ok=numrecords==0 || 
+		   fread(&m_Records[0],sizeof(float),m_Records.size(),file)==m_Records.size();
+		m_NumRecords=numrecords;
+	}
+	
+	fclose(file);
+	if (!ok) m_Records.clear();
+	return ok;
+}
+
+void OfflineAnalysis::SaveCache(unsigned long long hash)
+{
+	string filename=m_Filename+".fxa";
+	FILE *file=fopen(filename.c_str(),"wb");
+	if (!file)
+	{
+		cerr<<"Could not write analysis cache "<<filename<<endl;
+		return;
+	}
+	
+	bool ok=fwrite(CACHE_MAGIC,1,4,file)==4 &&
+	        fwrite(&hash,sizeof(hash),1,file)==1 &&
+	        fwrite(&m_RecordSize,sizeof(m_RecordSize),1,file)==1 &&
+	        fwrite(&m_NumRecords,sizeof(m_NumRecords),1,file)==1 &&
+	        (m_Records.empty() || 
+	         fwrite(&m_Records[0],sizeof(float),m_Records.size(),file)==m_Records.size());
+	fclose(file);
+	
+	if (!ok)
+	{
+		cerr<<"Could not write analysis cache "<<filename<<endl;
+		remove(filename.c_str());
+	}
+}
+
+void OfflineAnalysis::Get(double time, AudioFrame *frame)
+{
+	if (m_State!=READY) return;
+	
+	// the raw block centred on the time, and its spectrum - not worth 
+	// caching as it's only one fft per frame
+	int start=(int)(time*m_SampleRate)-(int)m_FFTLength/2;
+	for (unsigned int i=0; i<m_FFTLength; i++)
+	{
+		int pos=start+i;
+		m_Block[i]=(pos>=0 && pos<(int)m_Samples.size())?m_Samples[pos]:0;
+	}
+	unsigned int audiosize=frame->AudioSize<m_FFTLength?frame->AudioSize:m_FFTLength;
+	memcpy(frame->Audio,m_Block,audiosize*sizeof(float));
+	
+	if (frame->SpectrumSize==m_FFT.GetNumBins())
+	{
+		m_FFT.Impulse2Freq(m_Block,frame->Spectrum);
+		for (unsigned int i=0; i<frame->SpectrumSize; i++)
+		{
+			float mag=frame->Spectrum[i];
+			frame->LogSpectrum[i]=20.0f*log10(mag>1e-6f?mag:1e-6f);
+		}
+	}
+	
+	if (m_NumRecords==0) return;
+	
+	// record r is for the window ending at sample (r+1)*hop
+	int r=(int)floor((time*m_SampleRate+m_FFTLength/2)/m_HopSize+0.5)-1;
+	if (r<0) r=0;
+	if (r>=(int)m_NumRecords) r=m_NumRecords-1;
+	
+	const float *record=&m_Records[r*m_RecordSize];
+	memcpy(frame->Bands,record,m_NumBands*sizeof(float));
+	memcpy(frame->Envelopes,record+m_NumBands,m_NumBands*sizeof(float));
+	frame->NumBands=m_NumBands;
+	const float *scalars=record+m_NumBands*2;
+	frame->RMS=scalars[0];
+	frame->Peak=scalars[1];
+	frame->Flux=scalars[2];
+	frame->Tempo=scalars[3];
+	frame->BeatPhase=scalars[4];
+	frame->Onsets=(unsigned int)scalars[5];
+	frame->Beats=(unsigned int)scalars[6];
+}
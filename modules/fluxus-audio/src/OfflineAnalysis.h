@@ -0,0 +1,90 @@
+// Copyright (C) 2005 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include "AudioAnalyser.h"
+
+#ifndef OFFLINE_ANALYSIS
+#define OFFLINE_ANALYSIS
+
+using namespace std;
+
+///////////////////////////////////////////////////////////////
+// Analyses a whole audio file up front on a worker thread, 
+// keeping a record of the features for every hop. The records 
+// are cached in a sidecar file next to the audio (filename.fxa)
+// keyed by a hash of the samples and the analysis settings, so
+// running the same file again loads instantly. Features are 
+// then looked up by audio time rather than by frame.
+
+class OfflineAnalysis
+{
+public:
+	OfflineAnalysis(const string &filename, unsigned int fftlength, 
+		unsigned int averages, const AudioAnalyser &settings);
+	~OfflineAnalysis();
+
+	enum State {LOADING, READY, FAILED};
+
+	State GetState() { return m_State; }
+	float GetProgress() { return m_Progress; }
+	double GetLength() { return m_Length; }
+
+	// render side, only once it's ready - fills in the frame
+	// with the features for the hop centred nearest the time
+	void Get(double time, AudioFrame *frame);
+	unsigned int GetSpectrumSize() { return m_FFT.GetNumBins(); }
+
+private:
+	static void *Run(void *context);
+	void Run_i();
+	bool Decode();
+	void Analyse();
+	unsigned long long Hash();
+	bool LoadCache(unsigned long long hash);
+	void SaveCache(unsigned long long hash);
+
+	string m_Filename;
+	unsigned int m_FFTLength;
+	unsigned int m_Averages;
+	unsigned int m_NumBands;
+	float m_Attack;
+	float m_Release;
+	float m_OnsetThreshold;
+
+	vector<float> m_Samples;
+	unsigned int m_SampleRate;
+	unsigned int m_HopSize;
+	double m_Length;
+
+	// each record is the bands and envelopes followed by the scalars
+	vector<float> m_Records;
+	unsigned int m_RecordSize;
+	unsigned int m_NumRecords;
+
+	FFT m_FFT;
+	float *m_Block;
+
+	volatile State m_State;
+	volatile float m_Progress;
+	volatile bool m_Cancel;
+	bool m_Started;
+	pthread_t m_Thread;
+};
+
+#endif
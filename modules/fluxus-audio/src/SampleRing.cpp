@@ -0,0 +1,82 @@
+// Copyright (C) 2005 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include <cstring>
+#include "SampleRing.h"
+
+SampleRing::SampleRing(unsigned int size):
+m_ReadPos(0),
+m_WritePos(0),
+m_Size(1),
+m_Buffer(NULL)
+{
+	while (m_Size<size) m_Size<<=1;
+	m_SizeMask=m_Size-1;
+	m_Buffer = new float[m_Size];
+	memset(m_Buffer,0,m_Size*sizeof(float));
+}
+
+SampleRing::~SampleRing()	
+{
+	delete[] m_Buffer;
+}
+
+// the positions are free running counters, masked on use - each side only 
+// ever writes its own, and the barriers make sure the samples are in 
+// place before the other side sees the position move
+
+bool SampleRing::Write(const float *src, unsigned int count)
+{
+	if (WriteSpace()<count) return false;
+	__sync_synchronize();
+	
+	unsigned int pos=m_WritePos&m_SizeMask;
+	unsigned int first=m_Size-pos;
+	if (first>count) first=count;
+	memcpy(m_Buffer+pos,src,first*sizeof(float));
+	memcpy(m_Buffer,src+first,(count-first)*sizeof(float));
+	
+	__sync_synchronize();
+	m_WritePos+=count;
+	return true;
+}
+
+unsigned int SampleRing::Read(float *dest, unsigned int count)
+{
+	unsigned int space=ReadSpace();
+	if (count>space) count=space;
+	__sync_synchronize();
+	
+	unsigned int pos=m_ReadPos&m_SizeMask;
+	unsigned int first=m_Size-pos;
+	if (first>count) first=count;
+	memcpy(dest,m_Buffer+pos,first*sizeof(float));
+	memcpy(dest+first,m_Buffer,(count-first)*sizeof(float));
+	
+	__sync_synchronize();
+	m_ReadPos+=count;
+	return count;
+}
+
+unsigned int SampleRing::WriteSpace()
+{
+	return m_Size-(m_WritePos-m_ReadPos);
+}
+
+unsigned int SampleRing::ReadSpace()
+{
+	return m_WritePos-m_ReadPos;
+}
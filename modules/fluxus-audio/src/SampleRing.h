@@ -0,0 +1,47 @@
+// Copyright (C) 2005 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#ifndef SAMPLE_RING
+#define SAMPLE_RING
+
+// single reader, single writer ringbuffer of samples, lock free so 
+// the jack thread can write to it without ever blocking
+
+class SampleRing
+{
+public:
+	// size is rounded up to a power of two
+	SampleRing(unsigned int size);
+	~SampleRing();
+	
+	// returns false if there isn't room, and writes nothing
+	bool Write(const float *src, unsigned int count);
+	// returns the number of samples read, up to count
+	unsigned int Read(float *dest, unsigned int count);
+	
+	unsigned int WriteSpace();
+	unsigned int ReadSpace();
+	unsigned int GetSize() { return m_Size; }
+
+private:
+	volatile unsigned int m_ReadPos;
+	volatile unsigned int m_WritePos;
+	unsigned int m_Size;
+	unsigned int m_SizeMask;	
+	float *m_Buffer;	
+};
+
+#endif
@@ -2425,6 +2425,88 @@ Scheme_Object *shadow_debug(int argc, Scheme_Object **argv)
   return scheme_void;
 }
 
+// StartFunctionDoc-en
+// shadow-gpu number-setting
+// Returns: void
+// Description:
+// Extrudes the shadow volumes of polygon primitives in a vertex
+// shader, rather than finding the silhouette edges on the cpu. 
+// Needs GLSL, and the debug mode still uses the cpu.
+// Example:
+// (shadow-gpu 1)
+// EndFunctionDoc
+
+Scheme_Object *shadow_gpu(int argc, Scheme_Object **argv)
+{
+  DECL_ARGV();
+  ArgCheck("shadow-gpu", "i", argc, argv);
+  Engine::Get()->Renderer()->ShadowGPU(IntFromScheme(argv[0]));
+  MZ_GC_UNREG();
+  return scheme_void;
+}
+
+// StartFunctionDoc-en
+// shadow-map-size number-setting
+// Returns: void
+// Description:
+// Sets the size of the depth maps for lights casting shadows with
+// light-cast-shadow. Point lights use six of these, and directional 
+// lights one for each cascade. The default is 1024, and sizes too
+// big for a row of three maps to fit in a texture are made smaller.
+// Example:
+// (shadow-map-size 2048)
+// EndFunctionDoc
+
+Scheme_Object *shadow_map_size(int argc, Scheme_Object **argv)
+{
+  DECL_ARGV();
+  ArgCheck("shadow-map-size", "i", argc, argv);
+  Engine::Get()->Renderer()->ShadowMapSize(IntFromScheme(argv[0]));
+  MZ_GC_UNREG();
+  return scheme_void;
+}
+
+// StartFunctionDoc-en
+// shadow-map-cascades number-setting
+// Returns: void
+// Description:
+// Sets how many slices of the view directional lights casting 
+// shadows are split into, each with a depth map of its own, so 
+// shadows close to the camera are sharper. From 1 to 4, the 
+// default is 3.
+// Example:
+// (shadow-map-cascades 4)
+// EndFunctionDoc
+
+Scheme_Object *shadow_map_cascades(int argc, Scheme_Object **argv)
+{
+  DECL_ARGV();
+  ArgCheck("shadow-map-cascades", "i", argc, argv);
+  Engine::Get()->Renderer()->ShadowMapCascades(IntFromScheme(argv[0]));
+  MZ_GC_UNREG();
+  return scheme_void;
+}
+
+// StartFunctionDoc-en
+// shadow-map-range near-number far-number
+// Returns: void
+// Description:
+// Sets the depth range of the shadow maps of point and spot lights. 
+// The far distance is also how far from the camera the shadows of 
+// directional lights reach. The default is 0.1 to 100.
+// Example:
+// (shadow-map-range 1 50)
+// EndFunctionDoc
+
+Scheme_Object *shadow_map_range(int argc, Scheme_Object **argv)
+{
+  DECL_ARGV();
+  ArgCheck("shadow-map-range", "ff", argc, argv);
+  Engine::Get()->Renderer()->ShadowMapRange(FloatFromScheme(argv[0]),FloatFromScheme(argv[1]));
+  MZ_GC_UNREG();
+  return scheme_void;
+}
+
 // StartFunctionDoc-en
 // accum mode-symbol value-number
 // Returns: void
@@ -2689,6 +2771,10 @@ void GlobalStateFunctions::AddGlobals(Scheme_Env *env)
 	scheme_add_global("shadow-light", scheme_make_prim_w_arity(shadow_light, "shadow-light", 1, 1), env);
 	scheme_add_global("shadow-length", scheme_make_prim_w_arity(shadow_length, "shadow-length", 1, 1), env);
 	scheme_add_global("shadow-debug", scheme_make_prim_w_arity(shadow_debug, "shadow-ldebug", 1, 1), env);
+	scheme_add_global("shadow-gpu", scheme_make_prim_w_arity(shadow_gpu, "shadow-gpu", 1, 1), env);
+	scheme_add_global("shadow-map-size", scheme_make_prim_w_arity(shadow_map_size, "shadow-map-size", 1, 1), env);
+	scheme_add_global("shadow-map-cascades", scheme_make_prim_w_arity(shadow_map_cascades, "shadow-map-cascades", 1, 1), env);
+	scheme_add_global("shadow-map-range", scheme_make_prim_w_arity(shadow_map_range, "shadow-map-range", 2, 2), env);
 	scheme_add_global("accum", scheme_make_prim_w_arity(accum, "accum", 2, 2), env);
 	scheme_add_global("print-info", scheme_make_prim_w_arity(print_info, "print-info", 0, 0), env);
 	scheme_add_global("set-cursor",scheme_make_prim_w_arity(set_cursor,"set-cursor",1,1), env);
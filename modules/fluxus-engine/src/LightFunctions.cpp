@@ -1005,6 +1005,41 @@ Scheme_Object *light_direction(int argc, Scheme_Object **argv)
 	return scheme_void;
 }
 
+// StartFunctionDoc-en
+// light-cast-shadow lightid-number setting-number
+// Returns: void
+// Description:
+// Makes the light cast shadows with shadow maps, rendered from the 
+// light, rather than shadow volumes. Any number of lights can do this, 
+// and only primitives with the cast-shadow hint cast them. Needs GLSL. 
+// See also shadow-map-size, shadow-map-cascades and shadow-map-range.
+// Example:
+// (define mylight (make-light 'spot 'free))
+// (light-position mylight (vector 0 8 0))
+// (light-direction mylight (vector 0 -1 0))
+// (light-spot-angle mylight 45)
+// (light-cast-shadow mylight 1)
+//
+// (with-state
+//     (hint-cast-shadow)
+//     (build-torus 1 2 20 20))
+// (with-state
+//     (translate (vector 0 -3 0))
+//     (rotate (vector 90 0 0))
+//     (scale (vector 20 20 20))
+//     (build-seg-plane 20 20))
+// EndFunctionDoc
+
+Scheme_Object *light_cast_shadow(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("light-cast-shadow", "ii", argc, argv);
+	Light *light = Engine::Get()->Renderer()->GetLight(IntFromScheme(argv[0]));
+	if (light) light->SetCastShadow(IntFromScheme(argv[1]));
+	MZ_GC_UNREG();
+	return scheme_void;
+}
+
 void LightFunctions::AddGlobals(Scheme_Env *env)
 {
 	MZ_GC_DECL_REG(1);
@@ -1019,6 +1054,7 @@ void LightFunctions::AddGlobals(Scheme_Env *env)
 	scheme_add_global("light-spot-exponent", scheme_make_prim_w_arity(light_spot_exponent, "light-spot-exponent", 2, 2), env);
 	scheme_add_global("light-attenuation", scheme_make_prim_w_arity(light_attenuation, "light-attenuation", 3, 3), env);
 	scheme_add_global("light-direction", scheme_make_prim_w_arity(light_direction, "light-direction", 2, 2), env);
+	scheme_add_global("light-cast-shadow", scheme_make_prim_w_arity(light_cast_shadow, "light-cast-shadow", 2, 2), env);
 	MZ_GC_UNREG();
 }
 
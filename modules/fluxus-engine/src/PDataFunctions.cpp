@@ -15,6 +15,7 @@
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
 #include <assert.h>
+#include <string.h>
 #include "SchemeHelper.h"
 #include "Engine.h"
 #include "PDataFunctions.h"
@@ -725,15 +726,115 @@ Scheme_Object *pdata_size(int argc, Scheme_Object **argv)
 }
 
 // StartFunctionDoc-en
-// recalc-normals smoothornot-number
+// pdata-bytes type-string [bytes]
+// Returns: bytes
+// Description:
+// Packs a pdata array into bytes as 32 bit floats in the machine's byte order, 1 per 
+// number, 3 per vector, 4 per colour and 16 per matrix - mainly for sending as an osc 
+// blob. Give it the bytes it returned last time to have them refilled rather than 
+// making new ones every frame.
+// Example:
+// (define pixels (build-pixels 16 32))
+// (define buf #f)
+// (every-frame
+//     (with-primitive pixels
+//         (set! buf (pdata-bytes "c" buf))
+//         (osc-send "/wall" "b" (list buf))))
+// EndFunctionDoc
+
+Scheme_Object *pdata_bytes(int argc, Scheme_Object **argv)
+{
+	Scheme_Object *ret=NULL;
+	MZ_GC_DECL_REG(2);
+	MZ_GC_VAR_IN_REG(0, argv);
+	MZ_GC_VAR_IN_REG(1, ret);
+	MZ_GC_REG();	
+	ArgCheck("pdata-bytes", "s", argc, argv);		
+	
+	Primitive *Grabbed=Engine::Get()->Renderer()->Grabbed();    
+	if (!Grabbed) 
+	{
+		Trace::Stream<<"pdata-bytes called without an objected being grabbed"<<endl;
+		MZ_GC_UNREG();
+		return scheme_void;
+	}
+	
+	string name=StringFromScheme(argv[0]);
+	unsigned int size=0;
+	char type;
+	if (!Grabbed->GetDataInfo(name,type,size))
+	{
+		Trace::Stream<<"pdata-bytes: could not find pdata called ["<<name<<"]"<<endl;
+		MZ_GC_UNREG();
+		return scheme_void;
+	}
+
+	unsigned int width=0;
+	switch (type)
+	{
+		case 'f': width=1; break;
+		case 'v': width=3; break;
+		case 'c': width=4; break;
+		case 'm': width=16; break;
+		default: 
+			Trace::Stream<<"pdata-bytes: unknown pdata type ["<<type<<"]"<<endl;
+			MZ_GC_UNREG();
+			return scheme_void;
+	}
+	
+	unsigned int bytes=size*width*sizeof(float);
+	if (argc>1 && SCHEME_BYTE_STRINGP(argv[1]) && 
+		(unsigned int)SCHEME_BYTE_STRLEN_VAL(argv[1])==bytes) ret=argv[1];
+	else ret=scheme_alloc_byte_string(bytes,0);
+	
+	float *dst=(float*)SCHEME_BYTE_STR_VAL(ret);
+	if (size>0) switch (type)
+	{
+		case 'f': 
+		{
+			vector<float,FLX_ALLOC(float) > *data=Grabbed->GetDataVec<float>(name);
+			memcpy(dst,&(*data)[0],bytes);
+		}
+		break;
+		case 'v': 
+		{
+			// dVectors have a w we don't want
+			vector<dVector,FLX_ALLOC(dVector) > *data=Grabbed->GetDataVec<dVector>(name);
+			for (unsigned int i=0; i<size; i++) memcpy(dst+i*3,(*data)[i].arr(),3*sizeof(float));
+		}
+		break;
+		case 'c': 
+		{
+			vector<dColour,FLX_ALLOC(dColour) > *data=Grabbed->GetDataVec<dColour>(name);
+			memcpy(dst,&(*data)[0],bytes);
+		}
+		break;
+		case 'm': 
+		{
+			vector<dMatrix,FLX_ALLOC(dMatrix) > *data=Grabbed->GetDataVec<dMatrix>(name);
+			memcpy(dst,&(*data)[0],bytes);
+		}
+		break;
+	}
+	
+	MZ_GC_UNREG();
+	return ret;
+}
+
+// StartFunctionDoc-en
+// recalc-normals smoothornot-number [weighting-string]
 // Returns: void
 // Description:
 // For polygon primitives only. Looks at the vertex positions and calculates the lighting normals for you 
-// automatically. Call with "1" for smooth normals, "0" for faceted normals.
+// automatically. Call with "1" for smooth normals, "0" for faceted normals. The optional weighting 
+// sets how much each face counts towards a smooth normal - "none", "area" or "angle". Leaving it out
+// means "none", it is not remembered from the last call.
+// Calling this every frame on a deforming mesh is cheap if only some of the vertices have moved.
 // Example:
 // (define shape (build-sphere 10 10)) ; build a sphere (which is smooth by default)
 // (grab shape)
 // (recalc-normals 0) ; make the sphere faceted
+// (recalc-normals 1 "angle") ; smooth again, weighted by the corner angles
 // (ungrab)
 // EndFunctionDoc
 
@@ -754,9 +855,23 @@ Scheme_Object *pdata_size(int argc, Scheme_Object **argv)
 Scheme_Object *recalc_normals(int argc, Scheme_Object **argv)
 {
  	DECL_ARGV();
-	ArgCheck("recalc-normals", "i", argc, argv);			
+	if (argc==2) ArgCheck("recalc-normals", "is", argc, argv);			
+	else ArgCheck("recalc-normals", "i", argc, argv);			
 	Primitive *Grabbed=Engine::Get()->Renderer()->Grabbed();    
-	if (Grabbed) Grabbed->RecalculateNormals(IntFromScheme(argv[0]));
+	if (Grabbed) 
+	{
+		PolyPrimitive *pp = dynamic_cast<PolyPrimitive *>(Grabbed);
+		if (pp && argc==1) pp->SetNormalWeighting(NormalGen::WEIGHT_NONE);
+		else if (pp)
+		{
+			string weighting=StringFromScheme(argv[1]);
+			if (weighting=="none") pp->SetNormalWeighting(NormalGen::WEIGHT_NONE);
+			else if (weighting=="area") pp->SetNormalWeighting(NormalGen::WEIGHT_AREA);
+			else if (weighting=="angle") pp->SetNormalWeighting(NormalGen::WEIGHT_ANGLE);
+			else Trace::Stream<<"recalc-normals: unknown weighting "<<weighting<<endl;
+		}
+		Grabbed->RecalculateNormals(IntFromScheme(argv[0]));
+	}
 	MZ_GC_UNREG(); 
 	return scheme_void;
 }
@@ -774,6 +889,7 @@ void PDataFunctions::AddGlobals(Scheme_Env *env)
 	scheme_add_global("pdata-op", scheme_make_prim_w_arity(pdata_op, "pdata-op", 3, 3), env);
 	scheme_add_global("pdata-copy", scheme_make_prim_w_arity(pdata_copy, "pdata-copy", 2, 2), env);
 	scheme_add_global("pdata-size", scheme_make_prim_w_arity(pdata_size, "pdata-size", 0, 0), env);
-	scheme_add_global("recalc-normals", scheme_make_prim_w_arity(recalc_normals, "recalc-normals", 1, 1), env);
+	scheme_add_global("pdata-bytes", scheme_make_prim_w_arity(pdata_bytes, "pdata-bytes", 1, 2), env);
+	scheme_add_global("recalc-normals", scheme_make_prim_w_arity(recalc_normals, "recalc-normals", 1, 2), env);
  	MZ_GC_UNREG(); 
 }
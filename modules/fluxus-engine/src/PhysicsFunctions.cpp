@@ -1643,6 +1643,511 @@ Scheme_Object *has_collided(int argc, Scheme_Object **argv)
 	}
 }
 
+// StartFunctionDoc-en
+// physics-timestep step-seconds max-substeps-number
+// Returns: void
+// Description:
+// Runs the physics in fixed steps of step-seconds, driven by the real frame 
+// time, so the simulation runs at the same speed whatever the framerate. Up to 
+// max-substeps steps are run each frame, if the frame takes longer than that 
+// the simulation slows down rather than trying to catch up. A step of 0 goes 
+// back to the default, which is one step of 0.05 seconds per frame. 
+// Example:
+// (physics-timestep (/ 1 120) 8)
+// EndFunctionDoc
+
+Scheme_Object *physics_timestep(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("physics-timestep", "fi", argc, argv);
+	Engine::Get()->Physics()->SetTimestep(FloatFromScheme(argv[0]),IntFromScheme(argv[1]));
+	MZ_GC_UNREG(); 
+	return scheme_void;
+}
+
+// StartFunctionDoc-en
+// physics-interpolate on/off-boolean
+// Returns: void
+// Description:
+// With a fixed timestep, active objects are drawn part way between the last 
+// two physics steps, so they move smoothly when the physics runs at a different 
+// rate to the rendering. This delays them by up to one step. Defaults to on.
+// Example:
+// (physics-interpolate #f)
+// EndFunctionDoc
+
+Scheme_Object *physics_interpolate(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("physics-interpolate", "b", argc, argv);
+	Engine::Get()->Physics()->SetInterpolate(BoolFromScheme(argv[0]));
+	MZ_GC_UNREG(); 
+	return scheme_void;
+}
+
+// StartFunctionDoc-en
+// physics-thread on/off-boolean
+// Returns: void
+// Description:
+// Runs the physics in a separate thread at the rate set by physics-timestep, 
+// so it carries on at the same rate whatever the rendering is doing. Needs a 
+// fixed timestep to be set first. Kicks and forces are applied to the next 
+// step the thread runs.
+// Example:
+// (physics-timestep (/ 1 100) 4)
+// (physics-thread #t)
+// EndFunctionDoc
+
+Scheme_Object *physics_thread(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("physics-thread", "b", argc, argv);
+	Engine::Get()->Physics()->SetThreaded(BoolFromScheme(argv[0]));
+	MZ_GC_UNREG(); 
+	return scheme_void;
+}
+
+// StartFunctionDoc-en
+// active-swarm-box primitiveid-number
+// Returns: void
+// Description:
+// Makes an active body for every instance of an instance primitive (see 
+// build-instances) with a box as the bounding volume. The bodies all share the 
+// size of the source primitive, and write their transforms into the "m" pdata 
+// each frame. Use this rather than lots of separate active objects for large 
+// numbers of bodies. 
+// Example:
+// (clear)
+// (ground-plane (vector 0 1 0) 0)
+// (collisions 1)
+// (define cube (build-cube))
+// (define cubes (build-instances cube 2000))
+// (destroy cube)
+// (with-primitive cubes
+//     (pdata-map! 
+//         (lambda (m) 
+//             (mmul (mtranslate (vadd (vector 0 20 0) (vmul (srndvec) 20))) m)) 
+//         "m"))
+// (active-swarm-box cubes)
+// EndFunctionDoc
+
+// StartFunctionDoc-en
+// active-swarm-sphere primitiveid-number
+// Returns: void
+// Description:
+// As active-swarm-box, but using a sphere as the bounding volume.
+// Example:
+// (define sphere (build-sphere 6 6))
+// (define spheres (build-instances sphere 1000))
+// (destroy sphere)
+// (active-swarm-sphere spheres)
+// EndFunctionDoc
+
+// StartFunctionDoc-en
+// active-swarm-cylinder primitiveid-number
+// Returns: void
+// Description:
+// As active-swarm-box, but using a cylinder as the bounding volume.
+// Example:
+// (define cyl (build-cylinder 1 6))
+// (define cyls (build-instances cyl 1000))
+// (destroy cyl)
+// (active-swarm-cylinder cyls)
+// EndFunctionDoc
+
+Scheme_Object *active_swarm_box(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("active-swarm-box", "i", argc, argv);
+	Engine::Get()->Physics()->MakeSwarm(IntFromScheme(argv[0]),1.0f,Physics::BOX);
+	MZ_GC_UNREG(); 
+	return scheme_void;
+}
+
+Scheme_Object *active_swarm_sphere(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("active-swarm-sphere", "i", argc, argv);
+	Engine::Get()->Physics()->MakeSwarm(IntFromScheme(argv[0]),1.0f,Physics::SPHERE);
+	MZ_GC_UNREG(); 
+	return scheme_void;
+}
+
+Scheme_Object *active_swarm_cylinder(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("active-swarm-cylinder", "i", argc, argv);
+	Engine::Get()->Physics()->MakeSwarm(IntFromScheme(argv[0]),1.0f,Physics::CYLINDER);
+	MZ_GC_UNREG(); 
+	return scheme_void;
+}
+
+// StartFunctionDoc-en
+// swarm-size primitiveid-number
+// Returns: number
+// Description:
+// Returns the number of bodies in a swarm, or 0 if it isn't one.
+// Example:
+// (swarm-size cubes)
+// EndFunctionDoc
+
+Scheme_Object *swarm_size(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("swarm-size", "i", argc, argv);
+	int size=Engine::Get()->Physics()->GetSwarmSize(IntFromScheme(argv[0]));
+	MZ_GC_UNREG(); 
+	return scheme_make_integer_value(size);
+}
+
+// StartFunctionDoc-en
+// swarm-kick primitiveid-number start-number end-number kick-vector
+// Returns: void
+// Description:
+// Adds the velocity to the bodies in the swarm from start up to but 
+// not including end.
+// Example:
+// (swarm-kick cubes 0 (swarm-size cubes) (vector 0 5 0))
+// EndFunctionDoc
+
+Scheme_Object *swarm_kick(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("swarm-kick", "iiiv", argc, argv);
+	float vec[3];
+	FloatsFromScheme(argv[3],vec,3);
+	Engine::Get()->Physics()->SwarmKick(IntFromScheme(argv[0]),IntFromScheme(argv[1]),
+		IntFromScheme(argv[2]),dVector(vec[0],vec[1],vec[2]));
+	MZ_GC_UNREG(); 
+	return scheme_void;
+}
+
+// StartFunctionDoc-en
+// swarm-twist primitiveid-number start-number end-number spin-vector
+// Returns: void
+// Description:
+// Adds the angular velocity to the bodies in the swarm from start up to 
+// but not including end.
+// Example:
+// (swarm-twist cubes 0 100 (vector 0 2 0))
+// EndFunctionDoc
+
+Scheme_Object *swarm_twist(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("swarm-twist", "iiiv", argc, argv);
+	float vec[3];
+	FloatsFromScheme(argv[3],vec,3);
+	Engine::Get()->Physics()->SwarmTwist(IntFromScheme(argv[0]),IntFromScheme(argv[1]),
+		IntFromScheme(argv[2]),dVector(vec[0],vec[1],vec[2]));
+	MZ_GC_UNREG(); 
+	return scheme_void;
+}
+
+// StartFunctionDoc-en
+// swarm-add-force primitiveid-number start-number end-number force-vector
+// Returns: void
+// Description:
+// Applies the force to the bodies in the swarm from start up to but 
+// not including end, for the next physics step.
+// Example:
+// (every-frame (swarm-add-force cubes 0 500 (vector 0 12 0)))
+// EndFunctionDoc
+
+Scheme_Object *swarm_add_force(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("swarm-add-force", "iiiv", argc, argv);
+	float vec[3];
+	FloatsFromScheme(argv[3],vec,3);
+	Engine::Get()->Physics()->SwarmAddForce(IntFromScheme(argv[0]),IntFromScheme(argv[1]),
+		IntFromScheme(argv[2]),dVector(vec[0],vec[1],vec[2]));
+	MZ_GC_UNREG(); 
+	return scheme_void;
+}
+
+// StartFunctionDoc-en
+// swarm-collided primitiveid-number start-number end-number
+// Returns: list of numbers
+// Description:
+// Returns the indices of the bodies in the swarm, from start up to but not 
+// including end, which collided in the last frame.
+// Example:
+// (every-frame
+//     (with-primitive cubes
+//         (for-each 
+//             (lambda (i) (pdata-set! "m" i (mmul (pdata-ref "m" i) (mscale (vector 1.01 1.01 1.01)))))
+//             (swarm-collided cubes 0 (swarm-size cubes)))))
+// EndFunctionDoc
+
+Scheme_Object *swarm_collided(int argc, Scheme_Object **argv)
+{
+	Scheme_Object *l = NULL;
+	MZ_GC_DECL_REG(2);
+	MZ_GC_VAR_IN_REG(0, argv);
+	MZ_GC_VAR_IN_REG(1, l);
+	MZ_GC_REG();
+	ArgCheck("swarm-collided", "iii", argc, argv);
+	
+	vector<int> collided;
+	Engine::Get()->Physics()->SwarmCollided(IntFromScheme(argv[0]),IntFromScheme(argv[1]),
+		IntFromScheme(argv[2]),collided);
+	
+	l = scheme_null;
+	for (int n=(int)collided.size()-1; n>=0; n--)
+	{
+		l=scheme_make_pair(scheme_make_integer(collided[n]),l);
+	}
+	MZ_GC_UNREG(); 
+	return l;
+}
+
+// StartFunctionDoc-en
+// physics-mesh-hulls on/off-boolean
+// Returns: void
+// Description:
+// When on, active-mesh objects made afterwards collide using the convex hull of 
+// the mesh rather than it's triangles. This is much faster and more stable for 
+// moving objects, but fills in any concave parts. Passive meshes always use the 
+// triangles. Defaults to off.
+// Example:
+// (physics-mesh-hulls #t)
+// (active-mesh (load-primitive "bunny.obj"))
+// EndFunctionDoc
+
+Scheme_Object *physics_mesh_hulls(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("physics-mesh-hulls", "b", argc, argv);
+	Engine::Get()->Physics()->SetMeshHulls(BoolFromScheme(argv[0]));
+	MZ_GC_UNREG(); 
+	return scheme_void;
+}
+
+// StartFunctionDoc-en
+// physics-update-mesh primitiveid-number
+// Returns: void
+// Description:
+// Reloads the collision triangles of a mesh object from it's "p" pdata, so 
+// deformations of the mesh are seen by the physics. Objects made from the same 
+// geometry share their collision data, the first update gives this object a 
+// copy of its own. The number of vertices must not have changed.
+// Example:
+// (define floor (build-seg-plane 20 20))
+// (with-primitive floor (poly-convert-to-indexed))
+// (passive-mesh floor)
+// (every-frame
+//     (with-primitive floor
+//         (pdata-index-map! (lambda (i p) (vector (vx p) (vy p) (sin (+ (time) i)))) "p"))
+//     (physics-update-mesh floor))
+// EndFunctionDoc
+
+Scheme_Object *physics_update_mesh(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("physics-update-mesh", "i", argc, argv);
+	Engine::Get()->Physics()->UpdateMesh(IntFromScheme(argv[0]));
+	MZ_GC_UNREG(); 
+	return scheme_void;
+}
+
+// StartFunctionDoc-en
+// physics-broadphase type-string
+// Returns: void
+// Description:
+// Chooses how the physics finds objects which might be touching, either "hash" 
+// (the default) or "sap" (sweep and prune), which is usually faster for large 
+// numbers of objects spread along the ground. Existing objects are kept.
+// Example:
+// (physics-broadphase "sap")
+// EndFunctionDoc
+
+Scheme_Object *physics_broadphase(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("physics-broadphase", "s", argc, argv);
+	string type=StringFromScheme(argv[0]);
+	if (type=="hash") Engine::Get()->Physics()->SetBroadphase(Physics::HASH);
+	else if (type=="sap") Engine::Get()->Physics()->SetBroadphase(Physics::SAP);
+	else Trace::Stream<<"physics-broadphase: unknown type "<<type<<", use hash or sap"<<endl;
+	MZ_GC_UNREG(); 
+	return scheme_void;
+}
+
+// StartFunctionDoc-en
+// physics-threads count-number
+// Returns: void
+// Description:
+// Sets the number of threads used to work out collision contacts, and to 
+// solve separate groups of touching objects if your version of ode supports it. 
+// Only helps with lots of colliding objects. Defaults to 1.
+// Example:
+// (physics-threads 4)
+// EndFunctionDoc
+
+Scheme_Object *physics_threads(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("physics-threads", "i", argc, argv);
+	Engine::Get()->Physics()->SetThreads(IntFromScheme(argv[0]));
+	MZ_GC_UNREG(); 
+	return scheme_void;
+}
+
+// StartFunctionDoc-en
+// physics-benchmark count-number type-string steps-number
+// Returns: milliseconds-number
+// Description:
+// Simulates count boxes in a separate world for a number of steps, using the 
+// current broadphase and thread settings, and returns the average time per step. 
+// The type is "pile", a stack of boxes resting on the ground, or "rain", boxes 
+// falling onto the ground. Your scene isn't changed.
+// Example:
+// (for-each
+//     (lambda (threads)
+//         (physics-threads threads)
+//         (display (physics-benchmark 2000 "rain" 200))(newline))
+//     (list 1 2 4))
+// EndFunctionDoc
+
+Scheme_Object *physics_benchmark(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("physics-benchmark", "isi", argc, argv);
+	string type=StringFromScheme(argv[1]);
+	if (type!="pile" && type!="rain")
+	{
+		Trace::Stream<<"physics-benchmark: unknown type "<<type<<", use pile or rain"<<endl;
+		MZ_GC_UNREG(); 
+		return scheme_void;
+	}
+	float ms=Engine::Get()->Physics()->Benchmark(IntFromScheme(argv[0]),type=="rain",IntFromScheme(argv[2]));
+	MZ_GC_UNREG(); 
+	return scheme_make_double(ms);
+}
+
+// StartFunctionDoc-en
+// collision-events-enable on/off-boolean
+// Returns: void
+// Description:
+// Starts or stops collecting collision events, which are read with 
+// collision-events. Collisions need to be turned on too. Defaults to off.
+// Example:
+// (collisions 1)
+// (collision-events-enable #t)
+// EndFunctionDoc
+
+Scheme_Object *collision_events_enable(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("collision-events-enable", "b", argc, argv);
+	Engine::Get()->Physics()->SetCollisionEvents(BoolFromScheme(argv[0]));
+	MZ_GC_UNREG(); 
+	return scheme_void;
+}
+
+// StartFunctionDoc-en
+// collision-subscribe primitiveid-number
+// Returns: void
+// Description:
+// Once any objects are subscribed, only collisions involving them are reported 
+// by collision-events. Use this to cut down the events from a big scene to the 
+// ones you want to hear about.
+// Example:
+// (collision-subscribe ob)
+// EndFunctionDoc
+
+Scheme_Object *collision_subscribe(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("collision-subscribe", "i", argc, argv);
+	Engine::Get()->Physics()->Subscribe(IntFromScheme(argv[0]));
+	MZ_GC_UNREG(); 
+	return scheme_void;
+}
+
+// StartFunctionDoc-en
+// collision-unsubscribe primitiveid-number
+// Returns: void
+// Description:
+// Stops reporting collisions for an object subscribed with collision-subscribe.
+// Example:
+// (collision-unsubscribe ob)
+// EndFunctionDoc
+
+Scheme_Object *collision_unsubscribe(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("collision-unsubscribe", "i", argc, argv);
+	Engine::Get()->Physics()->Unsubscribe(IntFromScheme(argv[0]));
+	MZ_GC_UNREG(); 
+	return scheme_void;
+}
+
+// StartFunctionDoc-en
+// collision-events
+// Returns: vector of collision vectors
+// Description:
+// Returns the collisions from the last frame, one for each pair of objects that 
+// touched in each physics step. Each one is a vector of 
+// (id1 index1 id2 index2 position normal impulse), where the ids are primitives 
+// (0 for the ground plane), the indices are the body number for swarms, and 
+// position and normal are for the deepest contact between them. The impulse 
+// says how hard they hit. Much faster than calling has-collided on lots of objects.
+// Example:
+// (clear)
+// (ground-plane (vector 0 1 0) 0)
+// (collisions 1)
+// (collision-events-enable #t)
+// (every-frame
+//     (vector-for-each
+//         (lambda (e)
+//             (when (> (vector-ref e 6) 1)
+//                 (play-now (mul (adsr 0 0.1 0 0) (sine (* 100 (vector-ref e 6)))))))
+//         (collision-events)))
+// EndFunctionDoc
+
+Scheme_Object *collision_events(int argc, Scheme_Object **argv)
+{
+	Scheme_Object *ret = NULL;
+	Scheme_Object *ev = NULL;
+	Scheme_Object *tmp = NULL;
+	MZ_GC_DECL_REG(4);
+	MZ_GC_VAR_IN_REG(0, ret);
+	MZ_GC_VAR_IN_REG(1, ev);
+	MZ_GC_VAR_IN_REG(2, tmp);
+	MZ_GC_VAR_IN_REG(3, argv);
+	MZ_GC_REG();
+	
+	const vector<Physics::CollisionEvent> &events=Engine::Get()->Physics()->GetCollisionEvents();
+	ret = scheme_make_vector(events.size(), scheme_void);
+	for (unsigned int i=0; i<events.size(); i++)
+	{
+		const Physics::CollisionEvent &e=events[i];
+		ev = scheme_make_vector(7, scheme_void);
+		tmp = scheme_make_integer_value(e.Ob1);
+		SCHEME_VEC_ELS(ev)[0]=tmp;
+		tmp = scheme_make_integer_value(e.Index1);
+		SCHEME_VEC_ELS(ev)[1]=tmp;
+		tmp = scheme_make_integer_value(e.Ob2);
+		SCHEME_VEC_ELS(ev)[2]=tmp;
+		tmp = scheme_make_integer_value(e.Index2);
+		SCHEME_VEC_ELS(ev)[3]=tmp;
+		dVector pos=e.Pos;
+		tmp = FloatsToScheme(pos.arr(),3);
+		SCHEME_VEC_ELS(ev)[4]=tmp;
+		dVector normal=e.Normal;
+		tmp = FloatsToScheme(normal.arr(),3);
+		SCHEME_VEC_ELS(ev)[5]=tmp;
+		tmp = scheme_make_double(e.Impulse);
+		SCHEME_VEC_ELS(ev)[6]=tmp;
+		SCHEME_VEC_ELS(ret)[i]=ev;
+	}
+	
+	MZ_GC_UNREG(); 
+	return ret;
+}
+
 void PhysicsFunctions::AddGlobals(Scheme_Env *env)
 {
 	MZ_GC_DECL_REG(1);
@@ -1678,5 +2183,25 @@ void PhysicsFunctions::AddGlobals(Scheme_Env *env)
 	scheme_add_global("add-torque", scheme_make_prim_w_arity(add_torque, "add-torque", 2, 2), env);
 	scheme_add_global("set-gravity-mode", scheme_make_prim_w_arity(set_gravity_mode, "set-gravity-mode", 2, 2), env);
 	scheme_add_global("has-collided", scheme_make_prim_w_arity(has_collided, "has-collided", 1, 1), env);
+	scheme_add_global("physics-timestep", scheme_make_prim_w_arity(physics_timestep, "physics-timestep", 2, 2), env);
+	scheme_add_global("physics-interpolate", scheme_make_prim_w_arity(physics_interpolate, "physics-interpolate", 1, 1), env);
+	scheme_add_global("physics-thread", scheme_make_prim_w_arity(physics_thread, "physics-thread", 1, 1), env);
+	scheme_add_global("active-swarm-box", scheme_make_prim_w_arity(active_swarm_box, "active-swarm-box", 1, 1), env);
+	scheme_add_global("active-swarm-sphere", scheme_make_prim_w_arity(active_swarm_sphere, "active-swarm-sphere", 1, 1), env);
+	scheme_add_global("active-swarm-cylinder", scheme_make_prim_w_arity(active_swarm_cylinder, "active-swarm-cylinder", 1, 1), env);
+	scheme_add_global("swarm-size", scheme_make_prim_w_arity(swarm_size, "swarm-size", 1, 1), env);
+	scheme_add_global("swarm-kick", scheme_make_prim_w_arity(swarm_kick, "swarm-kick", 4, 4), env);
+	scheme_add_global("swarm-twist", scheme_make_prim_w_arity(swarm_twist, "swarm-twist", 4, 4), env);
+	scheme_add_global("swarm-add-force", scheme_make_prim_w_arity(swarm_add_force, "swarm-add-force", 4, 4), env);
+	scheme_add_global("swarm-collided", scheme_make_prim_w_arity(swarm_collided, "swarm-collided", 3, 3), env);
+	scheme_add_global("physics-mesh-hulls", scheme_make_prim_w_arity(physics_mesh_hulls, "physics-mesh-hulls", 1, 1), env);
+	scheme_add_global("physics-update-mesh", scheme_make_prim_w_arity(physics_update_mesh, "physics-update-mesh", 1, 1), env);
+	scheme_add_global("physics-broadphase", scheme_make_prim_w_arity(physics_broadphase, "physics-broadphase", 1, 1), env);
+	scheme_add_global("physics-threads", scheme_make_prim_w_arity(physics_threads, "physics-threads", 1, 1), env);
+	scheme_add_global("physics-benchmark", scheme_make_prim_w_arity(physics_benchmark, "physics-benchmark", 3, 3), env);
+	scheme_add_global("collision-events-enable", scheme_make_prim_w_arity(collision_events_enable, "collision-events-enable", 1, 1), env);
+	scheme_add_global("collision-subscribe", scheme_make_prim_w_arity(collision_subscribe, "collision-subscribe", 1, 1), env);
+	scheme_add_global("collision-unsubscribe", scheme_make_prim_w_arity(collision_unsubscribe, "collision-unsubscribe", 1, 1), env);
+	scheme_add_global("collision-events", scheme_make_prim_w_arity(collision_events, "collision-events", 0, 0), env);
 	MZ_GC_UNREG();
 }
@@ -24,6 +24,7 @@
 #include "TextPrimitive.h"
 #include "ParticlePrimitive.h"
 #include "LocatorPrimitive.h"
+#include "InstancePrimitive.h"
 #include "PixelPrimitive.h"
 #include "BlobbyPrimitive.h"
 #include "TypePrimitive.h"
@@ -867,6 +868,7 @@ Scheme_Object *voxels2blobby(int argc, Scheme_Object **argv)
 // Returns: polyprimid-number
 // Description:
 // Converts the voxels from a voxels primitive into a triangle list polygon primitive.
+// The threshold defaults to 1, and is clamped to 0.001 or more.
 // Example:
 // (clear)
 // (define vx (build-voxels 16 16 16))
@@ -1294,6 +1296,47 @@ Scheme_Object *voxels_point_light(int argc, Scheme_Object **argv)
 	Trace::Stream<<"voxels-point-light can only be called while a voxels primitive is grabbed"<<endl;
     return scheme_void;
 }
+
+// StartFunctionDoc-en
+// voxels-render-mode mode-symbol
+// Returns: void
+// Description:
+// Sets how the current voxels primitive is drawn, either 'sprites (the default),
+// which draws a textured sprite per voxel, or 'raymarch, which draws the volume
+// in one pass with a shader, skipping empty space. Raymarching needs glsl, and
+// falls back to sprites without it. Empty voxels need a zero alpha to be
+// transparent when raymarching.
+// Example:
+// (clear)
+// (define p (build-voxels 64 64 64))
+// (with-primitive p
+//     (voxels-box-solid (vector 0 0 0) (vector 1 1 1) (vector 0 0 0 0))
+//     (voxels-sphere-solid (vector 0.5 0.5 0.5) (vector 1 0.5 0.2 0.3) 0.3)
+//     (voxels-render-mode 'raymarch))
+// EndFunctionDoc
+Scheme_Object *voxels_render_mode(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("voxels-render-mode", "S", argc, argv);
+	Primitive *Grabbed=Engine::Get()->Renderer()->Grabbed();
+	if (Grabbed)
+	{
+		VoxelPrimitive *pp = dynamic_cast<VoxelPrimitive *>(Grabbed);
+		if (pp)
+		{
+			string mode=SymbolName(argv[0]);
+			if (mode=="sprites") pp->SetRenderMode(VoxelPrimitive::RENDER_SPRITES);
+			else if (mode=="raymarch") pp->SetRenderMode(VoxelPrimitive::RENDER_RAYMARCH);
+			else Trace::Stream<<"voxels-render-mode: unknown mode "<<mode<<endl;
+			MZ_GC_UNREG();
+		    return scheme_void;
+		}
+	}
+	MZ_GC_UNREG();
+
+	Trace::Stream<<"voxels-render-mode can only be called while a voxels primitive is grabbed"<<endl;
+    return scheme_void;
+}
 // StartFunctionDoc-en
 // build-locator
 // Returns: primitiveid-number
@@ -1323,6 +1366,44 @@ Scheme_Object *build_locator(int argc, Scheme_Object **argv)
     return scheme_make_integer_value(Engine::Get()->Renderer()->AddPrimitive(Prim));
 }
 
+// StartFunctionDoc-en
+// build-instances primitiveid-number count-number
+// Returns: primitiveid-number
+// Description:
+// Builds a primitive which draws a copy of the source primitive many times, 
+// with a transform for each copy in the "m" matrix pdata array. This is much 
+// faster than building lots of separate primitives, and can be used with 
+// active-swarm to simulate each copy with physics. The source primitive is 
+// copied, so it can be destroyed or hidden afterwards.
+// Example:
+// (define cube (build-cube))
+// (define cubes (build-instances cube 1000))
+// (destroy cube)
+// (with-primitive cubes
+//     (pdata-map! 
+//         (lambda (m) 
+//             (mmul (mtranslate (vmul (srndvec) 10)) m)) 
+//         "m"))
+// EndFunctionDoc
+
+Scheme_Object *build_instances(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("build-instances", "ii", argc, argv);
+	Primitive *Prim=Engine::Get()->Renderer()->GetPrimitive(IntFromScheme(argv[0]));
+	int count=IntFromScheme(argv[1]);
+	if (Prim==NULL || count<1)
+	{
+		Trace::Stream<<"build-instances: needs a primitive and a count of at least 1"<<endl;
+		MZ_GC_UNREG();
+		return scheme_void;
+	}
+	
+	InstancePrimitive *ip = new InstancePrimitive(Prim,count);
+	MZ_GC_UNREG();
+    return scheme_make_integer_value(Engine::Get()->Renderer()->AddPrimitive(ip));
+}
+
 // StartFunctionDoc-en
 // locator-bounding-radius
 // locator-bounding-radius size-number
@@ -2723,6 +2804,7 @@ Scheme_Object *build_copy(int argc, Scheme_Object **argv)
 //
 //     skeleton-root primid-number : the root of the bindpose skeleton for skinning
 //     sharpness float : a control of how sharp the creasing will be when skinned 
+//     influences number : how many of the nearest bones each vertex is weighted to (default 4)
 //
 // skinweights->vertcols
 //     A utility for visualising skinweights for debugging. 
@@ -2736,6 +2818,14 @@ Scheme_Object *build_copy(int argc, Scheme_Object **argv)
 //     skeleton-root primid-number : the root primitive of the animating skeleton
 //     bindpose-root primid-number : the root primitive of the bindpose skeleton
 //     skin-normals number : whether to skin the normals as well as the positions
+//     gpu number : instead of moving the vertices, send the bone matrices to the 
+//         primitive's shader as a uniform mat4 array called "SkinMatrices", to skin 
+//         in the vertex shader. 
+//
+//     Only the 4 strongest bones are used for each vertex, these are stored in 
+//     colour pdata called "skin_bones" (the bone numbers) and "skin_weights", which
+//     are remade when the "w" pdata changes, and can be used as vertex shader 
+//     attributes.
 //     
 // Example:
 // (define mypfunc (make-pfunc 'arithmetic))
@@ -2950,13 +3040,15 @@ Scheme_Object *pfunc_run(int argc, Scheme_Object **argv)
 }
 
 // StartFunctionDoc-en
-// geo/line-intersect start-vec end-vec
+// geo/line-intersect start-vec end-vec [pdata-names-list]
 // Returns: void
 // Description:
 // Returns a list of pdata values at each intersection point of 
-// the specified line. The line is in primitive local space, to 
-// check with a point in global space, you need to transform the 
-// point with the inverse of the primitive transform.
+// the specified line, nearest to the start first. The line is in 
+// primitive local space, to check with a point in global space, you 
+// need to transform the point with the inverse of the primitive 
+// transform. If a list of pdata names is given only those arrays
+// are interpolated, otherwise all of them are.
 // Example:
 // (clear)
 // (define s (with-state
@@ -3021,23 +3113,132 @@ Scheme_Object *pfunc_run(int argc, Scheme_Object **argv)
 //         (check (pdata-ref "p" 0) (pdata-ref "p" 1))))
 // EndFunctionDoc
 
-Scheme_Object *geo_line_intersect(int argc, Scheme_Object **argv)
+// the pdata names to interpolate at hits, the ones in the list if 
+// given or all of the grabbed primitive's arrays otherwise
+static void HitNamesFromScheme(Scheme_Object *list, vector<string> &names)
+{
+	Scheme_Object *namevec = NULL;
+	MZ_GC_DECL_REG(2);
+	MZ_GC_VAR_IN_REG(0, list);
+	MZ_GC_VAR_IN_REG(1, namevec);
+	MZ_GC_REG();
+	
+	names.clear();
+	if (list)
+	{
+		namevec = scheme_list_to_vector(list);
+		for (int n=0; n<SCHEME_VEC_SIZE(namevec); n++)
+		{
+			if (SCHEME_CHAR_STRINGP(SCHEME_VEC_ELS(namevec)[n]))
+			{
+				names.push_back(StringFromScheme(SCHEME_VEC_ELS(namevec)[n]));
+			}
+		}
+	}
+	else
+	{
+		Engine::Get()->Grabbed()->GetDataNames(names);
+	}
+	MZ_GC_UNREG(); 
+}
+
+// the pdata blended at each of the hits
+struct HitData
+{
+	vector<char> Types;
+	vector<vector<float> > Floats;
+	vector<vector<dVector> > Vectors;
+	vector<vector<dColour> > Colours;
+	vector<vector<dMatrix> > Matrices;
+};
+
+static void InterpolateHits(Evaluator *eval, const Evaluator::Hits &hits, 
+	const vector<string> &names, HitData &data)
+{
+	data.Types.assign(names.size(),0);
+	data.Floats.resize(names.size());
+	data.Vectors.resize(names.size());
+	data.Colours.resize(names.size());
+	data.Matrices.resize(names.size());
+	for (unsigned int n=0; n<names.size(); n++)
+	{
+		unsigned int size=0;
+		if (!Engine::Get()->Grabbed()->GetDataInfo(names[n],data.Types[n],size)) 
+		{
+			Trace::Stream<<"geo/line-intersect: pdata "<<names[n]<<" not found"<<endl;
+			data.Types[n]=0;
+			continue;
+		}
+		switch (data.Types[n])
+		{
+			case 'f': eval->Interpolate(names[n],hits,data.Floats[n]); break;
+			case 'v': eval->Interpolate(names[n],hits,data.Vectors[n]); break;
+			case 'c': eval->Interpolate(names[n],hits,data.Colours[n]); break;
+			case 'm': eval->Interpolate(names[n],hits,data.Matrices[n]); break;
+		}
+	}
+}
+
+// makes a list of assoc lists of pdata names and values, one for 
+// each of the hits from first up to end, from the pdata blended
+// for all of them with InterpolateHits
+static Scheme_Object *HitsToScheme(const Evaluator::Hits &hits, const vector<string> &names, 
+	const HitData &data, unsigned int first, unsigned int end)
 {
 	Scheme_Object *name = NULL;
 	Scheme_Object *value = NULL;
 	Scheme_Object *p = NULL;
-	Scheme_Object *l = NULL;
 	Scheme_Object *pl = NULL;
+	Scheme_Object *l = NULL;
 
-	MZ_GC_DECL_REG(6);
-	MZ_GC_VAR_IN_REG(0, argv);
-	MZ_GC_VAR_IN_REG(1, name);
-	MZ_GC_VAR_IN_REG(2, value);
-	MZ_GC_VAR_IN_REG(3, p);
+	MZ_GC_DECL_REG(5);
+	MZ_GC_VAR_IN_REG(0, name);
+	MZ_GC_VAR_IN_REG(1, value);
+	MZ_GC_VAR_IN_REG(2, p);
+	MZ_GC_VAR_IN_REG(3, pl);
 	MZ_GC_VAR_IN_REG(4, l);
-	MZ_GC_VAR_IN_REG(5, pl);
 	MZ_GC_REG();
-	ArgCheck("geo/line-intersect", "vv", argc, argv);
+	
+	// backwards, so the list is in the same order as the hits
+	l = scheme_null;
+	for (int i=end-1; i>=(int)first; i--)
+	{
+		pl = scheme_null;
+		// jam the parametric position on the ray to the end of the list
+		// (so as not to break compatibility :/)
+		pl = scheme_make_pair(scheme_make_double(hits.T[i]),pl);
+		for (unsigned int n=0; n<names.size(); n++)
+		{
+			switch(data.Types[n])
+			{
+				case 'f': value = scheme_make_double(data.Floats[n][i]); break;
+				case 'v': value = FloatsToScheme(data.Vectors[n][i].arr(),4); break;
+				case 'c': value = FloatsToScheme(data.Colours[n][i].arr(),4); break;
+				case 'm': value = FloatsToScheme(data.Matrices[n][i].arr(),16); break;
+				default: continue;
+			}
+			
+			name = scheme_make_utf8_string(names[n].c_str());
+			p = scheme_make_pair(name,value);					
+			pl = scheme_make_pair(p,pl);
+		}
+		l = scheme_make_pair(pl,l);
+	}
+	
+	MZ_GC_UNREG(); 
+	return l;
+}
+
+Scheme_Object *geo_line_intersect(int argc, Scheme_Object **argv)
+{
+	Scheme_Object *l = NULL;
+
+	MZ_GC_DECL_REG(2);
+	MZ_GC_VAR_IN_REG(0, argv);
+	MZ_GC_VAR_IN_REG(1, l);
+	MZ_GC_REG();
+	if (argc==3) ArgCheck("geo/line-intersect", "vvl", argc, argv);
+	else ArgCheck("geo/line-intersect", "vv", argc, argv);
 	
 	l = scheme_null;
 	
@@ -3046,34 +3247,147 @@ Scheme_Object *geo_line_intersect(int argc, Scheme_Object **argv)
 		Evaluator *eval = Engine::Get()->Grabbed()->MakeEvaluator();
 		if (eval)
 		{
-			vector<Evaluator::Point> points;
-			eval->IntersectLine(VectorFromScheme(argv[0]), VectorFromScheme(argv[1]), points);
+			Evaluator::Hits hits;
+			vector<string> names;
+			HitNamesFromScheme(argc==3?argv[2]:NULL,names);
+			eval->IntersectLine(VectorFromScheme(argv[0]), VectorFromScheme(argv[1]), hits);
+			HitData data;
+			InterpolateHits(eval,hits,names,data);
+			l = HitsToScheme(hits,names,data,0,hits.Size());
+			delete eval;
+		}
+	}
+	MZ_GC_UNREG(); 
+    return l;
+}
 
-			for (vector<Evaluator::Point>::iterator i=points.begin(); i!=points.end(); ++i)
-			{
-				pl = scheme_null;
-                // jam the parametric position on the ray to the end of the list
-                // (so as not to break compatibility :/)
-				pl = scheme_make_pair(scheme_make_double(i->m_T),pl);
-				for (vector<Evaluator::Blend*>::iterator b=i->m_Blends.begin(); b!=i->m_Blends.end(); ++b)
-				{
-					name = scheme_make_utf8_string((*b)->m_Name.c_str());
-					
-					switch((*b)->m_Type)
-					{
-						case 'f': value = scheme_make_double(static_cast<Evaluator::TypedBlend<float>*>(*b)->m_Blend); break;
-						case 'v': value = FloatsToScheme(static_cast<Evaluator::TypedBlend<dVector>*>(*b)->m_Blend.arr(),4); break;
-						case 'c': value = FloatsToScheme(static_cast<Evaluator::TypedBlend<dColour>*>(*b)->m_Blend.arr(),4); break;
-						case 'm': value = FloatsToScheme(static_cast<Evaluator::TypedBlend<dMatrix>*>(*b)->m_Blend.arr(),16); break;
-						default: assert(0); break;
-					}
+// StartFunctionDoc-en
+// geo/lines-intersect starts-list ends-list [pdata-names-list]
+// Returns: list of intersection lists
+// Description:
+// Intersects a batch of lines with the grabbed primitive in one 
+// go, which is much faster than calling geo/line-intersect for 
+// each one. Returns a list with an entry for each line, each the 
+// same as geo/line-intersect would return for it.
+// Example:
+// (clear)
+// (define s (build-sphere 10 10))
+// (define hits 
+//     (with-primitive s
+//         (geo/lines-intersect 
+//             (build-list 100 (lambda (i) (vector (- (/ i 50) 1) 0 -2)))
+//             (build-list 100 (lambda (i) (vector (- (/ i 50) 1) 0 2)))
+//             '("p"))))
+// EndFunctionDoc
 
-					p = scheme_make_pair(name,value);					
-					pl = scheme_make_pair(p,pl);
-				}
-				l = scheme_make_pair(pl,l);
+Scheme_Object *geo_lines_intersect(int argc, Scheme_Object **argv)
+{
+	Scheme_Object *startvec = NULL;
+	Scheme_Object *endvec = NULL;
+	Scheme_Object *linehits = NULL;
+	Scheme_Object *l = NULL;
+
+	MZ_GC_DECL_REG(5);
+	MZ_GC_VAR_IN_REG(0, argv);
+	MZ_GC_VAR_IN_REG(1, startvec);
+	MZ_GC_VAR_IN_REG(2, endvec);
+	MZ_GC_VAR_IN_REG(3, linehits);
+	MZ_GC_VAR_IN_REG(4, l);
+	MZ_GC_REG();
+	if (argc==3) ArgCheck("geo/lines-intersect", "lll", argc, argv);
+	else ArgCheck("geo/lines-intersect", "ll", argc, argv);
+	
+	l = scheme_null;
+	
+	if (Engine::Get()->Grabbed()) 
+	{
+		Evaluator *eval = Engine::Get()->Grabbed()->MakeEvaluator();
+		if (eval)
+		{
+			startvec = scheme_list_to_vector(argv[0]);
+			endvec = scheme_list_to_vector(argv[1]);
+			unsigned int count = min(SCHEME_VEC_SIZE(startvec),SCHEME_VEC_SIZE(endvec));
+			vector<dVector> starts(count), ends(count);
+			for (unsigned int n=0; n<count; n++)
+			{
+				starts[n]=VectorFromScheme(SCHEME_VEC_ELS(startvec)[n]);
+				ends[n]=VectorFromScheme(SCHEME_VEC_ELS(endvec)[n]);
+			}
+			
+			Evaluator::Hits hits;
+			vector<string> names;
+			HitNamesFromScheme(argc==3?argv[2]:NULL,names);
+			eval->IntersectLines(starts,ends,hits);
+			
+			// blend the pdata for all the lines at once
+			HitData data;
+			InterpolateHits(eval,hits,names,data);
+			
+			// hits come grouped by line, so build the lists backwards
+			int end = hits.Size();
+			for (int line=count-1; line>=0; line--)
+			{
+				int first = end;
+				while (first>0 && hits.Line[first-1]==(unsigned int)line) first--;
+				linehits = HitsToScheme(hits,names,data,first,end);
+				l = scheme_make_pair(linehits,l);
+				end = first;
 			}
+			delete eval;
+		}
+	}
+	MZ_GC_UNREG(); 
+    return l;
+}
+
+// StartFunctionDoc-en
+// geo/closest-point position-vec
+// Returns: list of pdata values
+// Description:
+// Returns the pdata values at the nearest point on the surface of 
+// the current primitive to the position, in the same form as 
+// geo/line-intersect, with the distance to the point at the end.
+// The position is in primitive local space. Returns an empty list 
+// if the primitive has no surface.
+// Example:
+// (clear)
+// (define s (build-torus 1 2 20 20))
+// (define m (with-state (scale 0.3) (build-sphere 5 5)))
+// 
+// (every-frame
+//     (let ((c (with-primitive s 
+//                 (geo/closest-point (vmul (vector (sin (time)) (cos (time)) 1) 4)))))
+//         (with-primitive m
+//             (identity)
+//             (translate (cdr (assoc "p" c))))))
+// EndFunctionDoc
+
+Scheme_Object *geo_closest_point(int argc, Scheme_Object **argv)
+{
+	Scheme_Object *l = NULL;
 
+	MZ_GC_DECL_REG(2);
+	MZ_GC_VAR_IN_REG(0, argv);
+	MZ_GC_VAR_IN_REG(1, l);
+	MZ_GC_REG();
+	ArgCheck("geo/closest-point", "v", argc, argv);
+	
+	l = scheme_null;
+	
+	if (Engine::Get()->Grabbed()) 
+	{
+		Evaluator *eval = Engine::Get()->Grabbed()->MakeEvaluator();
+		if (eval)
+		{
+			Evaluator::Hits hits;
+			if (eval->ClosestPoint(VectorFromScheme(argv[0]), hits)) 
+			{
+				vector<string> names;
+				HitNamesFromScheme(NULL,names);
+				HitData data;
+				InterpolateHits(eval,hits,names,data);
+				l = SCHEME_CAR(HitsToScheme(hits,names,data,0,hits.Size()));
+			}
 			delete eval;
 		}
 	}
@@ -3384,6 +3698,7 @@ void PrimitiveFunctions::AddGlobals(Scheme_Env *env)
 	scheme_add_global("build-particles", scheme_make_prim_w_arity(build_particles, "build-particles", 1, 1), env);
 	scheme_add_global("build-image", scheme_make_prim_w_arity(build_image, "build-image", 3, 3), env);
 	scheme_add_global("build-locator", scheme_make_prim_w_arity(build_locator, "build-locator", 0, 0), env);
+	scheme_add_global("build-instances", scheme_make_prim_w_arity(build_instances, "build-instances", 2, 2), env);
 	scheme_add_global("build-voxels", scheme_make_prim_w_arity(build_voxels, "build-voxels", 3, 3), env);
 	scheme_add_global("locator-bounding-radius", scheme_make_prim_w_arity(locator_bounding_radius, "locator-bounding-radius", 1, 1), env);
 	scheme_add_global("build-pixels", scheme_make_prim_w_arity(build_pixels, "build-pixels", 2, 4), env);
@@ -3412,6 +3727,7 @@ void PrimitiveFunctions::AddGlobals(Scheme_Env *env)
 	scheme_add_global("voxels-box-solid", scheme_make_prim_w_arity(voxels_box_solid, "voxels-box-solid", 3, 3), env);
 	scheme_add_global("voxels-threshold", scheme_make_prim_w_arity(voxels_threshold, "voxels-threshold", 1, 1), env);
 	scheme_add_global("voxels-point-light", scheme_make_prim_w_arity(voxels_point_light, "voxels-point-light", 2, 2), env);
+	scheme_add_global("voxels-render-mode", scheme_make_prim_w_arity(voxels_render_mode, "voxels-render-mode", 1, 1), env);
 	scheme_add_global("text-params", scheme_make_prim_w_arity(text_params, "text-params", 11, 11), env);
 	scheme_add_global("ribbon-inverse-normals", scheme_make_prim_w_arity(ribbon_inverse_normals, "ribbon-inverse-normals", 1, 1), env);
 	scheme_add_global("build-blobby", scheme_make_prim_w_arity(build_blobby, "build-blobby", 3, 3), env);
@@ -3435,7 +3751,9 @@ void PrimitiveFunctions::AddGlobals(Scheme_Env *env)
 	scheme_add_global("make-pfunc", scheme_make_prim_w_arity(make_pfunc, "make-pfunc", 1, 1), env);
 	scheme_add_global("pfunc-set!", scheme_make_prim_w_arity(pfunc_set, "pfunc-set!", 2, 2), env);
 	scheme_add_global("pfunc-run", scheme_make_prim_w_arity(pfunc_run, "pfunc-run", 1, 1), env);
-	scheme_add_global("geo/line-intersect", scheme_make_prim_w_arity(geo_line_intersect, "geo/line-intersect", 2, 2), env);
+	scheme_add_global("geo/line-intersect", scheme_make_prim_w_arity(geo_line_intersect, "geo/line-intersect", 2, 3), env);
+	scheme_add_global("geo/lines-intersect", scheme_make_prim_w_arity(geo_lines_intersect, "geo/lines-intersect", 2, 3), env);
+	scheme_add_global("geo/closest-point", scheme_make_prim_w_arity(geo_closest_point, "geo/closest-point", 1, 1), env);
 	scheme_add_global("recalc-bb", scheme_make_prim_w_arity(recalc_bb, "recalc-bb", 0, 0), env);
 	scheme_add_global("bb/bb-intersect?", scheme_make_prim_w_arity(bb_bb_intersect, "bb/bb-intersect?", 2, 2), env);
 	scheme_add_global("bb/point-intersect?", scheme_make_prim_w_arity(bb_point_intersect, "bb/point-intersect?", 2, 2), env);
@@ -16,6 +16,7 @@
 
 #include <escheme.h>
 #include <iostream>
+#include <cstring>
 #include "OSCServer.h"
 
 using namespace std;
@@ -157,7 +158,8 @@ Scheme_Object *osc_source(int argc, Scheme_Object **argv)
 // Returns: msgreceived-boolean
 // Description:
 // Returns true if the message has been received since the last frame, and sets it as the current 
-// message for subsequent calls to (osc) for reading the arguments. 
+// message for subsequent calls to (osc) for reading the arguments. The name can be an osc 
+// address pattern, in which case the first matching message is used.
 // Example:
 // (cond 
 //     ((osc-msg "/hello")              ; if a the /hello message is recieved
@@ -234,19 +236,14 @@ Scheme_Object *osc(int argc, Scheme_Object **argv)
 	unsigned int index=(unsigned int)scheme_real_to_double(argv[0]);
 	if (OSCServer!=NULL)
 	{
-		vector<OSCData*> args;
-		OSCServer->GetArgs(args);
-		if (index<args.size())
+		const OSCMessage &msg=OSCServer->GetMsg();
+		if (index<msg.Size())
 		{
-			char type = args[index]->Type();
+			char type = msg.Type(index);
 		
-			if (type=='f') ret=scheme_make_double(static_cast<OSCFloat*>(args[index])->Value);
-			else if (type=='i') ret=scheme_make_integer_value_from_unsigned(static_cast<OSCInt*>(args[index])->Value);
-			else if (type=='s') 
-			{
-				string value=static_cast<OSCString*>(args[index])->Value;
-				ret=scheme_make_utf8_string(value.c_str());	
-			}
+			if (type=='f') ret=scheme_make_double(msg.GetFloat(index));
+			else if (type=='i') ret=scheme_make_integer_value_from_unsigned(msg.GetInt(index));
+			else if (type=='s') ret=scheme_make_utf8_string(msg.GetString(index));
 			else ret=scheme_void;
 		}
 		else 
@@ -262,6 +259,117 @@ Scheme_Object *osc(int argc, Scheme_Object **argv)
 	return scheme_void;
 }
 
+// StartFunctionDoc-en
+// osc-path
+// Returns: address-string
+// Description:
+// Returns the address of the current osc message, useful when (osc-msg) was 
+// given a pattern.
+// Example:
+// (when (osc-msg "/fader/*")
+//     (display (osc-path))(newline))
+// EndFunctionDoc
+
+Scheme_Object *osc_path(int argc, Scheme_Object **argv)
+{
+	if (OSCServer!=NULL)
+	{
+		return scheme_make_utf8_string(OSCServer->GetMsg().Path);
+	}
+	return scheme_make_utf8_string("");
+}
+
+// StartFunctionDoc-en
+// osc-timetag
+// Returns: seconds-number
+// Description:
+// Returns the timetag of the bundle the current osc message arrived in, as seconds
+// since 1900, or 0 if it wasn't sent in a bundle. 
+// Example:
+// (when (osc-msg "/hit")
+//     (display (osc-timetag))(newline))
+// EndFunctionDoc
+
+Scheme_Object *osc_timetag(int argc, Scheme_Object **argv)
+{
+	if (OSCServer!=NULL)
+	{
+		const OSCMessage &msg=OSCServer->GetMsg();
+		return scheme_make_double(msg.TimeSec+msg.TimeFrac/4294967296.0);
+	}
+	return scheme_make_double(0);
+}
+
+// StartFunctionDoc-en
+// osc-subscribe pattern-string
+// Returns: void
+// Description:
+// Only keep messages with addresses matching the pattern, along with any other 
+// subscribed patterns. With no subscriptions all messages are kept. Patterns
+// use the osc syntax: ? * [a-z] [!abc] and {foo,bar}.
+// Example:
+// (osc-subscribe "/synth/{freq,amp}")
+// EndFunctionDoc
+
+Scheme_Object *osc_subscribe(int argc, Scheme_Object **argv)
+{
+	MZ_GC_DECL_REG(1); 
+	MZ_GC_VAR_IN_REG(0, argv); 
+	MZ_GC_REG();	
+	if (!SCHEME_CHAR_STRINGP(argv[0])) scheme_wrong_type("osc-subscribe", "string", 0, argc, argv);
+	char *pattern=scheme_utf8_encode_to_buffer(SCHEME_CHAR_STR_VAL(argv[0]),SCHEME_CHAR_STRLEN_VAL(argv[0]),NULL,0);
+	if (OSCServer!=NULL) OSCServer->Subscribe(pattern);
+	MZ_GC_UNREG(); 
+	return scheme_void;
+}
+
+// StartFunctionDoc-en
+// osc-unsubscribe pattern-string
+// Returns: void
+// Description:
+// Removes a pattern given to (osc-subscribe), and throws away anything stored 
+// that is no longer subscribed to.
+// Example:
+// (osc-unsubscribe "/synth/{freq,amp}")
+// EndFunctionDoc
+
+Scheme_Object *osc_unsubscribe(int argc, Scheme_Object **argv)
+{
+	MZ_GC_DECL_REG(1); 
+	MZ_GC_VAR_IN_REG(0, argv); 
+	MZ_GC_REG();	
+	if (!SCHEME_CHAR_STRINGP(argv[0])) scheme_wrong_type("osc-unsubscribe", "string", 0, argc, argv);
+	char *pattern=scheme_utf8_encode_to_buffer(SCHEME_CHAR_STR_VAL(argv[0]),SCHEME_CHAR_STRLEN_VAL(argv[0]),NULL,0);
+	if (OSCServer!=NULL) OSCServer->Unsubscribe(pattern);
+	MZ_GC_UNREG(); 
+	return scheme_void;
+}
+
+// StartFunctionDoc-en
+// osc-control pattern-string
+// Returns: void
+// Description:
+// Marks addresses matching the pattern as controls, which only keep the latest 
+// message rather than queueing them all up. Good for faders and knobs, where 
+// you only care about the current value.
+// Example:
+// (osc-control "/fader/*")
+// (when (osc-msg "/fader/1")
+//     (set! value (osc 0)))
+// EndFunctionDoc
+
+Scheme_Object *osc_control(int argc, Scheme_Object **argv)
+{
+	MZ_GC_DECL_REG(1); 
+	MZ_GC_VAR_IN_REG(0, argv); 
+	MZ_GC_REG();	
+	if (!SCHEME_CHAR_STRINGP(argv[0])) scheme_wrong_type("osc-control", "string", 0, argc, argv);
+	char *pattern=scheme_utf8_encode_to_buffer(SCHEME_CHAR_STR_VAL(argv[0]),SCHEME_CHAR_STRLEN_VAL(argv[0]),NULL,0);
+	if (OSCServer!=NULL) OSCServer->SetControl(pattern);
+	MZ_GC_UNREG(); 
+	return scheme_void;
+}
+
 // StartFunctionDoc-en
 // osc-destination port-string
 // Returns: void
@@ -338,7 +446,9 @@ Scheme_Object *osc_peek(int argc, Scheme_Object **argv)
 // Description:
 // Sends an osc message with the argument list as the osc data. Only supports 
 // floats, ints and strings as data. The format-string should be composed of "i", "f" and "s",
-// and must match the types given in the list. This could probably be removed by using the types 
+// and must match the types given in the list. Vectors are sent as a run of numbers of the type
+// given for them, and bytes (see pdata-bytes) as a blob. Inside (osc-bundle-begin) the 
+// message is added to the bundle instead of being sent. This could probably be removed by using the types 
 // directly, but doing it this way allows you to explicitly set the typing for the osc message.
 // Example:
 // (osc-destination "osc.udp://localhost:4444")
@@ -360,12 +470,29 @@ Scheme_Object *osc_peek(int argc, Scheme_Object **argv)
 // (osc-send "/hello" "sif" (list "boo!" 3 42.3))  ; send a message to this destination
 // EndFunctionDoc
 
+// adds a number argument as the type asks for, numbers without a type are skipped
+static void AddNumber(OSCPacket &packet, char type, Scheme_Object *o)
+{
+	if (type=='f') packet.AddFloat(scheme_real_to_double(o));
+	else if (type=='i') 
+	{
+		// large unsigned values (like fluxa timestamps) keep their bits
+		intptr_t val=0;
+		uintptr_t uval=0;
+		if (scheme_get_int_val(o,&val)) packet.AddInt(val);
+		else if (scheme_get_unsigned_int_val(o,&uval)) packet.AddInt(uval);
+		else packet.AddInt((int)scheme_real_to_double(o));
+	}
+}
+
 Scheme_Object *osc_send(int argc, Scheme_Object **argv)
 {
-	Scheme_Object *argvec = NULL;
-	MZ_GC_DECL_REG(2); 
+	Scheme_Object *arg = NULL;
+	Scheme_Object *list = NULL;
+	MZ_GC_DECL_REG(3); 
 	MZ_GC_VAR_IN_REG(0, argv); 
-	MZ_GC_VAR_IN_REG(1, argvec); 
+	MZ_GC_VAR_IN_REG(1, arg); 
+	MZ_GC_VAR_IN_REG(2, list); 
 	MZ_GC_REG();	
 	
 	if (!OSCClient) 
@@ -378,45 +505,108 @@ Scheme_Object *osc_send(int argc, Scheme_Object **argv)
 	if (!SCHEME_CHAR_STRINGP(argv[1])) scheme_wrong_type("osc-send", "string", 1, argc, argv);
 	if (!SCHEME_LISTP(argv[2])) scheme_wrong_type("osc-send", "list", 2, argc, argv);
 
-	char *msg=scheme_utf8_encode_to_buffer(SCHEME_CHAR_STR_VAL(argv[0]),SCHEME_CHAR_STRLEN_VAL(argv[0]),NULL,0);
-	char *types=scheme_utf8_encode_to_buffer(SCHEME_CHAR_STR_VAL(argv[1]),SCHEME_CHAR_STRLEN_VAL(argv[1]),NULL,0);
-	
-	argvec = scheme_list_to_vector(argv[2]);
+	// encode into our own buffers where they fit, to save on garbage
+	char msgbuf[OSC_MAX_PATH];
+	char typesbuf[OSC_MAX_ARGS];
+	char *msg=scheme_utf8_encode_to_buffer(SCHEME_CHAR_STR_VAL(argv[0]),SCHEME_CHAR_STRLEN_VAL(argv[0]),msgbuf,OSC_MAX_PATH);
+	char *types=scheme_utf8_encode_to_buffer(SCHEME_CHAR_STR_VAL(argv[1]),SCHEME_CHAR_STRLEN_VAL(argv[1]),typesbuf,OSC_MAX_ARGS);
+	unsigned int numtypes=strlen(types);
 	
-	vector<OSCData*> oscargs;
-	for (unsigned int n=0; n<(unsigned int)SCHEME_VEC_SIZE(argvec); n++)
+	OSCPacket &packet=OSCClient->BeginMessage(msg);
+	unsigned int n=0;
+	for (list=argv[2]; SCHEME_PAIRP(list); list=SCHEME_CDR(list), n++)
 	{
-		if (SCHEME_NUMBERP(SCHEME_VEC_ELS(argvec)[n]))// ||  scm_is_true(scm_exact_p(arg)) || scm_is_true(scm_inexact_p(arg)))
+		arg=SCHEME_CAR(list);
+		char type=n<numtypes?types[n]:0;
+		
+		if (SCHEME_NUMBERP(arg))
 		{
-			if (n<strlen(types))
-			{
-				if (types[n]=='f') oscargs.push_back(new OSCFloat(scheme_real_to_double(SCHEME_VEC_ELS(argvec)[n])));
-				else if (types[n]=='i') 
-				{
-					uintptr_t val = 0;
-					scheme_get_unsigned_int_val(SCHEME_VEC_ELS(argvec)[n],&val);
-					oscargs.push_back(new OSCInt(val));
-				}
-			}
+			AddNumber(packet,type,arg);
 		}
-		else if (SCHEME_CHAR_STRINGP(SCHEME_VEC_ELS(argvec)[n]))
+		else if (SCHEME_CHAR_STRINGP(arg))
 		{
-			char *argstring=scheme_utf8_encode_to_buffer(SCHEME_CHAR_STR_VAL(SCHEME_VEC_ELS(argvec)[n]),
-														 SCHEME_CHAR_STRLEN_VAL(SCHEME_VEC_ELS(argvec)[n]),NULL,0);
-			oscargs.push_back(new OSCString(argstring));
+			char buf[256];
+			char *argstring=scheme_utf8_encode_to_buffer(SCHEME_CHAR_STR_VAL(arg),SCHEME_CHAR_STRLEN_VAL(arg),buf,256);
+			packet.AddString(argstring);
+		}
+		else if (SCHEME_BYTE_STRINGP(arg))
+		{
+			packet.AddBlob(SCHEME_BYTE_STR_VAL(arg),SCHEME_BYTE_STRLEN_VAL(arg));
+		}
+		else if (SCHEME_VECTORP(arg))
+		{
+			// vectors and colours are sent as a run of numbers of the same type
+			for (int i=0; i<SCHEME_VEC_SIZE(arg); i++)
+			{
+				if (SCHEME_NUMBERP(SCHEME_VEC_ELS(arg)[i])) AddNumber(packet,type,SCHEME_VEC_ELS(arg)[i]);
+			}
 		}
 		else
 		{
-			cerr<<"osc-send has found an argument type it can't send, numbers and strings only"<<endl;
+			cerr<<"osc-send has found an argument type it can't send, numbers, strings, bytes and vectors only"<<endl;
+			// the half built message is dropped by the next one
 			MZ_GC_UNREG(); 
-    		return scheme_void;
+			return scheme_void;
 		}
 	}
-	OSCClient->Send(msg,oscargs);
+	OSCClient->EndMessage();
 	MZ_GC_UNREG(); 
     return scheme_void;
 }
 
+// StartFunctionDoc-en
+// osc-bundle-begin [delay-number]
+// Returns: void
+// Description:
+// Starts collecting the messages from (osc-send) into a bundle rather than sending them
+// straight away, so hundreds of messages can go in one packet. The optional delay in 
+// seconds sets the bundle's timetag, so the receiver can schedule them - without it 
+// they are handled immediately. Bundles can only be sent over udp. Beginning a bundle 
+// before sending the current one nests the new one inside it, and the packet goes out 
+// when the outermost bundle is sent.
+// Example:
+// (osc-destination "osc.udp://localhost:4444")
+// (osc-bundle-begin 0.1)
+// (for ((i (in-range 0 512)))
+//     (osc-send "/led" "if" (list i (vector 1 0 0))))
+// (osc-bundle-send)
+// EndFunctionDoc
+
+Scheme_Object *osc_bundle_begin(int argc, Scheme_Object **argv)
+{
+	MZ_GC_DECL_REG(1); 
+	MZ_GC_VAR_IN_REG(0, argv); 
+	MZ_GC_REG();	
+	double delay=0;
+	if (argc>0)
+	{
+		if (!SCHEME_NUMBERP(argv[0])) scheme_wrong_type("osc-bundle-begin", "number", 0, argc, argv);
+		delay=scheme_real_to_double(argv[0]);
+	}
+	if (OSCClient) OSCClient->BeginBundle(delay);
+	MZ_GC_UNREG(); 
+	return scheme_void;
+}
+
+// StartFunctionDoc-en
+// osc-bundle-send
+// Returns: void
+// Description:
+// Sends the bundle started with (osc-bundle-begin), and goes back to sending messages 
+// one at a time. For a nested bundle this closes it, and the outer one carries on.
+// Example:
+// (osc-bundle-begin)
+// (osc-send "/pixels" "b" (list (pdata-bytes "c")))
+// (osc-send "/frame" "i" (list (frame)))
+// (osc-bundle-send)
+// EndFunctionDoc
+
+Scheme_Object *osc_bundle_send(int argc, Scheme_Object **argv)
+{
+	if (OSCClient) OSCClient->SendBundle();
+	return scheme_void;
+}
+
 /////////////////////
 
 #ifdef STATIC_LINK
@@ -436,9 +626,16 @@ Scheme_Object *scheme_reload(Scheme_Env *env)
 	scheme_add_global("osc-source", scheme_make_prim_w_arity(osc_source, "osc-source", 1, 1), menv);
 	scheme_add_global("osc-msg", scheme_make_prim_w_arity(osc_msg, "osc-msg", 1, 1), menv);
 	scheme_add_global("osc", scheme_make_prim_w_arity(osc, "osc", 1, 1), menv);
+	scheme_add_global("osc-path", scheme_make_prim_w_arity(osc_path, "osc-path", 0, 0), menv);
+	scheme_add_global("osc-timetag", scheme_make_prim_w_arity(osc_timetag, "osc-timetag", 0, 0), menv);
+	scheme_add_global("osc-subscribe", scheme_make_prim_w_arity(osc_subscribe, "osc-subscribe", 1, 1), menv);
+	scheme_add_global("osc-unsubscribe", scheme_make_prim_w_arity(osc_unsubscribe, "osc-unsubscribe", 1, 1), menv);
+	scheme_add_global("osc-control", scheme_make_prim_w_arity(osc_control, "osc-control", 1, 1), menv);
 	scheme_add_global("osc-destination", scheme_make_prim_w_arity(osc_destination, "osc-destination", 1, 1), menv);
 	scheme_add_global("osc-peek", scheme_make_prim_w_arity(osc_peek, "osc-peek", 0, 0), menv);
 	scheme_add_global("osc-send", scheme_make_prim_w_arity(osc_send, "osc-send", 3, 3), menv);
+	scheme_add_global("osc-bundle-begin", scheme_make_prim_w_arity(osc_bundle_begin, "osc-bundle-begin", 0, 1), menv);
+	scheme_add_global("osc-bundle-send", scheme_make_prim_w_arity(osc_bundle_send, "osc-bundle-send", 0, 0), menv);
 
 	scheme_finish_primitive_module(menv);	
  	MZ_GC_UNREG(); 
@@ -16,6 +16,7 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <unistd.h>
 #include <iostream>
 
@@ -111,3 +112,337 @@ istream &fluxus::operator>>(istream &is, OSCMsgData &msg)
 }
 
 
+
+void OSCMessage::Clear()
+{
+	Path[0]=0;
+	TimeSec=0;
+	TimeFrac=0;
+	m_Types[0]=0;
+	m_NumArgs=0;
+	m_StringsSize=0;
+}
+
+bool OSCMessage::SetPath(const char *path)
+{
+	unsigned int len=strlen(path);
+	if (len>=OSC_MAX_PATH) return false;
+	memcpy(Path,path,len+1);
+	return true;
+}
+
+bool OSCMessage::AddInt(int v)
+{
+	if (m_NumArgs>=OSC_MAX_ARGS) return false;
+	m_Args[m_NumArgs].i=v;
+	m_Types[m_NumArgs++]='i';
+	m_Types[m_NumArgs]=0;
+	return true;
+}
+
+bool OSCMessage::AddFloat(float v)
+{
+	if (m_NumArgs>=OSC_MAX_ARGS) return false;
+	m_Args[m_NumArgs].f=v;
+	m_Types[m_NumArgs++]='f';
+	m_Types[m_NumArgs]=0;
+	return true;
+}
+
+bool OSCMessage::AddString(const char *str)
+{
+	unsigned int len=strlen(str)+1;
+	if (m_NumArgs>=OSC_MAX_ARGS || m_StringsSize+len>OSC_MAX_STRINGS) return false;
+	memcpy(m_Strings+m_StringsSize,str,len);
+	m_Args[m_NumArgs].s=m_StringsSize;
+	m_StringsSize+=len;
+	m_Types[m_NumArgs++]='s';
+	m_Types[m_NumArgs]=0;
+	return true;
+}
+
+bool OSCMessage::AddNull(char type)
+{
+	if (m_NumArgs>=OSC_MAX_ARGS) return false;
+	m_Args[m_NumArgs].i=0;
+	m_Types[m_NumArgs++]=type;
+	m_Types[m_NumArgs]=0;
+	return true;
+}
+
+string OSCMessage::Format() const
+{
+	string ret=string(Path)+" "+string(m_Types)+" ";
+	char buf[256];
+	for (unsigned int i=0; i<m_NumArgs; i++)
+	{
+		switch (m_Types[i])
+		{
+			case 'f': snprintf(buf,256,"%f ",m_Args[i].f); ret+=buf; break;
+			case 'i': snprintf(buf,256,"%i ",m_Args[i].i); ret+=buf; break;
+			case 's': ret+=string(GetString(i))+" "; break;
+			default: break;
+		}
+	}
+	return ret;
+}
+
+///////////////////////////////////////////////////////////////
+
+OSCMessageRing::OSCMessageRing(unsigned int size) :
+m_ReadPos(0),
+m_WritePos(0),
+m_Size(1)
+{
+	while (m_Size<size) m_Size<<=1;
+	m_SizeMask=m_Size-1;
+	m_Buffer = new OSCMessage[m_Size];
+}
+
+OSCMessageRing::~OSCMessageRing()
+{
+	delete[] m_Buffer;
+}
+
+OSCMessage *OSCMessageRing::Reserve()
+{
+	if (m_WritePos-m_ReadPos>=m_Size) return NULL;
+	__sync_synchronize();
+	OSCMessage *msg=&m_Buffer[m_WritePos&m_SizeMask];
+	msg->Clear();
+	return msg;
+}
+
+void OSCMessageRing::Commit()
+{
+	__sync_synchronize();
+	m_WritePos++;
+}
+
+const OSCMessage *OSCMessageRing::Peek()
+{
+	if (m_WritePos==m_ReadPos) return NULL;
+	__sync_synchronize();
+	return &m_Buffer[m_ReadPos&m_SizeMask];
+}
+
+void OSCMessageRing::Release()
+{
+	__sync_synchronize();
+	m_ReadPos++;
+}
+
+///////////////////////////////////////////////////////////////
+
+bool fluxus::OSCIsPattern(const char *s)
+{
+	return strpbrk(s,"?*[{")!=NULL;
+}
+
+bool fluxus::OSCPatternMatch(const char *p, const char *s)
+{
+	while (*p)
+	{
+		switch (*p)
+		{
+			case '?':
+				if (!*s || *s=='/') return false;
+				p++; s++;
+			break;
+			
+			case '*':
+			{
+				// only matches within one part of the address
+				while (*p=='*') p++;
+				for (const char *t=s; ; t++)
+				{
+					if (OSCPatternMatch(p,t)) return true;
+					if (!*t || *t=='/') return false;
+				}
+			}
+			
+			case '[':
+			{
+				if (!*s || *s=='/') return false;
+				p++;
+				bool negate=false;
+				if (*p=='!')
+				{
+					negate=true;
+					p++;
+				}
+				bool match=false;
+				while (*p && *p!=']')
+				{
+					if (p[1]=='-' && p[2] && p[2]!=']')
+					{
+						if (*s>=p[0] && *s<=p[2]) match=true;
+						p+=3;
+					}
+					else
+					{
+						if (*s==*p) match=true;
+						p++;
+					}
+				}
+				if (*p!=']' || match==negate) return false;
+				p++; s++;
+			}
+			break;
+			
+			case '{':
+			{
+				const char *end=strchr(p,'}');
+				if (!end) return false;
+				const char *option=p+1;
+				while (option<=end)
+				{
+					const char *comma=option;
+					while (comma<end && *comma!=',') comma++;
+					unsigned int len=comma-option;
+					if (!strncmp(option,s,len) && OSCPatternMatch(end+1,s+len)) return true;
+					option=comma+1;
+				}
+				return false;
+			}
+			
+			default:
+				if (*p!=*s) return false;
+				p++; s++;
+			break;
+		}
+	}
+	return *s==0;
+}
+
+//////////////////////////////////////////////////
+
+void OSCPacket::Buffer::Write(const void *data, unsigned int size)
+{
+	// only ever grows, so it stops allocating after the first few sends
+	if (Size+size>Data.size()) Data.resize((Size+size)*2);
+	memcpy(&Data[Size],data,size);
+	Size+=size;
+}
+
+void OSCPacket::Buffer::WriteInt(unsigned int v)
+{
+	// osc is big endian
+	unsigned char b[4] = { (unsigned char)(v>>24), (unsigned char)(v>>16), 
+	                       (unsigned char)(v>>8), (unsigned char)v };
+	Write(b,4);
+}
+
+void OSCPacket::Buffer::SetInt(unsigned int pos, unsigned int v)
+{
+	Data[pos]=(char)(v>>24);
+	Data[pos+1]=(char)(v>>16);
+	Data[pos+2]=(char)(v>>8);
+	Data[pos+3]=(char)v;
+}
+
+void OSCPacket::Buffer::WriteString(const char *s, unsigned int length)
+{
+	Write(s,length);
+	Write("",1);
+	Pad();
+}
+
+void OSCPacket::Buffer::Pad()
+{
+	static const char zeros[4] = {0,0,0,0};
+	if (Size%4) Write(zeros,4-Size%4);
+}
+
+OSCPacket::OSCPacket() :
+m_BundleDepth(0)
+{
+	m_Out.Data.resize(1024);
+}
+
+void OSCPacket::Clear()
+{
+	m_Out.Size=0;
+	m_BundleDepth=0;
+}
+
+bool OSCPacket::BeginBundle(unsigned int sec, unsigned int frac)
+{
+	if (m_BundleDepth==OSC_MAX_BUNDLE_DEPTH) return false;
+	
+	if (m_BundleDepth==0) m_Out.Size=0;
+	else
+	{
+		// nested bundles are elements of the outer one, so they
+		// need a size, which we know at EndBundle
+		m_BundleStart[m_BundleDepth]=m_Out.Size;
+		m_Out.WriteInt(0);
+	}
+	m_Out.WriteString("#bundle",7);
+	m_Out.WriteInt(sec);
+	m_Out.WriteInt(frac);
+	m_BundleDepth++;
+	return true;
+}
+
+void OSCPacket::EndBundle()
+{
+	if (m_BundleDepth==0) return;
+	m_BundleDepth--;
+	if (m_BundleDepth>0)
+	{
+		unsigned int start=m_BundleStart[m_BundleDepth];
+		m_Out.SetInt(start,m_Out.Size-start-4);
+	}
+}
+
+void OSCPacket::BeginMessage(const char *path)
+{
+	m_Path.Size=0;
+	m_Path.WriteString(path,strlen(path));
+	m_Types.Size=0;
+	m_Types.Write(",",1);
+	m_Args.Size=0;
+}
+
+void OSCPacket::AddInt(int v)
+{
+	m_Types.Write("i",1);
+	m_Args.WriteInt(v);
+}
+
+void OSCPacket::AddFloat(float v)
+{
+	m_Types.Write("f",1);
+	unsigned int i;
+	memcpy(&i,&v,4);
+	m_Args.WriteInt(i);
+}
+
+void OSCPacket::AddString(const char *s)
+{
+	m_Types.Write("s",1);
+	m_Args.WriteString(s,strlen(s));
+}
+
+void OSCPacket::AddBlob(const char *data, unsigned int size)
+{
+	m_Types.Write("b",1);
+	m_Args.WriteInt(size);
+	m_Args.Write(data,size);
+	m_Args.Pad();
+}
+
+void OSCPacket::EndMessage()
+{
+	m_Types.Write("",1);
+	m_Types.Pad();
+	
+	// not in a bundle means one message per packet
+	if (!InBundle()) m_Out.Size=0;
+	else m_Out.WriteInt(m_Path.Size+m_Types.Size+m_Args.Size);
+	
+	m_Out.Write(&m_Path.Data[0],m_Path.Size);
+	m_Out.Write(&m_Types.Data[0],m_Types.Size);
+	if (m_Args.Size) m_Out.Write(&m_Args.Data[0],m_Args.Size);
+}
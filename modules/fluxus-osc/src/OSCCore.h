@@ -72,6 +72,135 @@ public:
 ostream &operator<<(ostream &os, const OSCMsgData &msg);
 istream &operator>>(istream &os, OSCMsgData &msg);
 
+static const unsigned int OSC_MAX_PATH=256;
+static const unsigned int OSC_MAX_ARGS=64;
+// how deep outgoing bundles can be nested
+static const unsigned int OSC_MAX_BUNDLE_DEPTH=16;
+static const unsigned int OSC_MAX_STRINGS=1024;
+
+// a fixed size received message, so they can be passed between threads 
+// without any allocation - strings are packed into one buffer
+class OSCMessage
+{
+public:
+	OSCMessage() { Clear(); }
+	void Clear();
+	
+	// returns false if it didn't fit
+	bool SetPath(const char *path);
+	bool AddInt(int v);
+	bool AddFloat(float v);
+	bool AddString(const char *s);
+	bool AddNull(char type);
+	
+	unsigned int Size() const { return m_NumArgs; }
+	char Type(unsigned int n) const { return m_Types[n]; }
+	int GetInt(unsigned int n) const { return m_Args[n].i; }
+	float GetFloat(unsigned int n) const { return m_Args[n].f; }
+	const char *GetString(unsigned int n) const { return m_Strings+m_Args[n].s; }
+	
+	// builds the debug text for osc-peek
+	string Format() const;
+	
+	char Path[OSC_MAX_PATH];
+	// seconds and fraction from the bundle, both 0 if not in one
+	unsigned int TimeSec;
+	unsigned int TimeFrac;
+	
+private:
+	union Arg
+	{
+		int i;
+		float f;
+		unsigned int s;
+	};
+	
+	char m_Types[OSC_MAX_ARGS+1];
+	Arg m_Args[OSC_MAX_ARGS];
+	unsigned int m_NumArgs;
+	char m_Strings[OSC_MAX_STRINGS];
+	unsigned int m_StringsSize;
+};
+
+// single reader single writer ring of messages, lock free, with the
+// messages filled in place so the writer never copies or allocates
+class OSCMessageRing
+{
+public:
+	OSCMessageRing(unsigned int size);
+	~OSCMessageRing();
+	
+	// writer - get a slot to fill in, NULL if full, then commit it
+	OSCMessage *Reserve();
+	void Commit();
+	
+	// reader - the oldest message, NULL if empty, then release it
+	const OSCMessage *Peek();
+	void Release();
+	
+private:
+	volatile unsigned int m_ReadPos;
+	volatile unsigned int m_WritePos;
+	unsigned int m_Size;
+	unsigned int m_SizeMask;
+	OSCMessage *m_Buffer;
+};
+
+// osc 1.0 address pattern matching: ? * [abc] [!a-z] and {foo,bar}
+bool OSCPatternMatch(const char *pattern, const char *path);
+bool OSCIsPattern(const char *s);
+
+// builds outgoing osc messages or bundles of them into a buffer 
+// which is reused, so nothing is allocated once it's big enough
+class OSCPacket
+{
+public:
+	OSCPacket();
+	void Clear();
+	
+	// all messages until the matching EndBundle go into the bundle,
+	// a bundle begun inside another is nested in it. returns false
+	// if they are already OSC_MAX_BUNDLE_DEPTH deep
+	bool BeginBundle(unsigned int sec, unsigned int frac);
+	void EndBundle();
+	bool InBundle() const { return m_BundleDepth>0; }
+	// whether the data is a bundle rather than a single message
+	bool IsBundle() const { return m_Out.Size>0 && m_Out.Data[0]=='#'; }
+	
+	void BeginMessage(const char *path);
+	void AddInt(int v);
+	void AddFloat(float v);
+	void AddString(const char *s);
+	void AddBlob(const char *data, unsigned int size);
+	void EndMessage();
+	
+	const char *Data() const { return &m_Out.Data[0]; }
+	unsigned int Size() const { return m_Out.Size; }
+	
+private:
+	class Buffer
+	{
+	public:
+		Buffer() : Size(0) {}
+		void Write(const void *data, unsigned int size);
+		void WriteInt(unsigned int v);
+		void SetInt(unsigned int pos, unsigned int v);
+		// nul terminated and padded to 4 bytes
+		void WriteString(const char *s, unsigned int length);
+		void Pad();
+		vector<char> Data;
+		unsigned int Size;
+	};
+	
+	Buffer m_Out;
+	Buffer m_Path;
+	Buffer m_Types;
+	Buffer m_Args;
+	// where the size of each nested bundle goes
+	unsigned int m_BundleStart[OSC_MAX_BUNDLE_DEPTH];
+	unsigned int m_BundleDepth;
+};
+
 }
 
 #endif
@@ -17,7 +17,11 @@
 #include <cstring>
 #include <cstdio>
 #include <cstdlib>
+#include <cerrno>
+#include <cmath>
 #include <unistd.h>
+#include <netdb.h>
+#include <sys/time.h>
 #include <iostream>
 
 #include "OSCServer.h"
@@ -25,57 +29,172 @@
 using namespace std;
 using namespace fluxus;
 
+// osc time starts in 1900
+static const unsigned int NTP_EPOCH_OFFSET=2208988800U;
+
+Client::Client() : 
+m_Initialised(false),
+m_Socket(-1),
+m_AddressLength(0),
+m_TooDeep(0)
+{
+}
+
+Client::~Client()
+{
+	if (m_Socket!=-1) close(m_Socket);
+	if (m_Initialised) lo_address_free(m_Destination);
+}
+
 void Client::SetDestination(const string &Port) 
 { 
 	if (m_Initialised) lo_address_free(m_Destination);
 	m_Destination=lo_address_new_from_url(Port.c_str()); 
-	m_Initialised=true;
+	m_Initialised=m_Destination!=NULL;
+	
+	if (m_Socket!=-1) 
+	{
+		close(m_Socket);
+		m_Socket=-1;
+	}
+	
+	if (m_Initialised && lo_address_get_protocol(m_Destination)==LO_UDP)
+	{
+		addrinfo hints;
+		memset(&hints,0,sizeof(hints));
+		hints.ai_family=AF_UNSPEC;
+		hints.ai_socktype=SOCK_DGRAM;
+		addrinfo *res=NULL;
+		if (getaddrinfo(lo_address_get_hostname(m_Destination),
+		                lo_address_get_port(m_Destination),&hints,&res)==0)
+		{
+			m_Socket=socket(res->ai_family,res->ai_socktype,res->ai_protocol);
+			if (m_Socket!=-1)
+			{
+				// led controllers often listen on broadcast addresses
+				int on=1;
+				setsockopt(m_Socket,SOL_SOCKET,SO_BROADCAST,&on,sizeof(on));
+				memcpy(&m_Address,res->ai_addr,res->ai_addrlen);
+				m_AddressLength=res->ai_addrlen;
+			}
+			freeaddrinfo(res);
+		}
+		else
+		{
+			cerr<<"osc-destination: couldn't resolve "<<Port<<endl;
+		}
+	}
 }	
 
-void Client::Send(const string &msg, const vector<OSCData*> &args)
+void Client::BeginBundle(double delay)
 {
-	if (!m_Initialised) return;
+	// 0,1 is the timetag for immediately
+	unsigned int sec=0,frac=1;
+	if (delay>0)
+	{
+		timeval tv;
+		gettimeofday(&tv,NULL);
+		double f=tv.tv_usec/1000000.0+delay;
+		sec=tv.tv_sec+NTP_EPOCH_OFFSET+(unsigned int)floor(f);
+		f-=floor(f);
+		frac=(unsigned int)(f*4294967296.0);
+	}
 	
-	lo_message oscmsg=lo_message_new();
-		
-	for (vector<OSCData*>::const_iterator i=args.begin(); i!=args.end(); i++)
-	{					
-		switch((*i)->Type())
+	if (!m_Packet.BeginBundle(sec,frac))
+	{
+		m_TooDeep++;
+		cerr<<"osc-bundle-begin: bundles can only be nested "<<OSC_MAX_BUNDLE_DEPTH
+			<<" deep, adding to the current one"<<endl;
+	}
+}
+
+void Client::SendBundle()
+{
+	if (!m_Packet.InBundle()) return;
+	if (m_TooDeep>0)
+	{
+		m_TooDeep--;
+		return;
+	}
+	m_Packet.EndBundle();
+	if (!m_Packet.InBundle()) Flush();
+}
+
+OSCPacket &Client::BeginMessage(const char *path)
+{
+	m_Packet.BeginMessage(path);
+	m_Path=path;
+	return m_Packet;
+}
+
+void Client::EndMessage()
+{
+	m_Packet.EndMessage();
+	if (!m_Packet.InBundle()) Flush();
+}
+
+void Client::Flush()
+{
+	if (m_Initialised && m_Packet.Size()>0)
+	{
+		if (m_Socket!=-1)
 		{
-			case 's': lo_message_add_string(oscmsg,static_cast<OSCString*>(*i)->Value.c_str()); break;
-			case 'f': lo_message_add_float(oscmsg,static_cast<OSCFloat*>(*i)->Value); break;
-			case 'i': lo_message_add_int32(oscmsg,static_cast<OSCInt*>(*i)->Value); break;
-			default: break;
+			if (sendto(m_Socket,m_Packet.Data(),m_Packet.Size(),0,
+			           (sockaddr*)&m_Address,m_AddressLength)<0)
+			{
+				cerr<<"osc send failed: "<<strerror(errno)<<" ("<<m_Packet.Size()<<" bytes)"<<endl;
+			}
 		}
-	} 
-	
-	lo_send_message(m_Destination, msg.c_str(), oscmsg);
-	lo_message_free(oscmsg);
+		else if (m_Packet.IsBundle())
+		{
+			cerr<<"osc bundles can only be sent over udp"<<endl;
+		}
+		else
+		{
+#ifdef LO_MESSAGE_DESERIALISE
+			// let liblo deal with tcp and unix sockets
+			int result=0;
+			lo_message msg=lo_message_deserialise((void*)m_Packet.Data(),m_Packet.Size(),&result);
+			if (msg!=NULL)
+			{
+				lo_send_message(m_Destination,m_Path.c_str(),msg);
+				lo_message_free(msg);
+			}
+#else
+			cerr<<"osc over tcp and unix sockets needs liblo 0.26 or later"<<endl;
+#endif
+		}
+	}
+	m_Packet.Clear();
 }
-	
 
 static const unsigned int MAX_MSGS_STORED=2048;
-static const unsigned int DATA_PER_MESSAGE=256;
+static const unsigned int QUEUE_SIZE=32;
+static const unsigned int RING_SIZE=1024;
 
-bool Server::m_Exit=false;
-map<string,list<OSCMsgData*> > Server::m_Map;
-pthread_mutex_t* Server::m_Mutex;
-string Server::m_LastMsg="no message yet...";
-//EventRecorder *Server::m_Recorder=NULL;
 bool Server::m_Error=false;
 
 Server::Server(const string &Port) :
-m_ServerStarted(false)
+m_ServerStarted(false),
+m_Running(false),
+m_Ring(RING_SIZE),
+m_Dropped(0),
+m_TooBig(0),
+m_BundleDepth(0),
+m_KeepLast(false),
+m_ReportedDropped(0),
+m_ReportedTooBig(0)
 {
 	SetPort(Port);
-	m_Mutex = new pthread_mutex_t;
-	pthread_mutex_init(m_Mutex,NULL);
 }
 
-
 Server::~Server()
 {
-	m_Exit=true;
+	if (m_ServerStarted) 
+	{
+		lo_server_thread_stop(m_Server);
+		lo_server_thread_free(m_Server);
+	}
 }
 
 void Server::SetPort(const string &Port)
@@ -93,15 +212,25 @@ void Server::SetPort(const string &Port)
    		if (!m_Error) 
 		{
 			m_Port=Port;
-			lo_server_thread_add_method(m_Server, NULL, NULL, DefaultHandler, NULL);
+			lo_server_thread_add_method(m_Server, NULL, NULL, DefaultHandler, this);
+#ifdef LO_BUNDLE_HANDLERS
+			lo_server_add_bundle_handlers(lo_server_thread_get_server(m_Server), 
+				BundleStartHandler, BundleEndHandler, this);
+#endif
 			m_ServerStarted=true;
+			// carry on listening if we were already
+			if (m_Running) lo_server_thread_start(m_Server);
 		}
 	}
 }
 
 void Server::Run()
 {
-	if (!m_Error) lo_server_thread_start(m_Server);
+	if (!m_Error) 
+	{
+		lo_server_thread_start(m_Server);
+		m_Running=true;
+	}
 }
 
 void Server::ErrorHandler(int num, const char *msg, const char *path)
@@ -110,114 +239,245 @@ void Server::ErrorHandler(int num, const char *msg, const char *path)
 	m_Error=true;
 }
 
+// called from the liblo thread, so no locks, allocation or formatting in here
 int Server::DefaultHandler(const char *path, const char *types, lo_arg **argv,
 		    int argc, void *data, void *user_data)
 {
-	if (m_Map.size()>MAX_MSGS_STORED)
+	Server *server=(Server*)user_data;
+	OSCMessage *msg=server->m_Ring.Reserve();
+	if (msg==NULL || !msg->SetPath(path))
 	{
-		// stop us filling up mem with messages! :)
-		m_Map.erase(m_Map.begin());
-		// todo - this is a potential mem leak...
+		server->m_Dropped++;
+		return 1;
 	}
 	
-	// record the message name
-	pthread_mutex_lock(m_Mutex);
-	m_LastMsg=string(path)+" "+string(types)+" ";
-	pthread_mutex_unlock(m_Mutex);
-	
-	// put the data in a vector
-	vector<OSCData*> argsdata;
-	char buf[256];
+	if (server->m_BundleDepth>0)
+	{
+		// nested bundles use the innermost timetag
+		unsigned int top=server->m_BundleDepth<MAX_BUNDLE_DEPTH?server->m_BundleDepth:MAX_BUNDLE_DEPTH;
+		const lo_timetag &time=server->m_BundleTimes[top-1];
+		msg->TimeSec=time.sec;
+		msg->TimeFrac=time.frac;
+	}
+	else
+	{
+		msg->TimeSec=0;
+		msg->TimeFrac=0;
+	}
 	
-	for (unsigned int i=0; i<strlen(types); i++)
+	bool fits=true;
+	for (int i=0; i<argc && fits; i++)
 	{
 		switch (types[i]) 
 		{
-			case 'f': 
-			{
-				argsdata.push_back(new OSCFloat(argv[i]->f)); 
-				snprintf(buf,256,"%f",argv[i]->f);
-				m_LastMsg+=string(buf)+" "; 
-			}
-			break;
-			case 'i': 
-			{
-				argsdata.push_back(new OSCInt(argv[i]->i)); 
-				snprintf(buf,256,"%i",argv[i]->i);
-				m_LastMsg+=string(buf)+" "; 			
-			}
-			break;
-			case 's': argsdata.push_back(new OSCString(&argv[i]->s)); m_LastMsg+=string(&argv[i]->s)+" "; break;
-			default : argsdata.push_back(new OSCData); break; // put in a null data type
+			case 'f': fits=msg->AddFloat(argv[i]->f); break;
+			case 'i': fits=msg->AddInt(argv[i]->i); break;
+			case 's': fits=msg->AddString(&argv[i]->s); break;
+			default : fits=msg->AddNull(types[i]); break; // put in a null data type
 		}
 	}
 	
-	pthread_mutex_lock(m_Mutex);
-	if (m_Map[path].size()<DATA_PER_MESSAGE) 
-	{	
-		m_Map[path].push_back(new OSCMsgData(argsdata));	
-	}
-/*	if (m_Recorder && m_Recorder->GetMode()==EventRecorder::RECORD)
-	{
-		cerr<<"saving an osc message"<<endl;
-		RecorderMessage *event = new RecorderMessage;
-		event->Name=path;
-		event->Data.Copy(argsdata);
-		m_Recorder->Record(event);
-	}*/
-	pthread_mutex_unlock(m_Mutex);
-		
+	if (!fits)
+	{
+		// better to lose it than pass on some of the arguments,
+		// the slot is reused by the next message
+		server->m_TooBig++;
+		return 1;
+	}
+	
+	server->m_Ring.Commit();
     return 1;
 }
-/*
-void Server::PollRecorder()
+
+int Server::BundleStartHandler(lo_timetag time, void *user_data)
+{
+	Server *server=(Server*)user_data;
+	if (server->m_BundleDepth<MAX_BUNDLE_DEPTH)
+	{
+		server->m_BundleTimes[server->m_BundleDepth]=time;
+	}
+	else
+	{
+		// too deep to remember, carry on with the innermost one we have
+		server->m_BundleTimes[MAX_BUNDLE_DEPTH-1]=time;
+	}
+	server->m_BundleDepth++;
+	return 0;
+}
+
+int Server::BundleEndHandler(void *user_data)
+{
+	Server *server=(Server*)user_data;
+	// back to the timetag of the bundle this one was in
+	if (server->m_BundleDepth>0) server->m_BundleDepth--;
+	return 0;
+}
+
+void Server::Classify(const string &path, Address &address)
+{
+	address.Subscribed=m_Subscriptions.empty();
+	for (vector<string>::iterator i=m_Subscriptions.begin(); 
+		i!=m_Subscriptions.end() && !address.Subscribed; ++i)
+	{
+		address.Subscribed=OSCPatternMatch(i->c_str(),path.c_str());
+	}
+	
+	address.Control=false;
+	for (vector<string>::iterator i=m_Controls.begin(); 
+		i!=m_Controls.end() && !address.Control; ++i)
+	{
+		address.Control=OSCPatternMatch(i->c_str(),path.c_str());
+	}
+}
+
+void Server::Drain()
 {
-	if (m_Recorder && m_Recorder->GetMode()==EventRecorder::PLAYBACK)
+	const OSCMessage *msg=m_Ring.Peek();
+	while (msg!=NULL)
 	{
-		vector<RecorderMessage*> events;
-		m_Recorder->Get(events);
-		for (vector<RecorderMessage*>::iterator i=events.begin(); i!=events.end(); i++)
+		if (m_KeepLast) m_Last=*msg;
+		
+		map<string,Address>::iterator i=m_Addresses.find(msg->Path);
+		if (i==m_Addresses.end() && m_Addresses.size()<MAX_MSGS_STORED)
 		{
-			//cerr<<"polled an osc message from recorder"<<endl;
-			if (m_Map[(*i)->Name].size()<DATA_PER_MESSAGE) 
+			// only classify new addresses, not every message
+			i=m_Addresses.insert(pair<string,Address>(msg->Path,Address())).first;
+			Classify(i->first,i->second);
+		}
+		
+		if (i!=m_Addresses.end() && i->second.Subscribed)
+		{
+			Address &address=i->second;
+			if (address.Control)
 			{
-				OSCMsgData *msg = new OSCMsgData;
-				msg->Copy((*i)->Data.m_Data);
-				m_Map[(*i)->Name].push_back(msg);
+				address.Latest=*msg;
+				address.Fresh=true;
+			}
+			else
+			{
+				address.Push(*msg);
 			}
 		}
+		
+		m_Ring.Release();
+		msg=m_Ring.Peek();
+	}
+	
+	if (m_Dropped!=m_ReportedDropped)
+	{
+		cerr<<"fluxus-osc: receive buffer full, dropped "<<m_Dropped-m_ReportedDropped<<" messages"<<endl;
+		m_ReportedDropped=m_Dropped;
+	}
+	
+	if (m_TooBig!=m_ReportedTooBig)
+	{
+		cerr<<"fluxus-osc: dropped "<<m_TooBig-m_ReportedTooBig<<" messages with more than "
+			<<OSC_MAX_ARGS<<" arguments or "<<OSC_MAX_STRINGS<<" bytes of strings"<<endl;
+		m_ReportedTooBig=m_TooBig;
 	}
 }
-*/
-bool Server::GetArgs(vector<OSCData*> &args) 
-{ 
-	if (m_CurrentOSCMsg!="")
+
+bool Server::Pop(Address &address)
+{
+	if (address.Control)
 	{
-		pthread_mutex_lock(m_Mutex);
-		args = (*m_CurrentOSCData)->m_Data;
-		pthread_mutex_unlock(m_Mutex);
+		if (!address.Fresh) return false;
+		m_Current=address.Latest;
+		address.Fresh=false;
 		return true;
 	}
-	return false;
+	
+	return address.Pop(m_Current);
+}
+
+void Server::Address::Push(const OSCMessage &msg)
+{
+	if (Queue.empty()) Queue.resize(QUEUE_SIZE);
+	if (Count==Queue.size())
+	{
+		// full, so lose the oldest
+		Head=(Head+1)%Queue.size();
+		Count--;
+	}
+	Queue[(Head+Count)%Queue.size()]=msg;
+	Count++;
+}
+
+bool Server::Address::Pop(OSCMessage &msg)
+{
+	if (Count==0) return false;
+	msg=Queue[Head];
+	Head=(Head+1)%Queue.size();
+	Count--;
+	return true;
 }
 
 bool Server::SetMsg(const string &name) 
 {	
-	if (m_CurrentOSCMsg!="")
+	Drain();
+	
+	if (!OSCIsPattern(name.c_str()))
 	{
-		// get rid of the old data
-		delete *m_CurrentOSCData;
-		m_Map[m_CurrentOSCMsg].erase(m_CurrentOSCData);
+		map<string,Address>::iterator i=m_Addresses.find(name);
+		return i!=m_Addresses.end() && Pop(i->second);
 	}
 	
-	m_CurrentOSCMsg="";
-	map<string,list<OSCMsgData*> >::iterator i=m_Map.find(name);
-	if (i!=m_Map.end() && !i->second.empty())
+	for (map<string,Address>::iterator i=m_Addresses.begin(); i!=m_Addresses.end(); ++i)
 	{
-		m_CurrentOSCMsg=name;
-		m_CurrentOSCData=i->second.begin();
-		return true;
+		if (OSCPatternMatch(name.c_str(),i->first.c_str()) && Pop(i->second)) return true;
 	}
 	return false;
 }
 
+string Server::GetLastMsg()
+{
+	// only keep copies of the last message once somebody is looking
+	m_KeepLast=true;
+	Drain();
+	if (m_Last.Path[0]==0) return "no message yet...";
+	return m_Last.Format();
+}
+
+void Server::Subscribe(const string &pattern)
+{
+	m_Subscriptions.push_back(pattern);
+	for (map<string,Address>::iterator i=m_Addresses.begin(); i!=m_Addresses.end(); ++i)
+	{
+		Classify(i->first,i->second);
+	}
+}
+
+void Server::Unsubscribe(const string &pattern)
+{
+	for (vector<string>::iterator i=m_Subscriptions.begin(); i!=m_Subscriptions.end();)
+	{
+		if (*i==pattern) i=m_Subscriptions.erase(i);
+		else ++i;
+	}
+	
+	for (map<string,Address>::iterator i=m_Addresses.begin(); i!=m_Addresses.end(); ++i)
+	{
+		Classify(i->first,i->second);
+		if (!i->second.Subscribed)
+		{
+			i->second.Clear();
+			i->second.Fresh=false;
+		}
+	}
+}
+
+void Server::SetControl(const string &pattern)
+{
+	m_Controls.push_back(pattern);
+	for (map<string,Address>::iterator i=m_Addresses.begin(); i!=m_Addresses.end(); ++i)
+	{
+		Classify(i->first,i->second);
+		// a new control only wants the latest of anything queued
+		if (i->second.Control && i->second.Count>0)
+		{
+			i->second.Latest=i->second.Newest();
+			i->second.Fresh=true;
+			i->second.Clear();
+		}
+	}
+}
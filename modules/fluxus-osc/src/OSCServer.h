@@ -25,6 +25,7 @@
 #include <list>
 #include <vector>
 #include <pthread.h>
+#include <sys/socket.h>
 #include "OSCCore.h"
 
 using namespace std;
@@ -32,19 +33,54 @@ using namespace std;
 namespace fluxus
 {
 
+///////////////////////////////////////////////////////////////
+// Messages are built into a reused packet, and udp destinations 
+// are sent to directly with one sendto per message or bundle. 
+// Other protocols go through liblo, without bundles.
+
 class Client
 {
 public:
-	Client() : m_Initialised(false) {}
-	~Client() {}
+	Client();
+	~Client();
 	void SetDestination(const string &Port);	
-	void Send(const string &msg,const vector<OSCData*> &args);
+	
+	// messages are collected until SendBundle, 0 delay means immediately.
+	// beginning a bundle inside another nests it, and the packet is 
+	// sent when the outermost one is
+	void BeginBundle(double delay);
+	bool InBundle() { return m_Packet.InBundle(); }
+	void SendBundle();
+	
+	// add the arguments to the packet in between these
+	OSCPacket &BeginMessage(const char *path);
+	void EndMessage();
 	
 private:
+	void Flush();
+	
 	lo_address m_Destination;
 	bool m_Initialised;
+	int m_Socket;
+	sockaddr_storage m_Address;
+	socklen_t m_AddressLength;
+	OSCPacket m_Packet;
+	// the path of the message in the packet, for liblo
+	string m_Path;
+	// bundles begun past the depth limit, so their 
+	// SendBundle doesn't close an outer one
+	unsigned int m_TooDeep;
 };
 
+///////////////////////////////////////////////////////////////
+// The liblo thread writes incoming messages straight into a 
+// preallocated lock free ring, which the render thread drains 
+// into a store of addresses when it asks for a message. Most 
+// addresses keep a queue of their messages, but ones marked as
+// controls only keep the latest, as that's all that matters 
+// for a fader. Subscribing to address patterns filters out 
+// everything else.
+
 class Server
 {
 public:
@@ -53,32 +89,72 @@ public:
 	
 	void SetPort(const string &Port);
 	void Run();
+	// name can be an address pattern
 	bool SetMsg(const string &name);
-	bool GetArgs(vector<OSCData*> &args);
-	string GetLastMsg() { return m_LastMsg; }
-	
-	//static void SetRecorder(EventRecorder *s) { m_Recorder = s; }
+	const OSCMessage &GetMsg() { return m_Current; }
+	string GetLastMsg();
 	
-	// call once per frame
-	//void PollRecorder();
+	void Subscribe(const string &pattern);
+	void Unsubscribe(const string &pattern);
+	void SetControl(const string &pattern);
 	
 private:
 
+	class Address
+	{
+	public:
+		Address() : Subscribed(true), Control(false), Fresh(false), Head(0), Count(0) {}
+		// a fixed size ring, allocated the first time it's used,
+		// which drops the oldest message when it's full
+		void Push(const OSCMessage &msg);
+		bool Pop(OSCMessage &msg);
+		const OSCMessage &Newest() { return Queue[(Head+Count-1)%Queue.size()]; }
+		void Clear() { Head=0; Count=0; }
+		bool Subscribed;
+		bool Control;
+		bool Fresh;
+		OSCMessage Latest;
+		vector<OSCMessage> Queue;
+		unsigned int Head;
+		unsigned int Count;
+	};
+
+	void Drain();
+	void Classify(const string &path, Address &address);
+	bool Pop(Address &address);
+
 	static int DefaultHandler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
+	static int BundleStartHandler(lo_timetag time, void *user_data);
+	static int BundleEndHandler(void *user_data);
 	static void ErrorHandler(int num, const char *m, const char *path);	
 	
-	static map<string,list<OSCMsgData*> > m_Map;
-	static string m_LastMsg;
 	static bool m_Error;
 	bool m_ServerStarted;
+	bool m_Running;
 	
 	string m_Port;
 	lo_server_thread m_Server;
-	static bool m_Exit;
-	static pthread_mutex_t* m_Mutex;
-	string m_CurrentOSCMsg;
-	list<OSCMsgData*>::iterator m_CurrentOSCData;
-	//static EventRecorder *m_Recorder;
+	
+	// shared with the liblo thread
+	OSCMessageRing m_Ring;
+	volatile unsigned int m_Dropped;
+	volatile unsigned int m_TooBig;
+	
+	// only used by the liblo thread, the timetags of
+	// the bundles we are inside, innermost last
+	static const unsigned int MAX_BUNDLE_DEPTH=16;
+	lo_timetag m_BundleTimes[MAX_BUNDLE_DEPTH];
+	unsigned int m_BundleDepth;
+	
+	// only used by the render thread
+	map<string,Address> m_Addresses;
+	vector<string> m_Subscriptions;
+	vector<string> m_Controls;
+	OSCMessage m_Current;
+	OSCMessage m_Last;
+	bool m_KeepLast;
+	unsigned int m_ReportedDropped;
+	unsigned int m_ReportedTooBig;
 };
 
 }